@@ -0,0 +1,567 @@
+//
+// authentication.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "authentication.hpp"
+
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/spirit/include/qi_eoi.hpp>
+#include <boost/spirit/include/qi_parse.hpp>
+#include <boost/spirit/include/qi_sequence.hpp>
+#include <boost/spirit/include/qi_uint.hpp>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace sntp
+{
+    namespace
+    {
+        using block = std::array<std::uint8_t, CryptoPP::AES::BLOCKSIZE>;
+
+        // Keys longer than this are hex encoded
+        const std::size_t maximum_ascii_key = 20;
+
+        // Multiply by x in GF(2^128), to derive the CMAC subkeys
+        block double_block(const block& value)
+        {
+            block result = {{0}};
+            std::uint8_t carry = 0;
+            for (std::size_t byte = value.size(); byte != 0; --byte)
+            {
+                result[byte - 1] = std::uint8_t((value[byte - 1] << 1) | carry);
+                carry = value[byte - 1] >> 7;
+            }
+
+            if (carry)
+            {
+                result.back() ^= 0x87;
+            }
+            return result;
+        }
+
+        // Add one to a 128-bit big endian counter
+        void increment_counter(block& counter)
+        {
+            for (std::size_t byte = counter.size(); byte != 0; --byte)
+            {
+                if (++counter[byte - 1] != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        // Compare without an early exit, so timing does not reveal how many
+        // bytes of a forged digest are correct
+        bool equal_digests(
+            const std::uint8_t* const left,
+            const std::uint8_t* const right,
+            const std::size_t size)
+        {
+            std::uint8_t difference = 0;
+            for (std::size_t byte = 0; byte < size; ++byte)
+            {
+                difference |= left[byte] ^ right[byte];
+            }
+            return difference == 0;
+        }
+
+        bool equal_digests(const packet::digest& left, const packet::digest& right)
+        {
+            return equal_digests(left.data(), right.data(), left.size());
+        }
+
+        int hex_value(const char digit)
+        {
+            if ('0' <= digit && digit <= '9')
+            {
+                return digit - '0';
+            }
+            if ('a' <= digit && digit <= 'f')
+            {
+                return digit - 'a' + 10;
+            }
+            if ('A' <= digit && digit <= 'F')
+            {
+                return digit - 'A' + 10;
+            }
+            return -1;
+        }
+
+        bool decode_key(const std::string& encoded, std::vector<std::uint8_t>& key)
+        {
+            key.clear();
+            if (encoded.size() <= maximum_ascii_key)
+            {
+                key.assign(encoded.begin(), encoded.end());
+                return true;
+            }
+
+            if (encoded.size() % 2 != 0)
+            {
+                return false;
+            }
+
+            for (std::size_t digit = 0; digit < encoded.size(); digit += 2)
+            {
+                const int high = hex_value(encoded[digit]);
+                const int low = hex_value(encoded[digit + 1]);
+                if (high < 0 || low < 0)
+                {
+                    return false;
+                }
+                key.push_back(std::uint8_t((high << 4) | low));
+            }
+            return true;
+        }
+
+        std::runtime_error key_error(const std::size_t line, const char* const error)
+        {
+            std::ostringstream message;
+            message << "keys line " << line << ": " << error;
+            return std::runtime_error(message.str());
+        }
+    }
+
+    mac::~mac()
+    {
+    }
+
+    constexpr std::size_t cmac_aes128::key_size;
+
+    cmac_aes128::cmac_aes128(const std::uint8_t* const key) :
+        mac(),
+        cipher_(),
+        complete_subkey_(),
+        partial_subkey_()
+    {
+        set_key(key);
+    }
+
+    void cmac_aes128::set_key(const std::uint8_t* const key)
+    {
+        cipher_.SetKey(key, key_size);
+
+        block encrypted_zero = {{0}};
+        cipher_.ProcessBlock(encrypted_zero.data());
+        complete_subkey_ = double_block(encrypted_zero);
+        partial_subkey_ = double_block(complete_subkey_);
+    }
+
+    cmac_aes128::stream::stream(const cmac_aes128& key) :
+        key_(key),
+        state_(),
+        pending_(),
+        pending_size_(0)
+    {
+    }
+
+    void cmac_aes128::stream::update(const std::uint8_t* message, std::size_t length)
+    {
+        // The last block is held back, it is mixed with a subkey in final()
+        while (length != 0)
+        {
+            if (pending_size_ == pending_.size())
+            {
+                for (std::size_t byte = 0; byte < state_.size(); ++byte)
+                {
+                    state_[byte] ^= pending_[byte];
+                }
+                key_.cipher_.ProcessBlock(state_.data());
+                pending_size_ = 0;
+            }
+
+            const std::size_t copied = std::min(length, pending_.size() - pending_size_);
+            std::memcpy(pending_.data() + pending_size_, message, copied);
+            pending_size_ += copied;
+            message += copied;
+            length -= copied;
+        }
+    }
+
+    packet::digest cmac_aes128::stream::final()
+    {
+        const block* subkey = &key_.complete_subkey_;
+        if (pending_size_ != pending_.size())
+        {
+            std::memset(pending_.data() + pending_size_, 0, pending_.size() - pending_size_);
+            pending_[pending_size_] = 0x80;
+            subkey = &key_.partial_subkey_;
+        }
+
+        for (std::size_t byte = 0; byte < state_.size(); ++byte)
+        {
+            state_[byte] ^= pending_[byte] ^ (*subkey)[byte];
+        }
+        key_.cipher_.ProcessBlock(state_.data());
+
+        static_assert(sizeof(packet::digest) == sizeof(block), "digest size mismatch");
+        packet::digest result;
+        std::memcpy(result.data(), state_.data(), result.size());
+        return result;
+    }
+
+    packet::digest cmac_aes128::operator()(
+        const std::uint8_t* const message, const std::size_t length) const
+    {
+        stream digest(*this);
+        digest.update(message, length);
+        return digest.final();
+    }
+
+    std::size_t cmac_aes128::digest_size() const
+    {
+        return sizeof(packet::digest);
+    }
+
+    mac::digest cmac_aes128::compute(
+        const std::uint8_t* const message, const std::size_t length) const
+    {
+        const packet::digest value = (*this)(message, length);
+
+        digest result = {{0}};
+        std::memcpy(result.data(), value.data(), value.size());
+        return result;
+    }
+
+    constexpr std::size_t aes_siv::key_size;
+    constexpr std::size_t aes_siv::tag_size;
+
+    aes_siv::aes_siv(const std::uint8_t* const key) :
+        mac_(key),
+        cipher_(),
+        mac_of_zero_()
+    {
+        set_key(key);
+    }
+
+    void aes_siv::set_key(const std::uint8_t* const key)
+    {
+        // The first half keys S2V, the second half keys CTR
+        mac_.set_key(key);
+        cipher_.SetKey(key + cmac_aes128::key_size, cmac_aes128::key_size);
+
+        const block zero = {{0}};
+        mac_of_zero_ = mac_(zero.data(), zero.size());
+    }
+
+    void aes_siv::seal(
+        const std::uint8_t* const associated,
+        const std::size_t associated_length,
+        const std::uint8_t* const nonce,
+        const std::size_t nonce_length,
+        const std::uint8_t* const plaintext,
+        const std::size_t length,
+        std::uint8_t* const output) const
+    {
+        const packet::digest iv = synthetic_iv(
+            associated, associated_length, nonce, nonce_length, plaintext, length);
+
+        apply_keystream(iv, plaintext, length, output + tag_size);
+        std::memcpy(output, iv.data(), iv.size());
+    }
+
+    bool aes_siv::open(
+        const std::uint8_t* const associated,
+        const std::size_t associated_length,
+        const std::uint8_t* const nonce,
+        const std::size_t nonce_length,
+        const std::uint8_t* const sealed,
+        const std::size_t length,
+        std::uint8_t* const plaintext) const
+    {
+        if (length < tag_size)
+        {
+            return false;
+        }
+
+        packet::digest iv;
+        std::memcpy(iv.data(), sealed, iv.size());
+
+        const std::size_t plaintext_length = length - tag_size;
+        apply_keystream(iv, sealed + tag_size, plaintext_length, plaintext);
+
+        const packet::digest expected = synthetic_iv(
+            associated, associated_length, nonce, nonce_length, plaintext, plaintext_length);
+        if (!equal_digests(expected, iv))
+        {
+            std::memset(plaintext, 0, plaintext_length);
+            return false;
+        }
+        return true;
+    }
+
+    packet::digest aes_siv::synthetic_iv(
+        const std::uint8_t* const associated,
+        const std::size_t associated_length,
+        const std::uint8_t* const nonce,
+        const std::size_t nonce_length,
+        const std::uint8_t* const plaintext,
+        const std::size_t length) const
+    {
+        block chain = mac_of_zero_;
+
+        const auto mix = [this, &chain](const std::uint8_t* string, std::size_t size)
+        {
+            const packet::digest digest = mac_(string, size);
+            chain = double_block(chain);
+            for (std::size_t byte = 0; byte < chain.size(); ++byte)
+            {
+                chain[byte] ^= digest[byte];
+            }
+        };
+
+        mix(associated, associated_length);
+        if (nonce)
+        {
+            mix(nonce, nonce_length);
+        }
+
+        cmac_aes128::stream last(mac_);
+        if (length >= chain.size())
+        {
+            // xor the chain into the final block of the plaintext
+            const std::size_t head = length - chain.size();
+            last.update(plaintext, head);
+            for (std::size_t byte = 0; byte < chain.size(); ++byte)
+            {
+                chain[byte] ^= plaintext[head + byte];
+            }
+            last.update(chain.data(), chain.size());
+        }
+        else
+        {
+            chain = double_block(chain);
+            for (std::size_t byte = 0; byte < length; ++byte)
+            {
+                chain[byte] ^= plaintext[byte];
+            }
+            chain[length] ^= 0x80;
+            last.update(chain.data(), chain.size());
+        }
+        return last.final();
+    }
+
+    void aes_siv::apply_keystream(
+        const packet::digest& iv,
+        const std::uint8_t* input,
+        std::size_t length,
+        std::uint8_t* output) const
+    {
+        // Counter blocks encrypted per call
+        static const std::size_t parallel_blocks = 8;
+        std::array<block, parallel_blocks> counters;
+
+        // Bits 63 and 31 of the counter are cleared (RFC 5297 section 2.5)
+        block counter = iv;
+        counter[8] &= 0x7F;
+        counter[12] &= 0x7F;
+
+        while (length != 0)
+        {
+            const std::size_t blocks =
+                std::min((length + counter.size() - 1) / counter.size(), parallel_blocks);
+            for (std::size_t index = 0; index < blocks; ++index)
+            {
+                counters[index] = counter;
+                increment_counter(counter);
+            }
+
+            const std::size_t complete = std::min(length / counter.size(), blocks) * counter.size();
+            if (complete != 0)
+            {
+                cipher_.AdvancedProcessBlocks(
+                    counters.front().data(),
+                    input,
+                    output,
+                    complete,
+                    CryptoPP::BlockTransformation::BT_AllowParallel);
+            }
+
+            if (complete != blocks * counter.size())
+            {
+                // final partial block
+                block& keystream = counters[blocks - 1];
+                cipher_.ProcessBlock(keystream.data());
+                for (std::size_t byte = 0; byte < length - complete; ++byte)
+                {
+                    output[complete + byte] = input[complete + byte] ^ keystream[byte];
+                }
+                return;
+            }
+
+            input += complete;
+            output += complete;
+            length -= complete;
+        }
+    }
+
+    template<typename Hash>
+    hash_mac<Hash>::hash_mac(const std::uint8_t* const key, const std::size_t length) :
+        mac(),
+        keyed_()
+    {
+        keyed_.Update(key, length);
+    }
+
+    template<typename Hash>
+    mac::digest hash_mac<Hash>::operator()(
+        const std::uint8_t* const message, const std::size_t length) const
+    {
+        std::array<std::uint8_t, Hash::DIGESTSIZE> hash_value = {};
+
+        Hash hash(keyed_);
+        hash.Update(message, length);
+        hash.Final(hash_value.data());
+
+        digest result;
+        std::memcpy(result.data(), hash_value.data(), result.size());
+        return result;
+    }
+
+    template<typename Hash>
+    std::size_t hash_mac<Hash>::digest_size() const
+    {
+        return sizeof(digest);
+    }
+
+    template<typename Hash>
+    mac::digest hash_mac<Hash>::compute(
+        const std::uint8_t* const message, const std::size_t length) const
+    {
+        return (*this)(message, length);
+    }
+
+    template class hash_mac<CryptoPP::SHA1>;
+    template class hash_mac<CryptoPP::SHA256>;
+
+    key_table::key_table() :
+        keys_()
+    {
+    }
+
+    key_table key_table::load(std::istream& keys)
+    {
+        key_table table;
+
+        std::string line;
+        std::size_t line_number = 0;
+        std::vector<std::uint8_t> key;
+        while (std::getline(keys, line))
+        {
+            ++line_number;
+            line.erase(std::min(line.find('#'), line.size()));
+
+            std::istringstream fields(line);
+            std::string identifier_field;
+            std::string type;
+            std::string encoded_key;
+            std::string extra;
+            if (!(fields >> identifier_field))
+            {
+                continue;
+            }
+            if (!(fields >> type >> encoded_key) || (fields >> extra))
+            {
+                throw key_error(line_number, "expected identifier, type, and key");
+            }
+
+            std::uint32_t identifier = 0;
+            if (!boost::spirit::qi::parse(
+                    identifier_field.begin(),
+                    identifier_field.end(),
+                    (boost::spirit::qi::uint_parser<std::uint32_t>() >> boost::spirit::qi::eoi),
+                    identifier) ||
+                identifier == 0)
+            {
+                throw key_error(line_number, "invalid key identifier");
+            }
+
+            if (!decode_key(encoded_key, key))
+            {
+                throw key_error(line_number, "invalid hex key");
+            }
+
+            if (boost::algorithm::iequals(type, "AES128CMAC"))
+            {
+                if (key.size() != cmac_aes128::key_size)
+                {
+                    throw key_error(line_number, "AES128CMAC keys must be 16 bytes");
+                }
+                table.insert(identifier, std::make_unique<cmac_aes128>(key.data()));
+            }
+            else if (boost::algorithm::iequals(type, "SHA1"))
+            {
+                table.insert(identifier, std::make_unique<sha1_mac>(key.data(), key.size()));
+            }
+            else if (boost::algorithm::iequals(type, "SHA256"))
+            {
+                table.insert(identifier, std::make_unique<sha256_mac>(key.data(), key.size()));
+            }
+            else
+            {
+                throw key_error(line_number, "type must be AES128CMAC, SHA1, or SHA256");
+            }
+        }
+
+        return table;
+    }
+
+    void key_table::insert(const std::uint32_t identifier, std::unique_ptr<mac> key)
+    {
+        keys_[identifier] = std::move(key);
+    }
+
+    const mac* key_table::find(const std::uint32_t identifier) const
+    {
+        const auto key = keys_.find(identifier);
+        return key == keys_.end() ? nullptr : key->second.get();
+    }
+
+    key_table::verification key_table::verify(const packet_view& request) const
+    {
+        if (!request.has_mac())
+        {
+            return verification::unauthenticated;
+        }
+
+        const mac* const key = find(request.key_identifier());
+        if (!key || key->digest_size() != request.digest_size())
+        {
+            return verification::invalid;
+        }
+
+        const mac::digest expected =
+            key->compute(request.data(), packet::minimum_packet_size());
+        return equal_digests(expected.data(), request.digest(), request.digest_size()) ?
+            verification::valid : verification::invalid;
+    }
+
+    bool key_table::sign(const packet_view& response) const
+    {
+        if (!response.has_mac())
+        {
+            return false;
+        }
+
+        const mac* const key = find(response.key_identifier());
+        if (!key || key->digest_size() != response.digest_size())
+        {
+            return false;
+        }
+
+        const mac::digest value = key->compute(response.data(), packet::minimum_packet_size());
+        std::memcpy(response.digest(), value.data(), response.digest_size());
+        return true;
+    }
+}
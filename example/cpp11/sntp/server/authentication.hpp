@@ -0,0 +1,242 @@
+//
+// authentication.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef AUTHENTICATION_HPP
+#define AUTHENTICATION_HPP
+
+#include <array>
+#include <cryptopp/aes.h>
+#include <cryptopp/sha.h>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+
+namespace sntp
+{
+    // Symmetric key message authentication code of a NTP header (RFC 5905
+    // section 7.3). Implementations precompute all key dependent state on
+    // construction, never allocate, and must be safe to call from multiple
+    // threads.
+    class mac
+    {
+    public:
+
+        // Room for the longest digest; only digest_size() bytes are used
+        using digest = std::array<std::uint8_t, 20>;
+
+        virtual ~mac();
+
+        // 16 or 20 bytes, the MAC is 4 bytes longer
+        virtual std::size_t digest_size() const = 0;
+
+        virtual digest compute(const std::uint8_t* message, std::size_t length) const = 0;
+    };
+
+    // AES-128-CMAC (RFC 4493), as specified for NTP by RFC 8573
+    class cmac_aes128 : public mac
+    {
+        using block = std::array<std::uint8_t, CryptoPP::AES::BLOCKSIZE>;
+
+    public:
+
+        static constexpr std::size_t key_size = CryptoPP::AES::DEFAULT_KEYLENGTH;
+
+        // CMAC of a message provided in pieces
+        class stream
+        {
+        public:
+
+            explicit stream(const cmac_aes128& key);
+
+            void update(const std::uint8_t* message, std::size_t length);
+
+            packet::digest final();
+
+        private:
+
+            const cmac_aes128& key_;
+            block state_;
+            block pending_;
+            std::size_t pending_size_;
+        };
+
+        explicit cmac_aes128(const std::uint8_t* key);
+
+        // Replace the key, without allocating
+        void set_key(const std::uint8_t* key);
+
+        packet::digest operator()(const std::uint8_t* message, std::size_t length) const;
+
+        std::size_t digest_size() const override;
+
+        digest compute(const std::uint8_t* message, std::size_t length) const override;
+
+    private:
+
+        // expanded key schedule
+        CryptoPP::AES::Encryption cipher_;
+        block complete_subkey_;
+        block partial_subkey_;
+    };
+
+    // Deterministic authenticated encryption, AEAD_AES_SIV_CMAC_256 (RFC
+    // 5297), the AEAD algorithm of NTS. The synthetic IV (S2V) is a CMAC
+    // chain over the associated data, nonce, and plaintext; the keystream
+    // is AES-CTR, encrypted several counter blocks per call so the cipher
+    // can pipeline them. Never allocates, and is safe to call from
+    // multiple threads.
+    class aes_siv
+    {
+    public:
+
+        static constexpr std::size_t key_size = cmac_aes128::key_size * 2;
+        static constexpr std::size_t tag_size = CryptoPP::AES::BLOCKSIZE;
+
+        explicit aes_siv(const std::uint8_t* key);
+
+        // Replace the key, without allocating
+        void set_key(const std::uint8_t* key);
+
+        // Write the synthetic IV followed by the ciphertext (tag_size +
+        // length bytes) to output. plaintext may be output + tag_size to
+        // encrypt in place. A null nonce is left out of the S2V chain
+        // (deterministic mode).
+        void seal(
+            const std::uint8_t* associated,
+            std::size_t associated_length,
+            const std::uint8_t* nonce,
+            std::size_t nonce_length,
+            const std::uint8_t* plaintext,
+            std::size_t length,
+            std::uint8_t* output) const;
+
+        // Decrypt length bytes written by seal to plaintext (length -
+        // tag_size bytes), which may be sealed + tag_size. False is
+        // returned, and the plaintext zeroed, if the input is not
+        // authentic.
+        bool open(
+            const std::uint8_t* associated,
+            std::size_t associated_length,
+            const std::uint8_t* nonce,
+            std::size_t nonce_length,
+            const std::uint8_t* sealed,
+            std::size_t length,
+            std::uint8_t* plaintext) const;
+
+    private:
+
+        packet::digest synthetic_iv(
+            const std::uint8_t* associated,
+            std::size_t associated_length,
+            const std::uint8_t* nonce,
+            std::size_t nonce_length,
+            const std::uint8_t* plaintext,
+            std::size_t length) const;
+
+        // output = input xor AES-CTR keystream starting at iv
+        void apply_keystream(
+            const packet::digest& iv,
+            const std::uint8_t* input,
+            std::size_t length,
+            std::uint8_t* output) const;
+
+    private:
+
+        cmac_aes128 mac_;
+        CryptoPP::AES::Encryption cipher_;
+        packet::digest mac_of_zero_;    // first S2V value, key dependent only
+    };
+
+    // Hash(key || message) truncated to a 20 byte digest. This is the
+    // legacy NTP MAC construction, as ntpd and chrony use it for SHA1 and
+    // SHA256 keys.
+    template<typename Hash>
+    class hash_mac : public mac
+    {
+        static_assert(Hash::DIGESTSIZE >= sizeof(digest), "hash is too small");
+
+    public:
+
+        hash_mac(const std::uint8_t* key, std::size_t length);
+
+        digest operator()(const std::uint8_t* message, std::size_t length) const;
+
+        std::size_t digest_size() const override;
+
+        digest compute(const std::uint8_t* message, std::size_t length) const override;
+
+    private:
+
+        // hash state after the key has been processed
+        Hash keyed_;
+    };
+
+    extern template class hash_mac<CryptoPP::SHA1>;
+    extern template class hash_mac<CryptoPP::SHA256>;
+
+    using sha1_mac = hash_mac<CryptoPP::SHA1>;
+    using sha256_mac = hash_mac<CryptoPP::SHA256>;
+
+    // Keys indexed by key identifier. The table is filled before the
+    // workers start, and is only read afterwards.
+    class key_table
+    {
+    public:
+
+        enum class verification : std::uint8_t
+        {
+            unauthenticated,    // no MAC
+            valid,
+            invalid             // unknown key, or wrong digest
+        };
+
+        key_table();
+
+        key_table(key_table&&) = default;
+        key_table& operator=(key_table&&) = default;
+
+        // Read keys in the ntp.keys format: "identifier type key" per line,
+        // where type is AES128CMAC, SHA1, or SHA256. Keys of 20 characters
+        // or less are ASCII, longer keys are hex. '#' starts a comment.
+        // std::runtime_error is thrown on the first invalid line.
+        static key_table load(std::istream& keys);
+
+        // Replaces any key with the same identifier
+        void insert(std::uint32_t identifier, std::unique_ptr<mac> key);
+
+        std::size_t size() const
+        {
+            return keys_.size();
+        }
+
+        // nullptr is returned if the key is unknown
+        const mac* find(std::uint32_t identifier) const;
+
+        // Check the MAC of a request, see packet_view::has_mac(). A digest
+        // size that does not match the key is invalid.
+        verification verify(const packet_view& request) const;
+
+        // Compute the digest of a filled response, with the key of the
+        // (verified) request. False is returned if the key is unknown, or
+        // its digest size does not match.
+        bool sign(const packet_view& response) const;
+
+    private:
+
+        std::unordered_map<std::uint32_t, std::unique_ptr<mac>> keys_;
+    };
+}
+
+#endif // AUTHENTICATION_HPP
@@ -0,0 +1,314 @@
+//
+// batch.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "batch.hpp"
+
+#include <boost/asio/error.hpp>
+#include <cassert>
+#include <cerrno>
+
+#include "interleaved.hpp"
+#include "packet_view.hpp"
+#include "request_pipeline.hpp"
+#include "stats.hpp"
+
+namespace sntp
+{
+    namespace
+    {
+        boost::system::error_code last_error()
+        {
+            return boost::system::error_code(
+                errno, boost::asio::error::get_system_category());
+        }
+
+        bool would_block(const int error)
+        {
+            return error == EAGAIN || error == EWOULDBLOCK;
+        }
+    }
+
+
+    batch::batch(const std::size_t capacity) :
+        kernel_(),
+        datagrams_(capacity),
+        rejections_(capacity),
+        queued_(),
+        queued_times_(),
+        endpoints_(capacity),
+        receive_buffers_(capacity),
+        control_buffers_(capacity),
+        receive_headers_(capacity),
+        send_buffers_(capacity),
+        send_headers_(capacity),
+        arrivals_(capacity),
+        receive_time_(0),
+        received_(0),
+        last_received_(0),
+        responses_(0),
+        sent_(0),
+        interleaved_(nullptr),
+        keys_(nullptr),
+        nts_(nullptr),
+        limiter_(nullptr),
+        stats_(nullptr)
+    {
+        assert(capacity != 0);
+        queued_.reserve(capacity);
+        queued_times_.reserve(capacity * 2);
+
+        for (std::size_t index = 0; index < capacity; ++index)
+        {
+            receive_buffers_[index].iov_base = datagrams_[index].data;
+            receive_buffers_[index].iov_len = packet::maximum_datagram_size();
+
+            ::msghdr& header = receive_headers_[index].msg_hdr;
+            header = ::msghdr();
+            header.msg_name = endpoints_[index].data();
+            header.msg_iov = &receive_buffers_[index];
+            header.msg_iovlen = 1;
+            header.msg_control = control_buffers_[index].data;
+        }
+    }
+
+    const ::timespec* batch::find_receive_time(const ::msghdr& header)
+    {
+        // const_cast, CMSG_NXTHDR is not const correct in glibc
+        ::msghdr& mutable_header = const_cast<::msghdr&>(header);
+        for (::cmsghdr* control = CMSG_FIRSTHDR(&mutable_header);
+             control != nullptr;
+             control = CMSG_NXTHDR(&mutable_header, control))
+        {
+            if (control->cmsg_level == SOL_SOCKET &&
+                control->cmsg_type == SCM_TIMESTAMPNS &&
+                control->cmsg_len == CMSG_LEN(sizeof(::timespec)))
+            {
+                return reinterpret_cast<const ::timespec*>(CMSG_DATA(control));
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::size_t batch::receive(const int socket, boost::system::error_code& error)
+    {
+        assert(pending() == 0);
+
+        error = boost::system::error_code();
+        received_ = 0;
+        last_received_ = 0;
+        responses_ = 0;
+        sent_ = 0;
+
+        for (::mmsghdr& header : receive_headers_)
+        {
+            header.msg_hdr.msg_namelen = endpoints_.front().capacity();
+            header.msg_hdr.msg_controllen = sizeof(control_buffer::data);
+            header.msg_hdr.msg_flags = 0;
+            header.msg_len = 0;
+        }
+
+        const int received = ::recvmmsg(
+            socket,
+            receive_headers_.data(),
+            receive_headers_.size(),
+            MSG_DONTWAIT,
+            nullptr);
+
+        if (received < 0)
+        {
+            if (!would_block(errno))
+            {
+                error = last_error();
+            }
+            return 0;
+        }
+
+        received_ = received;
+        last_received_ = received_;
+        if (stats_)
+        {
+            stats_->increment(worker_stats::counter::received, received_);
+            if (stats_->timed())
+            {
+                receive_time_ = worker_stats::realtime();
+            }
+        }
+        return received_;
+    }
+
+    void batch::fill_server_values(
+        const packet_view& request,
+        const ::msghdr& header,
+        const bool share_clock_read,
+        const bool queue)
+    {
+        const ::timespec* const receive_time = find_receive_time(header);
+
+        const timestamp* const previous_transmit =
+            interleaved_ ? interleaved_->find(request.originate().load()) : nullptr;
+        if (previous_transmit)
+        {
+            request.fill_interleaved_server_values(
+                receive_time ? timestamp(*receive_time) : timestamp::now(),
+                *previous_transmit);
+            return;
+        }
+
+        if (queue)
+        {
+            // The strings are generated for the whole batch, at the end
+            const timestamp received = receive_time ?
+                timestamp::deferred(*receive_time) : timestamp::now_deferred();
+            queued_times_.push_back(received);
+            queued_times_.push_back(
+                share_clock_read && !receive_time ? received : timestamp::now_deferred());
+
+            response_kernel::response response;
+            response.datagram = request.data();
+            queued_.push_back(response);
+            return;
+        }
+
+        fill_response(kernel_, request, receive_time, share_clock_read);
+    }
+
+    std::size_t batch::fill_server_values(const bool share_clock_read)
+    {
+        responses_ = 0;
+        sent_ = 0;
+
+        // Short datagrams are checked too, and their result ignored
+        kernel_.check_requests(
+            datagrams_.front().data, sizeof(datagram), received_, rejections_.data());
+
+        worker_context context;
+        context.keys = keys_;
+        context.limiter = limiter_;
+        context.nts = nts_;
+        context.stats = stats_;
+
+        for (std::size_t index = 0; index < received_; ++index)
+        {
+            const ::mmsghdr& received = receive_headers_[index];
+            if (received.msg_len < packet::minimum_packet_size() ||
+                (received.msg_hdr.msg_flags & MSG_TRUNC))
+            {
+                if (stats_)
+                {
+                    stats_->increment(worker_stats::counter::short_packet);
+                }
+                continue;
+            }
+
+            const std::size_t response_size = accept_request(
+                packet_view(datagrams_[index].data, received.msg_len),
+                rejections_[index],
+                *static_cast<const ::sockaddr*>(received.msg_hdr.msg_name),
+                context,
+                [this, &received, share_clock_read]
+                (const packet_view& request, const bool deferrable)
+                {
+                    this->fill_server_values(
+                        request, received.msg_hdr, share_clock_read, deferrable);
+                });
+
+            if (response_size != 0)
+            {
+                ::iovec& send_buffer = send_buffers_[responses_];
+                send_buffer.iov_base = datagrams_[index].data;
+                send_buffer.iov_len = response_size;
+
+                ::msghdr& header = send_headers_[responses_].msg_hdr;
+                header = ::msghdr();
+                header.msg_name = received.msg_hdr.msg_name;
+                header.msg_namelen = received.msg_hdr.msg_namelen;
+                header.msg_iov = &send_buffer;
+                header.msg_iovlen = 1;
+
+                if (stats_ && stats_->timed())
+                {
+                    const ::timespec* const arrival =
+                        find_receive_time(received.msg_hdr);
+                    arrivals_[responses_] = arrival ?
+                        worker_stats::nanoseconds(*arrival) : receive_time_;
+                }
+
+                ++responses_;
+            }
+        }
+
+        timestamp::generate_crypto_strings(queued_times_.data(), queued_times_.size());
+        for (std::size_t index = 0; index < queued_.size(); ++index)
+        {
+            queued_[index].received = queued_times_[index * 2];
+            queued_[index].transmit = queued_times_[index * 2 + 1];
+        }
+
+        kernel_.fill_responses(queued_.data(), queued_.size());
+        queued_.clear();
+        queued_times_.clear();
+
+        received_ = 0;
+        return responses_;
+    }
+
+    std::size_t batch::send(const int socket, boost::system::error_code& error)
+    {
+        error = boost::system::error_code();
+
+        std::size_t transmitted = 0;
+        while (pending() != 0)
+        {
+            const std::uint64_t send_time =
+                stats_ && stats_->timed() ? worker_stats::realtime() : 0;
+            const int sent = ::sendmmsg(
+                socket, send_headers_.data() + sent_, pending(), MSG_DONTWAIT);
+
+            if (sent < 0)
+            {
+                if (would_block(errno))
+                {
+                    error = boost::asio::error::would_block;
+                    break;
+                }
+
+                // Datagram errors are specific to the destination (e.g.
+                // unreachable network), skip the response and continue.
+                if (errno != EINTR)
+                {
+                    error = last_error();
+                    ++sent_;
+                    if (stats_)
+                    {
+                        stats_->increment(worker_stats::counter::send_error);
+                    }
+                }
+                continue;
+            }
+
+            if (stats_)
+            {
+                stats_->increment(worker_stats::counter::answered, sent);
+                if (stats_->timed())
+                {
+                    for (std::size_t index = sent_; index < sent_ + sent; ++index)
+                    {
+                        stats_->record_residence(arrivals_[index], send_time);
+                    }
+                }
+            }
+            sent_ += sent;
+            transmitted += sent;
+        }
+
+        return transmitted;
+    }
+}
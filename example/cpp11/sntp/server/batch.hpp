@@ -0,0 +1,188 @@
+//
+// batch.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/system/error_code.hpp>
+#include <cstdint>
+#include <sys/socket.h>
+#include <time.h>
+#include <vector>
+
+#include "packet.hpp"
+#include "response_kernel.hpp"
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    namespace nts
+    {
+        class responder;
+    }
+
+    class interleaved_table;
+    class packet_view;
+    class key_table;
+    class rate_limiter;
+    class worker_stats;
+
+    // Receives and transmits groups of NTP packets with a single system
+    // call (recvmmsg / sendmmsg). All storage is allocated on construction.
+    class batch
+    {
+    public:
+
+        // Handle at most capacity datagrams per system call
+        explicit batch(std::size_t capacity);
+
+        batch(const batch&) = delete;
+        batch& operator=(const batch&) = delete;
+
+        // Maximum number of datagrams per system call
+        std::size_t capacity() const
+        {
+            return datagrams_.size();
+        }
+
+        // Read up to capacity() datagrams from a non-blocking socket. Zero
+        // is returned if no datagrams were waiting or on error.
+        std::size_t receive(int socket, boost::system::error_code& error);
+
+        // Call fill_server_values on every received packet of valid size, and
+        // queue the packets that need a response. The number of queued
+        // responses is returned. The requests are checked together, and
+        // plain responses are filled together, by a response_kernel. The
+        // cryptographic strings of their timestamps are generated together
+        // too, before the responses are filled. If the socket has SO_TIMESTAMPNS enabled,
+        // the kernel arrival time is used as the receive timestamp.
+        // Otherwise, if share_clock_read is set, each response uses one
+        // clock read for its receive and transmit timestamps. Requests whose
+        // originate timestamp is in the interleaved table get an interleaved
+        // mode response. Sources over the rate limit (if set) are dropped,
+        // or get a Kiss-o'-Death response. NTS requests get an NTS response
+        // if a responder is set.
+        std::size_t fill_server_values(bool share_clock_read = false);
+
+        // Enable interleaved mode responses. The table must outlive the
+        // batch, and is updated separately by transmit_timestamps.
+        void set_interleaved_table(const interleaved_table* const table)
+        {
+            interleaved_ = table;
+        }
+
+        // Verify requests with a MAC, and sign their responses. Requests
+        // with an invalid MAC are dropped. The keys must outlive the batch.
+        void set_keys(const key_table* const keys)
+        {
+            keys_ = keys;
+        }
+
+        // Answer NTS requests (RFC 8915). Requests with an unknown cookie
+        // or a forged authenticator get a "NTSN" Kiss-o'-Death, malformed
+        // ones are dropped. The responder must outlive the batch.
+        void set_nts(nts::responder* const responder)
+        {
+            nts_ = responder;
+        }
+
+        // Limit the request rate of each source. The limiter must outlive
+        // the batch.
+        void set_rate_limiter(rate_limiter* const limiter)
+        {
+            limiter_ = limiter;
+        }
+
+        // Count received, answered, and dropped packets, and record the
+        // residence time of each response if the stats are timed. The stats
+        // must outlive the batch.
+        void set_stats(worker_stats* const stats)
+        {
+            stats_ = stats;
+        }
+
+        // Transmit queued responses to a non-blocking socket. Returns the
+        // number of responses sent with this call. If the socket would block,
+        // error is set and the remaining responses stay queued. Responses
+        // that fail for other reasons are skipped, and error is set to the
+        // last failure.
+        std::size_t send(int socket, boost::system::error_code& error);
+
+        // Number of datagrams read by the last receive call
+        std::size_t last_received() const
+        {
+            return last_received_;
+        }
+
+        // Number of responses queued but not yet sent
+        std::size_t pending() const
+        {
+            return responses_ - sent_;
+        }
+
+        // Kernel receive time (SCM_TIMESTAMPNS) of a datagram, if provided
+        static const ::timespec* find_receive_time(const ::msghdr& header);
+
+    private:
+
+        // Room for a request with extension fields. Larger datagrams are
+        // truncated, and dropped.
+        struct datagram
+        {
+            alignas(packet) std::uint8_t data[packet::maximum_datagram_size()];
+        };
+
+        // Space for the control messages of a single datagram. Sockets with
+        // SO_TIMESTAMPING enabled (interleaved mode) also receive an
+        // SCM_TIMESTAMPING message.
+        struct control_buffer
+        {
+            alignas(::cmsghdr) std::uint8_t data[
+                CMSG_SPACE(sizeof(::timespec)) + CMSG_SPACE(sizeof(::timespec) * 3)];
+        };
+
+        // Fill the response of a request that passed check_requests now,
+        // or queue it for the kernel if nothing (a MAC or NTS) depends on
+        // the header yet
+        void fill_server_values(
+            const packet_view& request,
+            const ::msghdr& header,
+            bool share_clock_read,
+            bool queue);
+
+    private:
+
+        const response_kernel kernel_;
+        std::vector<datagram> datagrams_;
+        std::vector<packet::rejection> rejections_;
+        std::vector<response_kernel::response> queued_;  // filled by kernel_
+        std::vector<timestamp> queued_times_;   // receive, transmit of queued_
+        std::vector<boost::asio::ip::udp::endpoint> endpoints_;
+        std::vector<::iovec> receive_buffers_;
+        std::vector<control_buffer> control_buffers_;
+        std::vector<::mmsghdr> receive_headers_;
+        std::vector<::iovec> send_buffers_;
+        std::vector<::mmsghdr> send_headers_;
+        std::vector<std::uint64_t> arrivals_;    // per response, for stats_
+        std::uint64_t receive_time_;             // last receive, for stats_
+        std::size_t received_;
+        std::size_t last_received_;
+        std::size_t responses_;
+        std::size_t sent_;
+        const interleaved_table* interleaved_;
+        const key_table* keys_;
+        nts::responder* nts_;
+        rate_limiter* limiter_;
+        worker_stats* stats_;
+    };
+}
+
+#endif // BATCH_HPP
@@ -0,0 +1,283 @@
+//
+// clock_source.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "clock_source.hpp"
+
+#include <cassert>
+#include <limits>
+#include <time.h>
+
+// The TSC is read with rdtsc, and scaled with 128-bit integers
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SNTP_CLOCK_SOURCE_TSC 1
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace sntp
+{
+    namespace
+    {
+        const std::int64_t nanoseconds_per_second = 1000000000;
+
+        // Both clocks are read several times, and the reading with the
+        // fewest ticks around CLOCK_REALTIME is used
+        const unsigned reading_attempts = 8;
+
+        // Tick lengths further apart than 1 / 2000 (500 ppm) disagree
+        const std::uint64_t maximum_rate_change = 2000;
+
+        const std::chrono::milliseconds initial_calibration(10);
+
+        std::uint64_t read_ticks()
+        {
+#ifdef SNTP_CLOCK_SOURCE_TSC
+            return __rdtsc();
+#else
+            return 0;
+#endif
+        }
+
+        // Nanoseconds per tick in 32.32 fixed point
+        std::uint64_t make_tick_length(
+            const std::int64_t nanoseconds, const std::int64_t ticks)
+        {
+#ifdef SNTP_CLOCK_SOURCE_TSC
+            return std::uint64_t(
+                (static_cast<unsigned __int128>(nanoseconds) << 32) / std::uint64_t(ticks));
+#else
+            return 0;
+#endif
+        }
+
+        bool agree(const std::uint64_t current, const std::uint64_t measured)
+        {
+            const std::uint64_t change =
+                measured < current ? current - measured : measured - current;
+            return change <= current / maximum_rate_change;
+        }
+
+        // Nanoseconds in ticks, which can be negative when the TSC was read
+        // just before the calibration point was taken
+        std::int64_t scale(const std::int64_t ticks, const std::uint64_t tick_length)
+        {
+#ifdef SNTP_CLOCK_SOURCE_TSC
+            return std::int64_t((static_cast<__int128>(ticks) * tick_length) >> 32);
+#else
+            return 0;
+#endif
+        }
+    }
+
+    clock_source::~clock_source()
+    {
+    }
+
+    ::timespec realtime_clock::now() const
+    {
+        ::timespec current = {};
+        ::clock_gettime(CLOCK_REALTIME, &current);
+        return current;
+    }
+
+    const char* realtime_clock::name() const
+    {
+        return "realtime";
+    }
+
+    tick_rate_filter::tick_rate_filter() :
+        tick_length_(0),
+        candidate_(0),
+        measurements_(0)
+    {
+    }
+
+    std::uint64_t tick_rate_filter::update(const std::uint64_t measured)
+    {
+        // The initial length is always replaced by the first periodic one,
+        // which agrees or was measured over a longer period
+        const bool initial = measurements_ < 2;
+        if (initial)
+        {
+            ++measurements_;
+        }
+
+        if (initial || agree(tick_length_, measured) ||
+            (candidate_ != 0 && agree(candidate_, measured)))
+        {
+            tick_length_ = measured;
+            candidate_ = 0;
+        }
+        else
+        {
+            candidate_ = measured;
+        }
+        return tick_length_;
+    }
+
+    bool tsc_clock::supported()
+    {
+#ifdef SNTP_CLOCK_SOURCE_TSC
+        // Advanced power management leaf, EDX bit 8
+        unsigned eax = 0;
+        unsigned ebx = 0;
+        unsigned ecx = 0;
+        unsigned edx = 0;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    tsc_clock::tsc_clock(const std::chrono::milliseconds period) :
+        sequence_(0),
+        published_(),
+        mutex_(),
+        stop_requested_(),
+        stopping_(false),
+        previous_(read_both()),
+        rate_(),
+        period_(period),
+        calibrator_()
+    {
+        assert(supported());
+
+        std::this_thread::sleep_for(initial_calibration);
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            refresh();
+        }
+
+        calibrator_ = std::thread(
+            [this]
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_requested_.wait_for(lock, period_, [this] { return stopping_; }))
+                {
+                    refresh();
+                }
+            });
+    }
+
+    tsc_clock::~tsc_clock()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        stop_requested_.notify_all();
+        calibrator_.join();
+    }
+
+    ::timespec tsc_clock::now() const
+    {
+        std::uint64_t base_ticks = 0;
+        std::uint64_t base_nanoseconds = 0;
+        std::uint64_t tick_length = 0;
+
+        for (;;)
+        {
+            const std::uint32_t before = sequence_.load(std::memory_order_acquire);
+            if ((before & 1) == 0)
+            {
+                base_ticks = published_[0].load(std::memory_order_relaxed);
+                base_nanoseconds = published_[1].load(std::memory_order_relaxed);
+                tick_length = published_[2].load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence_.load(std::memory_order_relaxed) == before)
+                {
+                    break;
+                }
+            }
+        }
+
+        const std::int64_t nanoseconds =
+            std::int64_t(base_nanoseconds) +
+            scale(std::int64_t(read_ticks() - base_ticks), tick_length);
+
+        ::timespec current = {};
+        current.tv_sec = std::time_t(nanoseconds / nanoseconds_per_second);
+        current.tv_nsec = long(nanoseconds % nanoseconds_per_second);
+        return current;
+    }
+
+    const char* tsc_clock::name() const
+    {
+        return "tsc";
+    }
+
+    void tsc_clock::calibrate()
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        refresh();
+    }
+
+    tsc_clock::reading tsc_clock::read_both()
+    {
+        reading best = {0, 0};
+        std::uint64_t best_span = std::numeric_limits<std::uint64_t>::max();
+
+        for (unsigned attempt = 0; attempt < reading_attempts; ++attempt)
+        {
+            const std::uint64_t before = read_ticks();
+            ::timespec current = {};
+            ::clock_gettime(CLOCK_REALTIME, &current);
+            const std::uint64_t after = read_ticks();
+
+            if (after - before < best_span)
+            {
+                best_span = after - before;
+                best.ticks = before + best_span / 2;
+                best.nanoseconds =
+                    std::int64_t(current.tv_sec) * nanoseconds_per_second + current.tv_nsec;
+            }
+        }
+
+        return best;
+    }
+
+    void tsc_clock::refresh()
+    {
+        const reading current = read_both();
+        const std::int64_t ticks = std::int64_t(current.ticks - previous_.ticks);
+        const std::int64_t nanoseconds = current.nanoseconds - previous_.nanoseconds;
+
+        if (0 < ticks && 0 < nanoseconds)
+        {
+            rate_.update(make_tick_length(nanoseconds, ticks));
+        }
+
+        previous_ = current;
+        publish(current, rate_.tick_length());
+    }
+
+    void tsc_clock::publish(const reading& point, const std::uint64_t tick_length)
+    {
+        const std::uint32_t current = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        published_[0].store(point.ticks, std::memory_order_relaxed);
+        published_[1].store(std::uint64_t(point.nanoseconds), std::memory_order_relaxed);
+        published_[2].store(tick_length, std::memory_order_relaxed);
+
+        sequence_.store(current + 2, std::memory_order_release);
+    }
+
+    std::unique_ptr<const clock_source> make_tsc_clock(const std::chrono::milliseconds period)
+    {
+        if (tsc_clock::supported())
+        {
+            return std::make_unique<tsc_clock>(period);
+        }
+        return std::make_unique<realtime_clock>();
+    }
+}
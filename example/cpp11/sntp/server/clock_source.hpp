@@ -0,0 +1,147 @@
+//
+// clock_source.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef CLOCK_SOURCE_HPP
+#define CLOCK_SOURCE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace sntp
+{
+    // Source of the current time for timestamp::now. Implementations must
+    // be safe to call from multiple threads.
+    class clock_source
+    {
+    public:
+
+        virtual ~clock_source();
+
+        // Current unix (1970 epoch) time
+        virtual ::timespec now() const = 0;
+
+        virtual const char* name() const = 0;
+    };
+
+    // CLOCK_REALTIME, read through the vDSO. The default.
+    class realtime_clock : public clock_source
+    {
+    public:
+
+        ::timespec now() const override;
+        const char* name() const override;
+    };
+
+    // Chooses the tick length of tsc_clock from the length measured over
+    // each calibration period. A measurement more than 500 ppm (above the
+    // slew limit of the kernel) from the current length is a step of the
+    // system clock during the period, and is ignored unless the next
+    // measurement agrees with it. So a real change of rate, or a current
+    // length measured across a step, is replaced after two periods. The
+    // first length is from a short initial calibration, and is replaced by
+    // the next measurement if they disagree.
+    class tick_rate_filter
+    {
+    public:
+
+        tick_rate_filter();
+
+        // Nanoseconds per tick in 32.32 fixed point, zero until the first
+        // measurement
+        std::uint64_t tick_length() const
+        {
+            return tick_length_;
+        }
+
+        // Returns the tick length to use after this measurement
+        std::uint64_t update(std::uint64_t measured);
+
+    private:
+
+        std::uint64_t tick_length_;
+        std::uint64_t candidate_;       // last rejected measurement
+        unsigned measurements_;         // up to 2
+    };
+
+    // Counts TSC ticks from a calibration point, so reading the time is a
+    // rdtsc and a multiply instead of a vDSO call. A background thread
+    // compares the TSC to CLOCK_REALTIME every period, and publishes a new
+    // calibration point and tick length behind a seqlock. Slews of the
+    // system clock are followed within a period, and steps are followed at
+    // the next calibration.
+    class tsc_clock : public clock_source
+    {
+    public:
+
+        // True if this build can read the TSC, and the CPU has an invariant
+        // TSC (constant rate in every power state, synchronized cores)
+        static bool supported();
+
+        // Blocks for an initial calibration of about 10 milliseconds.
+        // supported() must be true.
+        explicit tsc_clock(std::chrono::milliseconds period = std::chrono::seconds(1));
+
+        // Stops the calibration thread
+        ~tsc_clock();
+
+        tsc_clock(const tsc_clock&) = delete;
+        tsc_clock& operator=(const tsc_clock&) = delete;
+
+        ::timespec now() const override;
+        const char* name() const override;
+
+        // Calibrate now, instead of waiting for the background thread
+        void calibrate();
+
+    private:
+
+        // A TSC reading and CLOCK_REALTIME at the same moment
+        struct reading
+        {
+            std::uint64_t ticks;
+            std::int64_t nanoseconds;   // since the unix epoch
+        };
+
+        static reading read_both();
+
+        // mutex_ must be held
+        void refresh();
+        void publish(const reading& point, std::uint64_t tick_length);
+
+    private:
+
+        // The calibration point, and nanoseconds per tick in 32.32 fixed
+        // point. The sequence is odd while a publish is in progress.
+        std::atomic<std::uint32_t> sequence_;
+        std::array<std::atomic<std::uint64_t>, 3> published_;
+
+        std::mutex mutex_;
+        std::condition_variable stop_requested_;
+        bool stopping_;
+        reading previous_;
+        tick_rate_filter rate_;
+
+        const std::chrono::milliseconds period_;
+        std::thread calibrator_;
+    };
+
+    // tsc_clock when supported, otherwise realtime_clock
+    std::unique_ptr<const clock_source> make_tsc_clock(
+        std::chrono::milliseconds period = std::chrono::seconds(1));
+}
+
+#endif // CLOCK_SOURCE_HPP
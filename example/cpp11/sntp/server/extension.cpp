@@ -0,0 +1,80 @@
+//
+// extension.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "extension.hpp"
+
+#include "packet.hpp"
+
+namespace sntp
+{
+    constexpr std::size_t extension_field::header_size;
+    constexpr std::size_t extension_field::minimum_size;
+    constexpr std::size_t extension_fields::short_mac_size;
+    constexpr std::size_t extension_fields::long_mac_size;
+
+    extension_fields extension_fields::parse(
+        const std::uint8_t* const datagram, const std::size_t length)
+    {
+        if (length < packet::minimum_packet_size())
+        {
+            extension_fields none(datagram, 0, false);
+            none.valid_ = false;
+            return none;
+        }
+
+        return extension_fields(
+            datagram + packet::minimum_packet_size(),
+            length - packet::minimum_packet_size(),
+            true);
+    }
+
+    extension_fields::extension_fields(
+        const std::uint8_t* const fields, const std::size_t length) :
+        extension_fields(fields, length, false)
+    {
+    }
+
+    extension_fields::extension_fields(
+        const std::uint8_t* const fields, const std::size_t length, const bool allow_mac) :
+        begin_(fields),
+        end_(fields),
+        mac_size_(0),
+        valid_(false)
+    {
+        const std::uint8_t* const last = fields + length;
+        while (end_ != last)
+        {
+            const std::size_t remaining = last - end_;
+            if (allow_mac &&
+                (remaining == short_mac_size || remaining == long_mac_size))
+            {
+                mac_size_ = remaining;
+                break;
+            }
+
+            if (remaining < extension_field::minimum_size)
+            {
+                end_ = begin_;
+                return;
+            }
+
+            const std::size_t size = extension_field(end_).size();
+            if (size < extension_field::minimum_size || size % 4 != 0 || remaining < size)
+            {
+                end_ = begin_;
+                return;
+            }
+
+            end_ += size;
+        }
+
+        valid_ = true;
+    }
+}
@@ -0,0 +1,181 @@
+//
+// extension.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef EXTENSION_HPP
+#define EXTENSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+namespace sntp
+{
+    // An extension field in place (RFC 7822): type, length, and a body
+    // padded to 4 bytes. The length includes the header.
+    class extension_field
+    {
+    public:
+
+        static constexpr std::size_t header_size = 4;
+        static constexpr std::size_t minimum_size = 16;
+
+        explicit extension_field(const std::uint8_t* const field) :
+            field_(field)
+        {
+        }
+
+        std::uint16_t type() const
+        {
+            return std::uint16_t((field_[0] << 8) | field_[1]);
+        }
+
+        // Including the header
+        std::size_t size() const
+        {
+            return std::size_t((field_[2] << 8) | field_[3]);
+        }
+
+        // Start of the header
+        const std::uint8_t* data() const
+        {
+            return field_;
+        }
+
+        const std::uint8_t* body() const
+        {
+            return field_ + header_size;
+        }
+
+        std::size_t body_size() const
+        {
+            return size() - header_size;
+        }
+
+    private:
+        const std::uint8_t* field_;
+    };
+
+    // Zero-copy view of the extension fields in a datagram. Every length
+    // is checked in a single pass on construction, so iteration does no
+    // checks. Never allocates; the datagram must outlive the view. An
+    // invalid view is empty.
+    class extension_fields
+    {
+    public:
+
+        // A MAC is a key identifier and a 16 byte (MD5, AES-CMAC) or 20 byte
+        // (SHA-1, SHA-256) digest
+        static constexpr std::size_t short_mac_size = 20;
+        static constexpr std::size_t long_mac_size = 24;
+
+        class iterator
+        {
+        public:
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = extension_field;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const extension_field*;
+            using reference = extension_field;
+
+            iterator() :
+                field_(nullptr)
+            {
+            }
+
+            explicit iterator(const std::uint8_t* const field) :
+                field_(field)
+            {
+            }
+
+            extension_field operator*() const
+            {
+                return extension_field(field_);
+            }
+
+            iterator& operator++()
+            {
+                field_ += extension_field(field_).size();
+                return *this;
+            }
+
+            iterator operator++(int)
+            {
+                const iterator current = *this;
+                ++*this;
+                return current;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+                return field_ == other.field_;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+                return field_ != other.field_;
+            }
+
+        private:
+            const std::uint8_t* field_;
+        };
+
+        // The fields after the header of a NTP datagram of length bytes.
+        // A trailing 20 or 24 byte MAC is not a field; the last field must
+        // be at least 28 bytes (RFC 7822 section 7.5), so a remainder of
+        // those sizes is always a MAC.
+        static extension_fields parse(const std::uint8_t* datagram, std::size_t length);
+
+        // A sequence of fields without a header or MAC, such as the
+        // decrypted fields of a NTS authenticator
+        extension_fields(const std::uint8_t* fields, std::size_t length);
+
+        // Every field is at least 16 bytes, a multiple of 4 bytes (each
+        // field stays 4 byte aligned), and within the datagram
+        bool valid() const
+        {
+            return valid_;
+        }
+
+        bool empty() const
+        {
+            return begin_ == end_;
+        }
+
+        iterator begin() const
+        {
+            return iterator(begin_);
+        }
+
+        iterator end() const
+        {
+            return iterator(end_);
+        }
+
+        // Size of the MAC after the fields, zero if none
+        std::size_t mac_size() const
+        {
+            return mac_size_;
+        }
+
+    private:
+
+        extension_fields(const std::uint8_t* fields, std::size_t length, bool allow_mac);
+
+    private:
+
+        const std::uint8_t* begin_;
+        const std::uint8_t* end_;
+        std::size_t mac_size_;
+        bool valid_;
+    };
+}
+
+#endif // EXTENSION_HPP
@@ -0,0 +1,405 @@
+//
+// fingerprint.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "fingerprint.hpp"
+
+#include <cryptopp/aes.h>
+#include <cryptopp/osrng.h>
+#include <cstring>
+
+// The AVX2 version is compiled with a function attribute and selected at
+// runtime, so the build needs no -m flags
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SNTP_FINGERPRINT_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace sntp
+{
+    namespace
+    {
+        inline std::uint64_t rotate_left(const std::uint64_t value, const int bits)
+        {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        inline void sip_round(std::array<std::uint64_t, 4>& v)
+        {
+            v[0] += v[1];
+            v[1] = rotate_left(v[1], 13);
+            v[1] ^= v[0];
+            v[0] = rotate_left(v[0], 32);
+
+            v[2] += v[3];
+            v[3] = rotate_left(v[3], 16);
+            v[3] ^= v[2];
+
+            v[0] += v[3];
+            v[3] = rotate_left(v[3], 21);
+            v[3] ^= v[0];
+
+            v[2] += v[1];
+            v[1] = rotate_left(v[1], 17);
+            v[1] ^= v[2];
+            v[2] = rotate_left(v[2], 32);
+        }
+
+        // SipHash reads keys and messages as little endian words
+        std::uint64_t load_little_endian(const std::uint8_t* const bytes)
+        {
+            std::uint64_t value = 0;
+            for (unsigned byte = 8; byte != 0; --byte)
+            {
+                value = (value << 8) | bytes[byte - 1];
+            }
+            return value;
+        }
+
+        std::uint64_t make_message(
+            const std::uint32_t seconds, const std::uint32_t fractional)
+        {
+            std::array<std::uint8_t, 8> bytes;
+            std::memcpy(bytes.data(), &seconds, sizeof(seconds));
+            std::memcpy(bytes.data() + sizeof(seconds), &fractional, sizeof(fractional));
+            return load_little_endian(bytes.data());
+        }
+
+        // final block only encodes the message length (8)
+        const std::uint64_t final_block = std::uint64_t(8) << 56;
+
+        // SipHash-2-4 of Lanes independent messages, a round of every lane
+        // at a time
+        template<std::size_t Lanes>
+        void hash_lanes(
+            const std::array<std::uint64_t, 4>& initial,
+            const std::uint32_t* const seconds,
+            const std::uint32_t* const fractional,
+            std::uint32_t* const strings)
+        {
+            std::array<std::array<std::uint64_t, 4>, Lanes> v;
+            std::array<std::uint64_t, Lanes> message;
+            for (std::size_t lane = 0; lane < Lanes; ++lane)
+            {
+                v[lane] = initial;
+                message[lane] = make_message(seconds[lane], fractional[lane]);
+                v[lane][3] ^= message[lane];
+            }
+
+            for (unsigned round = 0; round < 2; ++round)
+            {
+                for (std::array<std::uint64_t, 4>& state : v)
+                {
+                    sip_round(state);
+                }
+            }
+
+            for (std::size_t lane = 0; lane < Lanes; ++lane)
+            {
+                v[lane][0] ^= message[lane];
+                v[lane][3] ^= final_block;
+            }
+
+            for (unsigned round = 0; round < 2; ++round)
+            {
+                for (std::array<std::uint64_t, 4>& state : v)
+                {
+                    sip_round(state);
+                }
+            }
+
+            for (std::array<std::uint64_t, 4>& state : v)
+            {
+                state[0] ^= final_block;
+                state[2] ^= 0xFF;
+            }
+
+            for (unsigned round = 0; round < 4; ++round)
+            {
+                for (std::array<std::uint64_t, 4>& state : v)
+                {
+                    sip_round(state);
+                }
+            }
+
+            for (std::size_t lane = 0; lane < Lanes; ++lane)
+            {
+                strings[lane] = std::uint32_t(v[lane][0] ^ v[lane][1] ^ v[lane][2] ^ v[lane][3]);
+            }
+        }
+
+#ifdef SNTP_FINGERPRINT_AVX2
+        // SipHash state of 4 messages, one per 64-bit lane
+        struct avx2_lanes
+        {
+            __m256i v0;
+            __m256i v1;
+            __m256i v2;
+            __m256i v3;
+        };
+
+        template<int Bits>
+        __attribute__((target("avx2")))
+        inline __m256i rotate_lanes(const __m256i value)
+        {
+            return _mm256_or_si256(
+                _mm256_slli_epi64(value, Bits), _mm256_srli_epi64(value, 64 - Bits));
+        }
+
+        __attribute__((target("avx2")))
+        inline __m256i swap_halves(const __m256i value)
+        {
+            return _mm256_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1));
+        }
+
+        __attribute__((target("avx2")))
+        inline void sip_round(avx2_lanes& v)
+        {
+            v.v0 = _mm256_add_epi64(v.v0, v.v1);
+            v.v1 = rotate_lanes<13>(v.v1);
+            v.v1 = _mm256_xor_si256(v.v1, v.v0);
+            v.v0 = swap_halves(v.v0);
+
+            v.v2 = _mm256_add_epi64(v.v2, v.v3);
+            v.v3 = rotate_lanes<16>(v.v3);
+            v.v3 = _mm256_xor_si256(v.v3, v.v2);
+
+            v.v0 = _mm256_add_epi64(v.v0, v.v3);
+            v.v3 = rotate_lanes<21>(v.v3);
+            v.v3 = _mm256_xor_si256(v.v3, v.v0);
+
+            v.v2 = _mm256_add_epi64(v.v2, v.v1);
+            v.v1 = rotate_lanes<17>(v.v1);
+            v.v1 = _mm256_xor_si256(v.v1, v.v2);
+            v.v2 = swap_halves(v.v2);
+        }
+
+        // seconds || fractional of 4 timestamps, little endian
+        __attribute__((target("avx2")))
+        inline __m256i load_messages(
+            const std::uint32_t* const seconds, const std::uint32_t* const fractional)
+        {
+            return _mm256_or_si256(
+                _mm256_cvtepu32_epi64(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(seconds))),
+                _mm256_slli_epi64(
+                    _mm256_cvtepu32_epi64(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(fractional))),
+                    32));
+        }
+
+        // Two independent sets of 4 lanes per step, the rounds of one set
+        // execute while the other waits on its results
+        __attribute__((target("avx2")))
+        std::size_t hash_avx2(
+            const std::array<std::uint64_t, 4>& initial,
+            const std::uint32_t* const seconds,
+            const std::uint32_t* const fractional,
+            const std::size_t count,
+            std::uint32_t* const strings)
+        {
+            const __m256i final_lanes = _mm256_set1_epi64x(final_block);
+            const __m256i low_dwords = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+
+            std::size_t index = 0;
+            for (; index + 8 <= count; index += 8)
+            {
+                const __m256i messages[2] = {
+                    load_messages(seconds + index, fractional + index),
+                    load_messages(seconds + index + 4, fractional + index + 4)};
+                avx2_lanes v[2];
+                for (unsigned set = 0; set < 2; ++set)
+                {
+                    v[set].v0 = _mm256_set1_epi64x(initial[0]);
+                    v[set].v1 = _mm256_set1_epi64x(initial[1]);
+                    v[set].v2 = _mm256_set1_epi64x(initial[2]);
+                    v[set].v3 = _mm256_xor_si256(_mm256_set1_epi64x(initial[3]), messages[set]);
+                }
+
+                for (unsigned round = 0; round < 2; ++round)
+                {
+                    sip_round(v[0]);
+                    sip_round(v[1]);
+                }
+
+                for (unsigned set = 0; set < 2; ++set)
+                {
+                    v[set].v0 = _mm256_xor_si256(v[set].v0, messages[set]);
+                    v[set].v3 = _mm256_xor_si256(v[set].v3, final_lanes);
+                }
+
+                for (unsigned round = 0; round < 2; ++round)
+                {
+                    sip_round(v[0]);
+                    sip_round(v[1]);
+                }
+
+                for (unsigned set = 0; set < 2; ++set)
+                {
+                    v[set].v0 = _mm256_xor_si256(v[set].v0, final_lanes);
+                    v[set].v2 = _mm256_xor_si256(v[set].v2, _mm256_set1_epi64x(0xFF));
+                }
+
+                for (unsigned round = 0; round < 4; ++round)
+                {
+                    sip_round(v[0]);
+                    sip_round(v[1]);
+                }
+
+                for (unsigned set = 0; set < 2; ++set)
+                {
+                    const __m256i hash = _mm256_xor_si256(
+                        _mm256_xor_si256(v[set].v0, v[set].v1),
+                        _mm256_xor_si256(v[set].v2, v[set].v3));
+                    _mm_storeu_si128(
+                        reinterpret_cast<__m128i*>(strings + index + set * 4),
+                        _mm256_castsi256_si128(
+                            _mm256_permutevar8x32_epi32(hash, low_dwords)));
+                }
+            }
+
+            return index;
+        }
+
+        bool has_avx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+#endif // SNTP_FINGERPRINT_AVX2
+    }
+
+    fingerprint::key fingerprint::random_key()
+    {
+        key random = {{0}};
+        CryptoPP::AutoSeededX917RNG<CryptoPP::AES> random_generator;
+        random_generator.GenerateBlock(random.data(), random.size());
+        return random;
+    }
+
+    fingerprint::~fingerprint()
+    {
+    }
+
+    void fingerprint::compute(
+        const std::uint32_t* const seconds,
+        const std::uint32_t* const fractional,
+        const std::size_t count,
+        std::uint32_t* const strings) const
+    {
+        for (std::size_t index = 0; index < count; ++index)
+        {
+            strings[index] = (*this)(seconds[index], fractional[index]);
+        }
+    }
+
+    siphash_fingerprint::siphash_fingerprint(const key& secret) :
+        fingerprint(),
+        initial_()
+    {
+        const std::uint64_t k0 = load_little_endian(secret.data());
+        const std::uint64_t k1 = load_little_endian(secret.data() + 8);
+
+        initial_[0] = k0 ^ 0x736f6d6570736575ULL;
+        initial_[1] = k1 ^ 0x646f72616e646f6dULL;
+        initial_[2] = k0 ^ 0x6c7967656e657261ULL;
+        initial_[3] = k1 ^ 0x7465646279746573ULL;
+    }
+
+    std::uint64_t siphash_fingerprint::hash(const std::uint64_t message) const
+    {
+        std::array<std::uint64_t, 4> v = initial_;
+
+        v[3] ^= message;
+        sip_round(v);
+        sip_round(v);
+        v[0] ^= message;
+
+        v[3] ^= final_block;
+        sip_round(v);
+        sip_round(v);
+        v[0] ^= final_block;
+
+        v[2] ^= 0xFF;
+        sip_round(v);
+        sip_round(v);
+        sip_round(v);
+        sip_round(v);
+
+        return v[0] ^ v[1] ^ v[2] ^ v[3];
+    }
+
+    std::uint32_t siphash_fingerprint::operator()(
+        const std::uint32_t seconds, const std::uint32_t fractional) const
+    {
+        return std::uint32_t(hash(make_message(seconds, fractional)));
+    }
+
+    void siphash_fingerprint::compute(
+        const std::uint32_t* const seconds,
+        const std::uint32_t* const fractional,
+        const std::size_t count,
+        std::uint32_t* const strings) const
+    {
+        std::size_t index = 0;
+#ifdef SNTP_FINGERPRINT_AVX2
+        if (has_avx2())
+        {
+            index = hash_avx2(initial_, seconds, fractional, count, strings);
+        }
+#endif
+
+        for (; index + 4 <= count; index += 4)
+        {
+            hash_lanes<4>(initial_, seconds + index, fractional + index, strings + index);
+        }
+
+        for (; index < count; ++index)
+        {
+            hash_lanes<1>(initial_, seconds + index, fractional + index, strings + index);
+        }
+    }
+
+    std::unique_ptr<const fingerprint> siphash_fingerprint::rekey(const key& secret) const
+    {
+        return std::unique_ptr<const fingerprint>(new siphash_fingerprint(secret));
+    }
+
+    sha256_fingerprint::sha256_fingerprint(const key& secret) :
+        fingerprint(),
+        keyed_()
+    {
+        keyed_.Update(secret.data(), secret.size());
+    }
+
+    std::uint32_t sha256_fingerprint::operator()(
+        const std::uint32_t seconds, const std::uint32_t fractional) const
+    {
+        std::array<std::uint8_t, CryptoPP::SHA256::DIGESTSIZE> hash_value = {};
+
+        CryptoPP::SHA256 hash(keyed_);
+        hash.Update(
+            reinterpret_cast<const std::uint8_t*>(&seconds), sizeof(seconds));
+        hash.Update(
+            reinterpret_cast<const std::uint8_t*>(&fractional), sizeof(fractional));
+        hash.Final(hash_value.data());
+
+        std::uint32_t crypto_string = 0;
+        static_assert(
+            sizeof(crypto_string) <= hash_value.size(),
+            "hash is too small");
+        std::memcpy(&crypto_string, hash_value.data(), sizeof(crypto_string));
+        return crypto_string;
+    }
+
+    std::unique_ptr<const fingerprint> sha256_fingerprint::rekey(const key& secret) const
+    {
+        return std::unique_ptr<const fingerprint>(new sha256_fingerprint(secret));
+    }
+}
@@ -0,0 +1,106 @@
+//
+// fingerprint.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef FINGERPRINT_HPP
+#define FINGERPRINT_HPP
+
+#include <array>
+#include <cryptopp/sha.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace sntp
+{
+    // Keyed function used to mark timestamps generated by this server, so
+    // that loops and replays can be detected. Implementations precompute
+    // all key dependent state on construction, and must be safe to call
+    // from multiple threads.
+    class fingerprint
+    {
+    public:
+
+        using key = std::array<std::uint8_t, 16>;
+
+        // Generate a random 128-bit key
+        static key random_key();
+
+        virtual ~fingerprint();
+
+        // Compute 32 pseudo-random bits from the 8 bytes of a timestamp.
+        // Both values are in network byte order (as stored in a packet).
+        virtual std::uint32_t operator()(
+            std::uint32_t seconds, std::uint32_t fractional) const = 0;
+
+        // Compute the fingerprints of count timestamps, as operator() of
+        // each seconds[i] and fractional[i]. Engines that can hash several
+        // messages in parallel override this, the default computes one at
+        // a time.
+        virtual void compute(
+            const std::uint32_t* seconds,
+            const std::uint32_t* fractional,
+            std::size_t count,
+            std::uint32_t* strings) const;
+
+        // The same engine with a different key
+        virtual std::unique_ptr<const fingerprint> rekey(const key& secret) const = 0;
+    };
+
+    // SipHash-2-4, the default engine
+    class siphash_fingerprint : public fingerprint
+    {
+    public:
+
+        explicit siphash_fingerprint(const key& secret);
+
+        // Full 64-bit SipHash-2-4 of a single 8 byte message block
+        std::uint64_t hash(std::uint64_t message) const;
+
+        std::uint32_t operator()(
+            std::uint32_t seconds, std::uint32_t fractional) const override;
+
+        // Hashes 8 messages at once in AVX2 registers when the CPU has
+        // them, otherwise 4 at once in general registers. Independent
+        // hashes hide the latency of each round.
+        void compute(
+            const std::uint32_t* seconds,
+            const std::uint32_t* fractional,
+            std::size_t count,
+            std::uint32_t* strings) const override;
+
+        std::unique_ptr<const fingerprint> rekey(const key& secret) const override;
+
+    private:
+
+        // v0-v3 after key initialization
+        std::array<std::uint64_t, 4> initial_;
+    };
+
+    // First 4 bytes of SHA-256(key || seconds || fractional). This was the
+    // original engine, and is several times slower than siphash.
+    class sha256_fingerprint : public fingerprint
+    {
+    public:
+
+        explicit sha256_fingerprint(const key& secret);
+
+        std::uint32_t operator()(
+            std::uint32_t seconds, std::uint32_t fractional) const override;
+
+        std::unique_ptr<const fingerprint> rekey(const key& secret) const override;
+
+    private:
+
+        // hash state after the key has been processed
+        CryptoPP::SHA256 keyed_;
+    };
+}
+
+#endif // FINGERPRINT_HPP
@@ -0,0 +1,156 @@
+//
+// histogram.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace sntp
+{
+    constexpr unsigned histogram::sub_bucket_bits;
+    constexpr unsigned histogram::sub_buckets;
+    constexpr unsigned histogram::bucket_count;
+
+    histogram::histogram() :
+        buckets_(),
+        count_(0),
+        minimum_(std::numeric_limits<std::uint64_t>::max()),
+        maximum_(0)
+    {
+        for (std::atomic<std::uint64_t>& bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    histogram::histogram(const histogram& other) :
+        histogram()
+    {
+        merge(other);
+    }
+
+    histogram& histogram::operator=(const histogram& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            merge(other);
+        }
+        return *this;
+    }
+
+    unsigned histogram::index(const std::uint64_t value)
+    {
+        if (value < sub_buckets)
+        {
+            return unsigned(value);
+        }
+
+        // The bits after the most significant select the linear bucket
+        const unsigned shift = 63 - __builtin_clzll(value) - sub_bucket_bits;
+        return (shift + 1) * sub_buckets + unsigned(value >> shift) - sub_buckets;
+    }
+
+    std::uint64_t histogram::highest_value(const unsigned index)
+    {
+        if (index < sub_buckets * 2)
+        {
+            return index;
+        }
+
+        const unsigned shift = index / sub_buckets - 1;
+        const std::uint64_t mantissa = sub_buckets + index % sub_buckets;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    void histogram::record(const std::uint64_t value)
+    {
+        add(buckets_[index(value)], 1);
+        add(count_, 1);
+        if (value < minimum_.load(std::memory_order_relaxed))
+        {
+            minimum_.store(value, std::memory_order_relaxed);
+        }
+        if (maximum_.load(std::memory_order_relaxed) < value)
+        {
+            maximum_.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void histogram::merge(const histogram& other)
+    {
+        for (unsigned bucket = 0; bucket < bucket_count; ++bucket)
+        {
+            add(buckets_[bucket], other.buckets_[bucket].load(std::memory_order_relaxed));
+        }
+        add(count_, other.count());
+        minimum_.store(
+            std::min(
+                minimum_.load(std::memory_order_relaxed),
+                other.minimum_.load(std::memory_order_relaxed)),
+            std::memory_order_relaxed);
+        maximum_.store(
+            std::max(maximum(), other.maximum()), std::memory_order_relaxed);
+    }
+
+    void histogram::clear()
+    {
+        for (std::atomic<std::uint64_t>& bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        minimum_.store(
+            std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+        maximum_.store(0, std::memory_order_relaxed);
+    }
+
+    std::uint64_t histogram::minimum() const
+    {
+        return count() == 0 ? 0 : minimum_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t histogram::percentile(const double fraction) const
+    {
+        // The count is not read separately, since it can be updated while
+        // the buckets are read.
+        std::array<std::uint64_t, bucket_count> counts;
+        std::uint64_t total = 0;
+        for (unsigned bucket = 0; bucket < bucket_count; ++bucket)
+        {
+            counts[bucket] = buckets_[bucket].load(std::memory_order_relaxed);
+            total += counts[bucket];
+        }
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        const double clamped = std::min(1.0, std::max(0.0, fraction));
+        const std::uint64_t rank = std::max<std::uint64_t>(
+            1, std::uint64_t(std::ceil(clamped * double(total))));
+
+        const std::uint64_t largest = maximum();
+        std::uint64_t seen = 0;
+        for (unsigned bucket = 0; bucket < bucket_count; ++bucket)
+        {
+            seen += counts[bucket];
+            if (rank <= seen)
+            {
+                return std::min(highest_value(bucket), largest);
+            }
+        }
+
+        return largest;
+    }
+}
@@ -0,0 +1,87 @@
+//
+// histogram.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sntp
+{
+    // Fixed size histogram of 64-bit values (i.e. nanoseconds). Each power
+    // of two is split into 16 linear buckets, so values below 32 are exact
+    // and larger values are within 1/16 (6.25%). Recording never allocates.
+    // Only one thread may record or clear, but any thread can read (or merge
+    // from) the histogram while values are recorded. Per-thread histograms
+    // are merged on read.
+    class histogram
+    {
+    public:
+
+        histogram();
+        histogram(const histogram& other);
+        histogram& operator=(const histogram& other);
+
+        // Recording thread only
+        void record(std::uint64_t value);
+
+        // Add all values recorded by other
+        void merge(const histogram& other);
+
+        // Recording thread only
+        void clear();
+
+        std::uint64_t count() const
+        {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        // Zero if no values are recorded
+        std::uint64_t minimum() const;
+
+        std::uint64_t maximum() const
+        {
+            return maximum_.load(std::memory_order_relaxed);
+        }
+
+        // Smallest value that is greater than or equal to fraction (0.0 -
+        // 1.0) of the recorded values, within the precision of the buckets.
+        // Zero if no values are recorded.
+        std::uint64_t percentile(double fraction) const;
+
+    private:
+
+        static constexpr unsigned sub_bucket_bits = 4;
+        static constexpr unsigned sub_buckets = 1 << sub_bucket_bits;
+        static constexpr unsigned bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+        static unsigned index(std::uint64_t value);
+        static std::uint64_t highest_value(unsigned index);
+
+        // Single writer, so no read-modify-write instruction is needed
+        static void add(std::atomic<std::uint64_t>& value, const std::uint64_t amount)
+        {
+            value.store(
+                value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+        }
+
+    private:
+
+        std::array<std::atomic<std::uint64_t>, bucket_count> buckets_;
+        std::atomic<std::uint64_t> count_;
+        std::atomic<std::uint64_t> minimum_;
+        std::atomic<std::uint64_t> maximum_;
+    };
+}
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,248 @@
+//
+// interleaved.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "interleaved.hpp"
+
+#include <boost/asio/error.hpp>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+
+namespace sntp
+{
+    namespace
+    {
+        const std::size_t udp_header_size = 8;
+        const std::size_t receive_timestamp_offset = 32;
+
+        std::uint64_t to_key(const timestamp& time)
+        {
+            static_assert(sizeof(time) == sizeof(std::uint64_t), "bad timestamp size");
+            std::uint64_t key = 0;
+            std::memcpy(&key, static_cast<const void*>(&time), sizeof(key));
+            return key;
+        }
+
+        // The looped datagram includes link, network, and UDP headers. The
+        // NTP response is at the end, and directly follows a UDP header whose
+        // length field covers the rest of the datagram.
+        const std::uint8_t* find_response(
+            const std::uint8_t* const data, const std::size_t length)
+        {
+            if (length < udp_header_size + packet::minimum_packet_size())
+            {
+                return nullptr;
+            }
+
+            const std::size_t last_header =
+                length - udp_header_size - packet::minimum_packet_size();
+            for (std::size_t header = last_header + 1; header != 0; --header)
+            {
+                const std::uint8_t* const udp = data + header - 1;
+                const std::size_t udp_length = (std::size_t(udp[4]) << 8) | udp[5];
+                if (udp_length == std::size_t(data + length - udp))
+                {
+                    return udp + udp_header_size;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Software transmit time of a looped datagram, if provided
+        const ::timespec* find_transmit_time(::msghdr& header)
+        {
+            const ::timespec* transmit_time = nullptr;
+            bool transmit_report = false;
+
+            for (::cmsghdr* control = CMSG_FIRSTHDR(&header);
+                 control != nullptr;
+                 control = CMSG_NXTHDR(&header, control))
+            {
+                if (control->cmsg_level == SOL_SOCKET &&
+                    control->cmsg_type == SCM_TIMESTAMPING &&
+                    sizeof(::scm_timestamping) <= control->cmsg_len - CMSG_LEN(0))
+                {
+                    transmit_time =
+                        reinterpret_cast<const ::scm_timestamping*>(
+                            CMSG_DATA(control))->ts;
+                }
+                else if (
+                    (control->cmsg_level == SOL_IP && control->cmsg_type == IP_RECVERR) ||
+                    (control->cmsg_level == SOL_IPV6 && control->cmsg_type == IPV6_RECVERR))
+                {
+                    const ::sock_extended_err* const error =
+                        reinterpret_cast<const ::sock_extended_err*>(
+                            CMSG_DATA(control));
+                    transmit_report =
+                        error->ee_errno == ENOMSG &&
+                        error->ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+                        error->ee_info == SCM_TSTAMP_SND;
+                }
+            }
+
+            if (transmit_report && transmit_time &&
+                (transmit_time->tv_sec != 0 || transmit_time->tv_nsec != 0))
+            {
+                return transmit_time;
+            }
+
+            return nullptr;
+        }
+    }
+
+    interleaved_table::interleaved_table(const std::size_t capacity) :
+        entries_(),
+        index_bits_(0)
+    {
+        while ((std::size_t(1) << index_bits_) < capacity)
+        {
+            ++index_bits_;
+        }
+        entries_.resize(std::size_t(1) << index_bits_);
+    }
+
+    std::size_t interleaved_table::index(const timestamp& receive) const
+    {
+        if (index_bits_ == 0)
+        {
+            return 0;
+        }
+
+        // Fibonacci hashing, the high bits are the best mixed
+        const std::uint64_t mixed = to_key(receive) * 0x9E3779B97F4A7C15ULL;
+        return mixed >> (64 - index_bits_);
+    }
+
+    void interleaved_table::insert(const timestamp& receive, const timestamp& transmit)
+    {
+        entry& slot = entries_[index(receive)];
+        slot.receive = receive;
+        slot.transmit = transmit;
+    }
+
+    const timestamp* interleaved_table::find(const timestamp& receive) const
+    {
+        // Basic mode clients typically send zero, as do empty entries
+        if (receive == timestamp())
+        {
+            return nullptr;
+        }
+
+        const entry& slot = entries_[index(receive)];
+        return slot.receive == receive ? &slot.transmit : nullptr;
+    }
+
+    boost::system::error_code transmit_timestamps::enable(const int socket)
+    {
+        const int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (::setsockopt(
+                socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+        {
+            return boost::system::error_code(
+                errno, boost::asio::error::get_system_category());
+        }
+
+        return boost::system::error_code();
+    }
+
+    transmit_timestamps::transmit_timestamps(const std::size_t capacity) :
+        buffers_(capacity),
+        iovecs_(capacity),
+        headers_(capacity)
+    {
+        assert(capacity != 0);
+
+        for (std::size_t index = 0; index < capacity; ++index)
+        {
+            iovecs_[index].iov_base = buffers_[index].data.data();
+            iovecs_[index].iov_len = buffers_[index].data.size();
+
+            ::msghdr& header = headers_[index].msg_hdr;
+            header = ::msghdr();
+            header.msg_iov = &iovecs_[index];
+            header.msg_iovlen = 1;
+            header.msg_control = buffers_[index].control;
+        }
+    }
+
+    std::size_t transmit_timestamps::drain(
+        const int socket,
+        interleaved_table& table,
+        boost::system::error_code& error)
+    {
+        error = boost::system::error_code();
+
+        std::size_t recorded = 0;
+        while (true)
+        {
+            for (::mmsghdr& header : headers_)
+            {
+                header.msg_hdr.msg_controllen = sizeof(datagram_buffer::control);
+                header.msg_hdr.msg_flags = 0;
+                header.msg_len = 0;
+            }
+
+            const int received = ::recvmmsg(
+                socket,
+                headers_.data(),
+                headers_.size(),
+                MSG_ERRQUEUE | MSG_DONTWAIT,
+                nullptr);
+
+            if (received < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    error = boost::system::error_code(
+                        errno, boost::asio::error::get_system_category());
+                }
+                break;
+            }
+
+            for (int index = 0; index < received; ++index)
+            {
+                ::mmsghdr& looped = headers_[index];
+                const ::timespec* const transmit_time =
+                    find_transmit_time(looped.msg_hdr);
+                const std::uint8_t* const response =
+                    (looped.msg_hdr.msg_flags & MSG_TRUNC) ?
+                        nullptr :
+                        find_response(buffers_[index].data.data(), looped.msg_len);
+
+                if (transmit_time && response)
+                {
+                    table.insert(
+                        timestamp_view::read(response + receive_timestamp_offset),
+                        timestamp(*transmit_time));
+                    ++recorded;
+                }
+            }
+
+            if (std::size_t(received) != headers_.size())
+            {
+                break;
+            }
+        }
+
+        return recorded;
+    }
+}
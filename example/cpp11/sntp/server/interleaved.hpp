@@ -0,0 +1,100 @@
+//
+// interleaved.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef INTERLEAVED_HPP
+#define INTERLEAVED_HPP
+
+#include <array>
+#include <boost/system/error_code.hpp>
+#include <cstdint>
+#include <sys/socket.h>
+#include <vector>
+
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    // Maps the receive timestamp of each response to the time the kernel
+    // actually transmitted the response. A client in NTPv4 interleaved mode
+    // echoes the receive timestamp as the originate timestamp of its next
+    // request. The table is direct-mapped with a fixed size, so newer
+    // entries replace older ones. Not thread-safe, each worker owns a table.
+    class interleaved_table
+    {
+    public:
+
+        // Capacity is rounded up to a power of two
+        explicit interleaved_table(std::size_t capacity);
+
+        std::size_t capacity() const
+        {
+            return entries_.size();
+        }
+
+        // Record the transmit time of the response with this receive timestamp
+        void insert(const timestamp& receive, const timestamp& transmit);
+
+        // Find the transmit time of the response with this receive
+        // timestamp. nullptr is returned if unknown.
+        const timestamp* find(const timestamp& receive) const;
+
+    private:
+
+        struct entry
+        {
+            timestamp receive;
+            timestamp transmit;
+        };
+
+        std::size_t index(const timestamp& receive) const;
+
+    private:
+
+        std::vector<entry> entries_;
+        unsigned index_bits_;
+    };
+
+    // Reads software transmit timestamps from the error queue of a socket.
+    // The kernel returns a copy of each sent datagram with the time it was
+    // handed to the network device.
+    class transmit_timestamps
+    {
+    public:
+
+        // Enable SO_TIMESTAMPING software transmit timestamps
+        static boost::system::error_code enable(int socket);
+
+        // Read at most capacity timestamps per system call
+        explicit transmit_timestamps(std::size_t capacity);
+
+        transmit_timestamps(const transmit_timestamps&) = delete;
+        transmit_timestamps& operator=(const transmit_timestamps&) = delete;
+
+        // Read every queued transmit timestamp without blocking, and
+        // record each in table. Returns the number recorded.
+        std::size_t drain(
+            int socket, interleaved_table& table, boost::system::error_code& error);
+
+    private:
+
+        // Headers of the looped datagram, and the NTP response
+        struct datagram_buffer
+        {
+            std::array<std::uint8_t, 256> data;
+            alignas(::cmsghdr) std::uint8_t control[256];
+        };
+
+        std::vector<datagram_buffer> buffers_;
+        std::vector<::iovec> iovecs_;
+        std::vector<::mmsghdr> headers_;
+    };
+}
+
+#endif // INTERLEAVED_HPP
@@ -0,0 +1,430 @@
+//
+// nts.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "nts.hpp"
+
+#include <algorithm>
+#include <boost/algorithm/hex.hpp>
+#include <cassert>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <time.h>
+
+#include "packet.hpp"
+
+namespace sntp
+{
+    namespace nts
+    {
+        namespace
+        {
+            // Type and length of an extension field (RFC 7822)
+            const std::size_t field_header_size = extension_field::header_size;
+
+            const std::size_t minimum_unique_identifier = 32;
+
+            // Nonce length and ciphertext length of the authenticator
+            const std::size_t authenticator_header_size = 4;
+
+            const std::size_t cookie_field_size = field_header_size + cookie_keys::cookie_size;
+
+            // Authenticator of a response, without the cookies
+            const std::size_t authenticator_overhead =
+                field_header_size + authenticator_header_size +
+                nonce_sequence::nonce_size + aes_siv::tag_size;
+
+            const char cookie_label[] = "NTS cookie";
+
+            std::uint16_t read_short(const std::uint8_t* const bytes)
+            {
+                return std::uint16_t((bytes[0] << 8) | bytes[1]);
+            }
+
+            void write_short(std::uint8_t* const bytes, const std::size_t value)
+            {
+                bytes[0] = std::uint8_t(value >> 8);
+                bytes[1] = std::uint8_t(value);
+            }
+
+            void write_long(std::uint8_t* const bytes, const std::uint32_t value)
+            {
+                bytes[0] = std::uint8_t(value >> 24);
+                bytes[1] = std::uint8_t(value >> 16);
+                bytes[2] = std::uint8_t(value >> 8);
+                bytes[3] = std::uint8_t(value);
+            }
+
+            std::size_t padded(const std::size_t length)
+            {
+                return (length + 3) & ~std::size_t(3);
+            }
+
+            void write_field_header(
+                std::uint8_t* const data, const std::uint16_t type, const std::size_t size)
+            {
+                write_short(data, type);
+                write_short(data + 2, size);
+            }
+        }
+
+        constexpr std::size_t nonce_sequence::nonce_size;
+
+        nonce_sequence::nonce_sequence() :
+            prefix_(),
+            counter_(0)
+        {
+            const fingerprint::key random = fingerprint::random_key();
+            std::memcpy(prefix_.data(), random.data(), prefix_.size());
+        }
+
+        void nonce_sequence::next(std::uint8_t* const nonce)
+        {
+            std::memcpy(nonce, prefix_.data(), prefix_.size());
+            const std::uint64_t count = counter_++;
+            for (std::size_t byte = 0; byte < sizeof(count); ++byte)
+            {
+                nonce[prefix_.size() + byte] = std::uint8_t(count >> (byte * 8));
+            }
+        }
+
+        fingerprint::key load_master_key(std::istream& in)
+        {
+            std::string encoded;
+            std::string extra;
+            if (!(in >> encoded) || (in >> extra))
+            {
+                throw std::runtime_error("NTS master key file must contain one key");
+            }
+
+            fingerprint::key master;
+            if (encoded.size() != master.size() * 2)
+            {
+                throw std::runtime_error("NTS master key must be 32 hex digits");
+            }
+
+            try
+            {
+                boost::algorithm::unhex(encoded.begin(), encoded.end(), master.begin());
+            }
+            catch (const boost::algorithm::hex_decode_error&)
+            {
+                throw std::runtime_error("NTS master key must be 32 hex digits");
+            }
+            return master;
+        }
+
+        constexpr std::size_t cookie_keys::cookie_size;
+
+        cookie_keys::cached_key::cached_key() :
+            period(0),
+            key(std::array<std::uint8_t, aes_siv::key_size>().data())
+        {
+        }
+
+        cookie_keys::cookie_keys(
+            const fingerprint::key& master, const std::uint32_t rotation_seconds) :
+            master_(master.data()),
+            rotation_(rotation_seconds),
+            cache_(),
+            nonces_()
+        {
+            static_assert(
+                sizeof(master) == cmac_aes128::key_size, "master key must be an AES key");
+            static_assert(
+                sizeof(session_keys) == aes_siv::key_size * 2, "session keys are not packed");
+            assert(rotation_seconds != 0);
+        }
+
+        void cookie_keys::make(
+            const session_keys& keys, const std::uint64_t seconds, std::uint8_t* const cookie)
+        {
+            const std::uint64_t period = seconds / rotation_;
+            write_long(cookie, std::uint32_t(period));
+
+            std::uint8_t* const nonce = cookie + 4;
+            nonces_.next(nonce);
+
+            // The period is authenticated as associated data
+            period_key(period).seal(
+                cookie,
+                4,
+                nonce,
+                nonce_sequence::nonce_size,
+                reinterpret_cast<const std::uint8_t*>(&keys),
+                sizeof(keys),
+                nonce + nonce_sequence::nonce_size);
+        }
+
+        bool cookie_keys::open(
+            const std::uint8_t* const cookie,
+            const std::size_t length,
+            const std::uint64_t seconds,
+            session_keys& keys)
+        {
+            if (length != cookie_size)
+            {
+                return false;
+            }
+
+            // Cookies carry the low 32 bits of the period
+            const std::uint64_t current = seconds / rotation_;
+            const std::uint32_t age =
+                std::uint32_t(current) - ((std::uint32_t(cookie[0]) << 24) |
+                                          (std::uint32_t(cookie[1]) << 16) |
+                                          (std::uint32_t(cookie[2]) << 8) |
+                                          std::uint32_t(cookie[3]));
+            const bool next_period = age == std::uint32_t(-1);
+            if (age > 2 && !next_period)
+            {
+                return false;
+            }
+
+            const std::uint8_t* const nonce = cookie + 4;
+            return period_key(next_period ? current + 1 : current - age).open(
+                cookie,
+                4,
+                nonce,
+                nonce_sequence::nonce_size,
+                nonce + nonce_sequence::nonce_size,
+                aes_siv::tag_size + sizeof(keys),
+                reinterpret_cast<std::uint8_t*>(&keys));
+        }
+
+        std::uint64_t cookie_keys::now()
+        {
+            ::timespec current;
+            ::clock_gettime(CLOCK_REALTIME_COARSE, &current);
+            return std::uint64_t(current.tv_sec);
+        }
+
+        const aes_siv& cookie_keys::period_key(const std::uint64_t period)
+        {
+            cached_key& cached = cache_[period % cache_.size()];
+            if (cached.period != period + 1)
+            {
+                // Two CMAC blocks of [counter] || label || 0 || [period] || [256]
+                std::array<std::uint8_t, aes_siv::key_size> key;
+                for (std::uint32_t counter = 1; counter <= 2; ++counter)
+                {
+                    std::array<std::uint8_t, 4> number;
+                    cmac_aes128::stream derived(master_);
+
+                    write_long(number.data(), counter);
+                    derived.update(number.data(), number.size());
+                    derived.update(
+                        reinterpret_cast<const std::uint8_t*>(cookie_label), sizeof(cookie_label));
+                    write_long(number.data(), std::uint32_t(period));
+                    derived.update(number.data(), number.size());
+                    write_long(number.data(), aes_siv::key_size * 8);
+                    derived.update(number.data(), number.size());
+
+                    const packet::digest block = derived.final();
+                    std::memcpy(
+                        key.data() + (counter - 1) * block.size(), block.data(), block.size());
+                }
+
+                cached.key.set_key(key.data());
+                cached.period = period + 1;
+            }
+            return cached.key;
+        }
+
+        constexpr std::size_t responder::maximum_cookies;
+
+        responder::responder(
+            const fingerprint::key& master, const std::uint32_t rotation_seconds) :
+            cookies_(master, rotation_seconds),
+            nonces_(),
+            seconds_(0)
+        {
+        }
+
+        responder::status responder::verify(
+            std::uint8_t* const datagram, const extension_fields& fields, request& state)
+        {
+            if (fields.empty())
+            {
+                return status::not_nts;
+            }
+
+            // Fields in the datagram, null if missing
+            const std::uint8_t* unique_identifier = nullptr;
+            const std::uint8_t* cookie = nullptr;
+            const std::uint8_t* authenticator = nullptr;
+            std::size_t cookie_size = 0;
+            std::size_t authenticator_size = 0;
+            std::size_t placeholders = 0;
+
+            for (const extension_field extension : fields)
+            {
+                // Fields after the authenticator are not authenticated
+                if (authenticator)
+                {
+                    return status::invalid;
+                }
+
+                switch (extension.type())
+                {
+                case field::unique_identifier:
+                    if (unique_identifier ||
+                        extension.body_size() < minimum_unique_identifier)
+                    {
+                        return status::invalid;
+                    }
+                    unique_identifier = extension.data();
+                    state.unique_identifier_size = extension.size();
+                    break;
+
+                case field::cookie:
+                    if (cookie)
+                    {
+                        return status::invalid;
+                    }
+                    cookie = extension.data();
+                    cookie_size = extension.size();
+                    break;
+
+                case field::cookie_placeholder:
+                    placeholders += extension.size() == cookie_field_size;
+                    break;
+
+                case field::authenticator:
+                    authenticator = extension.data();
+                    authenticator_size = extension.size();
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+            if (!unique_identifier && !cookie && !authenticator)
+            {
+                return status::not_nts;
+            }
+            if (!unique_identifier || !cookie || !authenticator || fields.mac_size() != 0)
+            {
+                return status::invalid;
+            }
+            state.unique_identifier = unique_identifier - datagram;
+
+            // The authenticator is last, and covers everything before it
+            const std::size_t associated = authenticator - datagram;
+            const std::size_t length = associated + authenticator_size;
+
+            seconds_ = cookie_keys::now();
+            if (!cookies_.open(
+                    cookie + field_header_size,
+                    cookie_size - field_header_size,
+                    seconds_,
+                    state.keys))
+            {
+                return status::nak;
+            }
+
+            // Nonce length, ciphertext length, nonce, ciphertext, each
+            // padded to 4 bytes
+            std::uint8_t* const body = datagram + associated + field_header_size;
+            const std::size_t nonce_length = read_short(body);
+            const std::size_t sealed_length = read_short(body + 2);
+            if (nonce_length < nonce_sequence::nonce_size ||
+                sealed_length < aes_siv::tag_size ||
+                authenticator_size - field_header_size <
+                    authenticator_header_size + padded(nonce_length) + padded(sealed_length))
+            {
+                return status::invalid;
+            }
+
+            const std::uint8_t* const nonce = body + authenticator_header_size;
+            std::uint8_t* const sealed = body + authenticator_header_size + padded(nonce_length);
+            std::uint8_t* const plaintext = sealed + aes_siv::tag_size;
+            const aes_siv client_key(state.keys.client_to_server.data());
+            if (!client_key.open(
+                    datagram, associated, nonce, nonce_length, sealed, sealed_length, plaintext))
+            {
+                return status::nak;
+            }
+
+            const extension_fields encrypted(plaintext, sealed_length - aes_siv::tag_size);
+            if (!encrypted.valid())
+            {
+                return status::invalid;
+            }
+
+            for (const extension_field extension : encrypted)
+            {
+                placeholders +=
+                    extension.type() == field::cookie_placeholder &&
+                    extension.size() == cookie_field_size;
+            }
+
+            // One cookie replaces the one used, and one more for each
+            // placeholder, as long as the response is not larger than the
+            // request. The request has at least one cookie and an
+            // authenticator as large as the response overhead.
+            const std::size_t fixed =
+                packet::minimum_packet_size() +
+                state.unique_identifier_size +
+                authenticator_overhead;
+            state.cookies = std::min(
+                std::min(placeholders + 1, maximum_cookies),
+                (length - fixed) / cookie_field_size);
+            assert(state.cookies != 0);
+            return status::valid;
+        }
+
+        std::size_t responder::seal(std::uint8_t* const datagram, const request& state)
+        {
+            const std::size_t authenticator = nak(datagram, state);
+            const std::size_t plaintext_length = state.cookies * cookie_field_size;
+            const std::size_t size = authenticator_overhead + plaintext_length;
+
+            std::uint8_t* const field = datagram + authenticator;
+            write_field_header(field, field::authenticator, size);
+            write_short(field + field_header_size, nonce_sequence::nonce_size);
+            write_short(field + field_header_size + 2, aes_siv::tag_size + plaintext_length);
+
+            std::uint8_t* const nonce = field + field_header_size + authenticator_header_size;
+            std::uint8_t* const sealed = nonce + nonce_sequence::nonce_size;
+            std::uint8_t* const plaintext = sealed + aes_siv::tag_size;
+            nonces_.next(nonce);
+
+            for (std::size_t index = 0; index < state.cookies; ++index)
+            {
+                std::uint8_t* const cookie = plaintext + index * cookie_field_size;
+                write_field_header(cookie, field::cookie, cookie_field_size);
+                cookies_.make(state.keys, seconds_, cookie + field_header_size);
+            }
+
+            const aes_siv server_key(state.keys.server_to_client.data());
+            server_key.seal(
+                datagram,
+                authenticator,
+                nonce,
+                nonce_sequence::nonce_size,
+                plaintext,
+                plaintext_length,
+                sealed);
+            return authenticator + size;
+        }
+
+        std::size_t responder::nak(std::uint8_t* const datagram, const request& state)
+        {
+            // The unique identifier directly follows the header
+            std::memmove(
+                datagram + packet::minimum_packet_size(),
+                datagram + state.unique_identifier,
+                state.unique_identifier_size);
+            return packet::minimum_packet_size() + state.unique_identifier_size;
+        }
+    }
+}
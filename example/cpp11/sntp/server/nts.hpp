@@ -0,0 +1,183 @@
+//
+// nts.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NTS_HPP
+#define NTS_HPP
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+
+#include "authentication.hpp"
+#include "extension.hpp"
+#include "fingerprint.hpp"
+
+namespace sntp
+{
+    // Network Time Security for NTP (RFC 8915 section 5). Only the NTP side
+    // is implemented, sessions are established by a separate NTS-KE server
+    // that shares the cookie master secret.
+    namespace nts
+    {
+        // Extension field types
+        namespace field
+        {
+            constexpr std::uint16_t unique_identifier = 0x0104;
+            constexpr std::uint16_t cookie = 0x0204;
+            constexpr std::uint16_t cookie_placeholder = 0x0304;
+            constexpr std::uint16_t authenticator = 0x0404;
+        }
+
+        // AEAD_AES_SIV_CMAC_256 keys of a session, exported by NTS-KE
+        struct session_keys
+        {
+            std::array<std::uint8_t, aes_siv::key_size> client_to_server;
+            std::array<std::uint8_t, aes_siv::key_size> server_to_client;
+        };
+
+        // Unique nonces: a random prefix followed by a counter
+        class nonce_sequence
+        {
+        public:
+
+            static constexpr std::size_t nonce_size = 16;
+
+            nonce_sequence();
+
+            void next(std::uint8_t* nonce);
+
+        private:
+
+            std::array<std::uint8_t, 8> prefix_;
+            std::uint64_t counter_;
+        };
+
+        // Read a master secret of 32 hex digits. std::runtime_error is
+        // thrown if the input is not a single key.
+        fingerprint::key load_master_key(std::istream& in);
+
+        // Seals session keys into stateless cookies. The sealing key of
+        // each rotation period is derived from the master secret and the
+        // period number (NIST SP 800-108 counter mode KDF with CMAC), so
+        // every worker and the NTS-KE server use the same keys without
+        // sharing any state. Cookies from the two previous periods, and
+        // the next period (clock skew with NTS-KE), are accepted.
+        //
+        // The expanded keys are cached, not thread-safe; each worker owns
+        // an instance.
+        class cookie_keys
+        {
+        public:
+
+            // period || nonce || synthetic IV || sealed session keys
+            static constexpr std::size_t cookie_size =
+                4 + nonce_sequence::nonce_size + aes_siv::tag_size + sizeof(session_keys);
+
+            cookie_keys(const fingerprint::key& master, std::uint32_t rotation_seconds);
+
+            cookie_keys(const cookie_keys&) = delete;
+            cookie_keys& operator=(const cookie_keys&) = delete;
+
+            // Write a cookie of cookie_size bytes, sealed with the key of
+            // the period at seconds
+            void make(const session_keys& keys, std::uint64_t seconds, std::uint8_t* cookie);
+
+            // False if the cookie is not from an accepted period, or is not
+            // authentic
+            bool open(
+                const std::uint8_t* cookie,
+                std::size_t length,
+                std::uint64_t seconds,
+                session_keys& keys);
+
+            // Coarse realtime clock in seconds. Periods must agree with the
+            // NTS-KE server, so a monotonic clock cannot be used.
+            static std::uint64_t now();
+
+        private:
+
+            struct cached_key
+            {
+                cached_key();
+
+                std::uint64_t period;   // plus one, zero when empty
+                aes_siv key;
+            };
+
+            const aes_siv& period_key(std::uint64_t period);
+
+        private:
+
+            const cmac_aes128 master_;
+            const std::uint64_t rotation_;
+            std::array<cached_key, 4> cache_;
+            nonce_sequence nonces_;
+        };
+
+        // Answers NTS protected requests in place, in the receive buffer.
+        // verify() checks a request, the caller fills the NTP header, and
+        // seal() or nak() then writes the extension fields. A response is
+        // never larger than its request. Never allocates; not thread-safe,
+        // each worker owns an instance.
+        class responder
+        {
+        public:
+
+            enum class status : std::uint8_t
+            {
+                not_nts,    // no NTS extension fields
+                valid,
+                nak,        // cookie or authenticator rejected, answer "NTSN"
+                invalid     // malformed, drop
+            };
+
+            // Kept from verify() for seal() or nak()
+            struct request
+            {
+                session_keys keys;
+                std::size_t unique_identifier;      // offset of the field
+                std::size_t unique_identifier_size; // including its header
+                std::size_t cookies;                // to return
+            };
+
+            // Cookies returned in one response at most
+            static constexpr std::size_t maximum_cookies = 8;
+
+            responder(const fingerprint::key& master, std::uint32_t rotation_seconds);
+
+            // Check the extension fields of a request, and decrypt its
+            // cookie. The encrypted extension fields are decrypted in place.
+            status verify(
+                std::uint8_t* datagram, const extension_fields& fields, request& state);
+
+            // Append the unique identifier and an authenticator with fresh
+            // cookies to a filled header. Returns the response size.
+            std::size_t seal(std::uint8_t* datagram, const request& state);
+
+            // Append the unique identifier to a "NTSN" Kiss-o'-Death header.
+            // Returns the response size.
+            std::size_t nak(std::uint8_t* datagram, const request& state);
+
+            // Also used to issue the first cookies of a session (NTS-KE)
+            cookie_keys& cookies()
+            {
+                return cookies_;
+            }
+
+        private:
+
+            cookie_keys cookies_;
+            nonce_sequence nonces_;
+            std::uint64_t seconds_; // clock read by the last verify()
+        };
+    }
+}
+
+#endif // NTS_HPP
@@ -10,34 +10,16 @@
 
 #include "packet.hpp"
 
-#include <boost/range/algorithm/copy.hpp>
+#include <boost/asio/detail/socket_ops.hpp>
+
+#include "packet_view.hpp"
 
 namespace sntp
 {
     namespace
     {
-        const std::uint8_t version_mask = 0x38;
-        const std::uint8_t mode_mask = 0x07;
-
-        const std::uint8_t alarm_condition = 0xC0;
         const std::uint8_t version = 0x20;
-        const std::uint8_t client = 0x03;
         const std::uint8_t server = 0x04;
-
-        const std::uint8_t primary_reference = 1;
-        const std::uint8_t sixty_four_second_poll_interval = 6;
-        const std::array<std::uint8_t, 4> uncalibrated_local_clock = {{'L', 'O', 'C', 'L'}};
-
-        constexpr bool version_check(const std::uint8_t flags)
-        {
-            return (flags & version_mask) == version;
-        }
-
-        constexpr bool mode_check(const std::uint8_t flags)
-        {
-            const std::uint8_t mode = flags & mode_mask;
-            return mode == client || mode == server;
-        }
     }
 
     packet::packet() :
@@ -59,31 +41,39 @@ namespace sntp
 
     bool packet::fill_server_values()
     {
-        if (version_check(flags_) &&
-            mode_check(flags_) &&
-            !transmit_.from_server())
-        {
-            receive_ = timestamp::now();
+        return packet_view(*this).fill_server_values();
+    }
+
+    bool packet::fill_server_values(const timestamp& current)
+    {
+        return packet_view(*this).fill_server_values(current);
+    }
+
+    bool packet::fill_server_values(
+        const timestamp& received, const timestamp& transmit)
+    {
+        return packet_view(*this).fill_server_values(received, transmit);
+    }
+
+    bool packet::fill_interleaved_server_values(
+        const timestamp& received, const timestamp& previous_transmit)
+    {
+        return packet_view(*this).fill_interleaved_server_values(received, previous_transmit);
+    }
 
-            flags_ = alarm_condition | version | server;
-            stratum_ = primary_reference;
-            poll_ = sixty_four_second_poll_interval;
-            precision_ = timestamp::precision();
-            delay_ = 0;
-            dispersion_ = 0;
-            {
-                static_assert(
-                    sizeof(identifier_) == uncalibrated_local_clock.size(),
-                    "size mismatch");
-                boost::range::copy(uncalibrated_local_clock, identifier_.begin());
-            }
-            reference_ = timestamp();
-            originate_ = transmit_;
+    bool packet::fill_kiss_of_death(const std::array<std::uint8_t, 4>& code)
+    {
+        return packet_view(*this).fill_kiss_of_death(code);
+    }
 
-            transmit_ = timestamp::now();
-            return true;
-        }
+    std::uint32_t packet::key_identifier() const
+    {
+        return boost::asio::detail::socket_ops::network_to_host_long(key_identifier_);
+    }
 
-        return false;
+    packet::rejection packet::check_request() const
+    {
+        // the view is only read
+        return packet_view(const_cast<packet&>(*this)).check_request();
     }
 }
@@ -14,34 +14,61 @@
 #include <array>
 #include <boost/asio/buffer.hpp>
 #include <cstdint>
-#include <memory>
 #include <type_traits>
 
 #include "timestamp.hpp"
 
 namespace sntp
 {
+    // Kiss-o'-Death codes (RFC 5905 section 7.4), sent as the reference id
+    namespace kiss_code
+    {
+        constexpr std::array<std::uint8_t, 4> rate = {{'R', 'A', 'T', 'E'}};
+
+        // NTS cookie or authenticator rejected (RFC 8915 section 5.7)
+        constexpr std::array<std::uint8_t, 4> nts_negative = {{'N', 'T', 'S', 'N'}};
+    }
+
     class packet
     {
     public:
 
-        // Allocate a default initialized NTP packet
-        static std::shared_ptr<packet> allocate()
-        {
-            return std::make_shared<packet>();
-        }
-
         // Minimum size for a NTP packet
         static constexpr std::size_t minimum_packet_size()
         {
             return sizeof(packet) - sizeof(packet::key_identifier_) - sizeof(packet::digest_);
         }
 
-        // Initialize a packet with precision -20, in server mode,
-        // with version 4. All other fields are zeroed.
+        // Size of a NTP packet with a MAC (key identifier and 16 byte digest)
+        static constexpr std::size_t authenticated_packet_size()
+        {
+            return sizeof(packet);
+        }
+
+        // Largest datagram received, room for a request with extension
+        // fields (RFC 7822) such as NTS. A packet object only holds the
+        // header and MAC; larger datagrams need their own storage.
+        static constexpr std::size_t maximum_datagram_size()
+        {
+            return 1024;
+        }
+
+        using digest = std::array<std::uint8_t, 16>;
+
+        // Reasons a request is not answered
+        enum class rejection : std::uint8_t
+        {
+            none,
+            bad_version,
+            bad_mode,
+            looped      // transmit timestamp is from this server
+        };
+
+        // Initialize a packet with the timestamp::precision() setting, in
+        // server mode, with version 4. All other fields are zeroed.
         packet();
 
-        // Get the buffer for reading
+        // Get the buffer for reading, without extension fields
         auto get_receive_buffer()
         {
             return boost::asio::buffer(this, sizeof(packet));
@@ -53,10 +80,75 @@ namespace sntp
             return boost::asio::buffer(this, minimum_packet_size());
         }
 
+        // Get the buffer for writing, including the MAC if authenticated
+        auto get_send_buffer(const bool authenticated) const
+        {
+            return boost::asio::buffer(
+                this, authenticated ? authenticated_packet_size() : minimum_packet_size());
+        }
+
         // Update packet with values needed by client. False is returned
         // if packet appears to have come from server.
         bool fill_server_values();
 
+        // Same as fill_server_values(), except the receive and transmit
+        // timestamps are both set to current. This saves a clock read.
+        bool fill_server_values(const timestamp& current);
+
+        // Same as fill_server_values(), except the receive and transmit
+        // timestamps are provided (i.e. receive time from the kernel).
+        bool fill_server_values(const timestamp& received, const timestamp& transmit);
+
+        // Update packet with values needed by a client in NTPv4 interleaved
+        // mode. The originate timestamp is set to the receive timestamp of
+        // the request, and the transmit timestamp is the (more accurate)
+        // transmit time of the previous response to the client.
+        bool fill_interleaved_server_values(
+            const timestamp& received, const timestamp& previous_transmit);
+
+        // Turn a valid request into a Kiss-o'-Death response with the
+        // given code. No time is included, the receive and transmit
+        // timestamps echo the transmit timestamp of the request. False is
+        // returned if fill_server_values() would reject the packet.
+        bool fill_kiss_of_death(const std::array<std::uint8_t, 4>& code);
+
+        // Reason fill_server_values() rejects this packet, or
+        // rejection::none if it is a valid request. A rejected packet is
+        // left unmodified, so this can be called after a failed fill.
+        rejection check_request() const;
+
+        // Originate timestamp field
+        const timestamp& originate() const
+        {
+            return originate_;
+        }
+
+        // Receive timestamp field
+        const timestamp& receive() const
+        {
+            return receive_;
+        }
+
+        // Key identifier of the MAC, in host byte order
+        std::uint32_t key_identifier() const;
+
+        // Digest of the MAC
+        const digest& get_digest() const
+        {
+            return digest_;
+        }
+
+        void set_digest(const digest& value)
+        {
+            digest_ = value;
+        }
+
+    private:
+
+        // The fill functions are implemented by a view of the packet, so
+        // they are shared with packets processed in place
+        friend class packet_view;
+
     private:
 
         std::uint8_t flags_;
@@ -83,12 +175,13 @@ namespace sntp
 
         std::uint32_t key_identifier_;
 
-        std::array<std::uint8_t, 16> digest_;
+        digest digest_;
     };
 
-//    static_assert(std::is_trivially_copyable<packet>::value, "packet must be pod");
+    static_assert(std::is_trivially_copyable<packet>::value, "packet must be pod");
     static_assert(packet::minimum_packet_size() <= sizeof(packet), "bad min packet size");
     static_assert(sizeof(packet) == sizeof(std::uint32_t) * 17, "invalid packet size");
+    static_assert(packet::authenticated_packet_size() <= packet::maximum_datagram_size(), "bad max datagram size");
 }
 
 #endif // PACKET_HPP
@@ -0,0 +1,27 @@
+//
+// packet_pool.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "packet_pool.hpp"
+
+namespace sntp
+{
+    packet_pool::packet_pool(const std::size_t capacity) :
+        slots_(capacity),
+        available_(),
+        exhausted_(0)
+    {
+        // Hand out the lowest addresses first
+        available_.reserve(capacity);
+        for (auto slot = slots_.rbegin(); slot != slots_.rend(); ++slot)
+        {
+            available_.push_back(&slot->value);
+        }
+    }
+}
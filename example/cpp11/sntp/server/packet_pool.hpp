@@ -0,0 +1,130 @@
+//
+// packet_pool.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef PACKET_POOL_HPP
+#define PACKET_POOL_HPP
+
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace sntp
+{
+    // Fixed number of packets that are recycled instead of freed. Each
+    // packet starts on its own cache line, and is followed by room for
+    // extension fields up to packet::maximum_datagram_size(). The pool is
+    // not thread-safe, every worker thread should own a pool. The pool must
+    // outlive all handles it has given out.
+    class packet_pool
+    {
+    public:
+
+        static constexpr std::size_t cache_line_size = 64;
+
+        // Returns packets to the pool
+        class releaser
+        {
+        public:
+
+            explicit releaser(packet_pool* const pool = nullptr) :
+                pool_(pool)
+            {
+            }
+
+            void operator()(packet* const released) const
+            {
+                pool_->release(released);
+            }
+
+        private:
+            packet_pool* pool_;
+        };
+
+        using handle = std::unique_ptr<packet, releaser>;
+
+        // Construct all capacity packets up front
+        explicit packet_pool(std::size_t capacity);
+
+        packet_pool(const packet_pool&) = delete;
+        packet_pool& operator=(const packet_pool&) = delete;
+
+        // Retrieve a packet from the pool. Packets are NOT re-initialized
+        // and contain data from previous use. An empty handle is returned
+        // if every packet is in use.
+        handle allocate()
+        {
+            if (available_.empty())
+            {
+                ++exhausted_;
+                return handle(nullptr, releaser(this));
+            }
+
+            packet* const next = available_.back();
+            available_.pop_back();
+            return handle(next, releaser(this));
+        }
+
+        // Total number of packets owned by the pool
+        std::size_t capacity() const
+        {
+            return slots_.size();
+        }
+
+        // Number of packets not currently in use
+        std::size_t available() const
+        {
+            return available_.size();
+        }
+
+        // Buffer for reading a datagram into a pool packet, including any
+        // extension fields
+        static boost::asio::mutable_buffer get_receive_buffer(packet& pooled)
+        {
+            return boost::asio::buffer(&pooled, packet::maximum_datagram_size());
+        }
+
+        // Bytes of a pool packet, for the extension fields after the header
+        static std::uint8_t* get_datagram(packet& pooled)
+        {
+            return reinterpret_cast<std::uint8_t*>(&pooled);
+        }
+
+        // Number of times allocate() failed
+        std::uint64_t exhausted() const
+        {
+            return exhausted_;
+        }
+
+    private:
+
+        struct alignas(cache_line_size) slot
+        {
+            packet value;
+            std::uint8_t extension_fields[packet::maximum_datagram_size() - sizeof(packet)];
+        };
+
+        void release(packet* const released)
+        {
+            available_.push_back(released);
+        }
+
+    private:
+
+        std::vector<slot, boost::alignment::aligned_allocator<slot, cache_line_size>> slots_;
+        std::vector<packet*> available_;
+        std::uint64_t exhausted_;
+    };
+}
+
+#endif // PACKET_POOL_HPP
@@ -0,0 +1,230 @@
+//
+// packet_view.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "packet_view.hpp"
+
+#include <boost/asio/detail/socket_ops.hpp>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#include "server_state.hpp"
+
+namespace sntp
+{
+    namespace
+    {
+        const std::uint8_t version_mask = 0x38;
+        const std::uint8_t mode_mask = 0x07;
+
+        const std::uint8_t ntp_version = 0x20;
+        const std::uint8_t client = 0x03;
+        const std::uint8_t server = 0x04;
+
+        const std::uint8_t kiss_of_death = 0;
+
+        constexpr bool version_check(const std::uint8_t flags)
+        {
+            return (flags & version_mask) == ntp_version;
+        }
+
+        constexpr bool mode_check(const std::uint8_t flags)
+        {
+            const std::uint8_t mode = flags & mode_mask;
+            return mode == client || mode == server;
+        }
+    }
+
+    constexpr std::size_t packet_view::stratum_offset;
+    constexpr std::size_t packet_view::precision_offset;
+    constexpr std::size_t packet_view::root_delay_offset;
+    constexpr std::size_t packet_view::root_dispersion_offset;
+    constexpr std::size_t packet_view::identifier_offset;
+    constexpr std::size_t packet_view::reference_offset;
+    constexpr std::size_t packet_view::originate_offset;
+    constexpr std::size_t packet_view::receive_offset;
+    constexpr std::size_t packet_view::transmit_offset;
+    constexpr std::size_t packet_view::key_identifier_offset;
+    constexpr std::size_t packet_view::digest_offset;
+
+    packet_view::packet_view(std::uint8_t* const datagram, const std::size_t length) :
+        bytes_(datagram),
+        length_(length),
+        mac_size_(0)
+    {
+        assert(packet::minimum_packet_size() <= length);
+
+        // A remainder of either size is always a MAC, never a field
+        const std::size_t remaining = length - packet::minimum_packet_size();
+        if (remaining == extension_fields::short_mac_size ||
+            remaining == extension_fields::long_mac_size)
+        {
+            mac_size_ = remaining;
+        }
+    }
+
+    packet_view::packet_view(packet& whole) :
+        bytes_(reinterpret_cast<std::uint8_t*>(&whole)),
+        length_(sizeof(packet)),
+        mac_size_(extension_fields::short_mac_size)
+    {
+        static_assert(
+            sizeof(packet) - packet::minimum_packet_size() == extension_fields::short_mac_size,
+            "packet MAC is not a short MAC");
+        static_assert(std::is_standard_layout<packet>::value, "packet layout is not fixed");
+        static_assert(offsetof(packet, identifier_) == identifier_offset, "bad layout");
+        static_assert(offsetof(packet, reference_) == reference_offset, "bad layout");
+        static_assert(offsetof(packet, originate_) == originate_offset, "bad layout");
+        static_assert(offsetof(packet, receive_) == receive_offset, "bad layout");
+        static_assert(offsetof(packet, transmit_) == transmit_offset, "bad layout");
+        static_assert(offsetof(packet, key_identifier_) == key_identifier_offset, "bad layout");
+        static_assert(offsetof(packet, digest_) == digest_offset, "bad layout");
+    }
+
+    std::uint8_t packet_view::mode() const
+    {
+        return bytes_[0] & mode_mask;
+    }
+
+    std::uint8_t packet_view::version() const
+    {
+        return (bytes_[0] & version_mask) >> 3;
+    }
+
+    std::uint32_t packet_view::root_delay() const
+    {
+        std::uint32_t delay = 0;
+        std::memcpy(&delay, bytes_ + root_delay_offset, sizeof(delay));
+        return boost::asio::detail::socket_ops::network_to_host_long(delay);
+    }
+
+    std::uint32_t packet_view::root_dispersion() const
+    {
+        std::uint32_t dispersion = 0;
+        std::memcpy(&dispersion, bytes_ + root_dispersion_offset, sizeof(dispersion));
+        return boost::asio::detail::socket_ops::network_to_host_long(dispersion);
+    }
+
+    std::array<std::uint8_t, 4> packet_view::identifier() const
+    {
+        std::array<std::uint8_t, 4> code;
+        std::memcpy(code.data(), bytes_ + identifier_offset, code.size());
+        return code;
+    }
+
+    std::uint32_t packet_view::key_identifier() const
+    {
+        assert(has_mac());
+        std::uint32_t identifier = 0;
+        std::memcpy(&identifier, bytes_ + key_identifier_offset, sizeof(identifier));
+        return boost::asio::detail::socket_ops::network_to_host_long(identifier);
+    }
+
+    std::size_t packet_view::digest_size() const
+    {
+        assert(has_mac());
+        return mac_size_ - (digest_offset - key_identifier_offset);
+    }
+
+    std::uint8_t* packet_view::digest() const
+    {
+        assert(has_mac());
+        return bytes_ + digest_offset;
+    }
+
+    bool packet_view::fill_server_values() const
+    {
+        if (valid_request())
+        {
+            receive().store(timestamp::now());
+            fill_response();
+            transmit().store(timestamp::now());
+            return true;
+        }
+
+        return false;
+    }
+
+    bool packet_view::fill_server_values(const timestamp& current) const
+    {
+        return fill_server_values(current, current);
+    }
+
+    bool packet_view::fill_server_values(
+        const timestamp& received, const timestamp& transmitted) const
+    {
+        if (valid_request())
+        {
+            receive().store(received);
+            fill_response();
+            transmit().store(transmitted);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool packet_view::fill_interleaved_server_values(
+        const timestamp& received, const timestamp& previous_transmit) const
+    {
+        if (valid_request())
+        {
+            const timestamp request_receive = receive().load();
+            receive().store(received);
+            fill_response();
+            originate().store(request_receive);
+            transmit().store(previous_transmit);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool packet_view::fill_kiss_of_death(const std::array<std::uint8_t, 4>& code) const
+    {
+        if (valid_request())
+        {
+            fill_response();
+            bytes_[stratum_offset] = kiss_of_death;
+            std::memcpy(bytes_ + identifier_offset, code.data(), code.size());
+            receive().assign(transmit());
+            return true;
+        }
+
+        return false;
+    }
+
+    packet::rejection packet_view::check_request() const
+    {
+        if (!version_check(bytes_[0]))
+        {
+            return packet::rejection::bad_version;
+        }
+
+        if (!mode_check(bytes_[0]))
+        {
+            return packet::rejection::bad_mode;
+        }
+
+        if (transmit().load().from_server())
+        {
+            return packet::rejection::looped;
+        }
+
+        return packet::rejection::none;
+    }
+
+    void packet_view::fill_response() const
+    {
+        const server_state::header header = server_state::response_header();
+        std::memcpy(bytes_, header.data(), header.size());
+        originate().assign(transmit());
+    }
+}
@@ -0,0 +1,205 @@
+//
+// packet_view.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef PACKET_VIEW_HPP
+#define PACKET_VIEW_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "extension.hpp"
+#include "packet.hpp"
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    // A timestamp in place, 8 bytes in network byte order with no
+    // alignment requirement. Non-owning, like packet_view.
+    class timestamp_view
+    {
+    public:
+
+        explicit timestamp_view(std::uint8_t* const bytes) :
+            bytes_(bytes)
+        {
+        }
+
+        // Copy of a timestamp in a read-only buffer
+        static timestamp read(const std::uint8_t* const bytes)
+        {
+            timestamp value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+
+        timestamp load() const
+        {
+            return read(bytes_);
+        }
+
+        void store(const timestamp& value) const
+        {
+            std::memcpy(bytes_, &value, sizeof(value));
+        }
+
+        // Copy another timestamp field without converting it
+        void assign(const timestamp_view& other) const
+        {
+            std::memmove(bytes_, other.bytes_, sizeof(timestamp));
+        }
+
+        std::uint8_t* data() const
+        {
+            return bytes_;
+        }
+
+    private:
+        std::uint8_t* bytes_;
+    };
+
+    // Reads and writes the fields of a NTP packet where it was received,
+    // in a batch, ring, or mapped buffer, without copying it into a packet
+    // object. packet uses the same implementation over its own bytes.
+    // Non-owning; the bytes must outlive the view. Like a pointer, the
+    // view being const does not make the bytes const.
+    class packet_view
+    {
+    public:
+
+        // A datagram of length bytes, at least packet::minimum_packet_size()
+        packet_view(std::uint8_t* datagram, std::size_t length);
+
+        // Every byte of a packet object, including the MAC
+        explicit packet_view(packet& whole);
+
+        std::uint8_t* data() const
+        {
+            return bytes_;
+        }
+
+        // Length of the datagram
+        std::size_t size() const
+        {
+            return length_;
+        }
+
+        std::uint8_t mode() const;
+        std::uint8_t version() const;
+
+        // Leap indicator, 3 when the clock is unsynchronized
+        std::uint8_t leap() const
+        {
+            return bytes_[0] >> 6;
+        }
+
+        std::uint8_t stratum() const
+        {
+            return bytes_[stratum_offset];
+        }
+
+        // Log2 seconds
+        std::int8_t precision() const
+        {
+            return std::int8_t(bytes_[precision_offset]);
+        }
+
+        // In NTP short format (16.16 fixed point seconds), host byte order
+        std::uint32_t root_delay() const;
+        std::uint32_t root_dispersion() const;
+
+        // Reference id, or the Kiss-o'-Death code
+        std::array<std::uint8_t, 4> identifier() const;
+
+        timestamp_view reference() const
+        {
+            return timestamp_view(bytes_ + reference_offset);
+        }
+
+        timestamp_view originate() const
+        {
+            return timestamp_view(bytes_ + originate_offset);
+        }
+
+        timestamp_view receive() const
+        {
+            return timestamp_view(bytes_ + receive_offset);
+        }
+
+        timestamp_view transmit() const
+        {
+            return timestamp_view(bytes_ + transmit_offset);
+        }
+
+        // Size of a MAC directly following the header, as
+        // extension_fields::parse finds it: 20 bytes for a 16 byte digest,
+        // 24 bytes for a 20 byte digest, or zero if there is none. A MAC
+        // after extension fields is not found.
+        std::size_t mac_size() const
+        {
+            return mac_size_;
+        }
+
+        bool has_mac() const
+        {
+            return mac_size_ != 0;
+        }
+
+        // Key identifier of the MAC, in host byte order. has_mac() must be
+        // true.
+        std::uint32_t key_identifier() const;
+
+        // Size of the digest of the MAC. has_mac() must be true.
+        std::size_t digest_size() const;
+
+        // Digest of the MAC, in place. has_mac() must be true.
+        std::uint8_t* digest() const;
+
+        // See the packet functions of the same names
+        bool fill_server_values() const;
+        bool fill_server_values(const timestamp& current) const;
+        bool fill_server_values(const timestamp& received, const timestamp& transmit) const;
+        bool fill_interleaved_server_values(
+            const timestamp& received, const timestamp& previous_transmit) const;
+        bool fill_kiss_of_death(const std::array<std::uint8_t, 4>& code) const;
+        packet::rejection check_request() const;
+
+    private:
+
+        static constexpr std::size_t stratum_offset = 1;
+        static constexpr std::size_t precision_offset = 3;
+        static constexpr std::size_t root_delay_offset = 4;
+        static constexpr std::size_t root_dispersion_offset = 8;
+        static constexpr std::size_t identifier_offset = 12;
+        static constexpr std::size_t reference_offset = 16;
+        static constexpr std::size_t originate_offset = 24;
+        static constexpr std::size_t receive_offset = 32;
+        static constexpr std::size_t transmit_offset = 40;
+        static constexpr std::size_t key_identifier_offset = 48;
+        static constexpr std::size_t digest_offset = 52;
+
+        bool valid_request() const
+        {
+            return check_request() == packet::rejection::none;
+        }
+
+        // Set every field except the receive and transmit timestamps, from
+        // the published server_state
+        void fill_response() const;
+
+    private:
+
+        std::uint8_t* bytes_;
+        std::size_t length_;
+        std::size_t mac_size_;
+    };
+}
+
+#endif // PACKET_VIEW_HPP
@@ -0,0 +1,121 @@
+//
+// rate_limit.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "rate_limit.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <netinet/in.h>
+#include <time.h>
+
+namespace sntp
+{
+    namespace
+    {
+        std::size_t round_up_power_of_two(const std::size_t value)
+        {
+            std::size_t rounded = 1;
+            while (rounded < value)
+            {
+                rounded <<= 1;
+            }
+            return rounded;
+        }
+    }
+
+    constexpr std::size_t rate_limiter::set_size;
+
+    rate_limiter::rate_limiter(
+        const std::size_t capacity,
+        const std::uint32_t interval_milliseconds,
+        const std::uint32_t burst,
+        const bool kiss_of_death) :
+        sets_(round_up_power_of_two((capacity + set_size - 1) / set_size)),
+        hash_(fingerprint::random_key()),
+        interval_(interval_milliseconds),
+        tolerance_(std::uint64_t(std::max<std::uint32_t>(burst, 1) - 1) * interval_milliseconds),
+        over_limit_(kiss_of_death ? action::kiss_of_death : action::drop)
+    {
+        assert(interval_milliseconds != 0);
+    }
+
+    rate_limiter::action rate_limiter::check(
+        const ::sockaddr& source, const std::uint64_t milliseconds)
+    {
+        std::uint64_t hashed = 0;
+        if (!hash(source, hashed))
+        {
+            return action::answer;
+        }
+
+        set& candidates = sets_[hashed & (sets_.size() - 1)];
+        entry* least_active = &candidates.entries.front();
+        for (entry& current : candidates.entries)
+        {
+            if (current.source == hashed)
+            {
+                // Each request moves the next conforming time one interval
+                // later. A source is over the limit once that time is more
+                // than burst - 1 intervals away.
+                const std::uint64_t next_request =
+                    std::max(current.next_request, milliseconds);
+                if (milliseconds + tolerance_ < next_request)
+                {
+                    return over_limit_;
+                }
+
+                current.next_request = next_request + interval_;
+                return action::answer;
+            }
+
+            if (current.next_request < least_active->next_request)
+            {
+                least_active = &current;
+            }
+        }
+
+        least_active->source = hashed;
+        least_active->next_request = milliseconds + interval_;
+        return action::answer;
+    }
+
+    std::uint64_t rate_limiter::now()
+    {
+        ::timespec current;
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &current);
+        return std::uint64_t(current.tv_sec) * 1000 + std::uint64_t(current.tv_nsec) / 1000000;
+    }
+
+    bool rate_limiter::hash(const ::sockaddr& source, std::uint64_t& hashed) const
+    {
+        std::uint64_t message = 0;
+        switch (source.sa_family)
+        {
+        case AF_INET:
+        {
+            const ::sockaddr_in& address = reinterpret_cast<const ::sockaddr_in&>(source);
+            message = (std::uint64_t(AF_INET) << 32) | address.sin_addr.s_addr;
+            break;
+        }
+        case AF_INET6:
+        {
+            const ::sockaddr_in6& address = reinterpret_cast<const ::sockaddr_in6&>(source);
+            std::memcpy(&message, address.sin6_addr.s6_addr, sizeof(message));
+            break;
+        }
+        default:
+            return false;
+        }
+
+        hashed = hash_.hash(message);
+        return true;
+    }
+}
@@ -0,0 +1,106 @@
+//
+// rate_limit.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef RATE_LIMIT_HPP
+#define RATE_LIMIT_HPP
+
+#include <array>
+#include <boost/align/aligned_allocator.hpp>
+#include <cstdint>
+#include <sys/socket.h>
+#include <vector>
+
+#include "fingerprint.hpp"
+
+namespace sntp
+{
+    // Limits the request rate of each source address. A source may send
+    // burst requests at once, and then one request per interval on average
+    // (GCRA, a token bucket that stores a single time). IPv6 sources are
+    // limited by /64 prefix.
+    //
+    // Sources are kept in a fixed size table of cache line sized sets, each
+    // with four entries. A new source replaces the least recently active
+    // entry of its set, so memory is bounded regardless of the number of
+    // sources. The set is chosen by a keyed hash, so remote hosts cannot
+    // aim at the set of another source. Not thread-safe, each worker owns a
+    // limiter.
+    class rate_limiter
+    {
+    public:
+
+        // What to do with a request from a source over the limit
+        enum class action : std::uint8_t
+        {
+            answer,
+            kiss_of_death,  // answer with a "RATE" Kiss-o'-Death
+            drop
+        };
+
+        // Capacity is rounded up to a power of two, and at least one set
+        rate_limiter(
+            std::size_t capacity,
+            std::uint32_t interval_milliseconds,
+            std::uint32_t burst,
+            bool kiss_of_death);
+
+        rate_limiter(const rate_limiter&) = delete;
+        rate_limiter& operator=(const rate_limiter&) = delete;
+
+        // Maximum number of sources tracked
+        std::size_t capacity() const
+        {
+            return sets_.size() * set_size;
+        }
+
+        // Account for a request from source. AF_INET and AF_INET6 are
+        // limited, other address families are always answered.
+        action check(const ::sockaddr& source)
+        {
+            return check(source, now());
+        }
+
+        // Same as check(source), at a specific time in milliseconds
+        action check(const ::sockaddr& source, std::uint64_t milliseconds);
+
+        // Coarse monotonic clock in milliseconds
+        static std::uint64_t now();
+
+    private:
+
+        static constexpr std::size_t set_size = 4;
+
+        struct entry
+        {
+            std::uint64_t source;       // keyed hash of the address
+            std::uint64_t next_request; // GCRA theoretical arrival time
+        };
+
+        struct alignas(64) set
+        {
+            std::array<entry, set_size> entries;
+        };
+
+        static_assert(sizeof(set) == 64, "set must fill one cache line");
+
+        // False if the address family is not limited
+        bool hash(const ::sockaddr& source, std::uint64_t& hashed) const;
+
+    private:
+
+        std::vector<set, boost::alignment::aligned_allocator<set, 64>> sets_;
+        siphash_fingerprint hash_;
+        const std::uint64_t interval_;
+        const std::uint64_t tolerance_;
+        const action over_limit_;
+    };
+}
+
+#endif // RATE_LIMIT_HPP
@@ -0,0 +1,35 @@
+//
+// request_pipeline.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "request_pipeline.hpp"
+
+namespace sntp
+{
+    void fill_response(
+        const response_kernel& kernel,
+        const packet_view& request,
+        const ::timespec* const receive_time,
+        const bool share_clock_read)
+    {
+        response_kernel::response response;
+        response.datagram = request.data();
+        if (receive_time)
+        {
+            response.received = timestamp(*receive_time);
+            response.transmit = timestamp::now();
+        }
+        else
+        {
+            response.received = timestamp::now();
+            response.transmit = share_clock_read ? response.received : timestamp::now();
+        }
+        kernel.fill_responses(&response, 1);
+    }
+}
@@ -0,0 +1,203 @@
+//
+// request_pipeline.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef REQUEST_PIPELINE_HPP
+#define REQUEST_PIPELINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "authentication.hpp"
+#include "extension.hpp"
+#include "nts.hpp"
+#include "packet.hpp"
+#include "packet_view.hpp"
+#include "rate_limit.hpp"
+#include "response_kernel.hpp"
+#include "stats.hpp"
+
+namespace sntp
+{
+    // The objects of a worker that requests are checked against, and
+    // counted in. Each is optional.
+    struct worker_context
+    {
+        const key_table* keys = nullptr;
+        rate_limiter* limiter = nullptr;
+        nts::responder* nts = nullptr;
+        worker_stats* stats = nullptr;
+
+        // Start of the processing (worker_stats::now()), if the engine
+        // already read the clock for the request. Zero to read it after
+        // the request passes check_request. Only used when stats are timed.
+        std::uint64_t start = 0;
+
+        // Where the end of the processing is stored for answered requests,
+        // so the engine can reuse the clock read
+        std::uint64_t* end = nullptr;
+    };
+
+    // Fill the server values of a request that passed check_request. The
+    // receive timestamp is the kernel arrival time if given, otherwise the
+    // current time, which is also used for the transmit timestamp if
+    // share_clock_read is set.
+    void fill_response(
+        const response_kernel& kernel,
+        const packet_view& request,
+        const ::timespec* receive_time,
+        bool share_clock_read);
+
+    // Decide on a request, and fill (and sign or seal) its response in
+    // place. Every engine answers requests with this, so they all drop,
+    // limit, and count the same way:
+    //
+    //  - Malformed extension fields, and requests rejected by
+    //    check_request, are dropped before using rate limit credit or a MAC
+    //    or NTS check. The engine passes the rejection, so a batch can
+    //    check its requests together.
+    //  - Sources over the rate limit are dropped, or get a "RATE"
+    //    Kiss-o'-Death, which is not signed.
+    //  - NTS requests are verified and sealed, or get a "NTSN"
+    //    Kiss-o'-Death. Malformed ones are dropped.
+    //  - Requests with a MAC are verified, and signed with a digest of the
+    //    same size. An invalid MAC, or a MAC after extension fields, which
+    //    is not checked, is dropped.
+    //
+    // fill(request, deferrable) fills the server values. deferrable is true
+    // when nothing (a MAC or NTS) depends on the response yet, so a batch
+    // can wait to fill it with the rest. Returns the size of the response,
+    // or zero if the request is dropped. With timed stats, the processing
+    // time of answered requests is recorded, except for Kiss-o'-Death
+    // responses.
+    template<typename Fill>
+    std::size_t accept_request(
+        const packet_view& request,
+        const packet::rejection rejection,
+        const ::sockaddr& source,
+        const worker_context& context,
+        Fill&& fill)
+    {
+        using counter = worker_stats::counter;
+        const auto count = [&context](const counter which)
+        {
+            if (context.stats)
+            {
+                context.stats->increment(which);
+            }
+        };
+
+        std::uint8_t* const datagram = request.data();
+        const extension_fields fields = extension_fields::parse(datagram, request.size());
+        if (!fields.valid())
+        {
+            count(counter::bad_extension);
+            return 0;
+        }
+
+        if (rejection != packet::rejection::none)
+        {
+            if (context.stats)
+            {
+                context.stats->reject(rejection);
+            }
+            return 0;
+        }
+
+        const rate_limiter::action action = context.limiter ?
+            context.limiter->check(source) : rate_limiter::action::answer;
+
+        if (action == rate_limiter::action::drop)
+        {
+            count(counter::rate_limited);
+            return 0;
+        }
+
+        if (action == rate_limiter::action::kiss_of_death)
+        {
+            request.fill_kiss_of_death(kiss_code::rate);
+            count(counter::kiss_of_death);
+            return packet::minimum_packet_size();
+        }
+
+        const bool timed = context.stats && context.stats->timed();
+        const std::uint64_t start = !timed ? 0 :
+            context.start ? context.start : worker_stats::now();
+        std::size_t response_size = packet::minimum_packet_size();
+
+        nts::responder::request session;
+        const nts::responder::status nts_status = context.nts ?
+            context.nts->verify(datagram, fields, session) :
+            nts::responder::status::not_nts;
+
+        if (nts_status == nts::responder::status::invalid)
+        {
+            count(counter::bad_mac);
+            return 0;
+        }
+
+        if (nts_status != nts::responder::status::not_nts)
+        {
+            const bool nak = nts_status == nts::responder::status::nak;
+            if (nak)
+            {
+                request.fill_kiss_of_death(kiss_code::nts_negative);
+            }
+            else
+            {
+                fill(request, false);
+            }
+
+            response_size = nak ?
+                context.nts->nak(datagram, session) : context.nts->seal(datagram, session);
+            count(nak ? counter::nts_nak : counter::nts);
+        }
+        else
+        {
+            if (context.keys && fields.mac_size() != request.mac_size())
+            {
+                count(counter::bad_mac);
+                return 0;
+            }
+
+            const key_table::verification verification = context.keys ?
+                context.keys->verify(request) : key_table::verification::unauthenticated;
+
+            if (verification == key_table::verification::invalid)
+            {
+                count(counter::bad_mac);
+                return 0;
+            }
+
+            const bool signing = verification == key_table::verification::valid;
+            fill(request, !signing);
+
+            if (signing && context.keys->sign(request))
+            {
+                response_size = packet::minimum_packet_size() + request.mac_size();
+                count(counter::authenticated);
+            }
+        }
+
+        if (timed)
+        {
+            const std::uint64_t end = worker_stats::now();
+            context.stats->record_processing(start, end);
+            if (context.end)
+            {
+                *context.end = end;
+            }
+        }
+        return response_size;
+    }
+}
+
+#endif // REQUEST_PIPELINE_HPP
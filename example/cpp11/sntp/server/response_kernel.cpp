@@ -0,0 +1,376 @@
+//
+// response_kernel.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "response_kernel.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstring>
+
+#include "packet_view.hpp"
+#include "server_state.hpp"
+
+// The vector versions are compiled for their instruction set with function
+// attributes, and selected at runtime, so the build needs no -m flags.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SNTP_RESPONSE_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+namespace sntp
+{
+    namespace
+    {
+        const std::uint8_t version_mask = 0x38;
+        const std::uint8_t mode_mask = 0x07;
+        const std::uint8_t version = 0x20;
+        const std::uint8_t client = 0x03;
+        const std::uint8_t server = 0x04;
+
+        const std::size_t transmit_offset = 40;
+
+        using response_header = server_state::header;
+
+        packet::rejection check_flags(const std::uint8_t flags)
+        {
+            if ((flags & version_mask) != version)
+            {
+                return packet::rejection::bad_version;
+            }
+
+            const std::uint8_t mode = flags & mode_mask;
+            if (mode != client && mode != server)
+            {
+                return packet::rejection::bad_mode;
+            }
+
+            return packet::rejection::none;
+        }
+
+        void check_flags_scalar(
+            const std::uint8_t* const datagrams,
+            const std::size_t stride,
+            const std::size_t count,
+            packet::rejection* const results)
+        {
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                results[index] = check_flags(datagrams[index * stride]);
+            }
+        }
+
+        void fill_scalar(
+            const response_header& header,
+            const response_kernel::response* const responses,
+            const std::size_t count)
+        {
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                const response_kernel::response& current = responses[index];
+                std::uint8_t* const datagram = current.datagram;
+
+                std::memcpy(datagram + 24, datagram + transmit_offset, sizeof(timestamp));
+                std::memcpy(datagram, header.data(), header.size());
+                std::memcpy(datagram + 32, &current.received, sizeof(timestamp));
+                std::memcpy(datagram + 40, &current.transmit, sizeof(timestamp));
+            }
+        }
+
+#ifdef SNTP_RESPONSE_KERNEL_X86
+        // Rejection codes of 16 flag bytes: bad_version where the
+        // version differs, otherwise bad_mode where the mode is not client
+        // or server, otherwise none.
+        __m128i classify(const __m128i flags)
+        {
+            const __m128i version_ok = _mm_cmpeq_epi8(
+                _mm_and_si128(flags, _mm_set1_epi8(version_mask)), _mm_set1_epi8(version));
+            const __m128i mode = _mm_and_si128(flags, _mm_set1_epi8(mode_mask));
+            const __m128i mode_ok = _mm_or_si128(
+                _mm_cmpeq_epi8(mode, _mm_set1_epi8(client)),
+                _mm_cmpeq_epi8(mode, _mm_set1_epi8(server)));
+
+            const __m128i bad_version = _mm_set1_epi8(
+                std::uint8_t(packet::rejection::bad_version));
+            const __m128i bad_mode = _mm_set1_epi8(
+                std::uint8_t(packet::rejection::bad_mode));
+            return _mm_or_si128(
+                _mm_andnot_si128(version_ok, bad_version),
+                _mm_and_si128(version_ok, _mm_andnot_si128(mode_ok, bad_mode)));
+        }
+
+        void check_flags_sse2(
+            const std::uint8_t* const datagrams,
+            const std::size_t stride,
+            const std::size_t count,
+            packet::rejection* const results)
+        {
+            static_assert(sizeof(packet::rejection) == 1, "rejection is not a byte");
+
+            // SSE2 has no gather, the flags are collected first
+            alignas(16) std::uint8_t flags[16];
+
+            std::size_t index = 0;
+            for (; index + 16 <= count; index += 16)
+            {
+                for (std::size_t lane = 0; lane < 16; ++lane)
+                {
+                    flags[lane] = datagrams[(index + lane) * stride];
+                }
+
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i*>(results + index),
+                    classify(_mm_load_si128(reinterpret_cast<const __m128i*>(flags))));
+            }
+
+            check_flags_scalar(
+                datagrams + index * stride, stride, count - index, results + index);
+        }
+
+        __attribute__((target("avx2")))
+        void check_flags_avx2(
+            const std::uint8_t* const datagrams,
+            const std::size_t stride,
+            const std::size_t count,
+            packet::rejection* const results)
+        {
+            // Eight 32-bit gathers per step; the flags are the first byte
+            // of each, and every datagram has at least 4 bytes. The lane
+            // offsets are 32-bit.
+            const std::size_t gathered_count =
+                stride <= std::size_t(INT32_MAX / 8) ? count - count % 8 : 0;
+            const int lane_stride = int(stride);
+            const __m256i offsets = _mm256_mullo_epi32(
+                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(lane_stride));
+
+            // First byte of each 32-bit lane, into the low 8 bytes
+            const __m256i first_bytes = _mm256_setr_epi8(
+                0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+            const __m256i low_dwords = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+
+            std::size_t index = 0;
+            for (; index < gathered_count; index += 8)
+            {
+                const __m256i gathered = _mm256_i32gather_epi32(
+                    reinterpret_cast<const int*>(datagrams + index * stride), offsets, 1);
+                const __m256i packed = _mm256_permutevar8x32_epi32(
+                    _mm256_shuffle_epi8(gathered, first_bytes), low_dwords);
+
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i*>(results + index),
+                    classify(_mm256_castsi256_si128(packed)));
+            }
+
+            check_flags_scalar(
+                datagrams + index * stride, stride, count - index, results + index);
+        }
+
+        // Bytes 16 - 31 of a response: the reference timestamp of the
+        // header, then the request transmit timestamp as the originate
+        // timestamp
+        __m128i reference_and_originate(
+            const __m128i reference, const std::uint8_t* const datagram)
+        {
+            return _mm_unpacklo_epi64(
+                reference,
+                _mm_loadl_epi64(
+                    reinterpret_cast<const __m128i*>(datagram + transmit_offset)));
+        }
+
+        __m128i receive_and_transmit(const response_kernel::response& current)
+        {
+            return _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&current.received)),
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&current.transmit)));
+        }
+
+        void fill_sse2(
+            const response_header& header,
+            const response_kernel::response* const responses,
+            const std::size_t count)
+        {
+            const __m128i first = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(header.data()));
+            const __m128i reference = _mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(header.data() + 16));
+
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                const response_kernel::response& current = responses[index];
+                __m128i* const datagram = reinterpret_cast<__m128i*>(current.datagram);
+
+                const __m128i second = reference_and_originate(reference, current.datagram);
+                _mm_storeu_si128(datagram, first);
+                _mm_storeu_si128(datagram + 1, second);
+                _mm_storeu_si128(datagram + 2, receive_and_transmit(current));
+            }
+        }
+
+        __attribute__((target("avx2")))
+        void fill_avx2(
+            const response_header& header,
+            const response_kernel::response* const responses,
+            const std::size_t count)
+        {
+            const __m128i first = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(header.data()));
+            const __m128i reference = _mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(header.data() + 16));
+
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                const response_kernel::response& current = responses[index];
+                std::uint8_t* const datagram = current.datagram;
+
+                const __m256i start = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(first), reference_and_originate(reference, datagram), 1);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(datagram), start);
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i*>(datagram + 32), receive_and_transmit(current));
+            }
+        }
+#endif // SNTP_RESPONSE_KERNEL_X86
+    }
+
+    bool response_kernel::supported(const instruction_set isa)
+    {
+        switch (isa)
+        {
+        case instruction_set::scalar:
+            return true;
+#ifdef SNTP_RESPONSE_KERNEL_X86
+        case instruction_set::sse2:
+            return true;    // part of x86-64
+        case instruction_set::avx2:
+            return __builtin_cpu_supports("avx2");
+#else
+        default:
+            break;
+#endif
+        }
+
+        return false;
+    }
+
+    response_kernel::instruction_set response_kernel::detect()
+    {
+        for (const instruction_set isa : {instruction_set::avx2, instruction_set::sse2})
+        {
+            if (supported(isa))
+            {
+                return isa;
+            }
+        }
+        return instruction_set::scalar;
+    }
+
+    const char* response_kernel::name(const instruction_set isa)
+    {
+        switch (isa)
+        {
+        case instruction_set::scalar:
+            return "scalar";
+        case instruction_set::sse2:
+            return "sse2";
+        case instruction_set::avx2:
+            return "avx2";
+        }
+
+        return "unknown";
+    }
+
+    response_kernel::response_kernel(const instruction_set isa) :
+        isa_(isa)
+    {
+        assert(supported(isa));
+    }
+
+    void response_kernel::check_requests(
+        const std::uint8_t* const datagrams,
+        const std::size_t stride,
+        const std::size_t count,
+        packet::rejection* const results) const
+    {
+        assert(packet::minimum_packet_size() <= stride);
+
+        switch (isa_)
+        {
+#ifdef SNTP_RESPONSE_KERNEL_X86
+        case instruction_set::avx2:
+            check_flags_avx2(datagrams, stride, count, results);
+            break;
+        case instruction_set::sse2:
+            check_flags_sse2(datagrams, stride, count, results);
+            break;
+#endif
+        default:
+            check_flags_scalar(datagrams, stride, count, results);
+            break;
+        }
+
+        // The transmit timestamps of requests with valid flags are
+        // fingerprinted together
+        std::array<std::size_t, 64> indexes;
+        std::array<timestamp, 64> transmits;
+        std::array<bool, 64> looped;
+        std::size_t grouped = 0;
+
+        const auto check_group = [&]()
+        {
+            timestamp::from_server(transmits.data(), grouped, looped.data());
+            for (std::size_t index = 0; index < grouped; ++index)
+            {
+                if (looped[index])
+                {
+                    results[indexes[index]] = packet::rejection::looped;
+                }
+            }
+            grouped = 0;
+        };
+
+        for (std::size_t index = 0; index < count; ++index)
+        {
+            if (results[index] == packet::rejection::none)
+            {
+                indexes[grouped] = index;
+                transmits[grouped] =
+                    timestamp_view::read(datagrams + index * stride + transmit_offset);
+                if (++grouped == transmits.size())
+                {
+                    check_group();
+                }
+            }
+        }
+
+        check_group();
+    }
+
+    void response_kernel::fill_responses(
+        const response* const responses, const std::size_t count) const
+    {
+        // One read of the published state for every response
+        const response_header header = server_state::response_header();
+
+        switch (isa_)
+        {
+#ifdef SNTP_RESPONSE_KERNEL_X86
+        case instruction_set::avx2:
+            fill_avx2(header, responses, count);
+            break;
+        case instruction_set::sse2:
+            fill_sse2(header, responses, count);
+            break;
+#endif
+        default:
+            fill_scalar(header, responses, count);
+            break;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+//
+// response_kernel.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef RESPONSE_KERNEL_HPP
+#define RESPONSE_KERNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet.hpp"
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    // Checks and answers the requests of a batch together, instead of one
+    // packet_view at a time. The flags of every request are classified at
+    // once with vector instructions, and responses are written by merging
+    // the published server_state header with the timestamps in a few wide
+    // stores. The results are identical to packet_view::check_request and
+    // packet_view::fill_server_values on every instruction set.
+    class response_kernel
+    {
+    public:
+
+        enum class instruction_set : std::uint8_t
+        {
+            scalar,
+            sse2,
+            avx2
+        };
+
+        // A request that passed check_requests, and its timestamps
+        struct response
+        {
+            std::uint8_t* datagram;
+            timestamp received;
+            timestamp transmit;
+        };
+
+        // True if this build and CPU can use the instruction set
+        static bool supported(instruction_set isa);
+
+        // Best supported instruction set
+        static instruction_set detect();
+
+        static const char* name(instruction_set isa);
+
+        // isa must be supported
+        explicit response_kernel(instruction_set isa = detect());
+
+        instruction_set isa() const
+        {
+            return isa_;
+        }
+
+        // Store the packet_view::check_request result of count datagrams,
+        // stride bytes apart, in results. The flags are checked first, then
+        // the transmit timestamps of requests with valid flags are
+        // fingerprinted together (timestamp::from_server).
+        void check_requests(
+            const std::uint8_t* datagrams,
+            std::size_t stride,
+            std::size_t count,
+            packet::rejection* results) const;
+
+        // Fill count responses, as fill_server_values(received, transmit)
+        // would. The requests must have passed check_requests.
+        void fill_responses(const response* responses, std::size_t count) const;
+
+    private:
+
+        instruction_set isa_;
+    };
+}
+
+#endif // RESPONSE_KERNEL_HPP
@@ -10,80 +10,842 @@
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/detail/socket_option.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/spirit/include/qi_eoi.hpp>
 #include <boost/spirit/include/qi_parse.hpp>
 #include <boost/spirit/include/qi_sequence.hpp>
 #include <boost/spirit/include/qi_uint.hpp>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "authentication.hpp"
+#include "batch.hpp"
+#include "clock_source.hpp"
+#include "extension.hpp"
+#include "fingerprint.hpp"
+#include "interleaved.hpp"
 #include "packet.hpp"
+#include "packet_pool.hpp"
+#include "packet_view.hpp"
+#include "nts.hpp"
+#include "rate_limit.hpp"
+#include "request_pipeline.hpp"
+#include "server_state.hpp"
+#include "stats.hpp"
+#include "timestamp.hpp"
+#include "upstream.hpp"
+#include "uring.hpp"
+#include "worker_threads.hpp"
 
 namespace
 {
+    // Allows several sockets to bind the same port. The kernel spreads
+    // incoming datagrams across the sockets by source address.
+    using reuse_port =
+        boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    // Kernel attaches the arrival time (nanoseconds) to each datagram
+    using receive_timestamps =
+        boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMPNS>;
+
+    boost::asio::ip::udp::socket open_socket(
+        boost::asio::io_service& service,
+        const std::uint16_t port,
+        const bool shared)
+    {
+        const boost::asio::ip::udp::endpoint local(
+            boost::asio::ip::udp::v4(), port);
+
+        boost::asio::ip::udp::socket socket(service, local.protocol());
+        if (shared)
+        {
+            socket.set_option(reuse_port(true));
+        }
+        socket.bind(local);
+        return socket;
+    }
+
+    // Per-source request limit of each worker. Disabled if interval is zero.
+    struct rate_limit_options
+    {
+        rate_limit_options() :
+            interval(0),
+            burst(8),
+            sources(65536),
+            kiss_of_death(false)
+        {
+        }
+
+        std::uint32_t interval;     // milliseconds between requests
+        std::uint32_t burst;
+        std::size_t sources;
+        bool kiss_of_death;
+    };
+
+    // NTS cookie keys shared with the NTS-KE server. Disabled without a
+    // master key.
+    struct nts_options
+    {
+        nts_options() :
+            enabled(false),
+            master(),
+            rotation(3600)
+        {
+        }
+
+        bool enabled;
+        sntp::fingerprint::key master;
+        std::uint32_t rotation;     // seconds per cookie key
+    };
+
+    // Resources owned by a single worker thread. Created before and
+    // destroyed after the worker's io_service, because handlers destroyed
+    // by the io_service can still return packets to the pool.
+    struct worker_state
+    {
+        worker_state(
+                const std::size_t pool_size,
+                const bool share_clock_read,
+                const bool kernel_timestamps,
+                const bool timed_stats,
+                const std::size_t interleaved_size,
+                const rate_limit_options& rate_limit,
+                const sntp::key_table* const keys,
+                const nts_options& nts) :
+            pool(pool_size),
+            stats(timed_stats),
+            interleaved(
+                interleaved_size ?
+                    new sntp::interleaved_table(interleaved_size) : nullptr),
+            limiter(
+                rate_limit.interval ?
+                    new sntp::rate_limiter(
+                        rate_limit.sources,
+                        rate_limit.interval,
+                        rate_limit.burst,
+                        rate_limit.kiss_of_death) :
+                    nullptr),
+            keys(keys),
+            nts(nts.enabled ? new sntp::nts::responder(nts.master, nts.rotation) : nullptr),
+            kernel(),
+            share_clock_read(share_clock_read),
+            kernel_timestamps(kernel_timestamps)
+        {
+        }
+
+        // The objects requests are checked against, for accept_request
+        sntp::worker_context context()
+        {
+            sntp::worker_context objects;
+            objects.keys = keys;
+            objects.limiter = limiter.get();
+            objects.nts = nts.get();
+            objects.stats = &stats;
+            return objects;
+        }
+
+        sntp::packet_pool pool;
+        sntp::worker_stats stats;
+        const std::unique_ptr<sntp::interleaved_table> interleaved;
+        const std::unique_ptr<sntp::rate_limiter> limiter;
+        const sntp::key_table* const keys;     // shared by all workers
+        const std::unique_ptr<sntp::nts::responder> nts;
+        const sntp::response_kernel kernel;
+        const bool share_clock_read;
+        const bool kernel_timestamps;
+    };
+
+    // Keeps a fixed number of receive operations outstanding. Each receive
+    // operation is re-armed as soon as a request arrives, so responses
+    // being sent never stall new requests.
     struct ntp_server
     {
     public:
 
-        ntp_server(boost::asio::io_service& service, const std::uint16_t port) :
-            socket_(
-                service,
-                boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port)),
-            remote_endpoint_()
+        ntp_server(
+                boost::asio::ip::udp::socket socket,
+                worker_state& state,
+                const std::size_t depth) :
+            socket_(std::move(socket)),
+            state_(state),
+            operations_(depth)
+        {
+            for (receive_operation& operation : operations_)
+            {
+                operation.packet = state_.pool.allocate();
+                if (!operation.packet)
+                {
+                    throw std::invalid_argument(
+                        "packet pool is smaller than receive depth");
+                }
+                wait_for_request(operation);
+            }
+        }
+
+        // Requests are only handled by the io_service, stopping it is enough
+        void stop()
         {
-            wait_for_request();
         }
 
-        void wait_for_request()
+        // Run an empty handler, so an idle worker reports a
+        // timestamp::quiescent() state. Safe to call from any thread.
+        void wake()
+        {
+            boost::asio::post(socket_.get_executor(), [] {});
+        }
+
+    private:
+
+        // State for a single outstanding receive
+        struct receive_operation
+        {
+            receive_operation() :
+                packet(),
+                remote_endpoint(),
+                response_size(0),
+                start(0),
+                end(0)
+            {
+            }
+
+            sntp::packet_pool::handle packet;
+            boost::asio::ip::udp::endpoint remote_endpoint;
+            std::size_t response_size;  // header, and a MAC or NTS fields
+            std::uint64_t start;        // processing, and residence, start
+            std::uint64_t end;          // processing end, zero if not filled
+        };
+
+        void wait_for_request(receive_operation& operation)
         {
-            const auto packet = sntp::packet::allocate();
             socket_.async_receive_from(
-                packet->get_receive_buffer(),
-                remote_endpoint_,
+                sntp::packet_pool::get_receive_buffer(*operation.packet),
+                operation.remote_endpoint,
                 (
-                    [this, packet]
+                    [this, &operation]
                     (const boost::system::error_code& error, const std::size_t bytes_received)
                     {
-                        if (!error && sntp::packet::minimum_packet_size() <= bytes_received)
+                        if (!error &&
+                            this->accept_request(operation, bytes_received))
                         {
-                            this->send_response(packet);
+                            this->send_response(operation);
                         }
                         else
                         {
-                            this->wait_for_request();
+                            this->wait_for_request(operation);
                         }
                     }));
         }
 
-    private:
+        // Fill (and sign) a received request, counting the reason if it is
+        // dropped. With timed stats, the clock is read once the request
+        // passes check_request, at the start and end of its processing.
+        bool accept_request(
+            receive_operation& operation, const std::size_t bytes_received)
+        {
+            using counter = sntp::worker_stats::counter;
+            std::uint8_t* const datagram = sntp::packet_pool::get_datagram(*operation.packet);
+            state_.stats.increment(counter::received);
+
+            // A datagram that fills the buffer may have been truncated
+            if (bytes_received < sntp::packet::minimum_packet_size() ||
+                bytes_received == sntp::packet::maximum_datagram_size())
+            {
+                state_.stats.increment(counter::short_packet);
+                return false;
+            }
+
+            const sntp::packet_view request(datagram, bytes_received);
+            const sntp::packet::rejection rejection = request.check_request();
+
+            operation.start =
+                state_.stats.timed() && rejection == sntp::packet::rejection::none ?
+                    sntp::worker_stats::now() : 0;
+            operation.end = 0;
+
+            sntp::worker_context context = state_.context();
+            context.start = operation.start;
+            context.end = &operation.end;
+
+            operation.response_size = sntp::accept_request(
+                request,
+                rejection,
+                *operation.remote_endpoint.data(),
+                context,
+                [this](const sntp::packet_view& response, bool)
+                {
+                    sntp::fill_response(
+                        this->state_.kernel, response, nullptr, this->state_.share_clock_read);
+                });
+            return operation.response_size != 0;
+        }
+
+        static void count_send(
+            sntp::worker_stats& stats, const boost::system::error_code& error)
+        {
+            stats.increment(
+                error ?
+                    sntp::worker_stats::counter::send_error :
+                    sntp::worker_stats::counter::answered);
+        }
 
-        void send_response(const std::shared_ptr<sntp::packet>& response_packet)
+        // Swap in a new packet for the receive, and send the old packet
+        // as the response. If the pool is exhausted, the receive is
+        // re-armed after the send completes. With timed stats, the residence
+        // time is recorded from the start until the end of the processing;
+        // only a Kiss-o'-Death, which is not processed, reads the clock
+        // again.
+        void send_response(receive_operation& operation)
         {
-            if (response_packet->fill_server_values())
+            if (state_.stats.timed())
+            {
+                state_.stats.record_residence(
+                    operation.start,
+                    operation.end ? operation.end : sntp::worker_stats::now());
+            }
+
+            sntp::packet_pool::handle response_packet = state_.pool.allocate();
+            response_packet.swap(operation.packet);
+
+            if (operation.packet)
             {
-                // make sure to keep shared_ptr to packet active while sending data.
+                const auto send_buffer =
+                    boost::asio::buffer(response_packet.get(), operation.response_size);
                 socket_.async_send_to(
-                    response_packet->get_send_buffer(),
-                    remote_endpoint_,
-                    [this, response_packet]
-                    (const boost::system::error_code&, const std::size_t)
+                    send_buffer,
+                    operation.remote_endpoint,
+                    [&stats = state_.stats, response_packet = std::move(response_packet)]
+                    (const boost::system::error_code& error, const std::size_t)
                     {
-                        this->wait_for_request();
+                        count_send(stats, error);
                     });
+
+                wait_for_request(operation);
             }
             else
             {
-                wait_for_request();
+                state_.stats.increment(sntp::worker_stats::counter::pool_exhausted);
+                operation.packet.swap(response_packet);
+                socket_.async_send_to(
+                    boost::asio::buffer(operation.packet.get(), operation.response_size),
+                    operation.remote_endpoint,
+                    [this, &operation]
+                    (const boost::system::error_code& error, const std::size_t)
+                    {
+                        count_send(this->state_.stats, error);
+                        this->wait_for_request(operation);
+                    });
             }
         }
 
     private:
 
         boost::asio::ip::udp::socket socket_;
-        boost::asio::ip::udp::endpoint remote_endpoint_;
+        worker_state& state_;
+        std::vector<receive_operation> operations_;
     };
 
+    // Drains every waiting request with one recvmmsg call, and sends all
+    // of the responses with one sendmmsg call.
+    class batched_ntp_server
+    {
+    public:
+
+        batched_ntp_server(
+                boost::asio::ip::udp::socket socket,
+                worker_state& state,
+                const std::size_t batch_size) :
+            socket_(std::move(socket)),
+            state_(state),
+            batch_(batch_size),
+            transmit_timestamps_(batch_size)
+        {
+            if (state_.kernel_timestamps)
+            {
+                socket_.set_option(receive_timestamps(true));
+            }
+
+            socket_.non_blocking(true);
+            batch_.set_stats(&state_.stats);
+            batch_.set_rate_limiter(state_.limiter.get());
+            batch_.set_keys(state_.keys);
+            batch_.set_nts(state_.nts.get());
+            wait_for_requests();
+
+            if (state_.interleaved)
+            {
+                const boost::system::error_code error =
+                    sntp::transmit_timestamps::enable(socket_.native_handle());
+                if (error)
+                {
+                    throw boost::system::system_error(error);
+                }
+
+                batch_.set_interleaved_table(state_.interleaved.get());
+                wait_for_transmit_timestamps();
+            }
+        }
+
+        // Requests are only handled by the io_service, stopping it is enough
+        void stop()
+        {
+        }
+
+        // Run an empty handler, so an idle worker reports a
+        // timestamp::quiescent() state. Safe to call from any thread.
+        void wake()
+        {
+            boost::asio::post(socket_.get_executor(), [] {});
+        }
+
+    private:
+
+        // Transmit timestamps are read from the error queue separately from
+        // requests, so the request path never waits on them.
+        void wait_for_transmit_timestamps()
+        {
+            socket_.async_wait(
+                boost::asio::ip::udp::socket::wait_error,
+                [this](const boost::system::error_code& error)
+                {
+                    if (error != boost::asio::error::operation_aborted)
+                    {
+                        boost::system::error_code drain_error;
+                        this->transmit_timestamps_.drain(
+                            this->socket_.native_handle(),
+                            *(this->state_.interleaved),
+                            drain_error);
+
+                        this->wait_for_transmit_timestamps();
+                    }
+                });
+        }
+
+        void wait_for_requests()
+        {
+            socket_.async_receive(
+                boost::asio::null_buffers(),
+                [this](const boost::system::error_code& error, const std::size_t)
+                {
+                    if (error)
+                    {
+                        this->wait_for_requests();
+                    }
+                    else
+                    {
+                        this->receive_requests();
+                    }
+                });
+        }
+
+        void wait_for_send()
+        {
+            socket_.async_send(
+                boost::asio::null_buffers(),
+                [this](const boost::system::error_code&, const std::size_t)
+                {
+                    this->send_responses();
+                });
+        }
+
+        void receive_requests()
+        {
+            boost::system::error_code error;
+            const std::size_t received =
+                batch_.receive(socket_.native_handle(), error);
+
+            if (received == 0)
+            {
+                wait_for_requests();
+                return;
+            }
+
+            batch_.fill_server_values(state_.share_clock_read);
+            send_responses();
+        }
+
+        void send_responses()
+        {
+            boost::system::error_code error;
+            batch_.send(socket_.native_handle(), error);
+
+            if (error == boost::asio::error::would_block)
+            {
+                wait_for_send();
+            }
+            else if (batch_.capacity() == batch_.last_received())
+            {
+                // more requests are likely waiting
+                receive_requests();
+            }
+            else
+            {
+                wait_for_requests();
+            }
+        }
+
+    private:
+
+        boost::asio::ip::udp::socket socket_;
+        worker_state& state_;
+        sntp::batch batch_;
+        sntp::transmit_timestamps transmit_timestamps_;
+    };
+
+    // Receives with a multishot io_uring recvmsg into kernel selected
+    // buffers, and sends each response from the buffer of its request. The
+    // completion loop runs inside the io_service of the worker, and does not
+    // return.
+    class uring_ntp_server
+    {
+    public:
+
+        uring_ntp_server(
+                boost::asio::ip::udp::socket socket,
+                worker_state& state,
+                const std::size_t buffers) :
+            socket_(std::move(socket)),
+            server_(
+                socket_.native_handle(),
+                buffers,
+                state.share_clock_read,
+                state.kernel_timestamps)
+        {
+            if (state.kernel_timestamps)
+            {
+                socket_.set_option(receive_timestamps(true));
+            }
+
+            server_.set_stats(&state.stats);
+            server_.set_rate_limiter(state.limiter.get());
+            server_.set_keys(state.keys);
+            server_.set_nts(state.nts.get());
+            boost::asio::post(
+                socket_.get_executor(),
+                [this]
+                {
+                    this->server_.run();
+                });
+        }
+
+        // The server never returns to the io_service until stopped itself.
+        // Safe to call from any thread.
+        void stop()
+        {
+            server_.stop();
+        }
+
+        // The server is timestamp::offline() while it waits for requests
+        void wake()
+        {
+        }
+
+    private:
+
+        boost::asio::ip::udp::socket socket_;
+        sntp::uring_server server_;
+    };
+
+    enum class fingerprint_engine
+    {
+        siphash,
+        sha256
+    };
+
+    enum class clock_engine
+    {
+        realtime,
+        tsc
+    };
+
+    struct options
+    {
+        options() :
+            port(0),
+            batch_size(0),
+            uring_buffers(0),
+            depth(1),
+            pool_size(1024),
+            threads(1),
+            pin_threads(false),
+            share_clock_read(false),
+            kernel_timestamps(false),
+            timed_stats(false),
+            interleaved_size(0),
+            rate_limit(),
+            keys(),
+            nts(),
+            significant_bits(sntp::timestamp::precision::default_significant_bits),
+            fingerprint(fingerprint_engine::siphash),
+            fingerprint_rotation(3600),
+            clock(clock_engine::realtime),
+            upstreams(),
+            upstream_poll(64)
+        {
+        }
+
+        std::uint16_t port;
+        std::size_t batch_size;
+        std::size_t uring_buffers;
+        std::size_t depth;
+        std::size_t pool_size;
+        std::size_t threads;
+        bool pin_threads;
+        bool share_clock_read;
+        bool kernel_timestamps;
+        bool timed_stats;                       // residence and processing histograms
+        std::size_t interleaved_size;
+        rate_limit_options rate_limit;
+        std::shared_ptr<const sntp::key_table> keys;
+        nts_options nts;
+        unsigned significant_bits;
+        fingerprint_engine fingerprint;
+        std::uint32_t fingerprint_rotation;     // seconds, zero to never rotate
+        clock_engine clock;
+        std::vector<boost::asio::ip::udp::endpoint> upstreams;
+        std::uint32_t upstream_poll;            // seconds
+    };
+
+    // Restrict a thread to the Nth processor it is allowed to run on
+    void pin_thread(const pthread_t thread, const std::size_t index)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return;
+        }
+
+        const int count = CPU_COUNT(&allowed);
+        if (count == 0)
+        {
+            return;
+        }
+
+        int skip = index % count;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed) && skip-- == 0)
+            {
+                cpu_set_t selected;
+                CPU_ZERO(&selected);
+                CPU_SET(cpu, &selected);
+                pthread_setaffinity_np(thread, sizeof(selected), &selected);
+                return;
+            }
+        }
+    }
+
+    // Print the totals of every worker each time the signal arrives, and
+    // the upstream status when polling upstream servers
+    void report_on_signal(
+        boost::asio::signal_set& signals,
+        const std::vector<std::unique_ptr<worker_state>>& states,
+        const sntp::upstream::client* const upstream)
+    {
+        signals.async_wait(
+            [&signals, &states, upstream](const boost::system::error_code& error, int)
+            {
+                if (!error)
+                {
+                    sntp::stats_snapshot totals;
+                    for (const std::unique_ptr<worker_state>& state : states)
+                    {
+                        totals += state->stats;
+                    }
+                    std::cout << totals << std::endl;
+
+                    if (upstream)
+                    {
+                        std::cout << upstream->current() << std::endl;
+                    }
+
+                    report_on_signal(signals, states, upstream);
+                }
+            });
+    }
+
+    // Switch to a new fingerprint key every period. Loops and replays of
+    // the last two periods are still detected. Idle workers are woken, so
+    // the replaced key set can be freed by the next rotation.
+    template<typename Server>
+    void rotate_fingerprint(
+        boost::asio::steady_timer& timer,
+        const std::chrono::seconds period,
+        const std::vector<std::unique_ptr<Server>>& servers)
+    {
+        timer.expires_after(period);
+        timer.async_wait(
+            [&timer, period, &servers](const boost::system::error_code& error)
+            {
+                if (!error)
+                {
+                    sntp::timestamp::rotate_fingerprint();
+                    for (const std::unique_ptr<Server>& server : servers)
+                    {
+                        server->wake();
+                    }
+                    rotate_fingerprint(timer, period, servers);
+                }
+            });
+    }
+
+    // Each worker thread gets its own io_service, socket, and server, so
+    // nothing mutable is shared between threads while processing requests.
+    // The calling thread runs the first worker.
+    template<typename Server, typename... Args>
+    void run_workers(const options& config, const Args&... args)
+    {
+        // destruction order matters, see worker_state
+        std::vector<std::unique_ptr<worker_state>> states;
+        std::vector<std::unique_ptr<boost::asio::io_service>> services;
+        std::vector<std::unique_ptr<Server>> servers;
+
+        const bool shared = config.threads != 1;
+        for (std::size_t worker = 0; worker < config.threads; ++worker)
+        {
+            states.emplace_back(new worker_state(
+                    config.pool_size,
+                    config.share_clock_read,
+                    config.kernel_timestamps,
+                    config.timed_stats,
+                    config.interleaved_size,
+                    config.rate_limit,
+                    config.keys.get(),
+                    config.nts));
+
+            // concurrency hint of 1 removes locking inside the io_service
+            services.emplace_back(new boost::asio::io_service(1));
+            servers.emplace_back(
+                new Server(
+                    open_socket(*services.back(), config.port, shared),
+                    *states.back(),
+                    args...));
+        }
+
+        // SIGUSR1 reports, key rotation, and upstream polling are handled on
+        // a separate thread, because a worker might never return to its
+        // io_service (io_uring).
+        boost::asio::io_service report_service(1);
+
+        std::unique_ptr<sntp::upstream::client> upstream;
+        if (!config.upstreams.empty())
+        {
+            upstream = std::make_unique<sntp::upstream::client>(
+                report_service,
+                config.upstreams,
+                std::chrono::seconds(config.upstream_poll));
+            upstream->start();
+        }
+
+        boost::asio::signal_set report_signal(report_service, SIGUSR1);
+        report_on_signal(report_signal, states, upstream.get());
+
+        boost::asio::steady_timer rotation_timer(report_service);
+        if (config.fingerprint_rotation != 0)
+        {
+            rotate_fingerprint(
+                rotation_timer, std::chrono::seconds(config.fingerprint_rotation), servers);
+        }
+
+        std::thread reporter(
+            [&report_service]
+            {
+                report_service.run();
+            });
+
+        // A failed worker stops the others, and the failure is reported
+        // once all of them return
+        try
+        {
+            sntp::run_worker_threads(
+                config.threads,
+                [&config, &services](const std::size_t worker)
+                {
+                    if (config.pin_threads)
+                    {
+                        pin_thread(pthread_self(), worker);
+                    }
+
+                    // Replaced fingerprint keys are freed once every worker
+                    // has finished a handler since, see Server::wake
+                    sntp::timestamp::quiescent();
+                    while (services[worker]->run_one())
+                    {
+                        sntp::timestamp::quiescent();
+                    }
+                    sntp::timestamp::offline();
+                },
+                [&services, &servers]
+                {
+                    for (const std::unique_ptr<boost::asio::io_service>& service : services)
+                    {
+                        service->stop();
+                    }
+                    for (const std::unique_ptr<Server>& server : servers)
+                    {
+                        server->stop();
+                    }
+                });
+        }
+        catch (...)
+        {
+            report_service.stop();
+            reporter.join();
+            throw;
+        }
+
+        report_service.stop();
+        reporter.join();
+    }
+
+    template<typename Integer>
+    bool parse_integer(const char* const value, Integer& parsed)
+    {
+        return boost::spirit::qi::parse(
+            value,
+            value + std::strlen(value),
+            (boost::spirit::qi::uint_parser<Integer>() >> boost::spirit::qi::eoi),
+            parsed);
+    }
+
+    // host[:port], port 123 by default. Every IPv4 address of the host is an
+    // upstream server.
+    std::vector<boost::asio::ip::udp::endpoint> resolve_upstream(
+        boost::asio::io_service& service, const std::string& name)
+    {
+        std::string host = name;
+        std::string port = "123";
+
+        const std::size_t separator = name.rfind(':');
+        if (separator != std::string::npos)
+        {
+            host = name.substr(0, separator);
+            port = name.substr(separator + 1);
+        }
+
+        boost::asio::ip::udp::resolver resolver(service);
+        std::vector<boost::asio::ip::udp::endpoint> endpoints;
+        for (const auto& entry : resolver.resolve(boost::asio::ip::udp::v4(), host, port))
+        {
+            endpoints.push_back(entry.endpoint());
+        }
+        return endpoints;
+    }
+
     int display_option_error(const char* const error, int argc, const char** argv)
     {
         if (argc == 0)
@@ -93,7 +855,18 @@ namespace
         else
         {
             std::cerr << error << "\n\n" <<
-                argv[0] << " [port]" << std::endl;
+                argv[0] <<
+                " [port] [--batch size] [--depth receives] [--pool packets]"
+                " [--threads count] [--pin] [--fingerprint siphash|sha256]"
+                " [--fingerprint-rotation seconds] [--clock realtime|tsc]"
+                " [--single-clock-read] [--precision bits]"
+                " [--kernel-timestamps] [--timed-stats] [--interleaved clients]"
+                " [--uring buffers] [--rate-limit milliseconds]"
+                " [--rate-burst requests] [--rate-sources count]"
+                " [--rate-kiss-of-death] [--keys file]"
+                " [--nts master-key-file] [--nts-rotation seconds]"
+                " [--upstream host[:port]]... [--upstream-poll seconds]"
+                " [--reference-id code]" << std::endl;
         }
 
         return EXIT_FAILURE;
@@ -102,26 +875,341 @@ namespace
 
 int main(int argc, const char** argv)
 {
-    if (argc != 2)
+    if (argc < 2)
     {
-        return display_option_error("Two arguments required", argc, argv);
+        return display_option_error("Port argument required", argc, argv);
     }
 
-    std::uint16_t port = 0;
-    if (!boost::spirit::qi::parse(
-            argv[1],
-            argv[1] + strlen(argv[1]),
-            (boost::spirit::qi::ushort_ >> boost::spirit::qi::eoi),
-            port))
+    options config;
+    const char* keys_path = nullptr;
+    const char* nts_path = nullptr;
+    const char* reference_id = nullptr;
+    std::vector<const char*> upstream_names;
+    if (!parse_integer(argv[1], config.port))
     {
         return display_option_error("Invalid port provided", argc, argv);
     }
 
+    for (int argument = 2; argument < argc; ++argument)
+    {
+        const char* const option = argv[argument];
+
+        if (std::strcmp(option, "--pin") == 0)
+        {
+            config.pin_threads = true;
+            continue;
+        }
+
+        if (std::strcmp(option, "--single-clock-read") == 0)
+        {
+            config.share_clock_read = true;
+            continue;
+        }
+
+        if (std::strcmp(option, "--kernel-timestamps") == 0)
+        {
+            config.kernel_timestamps = true;
+            continue;
+        }
+
+        if (std::strcmp(option, "--timed-stats") == 0)
+        {
+            config.timed_stats = true;
+            continue;
+        }
+
+        if (std::strcmp(option, "--rate-kiss-of-death") == 0)
+        {
+            config.rate_limit.kiss_of_death = true;
+            continue;
+        }
+
+        if (argument + 1 == argc)
+        {
+            return display_option_error("Option missing value", argc, argv);
+        }
+
+        const char* const value = argv[++argument];
+        if (std::strcmp(option, "--batch") == 0)
+        {
+            if (!parse_integer(value, config.batch_size) || config.batch_size == 0)
+            {
+                return display_option_error("Invalid batch size", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--depth") == 0)
+        {
+            if (!parse_integer(value, config.depth) || config.depth == 0)
+            {
+                return display_option_error("Invalid receive depth", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--pool") == 0)
+        {
+            if (!parse_integer(value, config.pool_size) || config.pool_size == 0)
+            {
+                return display_option_error("Invalid pool size", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--threads") == 0)
+        {
+            if (!parse_integer(value, config.threads) || config.threads == 0)
+            {
+                return display_option_error("Invalid thread count", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--uring") == 0)
+        {
+            if (!parse_integer(value, config.uring_buffers) ||
+                config.uring_buffers == 0 ||
+                32768 < config.uring_buffers)
+            {
+                return display_option_error(
+                    "io_uring buffers must be 1 - 32768", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--interleaved") == 0)
+        {
+            if (!parse_integer(value, config.interleaved_size) ||
+                config.interleaved_size == 0)
+            {
+                return display_option_error("Invalid interleaved table size", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--rate-limit") == 0)
+        {
+            if (!parse_integer(value, config.rate_limit.interval) ||
+                config.rate_limit.interval == 0)
+            {
+                return display_option_error("Invalid rate limit interval", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--rate-burst") == 0)
+        {
+            if (!parse_integer(value, config.rate_limit.burst) ||
+                config.rate_limit.burst == 0)
+            {
+                return display_option_error("Invalid rate limit burst", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--rate-sources") == 0)
+        {
+            if (!parse_integer(value, config.rate_limit.sources) ||
+                config.rate_limit.sources == 0)
+            {
+                return display_option_error("Invalid rate limit sources", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--keys") == 0)
+        {
+            keys_path = value;
+        }
+        else if (std::strcmp(option, "--nts") == 0)
+        {
+            nts_path = value;
+        }
+        else if (std::strcmp(option, "--nts-rotation") == 0)
+        {
+            if (!parse_integer(value, config.nts.rotation) || config.nts.rotation == 0)
+            {
+                return display_option_error("Invalid NTS key rotation", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--fingerprint-rotation") == 0)
+        {
+            if (!parse_integer(value, config.fingerprint_rotation) ||
+                (config.fingerprint_rotation != 0 &&
+                 config.fingerprint_rotation < sntp::timestamp::minimum_rotation_period))
+            {
+                return display_option_error(
+                    "Fingerprint key rotation must be 0 (never) or at least 60 seconds",
+                    argc,
+                    argv);
+            }
+        }
+        else if (std::strcmp(option, "--upstream") == 0)
+        {
+            upstream_names.push_back(value);
+        }
+        else if (std::strcmp(option, "--upstream-poll") == 0)
+        {
+            if (!parse_integer(value, config.upstream_poll) ||
+                config.upstream_poll == 0 ||
+                131072 < config.upstream_poll)
+            {
+                return display_option_error(
+                    "Upstream poll interval must be 1 - 131072 seconds", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--reference-id") == 0)
+        {
+            const std::size_t length = std::strlen(value);
+            if (length == 0 || 4 < length)
+            {
+                return display_option_error(
+                    "Reference id must be 1 - 4 characters", argc, argv);
+            }
+            reference_id = value;
+        }
+        else if (std::strcmp(option, "--precision") == 0)
+        {
+            if (!parse_integer(value, config.significant_bits) ||
+                config.significant_bits <
+                    unsigned(sntp::timestamp::precision::minimum_significant_bits) ||
+                unsigned(sntp::timestamp::precision::maximum_significant_bits) <
+                    config.significant_bits)
+            {
+                return display_option_error(
+                    "Precision must be 10 (millisecond) to 21 (half microsecond) bits",
+                    argc,
+                    argv);
+            }
+        }
+        else if (std::strcmp(option, "--fingerprint") == 0)
+        {
+            if (std::strcmp(value, "siphash") == 0)
+            {
+                config.fingerprint = fingerprint_engine::siphash;
+            }
+            else if (std::strcmp(value, "sha256") == 0)
+            {
+                config.fingerprint = fingerprint_engine::sha256;
+            }
+            else
+            {
+                return display_option_error("Invalid fingerprint engine", argc, argv);
+            }
+        }
+        else if (std::strcmp(option, "--clock") == 0)
+        {
+            if (std::strcmp(value, "realtime") == 0)
+            {
+                config.clock = clock_engine::realtime;
+            }
+            else if (std::strcmp(value, "tsc") == 0)
+            {
+                config.clock = clock_engine::tsc;
+            }
+            else
+            {
+                return display_option_error("Invalid clock source", argc, argv);
+            }
+        }
+        else
+        {
+            return display_option_error("Unknown option", argc, argv);
+        }
+    }
+
+    if (config.batch_size != 0 && config.uring_buffers != 0)
+    {
+        return display_option_error(
+            "--batch and --uring are mutually exclusive", argc, argv);
+    }
+
+    if (config.kernel_timestamps &&
+        config.batch_size == 0 &&
+        config.uring_buffers == 0)
+    {
+        return display_option_error(
+            "--kernel-timestamps requires --batch or --uring", argc, argv);
+    }
+
+    if (config.interleaved_size != 0 && config.batch_size == 0)
+    {
+        return display_option_error("--interleaved requires --batch", argc, argv);
+    }
+
+    if (config.rate_limit.kiss_of_death && config.rate_limit.interval == 0)
+    {
+        return display_option_error(
+            "--rate-kiss-of-death requires --rate-limit", argc, argv);
+    }
+
+    if (reference_id && !upstream_names.empty())
+    {
+        return display_option_error(
+            "--reference-id and --upstream are mutually exclusive", argc, argv);
+    }
+
     try
     {
-        boost::asio::io_service service;
-        ntp_server server(service, port);
-        service.run();
+        sntp::timestamp::precision::set_significant_bits(config.significant_bits);
+
+        if (config.clock == clock_engine::tsc)
+        {
+            if (!sntp::tsc_clock::supported())
+            {
+                std::cerr << "TSC is not invariant, using CLOCK_REALTIME" << std::endl;
+            }
+            sntp::timestamp::set_clock_source(sntp::make_tsc_clock());
+        }
+
+        if (!upstream_names.empty())
+        {
+            boost::asio::io_service resolver_service;
+            for (const char* const name : upstream_names)
+            {
+                const std::vector<boost::asio::ip::udp::endpoint> endpoints =
+                    resolve_upstream(resolver_service, name);
+                config.upstreams.insert(
+                    config.upstreams.end(), endpoints.begin(), endpoints.end());
+            }
+        }
+
+        // The system clock is disciplined by a local reference clock
+        if (reference_id)
+        {
+            sntp::server_state state;
+            state.leap = sntp::server_state::leap_indicator::none;
+            state.stratum = 1;
+            state.identifier = {{0}};
+            std::memcpy(state.identifier.data(), reference_id, std::strlen(reference_id));
+            state.reference = sntp::timestamp::now();
+            state.publish();
+        }
+
+        if (keys_path)
+        {
+            std::ifstream keys(keys_path);
+            if (!keys)
+            {
+                throw std::runtime_error(std::string("unable to open ") + keys_path);
+            }
+            config.keys = std::make_shared<const sntp::key_table>(
+                sntp::key_table::load(keys));
+        }
+
+        if (nts_path)
+        {
+            std::ifstream master(nts_path);
+            if (!master)
+            {
+                throw std::runtime_error(std::string("unable to open ") + nts_path);
+            }
+            config.nts.master = sntp::nts::load_master_key(master);
+            config.nts.enabled = true;
+        }
+
+        if (config.fingerprint == fingerprint_engine::sha256)
+        {
+            sntp::timestamp::set_fingerprint(
+                std::make_unique<sntp::sha256_fingerprint>(
+                    sntp::fingerprint::random_key()));
+        }
+
+        if (config.batch_size != 0)
+        {
+            run_workers<batched_ntp_server>(config, config.batch_size);
+        }
+        else if (config.uring_buffers != 0)
+        {
+            run_workers<uring_ntp_server>(config, config.uring_buffers);
+        }
+        else
+        {
+            run_workers<ntp_server>(config, config.depth);
+        }
     }
     catch (const std::exception& error)
     {
@@ -0,0 +1,110 @@
+//
+// server_state.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "server_state.hpp"
+
+#include <atomic>
+#include <cstring>
+
+#include "conversion.hpp"
+
+namespace sntp
+{
+    namespace
+    {
+        const std::uint8_t version = 0x20;
+        const std::uint8_t server = 0x04;
+        const std::uint8_t sixty_four_second_poll_interval = 6;
+
+        const std::size_t precision_offset = 3;
+
+        server_state::header make_header(const server_state& state)
+        {
+            server_state::header bytes = {{0}};
+            bytes[0] = (std::uint8_t(state.leap) << 6) | version | server;
+            bytes[1] = state.stratum;
+            bytes[2] = sixty_four_second_poll_interval;
+
+            const std::uint32_t delay = to_ulong(state.root_delay);
+            const std::uint32_t dispersion = to_ulong(state.root_dispersion);
+            std::memcpy(bytes.data() + 4, &delay, sizeof(delay));
+            std::memcpy(bytes.data() + 8, &dispersion, sizeof(dispersion));
+            std::memcpy(bytes.data() + 12, state.identifier.data(), state.identifier.size());
+            std::memcpy(bytes.data() + 16, &state.reference, sizeof(state.reference));
+            return bytes;
+        }
+
+        // The header is stored in 64-bit atomic words so readers racing a
+        // publish have defined behaviour, and discard what they read. The
+        // sequence is odd while a publish is in progress, and zero until
+        // the first publish (the default state).
+        using header_words = std::array<std::atomic<std::uint64_t>, 3>;
+        static_assert(
+            sizeof(std::uint64_t) * 3 == sizeof(server_state::header), "header is not 3 words");
+
+        std::atomic<std::uint32_t> sequence(0);
+        header_words published_words;
+    }
+
+    void server_state::publish() const
+    {
+        const header bytes = make_header(*this);
+        std::array<std::uint64_t, 3> words;
+        std::memcpy(words.data(), bytes.data(), bytes.size());
+
+        const std::uint32_t current = sequence.load(std::memory_order_relaxed);
+        sequence.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (std::size_t index = 0; index < words.size(); ++index)
+        {
+            published_words[index].store(words[index], std::memory_order_relaxed);
+        }
+
+        sequence.store(current + 2, std::memory_order_release);
+    }
+
+    server_state::header server_state::response_header()
+    {
+        header bytes;
+
+        for (;;)
+        {
+            const std::uint32_t before = sequence.load(std::memory_order_acquire);
+            if (before == 0)
+            {
+                bytes = make_header(server_state());
+                break;
+            }
+
+            if ((before & 1) == 0)
+            {
+                std::array<std::uint64_t, 3> words;
+                for (std::size_t index = 0; index < words.size(); ++index)
+                {
+                    words[index] = published_words[index].load(std::memory_order_relaxed);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before)
+                {
+                    std::memcpy(bytes.data(), words.data(), bytes.size());
+                    break;
+                }
+            }
+        }
+
+        // A setting of this process, not state of the clock
+        const timestamp::precision precision;
+        static_assert(sizeof(precision) == 1, "precision is not a single byte");
+        std::memcpy(bytes.data() + precision_offset, &precision, sizeof(precision));
+        return bytes;
+    }
+}
@@ -0,0 +1,68 @@
+//
+// server_state.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVER_STATE_HPP
+#define SERVER_STATE_HPP
+
+#include <array>
+#include <cstdint>
+
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    // The state of the server clock, sent in every response. The default
+    // is an unsynchronized, uncalibrated local clock.
+    //
+    // A published state is kept as the first 24 bytes of a response
+    // (flags through reference timestamp) in network byte order, behind a
+    // seqlock. Workers copy the bytes into each response, never waiting on
+    // a publisher, so real state costs no more than constants.
+    struct server_state
+    {
+        enum class leap_indicator : std::uint8_t
+        {
+            none = 0,
+            add_second = 1,     // last minute of the day has 61 seconds
+            remove_second = 2,  // last minute of the day has 59 seconds
+            unsynchronized = 3
+        };
+
+        // flags, stratum, poll, precision, delay, dispersion, identifier,
+        // and reference timestamp
+        using header = std::array<std::uint8_t, 24>;
+
+        // Publish this state for every response. Only one thread may
+        // publish at a time.
+        void publish() const;
+
+        // The published state as the start of a server mode response, with
+        // the current precision setting. Safe to call from any thread.
+        static header response_header();
+
+        leap_indicator leap = leap_indicator::unsynchronized;
+        std::uint8_t stratum = 1;
+
+        // Reference id: a clock source code at stratum 1, otherwise the
+        // IPv4 address of the upstream server (or a hash of its IPv6
+        // address)
+        std::array<std::uint8_t, 4> identifier = {{'L', 'O', 'C', 'L'}};
+
+        // Time the clock was last set or corrected
+        timestamp reference = timestamp();
+
+        // Round-trip delay and dispersion to the primary reference, in NTP
+        // short format (16.16 fixed point seconds), host byte order
+        std::uint32_t root_delay = 0;
+        std::uint32_t root_dispersion = 0;
+    };
+}
+
+#endif // SERVER_STATE_HPP
@@ -0,0 +1,141 @@
+//
+// stats.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "stats.hpp"
+
+#include <iomanip>
+#include <ostream>
+
+namespace sntp
+{
+    namespace
+    {
+        // Percentiles in microseconds, to keep the summary on one line
+        void display_percentiles(std::ostream& out, const histogram& values)
+        {
+            const auto microseconds = [&values](const double fraction)
+            {
+                return double(values.percentile(fraction)) / 1000;
+            };
+
+            const std::ios_base::fmtflags flags = out.flags();
+            const std::streamsize precision = out.precision();
+            out << std::fixed << std::setprecision(1) <<
+                "p50 " << microseconds(0.5) <<
+                " p99 " << microseconds(0.99) <<
+                " p99.9 " << microseconds(0.999) << "us";
+            out.flags(flags);
+            out.precision(precision);
+        }
+    }
+
+    constexpr std::size_t worker_stats::cache_line_size;
+
+    worker_stats::worker_stats(const bool timed) :
+        leading_padding_(),
+        counters_(),
+        residence_(),
+        processing_(),
+        timed_(timed),
+        trailing_padding_()
+    {
+        for (std::atomic<std::uint64_t>& value : counters_)
+        {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void worker_stats::reject(const packet::rejection reason)
+    {
+        switch (reason)
+        {
+        case packet::rejection::bad_version:
+            increment(counter::bad_version);
+            break;
+        case packet::rejection::bad_mode:
+            increment(counter::bad_mode);
+            break;
+        case packet::rejection::looped:
+            increment(counter::looped);
+            break;
+        case packet::rejection::none:
+            break;
+        }
+    }
+
+    stats_snapshot::stats_snapshot() :
+        received(0),
+        answered(0),
+        short_packet(0),
+        bad_version(0),
+        bad_mode(0),
+        looped(0),
+        send_error(0),
+        rate_limited(0),
+        bad_mac(0),
+        bad_extension(0),
+        kiss_of_death(0),
+        authenticated(0),
+        nts(0),
+        nts_nak(0),
+        pool_exhausted(0),
+        residence(),
+        processing()
+    {
+    }
+
+    stats_snapshot& stats_snapshot::operator+=(const worker_stats& worker)
+    {
+        using counter = worker_stats::counter;
+        received += worker.get(counter::received);
+        answered += worker.get(counter::answered);
+        short_packet += worker.get(counter::short_packet);
+        bad_version += worker.get(counter::bad_version);
+        bad_mode += worker.get(counter::bad_mode);
+        looped += worker.get(counter::looped);
+        send_error += worker.get(counter::send_error);
+        rate_limited += worker.get(counter::rate_limited);
+        bad_mac += worker.get(counter::bad_mac);
+        bad_extension += worker.get(counter::bad_extension);
+        kiss_of_death += worker.get(counter::kiss_of_death);
+        authenticated += worker.get(counter::authenticated);
+        nts += worker.get(counter::nts);
+        nts_nak += worker.get(counter::nts_nak);
+        pool_exhausted += worker.get(counter::pool_exhausted);
+        residence.merge(worker.residence());
+        processing.merge(worker.processing());
+        return *this;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const stats_snapshot& snapshot)
+    {
+        out <<
+            "received " << snapshot.received <<
+            " answered " << snapshot.answered <<
+            " dropped " << snapshot.dropped() <<
+            " (short " << snapshot.short_packet <<
+            " bad-version " << snapshot.bad_version <<
+            " bad-mode " << snapshot.bad_mode <<
+            " looped " << snapshot.looped <<
+            " send-error " << snapshot.send_error <<
+            " rate-limited " << snapshot.rate_limited <<
+            " bad-mac " << snapshot.bad_mac <<
+            " bad-extension " << snapshot.bad_extension <<
+            ") kiss-of-death " << snapshot.kiss_of_death <<
+            " authenticated " << snapshot.authenticated <<
+            " nts " << snapshot.nts <<
+            " nts-nak " << snapshot.nts_nak <<
+            " pool-exhausted " << snapshot.pool_exhausted << " residence ";
+        display_percentiles(out, snapshot.residence);
+        out << " processing ";
+        display_percentiles(out, snapshot.processing);
+        return out;
+    }
+}
@@ -0,0 +1,209 @@
+//
+// stats.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <time.h>
+
+#include "histogram.hpp"
+#include "packet.hpp"
+
+namespace sntp
+{
+    // Packet counters and latency histograms of a single worker. Only the
+    // owning worker thread updates them, so increments are a plain load and
+    // store without a lock prefix. Any thread can read them at any time. The
+    // counters are padded on both sides so that workers never share a cache
+    // line, regardless of where the object is allocated. The histograms are
+    // only filled when timed, because timing a request costs extra clock
+    // reads.
+    class worker_stats
+    {
+    public:
+
+        enum class counter : std::uint8_t
+        {
+            received,
+            answered,
+            short_packet,   // smaller than a header, or truncated
+            bad_version,
+            bad_mode,
+            looped,
+            send_error,
+            rate_limited,   // dropped without a response
+            bad_mac,        // unknown key, wrong digest, or malformed NTS
+            bad_extension,  // malformed extension fields
+            kiss_of_death,  // answered with a "RATE" Kiss-o'-Death
+            authenticated,  // answered with a MAC
+            nts,            // answered with NTS authentication
+            nts_nak,        // answered with a "NTSN" Kiss-o'-Death
+            pool_exhausted,
+            count
+        };
+
+        explicit worker_stats(bool timed = false);
+
+        worker_stats(const worker_stats&) = delete;
+        worker_stats& operator=(const worker_stats&) = delete;
+
+        // Owning thread only
+        void increment(const counter which, const std::uint64_t amount = 1)
+        {
+            std::atomic<std::uint64_t>& value = get_counter(which);
+            value.store(
+                value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+        }
+
+        // Whether the engines and accept_request record the residence and
+        // processing histograms
+        bool timed() const
+        {
+            return timed_;
+        }
+
+        // Owning thread only. Count a request rejected by
+        // packet::fill_server_values()
+        void reject(packet::rejection reason);
+
+        // Owning thread only. Record the nanoseconds from the arrival of a
+        // request until its response is handed to the kernel. Both are read
+        // from the same clock: realtime() for a kernel timestamp, otherwise
+        // now() at the start of the processing.
+        void record_residence(const std::uint64_t arrival, const std::uint64_t sent)
+        {
+            residence_.record(elapsed(arrival, sent));
+        }
+
+        // Owning thread only. Record the nanoseconds from a kernel arrival
+        // timestamp until now.
+        void record_residence(const ::timespec& arrival)
+        {
+            record_residence(nanoseconds(arrival), realtime());
+        }
+
+        // Owning thread only. Record the nanoseconds spent filling a
+        // response, between two now() reads
+        void record_processing(const std::uint64_t start, const std::uint64_t end)
+        {
+            processing_.record(elapsed(start, end));
+        }
+
+        // Safe from any thread
+        std::uint64_t get(const counter which) const
+        {
+            return counters_[std::size_t(which)].load(std::memory_order_relaxed);
+        }
+
+        // Safe from any thread
+        const histogram& residence() const
+        {
+            return residence_;
+        }
+
+        // Safe from any thread
+        const histogram& processing() const
+        {
+            return processing_;
+        }
+
+        // Monotonic clock in nanoseconds, for processing times. Clock steps
+        // do not change it.
+        static std::uint64_t now()
+        {
+            ::timespec current;
+            ::clock_gettime(CLOCK_MONOTONIC, &current);
+            return nanoseconds(current);
+        }
+
+        // Realtime clock in nanoseconds, the same clock as SO_TIMESTAMPNS
+        static std::uint64_t realtime()
+        {
+            ::timespec current;
+            ::clock_gettime(CLOCK_REALTIME, &current);
+            return nanoseconds(current);
+        }
+
+        static std::uint64_t nanoseconds(const ::timespec& time)
+        {
+            return std::uint64_t(time.tv_sec) * 1000000000 + std::uint64_t(time.tv_nsec);
+        }
+
+    private:
+
+        static constexpr std::size_t cache_line_size = 64;
+
+        std::atomic<std::uint64_t>& get_counter(const counter which)
+        {
+            return counters_[std::size_t(which)];
+        }
+
+        // A realtime clock step backwards is recorded as zero
+        static std::uint64_t elapsed(const std::uint64_t start, const std::uint64_t end)
+        {
+            return start < end ? end - start : 0;
+        }
+
+    private:
+
+        std::uint8_t leading_padding_[cache_line_size];
+        std::array<std::atomic<std::uint64_t>, std::size_t(counter::count)> counters_;
+        histogram residence_;
+        histogram processing_;
+        const bool timed_;
+        std::uint8_t trailing_padding_[cache_line_size];
+    };
+
+    // Totals across workers. Counters are read individually without
+    // stopping the workers, so totals taken under load can be off by the
+    // packets in flight.
+    struct stats_snapshot
+    {
+        stats_snapshot();
+
+        // Add the current counters of a worker
+        stats_snapshot& operator+=(const worker_stats& worker);
+
+        // Requests that were not answered for any reason
+        std::uint64_t dropped() const
+        {
+            return short_packet + bad_version + bad_mode + looped + send_error +
+                rate_limited + bad_mac + bad_extension;
+        }
+
+        std::uint64_t received;
+        std::uint64_t answered;
+        std::uint64_t short_packet;
+        std::uint64_t bad_version;
+        std::uint64_t bad_mode;
+        std::uint64_t looped;
+        std::uint64_t send_error;
+        std::uint64_t rate_limited;
+        std::uint64_t bad_mac;
+        std::uint64_t bad_extension;
+        std::uint64_t kiss_of_death;
+        std::uint64_t authenticated;
+        std::uint64_t nts;
+        std::uint64_t nts_nak;
+        std::uint64_t pool_exhausted;
+        histogram residence;
+        histogram processing;
+    };
+
+    // Single line summary of the snapshot
+    std::ostream& operator<<(std::ostream& out, const stats_snapshot& snapshot);
+}
+
+#endif // STATS_HPP
@@ -0,0 +1,344 @@
+#include <array>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "authentication.hpp"
+#include "packet.hpp"
+#include "packet_view.hpp"
+
+namespace
+{
+    std::vector<std::uint8_t> from_hex(const std::string& hex)
+    {
+        std::vector<std::uint8_t> bytes;
+        for (std::size_t digit = 0; digit < hex.size(); digit += 2)
+        {
+            bytes.push_back(std::uint8_t(std::stoul(hex.substr(digit, 2), nullptr, 16)));
+        }
+        return bytes;
+    }
+
+    template<std::size_t Size>
+    bool digest_is(const std::array<std::uint8_t, Size>& digest, const std::string& hex)
+    {
+        const std::vector<std::uint8_t> expected = from_hex(hex);
+        return expected.size() == digest.size() &&
+            std::memcmp(expected.data(), digest.data(), digest.size()) == 0;
+    }
+
+    // RFC 4493 section 4
+    const std::string cmac_key = "2b7e151628aed2a6abf7158809cf4f3c";
+    const std::string cmac_message =
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+
+    // Version 4 client request with key identifier 7
+    sntp::packet make_request(const std::uint8_t id)
+    {
+        std::array<std::uint8_t, sizeof(sntp::packet)> bytes = {{0}};
+        bytes[0] = 0x23;
+        bytes[47] = id;
+        bytes[51] = 7;
+
+        sntp::packet request;
+        std::memcpy(&request, bytes.data(), bytes.size());
+        return request;
+    }
+
+    const std::uint8_t* header(const sntp::packet& packet)
+    {
+        return reinterpret_cast<const std::uint8_t*>(&packet);
+    }
+}
+
+int test_main(int, char**)
+{
+    {
+        const std::vector<std::uint8_t> key = from_hex(cmac_key);
+        const std::vector<std::uint8_t> message = from_hex(cmac_message);
+        const sntp::cmac_aes128 cmac(key.data());
+
+        BOOST_CHECK(digest_is(cmac(message.data(), 0), "bb1d6929e95937287fa37d129b756746"));
+        BOOST_CHECK(digest_is(cmac(message.data(), 16), "070a16b46b4d4144f79bdd9dd04a287c"));
+        BOOST_CHECK(digest_is(cmac(message.data(), 40), "dfa66747de9ae63030ca32611497c827"));
+        BOOST_CHECK(digest_is(cmac(message.data(), 48), "c47c4d9d64588f67fb9de6fe745d7fbf"));
+        BOOST_CHECK(digest_is(cmac(message.data(), 64), "51f0bebf7e3b9d92fc49741779363cfe"));
+    }
+    // incremental CMAC, in uneven pieces
+    {
+        const std::vector<std::uint8_t> key = from_hex(cmac_key);
+        const std::vector<std::uint8_t> message = from_hex(cmac_message);
+        const sntp::cmac_aes128 cmac(key.data());
+
+        sntp::cmac_aes128::stream pieces(cmac);
+        pieces.update(message.data(), 7);
+        pieces.update(message.data() + 7, 9);
+        pieces.update(message.data() + 16, 0);
+        pieces.update(message.data() + 16, 24);
+        BOOST_CHECK(digest_is(pieces.final(), "dfa66747de9ae63030ca32611497c827"));
+    }
+    {
+        const std::string key = "sntp-test-key";
+        const std::vector<std::uint8_t> message = from_hex(cmac_message);
+        const sntp::sha256_mac sha256(
+            reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+
+        BOOST_CHECK(sha256.digest_size() == 20);
+        BOOST_CHECK(
+            digest_is(sha256(message.data(), 48), "0b190af33d3110beeed741bb474405b0b1457d67"));
+        BOOST_CHECK(sha256.compute(message.data(), 48) == sha256(message.data(), 48));
+    }
+    {
+        const std::string key = "sntp-test-key";
+        const std::vector<std::uint8_t> message = from_hex(cmac_message);
+        const sntp::sha1_mac sha1(reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+
+        BOOST_CHECK(
+            digest_is(sha1(message.data(), 48), "2d67627f2b7a215a33d83a07e5ecc40792ee6538"));
+    }
+
+    // AES-SIV, RFC 5297 appendix A.1 (deterministic)
+    {
+        const std::vector<std::uint8_t> key = from_hex(
+            "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+        const std::vector<std::uint8_t> associated =
+            from_hex("101112131415161718191a1b1c1d1e1f2021222324252627");
+        const std::vector<std::uint8_t> plaintext = from_hex("112233445566778899aabbccddee");
+        const sntp::aes_siv siv(key.data());
+
+        std::vector<std::uint8_t> sealed(sntp::aes_siv::tag_size + plaintext.size());
+        siv.seal(
+            associated.data(), associated.size(), nullptr, 0,
+            plaintext.data(), plaintext.size(), sealed.data());
+        BOOST_CHECK(
+            sealed == from_hex("85632d07c6e8f37f950acd320a2ecc9340c02b9690c4dc04daef7f6afe5c"));
+
+        std::vector<std::uint8_t> opened(plaintext.size());
+        BOOST_CHECK(
+            siv.open(
+                associated.data(), associated.size(), nullptr, 0,
+                sealed.data(), sealed.size(), opened.data()));
+        BOOST_CHECK(opened == plaintext);
+    }
+
+    // AES-SIV with a nonce, as used by NTS. 150 bytes covers more than one
+    // group of counter blocks, and a partial final block.
+    {
+        std::vector<std::uint8_t> key;
+        std::vector<std::uint8_t> associated;
+        std::vector<std::uint8_t> nonce;
+        std::vector<std::uint8_t> message;
+        for (std::uint8_t value = 0; value < 32; ++value)
+        {
+            key.push_back(value);
+        }
+        for (std::uint8_t value = 100; value < 148; ++value)
+        {
+            associated.push_back(value);
+        }
+        for (std::uint8_t value = 200; value < 216; ++value)
+        {
+            nonce.push_back(value);
+        }
+        for (std::uint8_t value = 0; value < 150; ++value)
+        {
+            message.push_back(value);
+        }
+        const sntp::aes_siv siv(key.data());
+
+        // in place
+        std::vector<std::uint8_t> buffer(sntp::aes_siv::tag_size + message.size());
+        std::memcpy(buffer.data() + sntp::aes_siv::tag_size, message.data(), message.size());
+        siv.seal(
+            associated.data(), associated.size(), nonce.data(), nonce.size(),
+            buffer.data() + sntp::aes_siv::tag_size, message.size(), buffer.data());
+        BOOST_CHECK(
+            buffer == from_hex(
+                "381aeac00fc3ddf85d0f523907e525b188e8b8c8a1d19e3b7bfbbed1f7c1b285"
+                "d864b1f57ad14317a9bcea0a9f4e81de7dacc0694ee54aea9b19ca2bd4e20cbd"
+                "7059bc622c9889c233ac368db47616e7031d960079391221842d72aa0fbe6aa7"
+                "6d5f659383ff05e50a0fe13e33fea0fca97b29964883d7bfbe67f43acd5226c5"
+                "b97d94670a5db0a741bbba5e4df8f41fe64932f478ec59eeffeb3c6ff34a83ed"
+                "3fe9a0f3632c"));
+
+        std::vector<std::uint8_t> short_sealed(sntp::aes_siv::tag_size + 5);
+        siv.seal(
+            associated.data(), associated.size(), nonce.data(), nonce.size(),
+            message.data(), 5, short_sealed.data());
+        BOOST_CHECK(short_sealed == from_hex("9a6f8fb192ee27d53aa847f3e2d487253eaa5c2f61"));
+
+        BOOST_CHECK(
+            siv.open(
+                associated.data(), associated.size(), nonce.data(), nonce.size(),
+                buffer.data(), buffer.size(), buffer.data() + sntp::aes_siv::tag_size));
+        BOOST_CHECK(
+            std::memcmp(
+                buffer.data() + sntp::aes_siv::tag_size, message.data(), message.size()) == 0);
+
+        // any change to the associated data, nonce, or ciphertext is detected
+        siv.seal(
+            associated.data(), associated.size(), nonce.data(), nonce.size(),
+            message.data(), message.size(), buffer.data());
+        std::vector<std::uint8_t> opened(message.size());
+        nonce[3] ^= 1;
+        BOOST_CHECK(
+            !siv.open(
+                associated.data(), associated.size(), nonce.data(), nonce.size(),
+                buffer.data(), buffer.size(), opened.data()));
+        nonce[3] ^= 1;
+        buffer[100] ^= 1;
+        BOOST_CHECK(
+            !siv.open(
+                associated.data(), associated.size(), nonce.data(), nonce.size(),
+                buffer.data(), buffer.size(), opened.data()));
+        BOOST_CHECK(opened == std::vector<std::uint8_t>(message.size()));
+        BOOST_CHECK(
+            !siv.open(
+                associated.data(), associated.size(), nonce.data(), nonce.size(),
+                buffer.data(), sntp::aes_siv::tag_size - 1, opened.data()));
+    }
+
+    // key file
+    {
+        std::istringstream keys(
+            "# comment line\n"
+            "\n"
+            "7 AES128CMAC " + cmac_key + " # trailing comment\n"
+            "8 sha256 sntp-test-key\n"
+            "9 SHA1 sntp-test-key\n");
+        const sntp::key_table table = sntp::key_table::load(keys);
+        BOOST_CHECK(table.size() == 3);
+        BOOST_CHECK(table.find(7) != nullptr);
+        BOOST_CHECK(table.find(7)->digest_size() == 16);
+        BOOST_CHECK(table.find(8) != nullptr);
+        BOOST_CHECK(table.find(8)->digest_size() == 20);
+        BOOST_CHECK(table.find(9) != nullptr);
+        BOOST_CHECK(table.find(10) == nullptr);
+    }
+    for (const char* const invalid :
+         {"0 SHA256 key\n",
+          "7 SHA256\n",
+          "7 SHA256 key extra\n",
+          "7 MD5 key\n",
+          "7 AES128CMAC short\n",
+          "7 SHA256 0123456789abcdef0123456789abcdefxx\n"})
+    {
+        std::istringstream keys(invalid);
+        bool thrown = false;
+        try
+        {
+            sntp::key_table::load(keys);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        BOOST_CHECK(thrown);
+    }
+
+    // verify a request, and sign the response
+    {
+        sntp::key_table table;
+        const std::vector<std::uint8_t> key = from_hex(cmac_key);
+        table.insert(7, std::make_unique<sntp::cmac_aes128>(key.data()));
+        const sntp::cmac_aes128 cmac(key.data());
+
+        sntp::packet request = make_request(1);
+        BOOST_CHECK(request.key_identifier() == 7);
+
+        // no MAC
+        const sntp::packet_view unsigned_request(
+            reinterpret_cast<std::uint8_t*>(&request), sntp::packet::minimum_packet_size());
+        BOOST_CHECK(
+            table.verify(unsigned_request) == sntp::key_table::verification::unauthenticated);
+        BOOST_CHECK(!table.sign(unsigned_request));
+
+        // wrong digest
+        BOOST_CHECK(
+            table.verify(sntp::packet_view(request)) ==
+            sntp::key_table::verification::invalid);
+
+        request.set_digest(cmac(header(request), sntp::packet::minimum_packet_size()));
+        BOOST_CHECK(
+            table.verify(sntp::packet_view(request)) ==
+            sntp::key_table::verification::valid);
+
+        BOOST_CHECK(request.fill_server_values());
+        BOOST_CHECK(table.sign(sntp::packet_view(request)));
+        BOOST_CHECK(request.key_identifier() == 7);
+        BOOST_CHECK(
+            request.get_digest() ==
+            cmac(header(request), sntp::packet::minimum_packet_size()));
+        BOOST_CHECK(
+            boost::asio::buffer_size(request.get_send_buffer(true)) ==
+            sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(
+            boost::asio::buffer_size(request.get_send_buffer(false)) ==
+            sntp::packet::minimum_packet_size());
+
+        // unknown key
+        std::array<std::uint8_t, sizeof(sntp::packet)> bytes;
+        std::memcpy(bytes.data(), &request, bytes.size());
+        bytes[51] = 9;
+        sntp::packet unknown;
+        std::memcpy(&unknown, bytes.data(), bytes.size());
+        BOOST_CHECK(
+            table.verify(sntp::packet_view(unknown)) ==
+            sntp::key_table::verification::invalid);
+        BOOST_CHECK(!table.sign(sntp::packet_view(unknown)));
+    }
+
+    // a SHA-256 request from ntpd or chrony has a 20 byte digest (72 bytes)
+    {
+        sntp::key_table table;
+        const std::string key = "sntp-test-key";
+        const sntp::sha256_mac sha256(
+            reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+        table.insert(
+            7,
+            std::make_unique<sntp::sha256_mac>(
+                reinterpret_cast<const std::uint8_t*>(key.data()), key.size()));
+        table.insert(8, std::make_unique<sntp::cmac_aes128>(from_hex(cmac_key).data()));
+
+        const sntp::packet header_only = make_request(2);
+        std::vector<std::uint8_t> bytes(sntp::packet::minimum_packet_size() + 24);
+        std::memcpy(bytes.data(), &header_only, sntp::packet::minimum_packet_size());
+        bytes[51] = 7;
+        const sntp::mac::digest digest =
+            sha256(bytes.data(), sntp::packet::minimum_packet_size());
+        std::memcpy(bytes.data() + 52, digest.data(), digest.size());
+
+        const sntp::packet_view request(bytes.data(), bytes.size());
+        BOOST_CHECK(request.mac_size() == 24);
+        BOOST_CHECK(request.digest_size() == 20);
+        BOOST_CHECK(table.verify(request) == sntp::key_table::verification::valid);
+
+        BOOST_CHECK(request.fill_server_values());
+        BOOST_CHECK(table.sign(request));
+        const sntp::mac::digest expected =
+            sha256(bytes.data(), sntp::packet::minimum_packet_size());
+        BOOST_CHECK(std::memcmp(bytes.data() + 52, expected.data(), expected.size()) == 0);
+
+        // only the last digest byte is wrong
+        bytes[71] ^= 1;
+        BOOST_CHECK(table.verify(request) == sntp::key_table::verification::invalid);
+        bytes[71] ^= 1;
+
+        // a 16 byte digest for a SHA-256 key, or a 20 byte digest for a
+        // CMAC key, is invalid
+        const sntp::packet_view truncated(bytes.data(), sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(table.verify(truncated) == sntp::key_table::verification::invalid);
+        BOOST_CHECK(!table.sign(truncated));
+        bytes[51] = 8;
+        BOOST_CHECK(table.verify(request) == sntp::key_table::verification::invalid);
+        BOOST_CHECK(!table.sign(request));
+    }
+
+    return 0;
+}
@@ -0,0 +1,345 @@
+#include <array>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/test/minimal.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "authentication.hpp"
+#include "batch.hpp"
+#include "nts.hpp"
+#include "packet_util.hpp"
+#include "rate_limit.hpp"
+#include "stats.hpp"
+
+namespace
+{
+    using request = std::array<std::uint8_t, 48>;
+
+    void append_field(
+        std::vector<std::uint8_t>& datagram,
+        const std::uint16_t type,
+        const std::vector<std::uint8_t>& body)
+    {
+        const std::size_t size = 4 + body.size();
+        const std::uint8_t header[] = {
+            std::uint8_t(type >> 8), std::uint8_t(type), std::uint8_t(size >> 8), std::uint8_t(size)};
+        datagram.insert(datagram.end(), std::begin(header), std::end(header));
+        datagram.insert(datagram.end(), body.begin(), body.end());
+    }
+
+    // NTS request with a unique identifier, a cookie, and an authenticator
+    std::vector<std::uint8_t> make_nts_request(
+        const std::uint8_t id,
+        const std::vector<std::uint8_t>& cookie,
+        const sntp::nts::session_keys& keys)
+    {
+        const request header = test::sntp::make_request(test::sntp::valid_client, id);
+        std::vector<std::uint8_t> datagram(header.begin(), header.end());
+        append_field(datagram, sntp::nts::field::unique_identifier, std::vector<std::uint8_t>(32, id));
+        append_field(datagram, sntp::nts::field::cookie, cookie);
+
+        std::vector<std::uint8_t> body = {0, 16, 0, std::uint8_t(sntp::aes_siv::tag_size)};
+        body.resize(body.size() + 16 + sntp::aes_siv::tag_size, id);
+        sntp::aes_siv(keys.client_to_server.data()).seal(
+            datagram.data(), datagram.size(), body.data() + 4, 16, nullptr, 0, body.data() + 20);
+        append_field(datagram, sntp::nts::field::authenticator, body);
+        return datagram;
+    }
+}
+
+int test_main(int, char**)
+{
+    boost::asio::io_service service;
+    const boost::asio::ip::udp::endpoint loopback(
+        boost::asio::ip::address_v4::loopback(), 0);
+
+    boost::asio::ip::udp::socket server(service, loopback);
+    boost::asio::ip::udp::socket client(service, loopback);
+    server.non_blocking(true);
+    client.non_blocking(true);
+
+    sntp::worker_stats stats(true);
+    sntp::batch batch(4);
+    batch.set_stats(&stats);
+    BOOST_CHECK(batch.capacity() == 4);
+    BOOST_CHECK(batch.pending() == 0);
+    {
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 0);
+        BOOST_CHECK(!error);
+    }
+
+    // 5 requests: 1 invalid version, 1 short, 3 valid. The batch should
+    // only read the first 4, and respond to 2 of them.
+    {
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::invalid_client, 1)),
+            server.local_endpoint());
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 2)),
+            server.local_endpoint());
+
+        const request short_request = test::sntp::make_request(test::sntp::valid_client, 3);
+        client.send_to(
+            boost::asio::buffer(short_request.data(), short_request.size() - 1),
+            server.local_endpoint());
+
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 4)),
+            server.local_endpoint());
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 5)),
+            server.local_endpoint());
+    }
+
+    {
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 4);
+        BOOST_CHECK(!error);
+        BOOST_CHECK(batch.last_received() == 4);
+        BOOST_CHECK(batch.fill_server_values() == 2);
+        BOOST_CHECK(batch.pending() == 2);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 2);
+        BOOST_CHECK(!error);
+        BOOST_CHECK(batch.pending() == 0);
+
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 1);
+        BOOST_CHECK(batch.fill_server_values() == 1);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 1);
+        BOOST_CHECK(!error);
+    }
+
+    {
+        using counter = sntp::worker_stats::counter;
+        BOOST_CHECK(stats.get(counter::received) == 5);
+        BOOST_CHECK(stats.get(counter::answered) == 3);
+        BOOST_CHECK(stats.get(counter::short_packet) == 1);
+        BOOST_CHECK(stats.get(counter::bad_version) == 1);
+        BOOST_CHECK(stats.residence().count() == 3);
+    }
+
+    // malformed extension fields (too small to be a field or a MAC) are
+    // dropped
+    {
+        const request valid = test::sntp::make_request(test::sntp::valid_client, 6);
+        std::vector<std::uint8_t> extended(valid.begin(), valid.end());
+        extended.resize(sntp::packet::minimum_packet_size() + 8);
+        client.send_to(boost::asio::buffer(extended), server.local_endpoint());
+
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 1);
+        BOOST_CHECK(batch.fill_server_values() == 0);
+        BOOST_CHECK(stats.get(sntp::worker_stats::counter::bad_extension) == 1);
+    }
+
+    // responses arrive in request order, from the server socket
+    for (const std::uint8_t expected_id : {2, 4, 5})
+    {
+        std::array<std::uint8_t, 68> response = {{0}};
+        boost::asio::ip::udp::endpoint sender;
+        boost::system::error_code error;
+
+        const std::size_t bytes = client.receive_from(
+            boost::asio::buffer(response), sender, 0, error);
+
+        BOOST_CHECK(!error);
+        BOOST_CHECK(bytes == sntp::packet::minimum_packet_size());
+        BOOST_CHECK(sender == server.local_endpoint());
+        BOOST_CHECK((response[0] & 0x07) == 0x04);
+        BOOST_CHECK(
+            response[test::sntp::originate_fractional_offset] == expected_id);
+        BOOST_CHECK(test::sntp::receive_before_transmit(response));
+    }
+
+    // kernel timestamps are used for the receive timestamp
+    {
+        server.set_option(test::sntp::receive_timestamps(true));
+
+        // The kernel enables timestamping lazily, so the first datagram
+        // after the option is set might arrive without one
+        boost::system::error_code error;
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 9)),
+            server.local_endpoint());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 1);
+
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 6)),
+            server.local_endpoint());
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 1);
+        BOOST_CHECK(batch.fill_server_values() == 1);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 1);
+
+        std::array<std::uint8_t, 68> response = {{0}};
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(response), 0, error) ==
+            sntp::packet::minimum_packet_size());
+        BOOST_CHECK(response[test::sntp::originate_fractional_offset] == 6);
+
+        // arrival was at least 20 milliseconds before transmit
+        const std::uint64_t received =
+            test::sntp::extract_time(response, test::sntp::receive_timestamp_offset);
+        const std::uint64_t transmitted =
+            test::sntp::extract_time(response, test::sntp::transmit_timestamp_offset);
+        BOOST_CHECK(received < transmitted);
+        BOOST_CHECK(
+            (std::uint64_t(1) << 32) / 50 <= transmitted - received);
+    }
+
+    // a source over the rate limit gets a Kiss-o'-Death, or nothing
+    {
+        using counter = sntp::worker_stats::counter;
+        server.set_option(test::sntp::receive_timestamps(false));
+
+        sntp::rate_limiter kiss_limiter(16, 60000, 1, true);
+        batch.set_rate_limiter(&kiss_limiter);
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 7)),
+            server.local_endpoint());
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 8)),
+            server.local_endpoint());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 2);
+        BOOST_CHECK(batch.fill_server_values() == 2);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 2);
+        BOOST_CHECK(stats.get(counter::kiss_of_death) == 1);
+
+        for (const std::uint8_t expected_stratum : {1, 0})
+        {
+            std::array<std::uint8_t, 68> response = {{0}};
+            BOOST_CHECK(
+                client.receive(boost::asio::buffer(response), 0, error) ==
+                sntp::packet::minimum_packet_size());
+            BOOST_CHECK(response[1] == expected_stratum);
+            if (expected_stratum == 0)
+            {
+                BOOST_CHECK(response[12] == 'R' && response[15] == 'E');
+            }
+        }
+
+        sntp::rate_limiter drop_limiter(16, 60000, 1, false);
+        batch.set_rate_limiter(&drop_limiter);
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 9)),
+            server.local_endpoint());
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 10)),
+            server.local_endpoint());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 2);
+        BOOST_CHECK(batch.fill_server_values() == 1);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 1);
+        BOOST_CHECK(stats.get(counter::rate_limited) == 1);
+        batch.set_rate_limiter(nullptr);
+
+        std::array<std::uint8_t, 68> response = {{0}};
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(response), 0, error) ==
+            sntp::packet::minimum_packet_size());
+    }
+
+    // a request with a valid MAC gets a signed response, an invalid MAC is
+    // dropped
+    {
+        using counter = sntp::worker_stats::counter;
+        const std::array<std::uint8_t, 16> key =
+            {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}};
+        const sntp::cmac_aes128 cmac(key.data());
+        sntp::key_table keys;
+        keys.insert(1, std::make_unique<sntp::cmac_aes128>(key.data()));
+        batch.set_keys(&keys);
+
+        std::array<std::uint8_t, 68> signed_request = {{0}};
+        const request header = test::sntp::make_request(test::sntp::valid_client, 11);
+        std::memcpy(signed_request.data(), header.data(), header.size());
+        signed_request[51] = 1;
+        const sntp::packet::digest digest = cmac(header.data(), header.size());
+        std::memcpy(signed_request.data() + 52, digest.data(), digest.size());
+
+        std::array<std::uint8_t, 68> forged_request = signed_request;
+        forged_request[67] ^= 1;
+
+        client.send_to(boost::asio::buffer(signed_request), server.local_endpoint());
+        client.send_to(boost::asio::buffer(forged_request), server.local_endpoint());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 2);
+        BOOST_CHECK(batch.fill_server_values() == 1);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 1);
+        BOOST_CHECK(stats.get(counter::bad_mac) == 1);
+        BOOST_CHECK(stats.get(counter::authenticated) == 1);
+
+        std::array<std::uint8_t, 68> response = {{0}};
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(response), 0, error) ==
+            sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(response[test::sntp::originate_fractional_offset] == 11);
+        BOOST_CHECK(response[51] == 1);
+
+        const sntp::packet::digest expected =
+            cmac(response.data(), sntp::packet::minimum_packet_size());
+        BOOST_CHECK(std::memcmp(response.data() + 52, expected.data(), expected.size()) == 0);
+        batch.set_keys(nullptr);
+    }
+
+    // NTS requests get an authenticated response with a fresh cookie, or a
+    // "NTSN" Kiss-o'-Death if the authenticator is forged
+    {
+        using counter = sntp::worker_stats::counter;
+        const sntp::fingerprint::key master = sntp::fingerprint::random_key();
+        sntp::nts::responder responder(master, 3600);
+        batch.set_nts(&responder);
+
+        sntp::nts::session_keys keys;
+        keys.client_to_server.fill(1);
+        keys.server_to_client.fill(2);
+        std::vector<std::uint8_t> cookie(sntp::nts::cookie_keys::cookie_size);
+        responder.cookies().make(keys, sntp::nts::cookie_keys::now(), cookie.data());
+
+        const std::vector<std::uint8_t> valid = make_nts_request(12, cookie, keys);
+        std::vector<std::uint8_t> forged = make_nts_request(13, cookie, keys);
+        forged.back() ^= 1;
+
+        client.send_to(boost::asio::buffer(valid), server.local_endpoint());
+        client.send_to(boost::asio::buffer(forged), server.local_endpoint());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 2);
+        BOOST_CHECK(batch.fill_server_values() == 2);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 2);
+        BOOST_CHECK(stats.get(counter::nts) == 1);
+        BOOST_CHECK(stats.get(counter::nts_nak) == 1);
+
+        // header, unique identifier, authenticator with one cookie
+        std::array<std::uint8_t, 512> response = {{0}};
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(response), 0, error) ==
+            sntp::packet::minimum_packet_size() + 36 + 40 + 4 + cookie.size());
+        BOOST_CHECK(response[test::sntp::originate_fractional_offset] == 12);
+        BOOST_CHECK(response[1] == 1);
+
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(response), 0, error) ==
+            sntp::packet::minimum_packet_size() + 36);
+        BOOST_CHECK(response[1] == 0);
+        BOOST_CHECK(response[12] == 'N' && response[15] == 'N');
+        batch.set_nts(nullptr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,552 @@
+#include <array>
+#include <atomic>
+#include <boost/asio/buffer.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/spirit/include/qi_eoi.hpp>
+#include <boost/spirit/include/qi_parse.hpp>
+#include <boost/spirit/include/qi_sequence.hpp>
+#include <boost/spirit/include/qi_uint.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "authentication.hpp"
+#include "clock_source.hpp"
+#include "extension.hpp"
+#include "fingerprint.hpp"
+#include "nts.hpp"
+#include "packet.hpp"
+#include "packet_pool.hpp"
+#include "packet_view.hpp"
+#include "response_kernel.hpp"
+#include "timestamp.hpp"
+
+// Microbenchmarks of the request path. Each benchmark repeats an operation
+// until the minimum time has passed, and reports nanoseconds and heap
+// allocations per operation as JSON so that runs can be diffed.
+
+namespace
+{
+    // Counts every allocation made through the global operator new
+    std::atomic<std::uint64_t> allocations(0);
+
+    // Prevent the compiler from discarding a result
+    template<typename Type>
+    inline void escape(const Type& value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    struct result
+    {
+        std::string name;
+        std::uint64_t iterations;
+        double nanoseconds;
+        double allocations;
+    };
+
+    // Operations done at once by the batched benchmarks. Every count passed
+    // to a benchmark is a multiple of it, so none does more than count.
+    constexpr std::uint64_t batch_operations = 64;
+
+    // Smallest multiple of batch_operations not less than count
+    constexpr std::uint64_t whole_batches(const std::uint64_t count)
+    {
+        return (count + batch_operations - 1) / batch_operations * batch_operations;
+    }
+
+    result measure(
+        const char* const name,
+        const std::chrono::nanoseconds minimum_time,
+        const std::function<void(std::uint64_t)>& batch)
+    {
+        using clock = std::chrono::steady_clock;
+
+        // warm up caches and branch predictors
+        batch(whole_batches(1000));
+
+        std::uint64_t iterations = 0;
+        std::uint64_t batch_size = whole_batches(1000);
+        clock::duration elapsed = clock::duration::zero();
+        const std::uint64_t allocations_before = allocations.load();
+
+        while (elapsed < minimum_time)
+        {
+            const clock::time_point start = clock::now();
+            batch(batch_size);
+            elapsed += clock::now() - start;
+            iterations += batch_size;
+
+            // larger batches amortize the clock reads
+            if (batch_size < 1000000)
+            {
+                batch_size *= 2;
+            }
+        }
+
+        const std::uint64_t allocated = allocations.load() - allocations_before;
+        return result{
+            name,
+            iterations,
+            double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+                iterations,
+            double(allocated) / iterations};
+    }
+
+    // A version 4 client request, as it arrives from the network
+    std::array<std::uint8_t, 48> make_request()
+    {
+        std::array<std::uint8_t, 48> request = {{0}};
+        request[0] = 0x23;
+        request[40] = 0xDE;
+        request[41] = 0xAD;
+        request[42] = 0xBE;
+        request[43] = 0xEF;
+        return request;
+    }
+
+    void load_request(sntp::packet& destination, const std::array<std::uint8_t, 48>& request)
+    {
+        std::memcpy(
+            boost::asio::buffer_cast<void*>(destination.get_receive_buffer()),
+            request.data(),
+            request.size());
+    }
+
+    void display_results(const std::vector<result>& results)
+    {
+        std::cout << "{\n  \"benchmarks\": [";
+        for (std::size_t index = 0; index < results.size(); ++index)
+        {
+            const result& current = results[index];
+            std::cout << (index == 0 ? "\n" : ",\n") <<
+                "    {\"name\": \"" << current.name << "\", " <<
+                "\"iterations\": " << current.iterations << ", " <<
+                std::fixed << std::setprecision(2) <<
+                "\"ns_per_op\": " << current.nanoseconds << ", " <<
+                std::setprecision(3) <<
+                "\"allocations_per_op\": " << current.allocations << "}";
+        }
+        std::cout << "\n  ]\n}" << std::endl;
+    }
+
+    template<typename Integer>
+    bool parse_integer(const char* const value, Integer& parsed)
+    {
+        return boost::spirit::qi::parse(
+            value,
+            value + std::strlen(value),
+            (boost::spirit::qi::uint_parser<Integer>() >> boost::spirit::qi::eoi),
+            parsed);
+    }
+
+    int display_option_error(const char* const error, int argc, const char** argv)
+    {
+        if (argc == 0)
+        {
+            std::cerr << "Bad program" << std::endl;
+        }
+        else
+        {
+            std::cerr << error << "\n\n" <<
+                argv[0] << " [--time milliseconds] [--filter name]" << std::endl;
+        }
+        return EXIT_FAILURE;
+    }
+}
+
+void* operator new(const std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* const memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC 11+ flags the free of memory from (the replaced) operator new
+#if defined(__GNUC__) && !defined(__clang__) && 11 <= __GNUC__
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* const memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* const memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+int main(int argc, const char** argv)
+{
+    std::uint64_t milliseconds = 200;
+    const char* filter = "";
+
+    for (int argument = 1; argument < argc; argument += 2)
+    {
+        if (argument + 1 == argc)
+        {
+            return display_option_error("Option missing value", argc, argv);
+        }
+
+        if (std::strcmp(argv[argument], "--time") == 0)
+        {
+            if (!parse_integer(argv[argument + 1], milliseconds) || milliseconds == 0)
+            {
+                return display_option_error("Invalid time", argc, argv);
+            }
+        }
+        else if (std::strcmp(argv[argument], "--filter") == 0)
+        {
+            filter = argv[argument + 1];
+        }
+        else
+        {
+            return display_option_error("Unknown option", argc, argv);
+        }
+    }
+
+    const std::chrono::nanoseconds minimum_time =
+        std::chrono::milliseconds(milliseconds);
+    const std::array<std::uint8_t, 48> request = make_request();
+    const boost::posix_time::time_duration since_epoch =
+        boost::posix_time::microsec_clock::universal_time() -
+        boost::posix_time::ptime(boost::gregorian::date(1900, 1, 1));
+
+    ::timespec unix_time = {};
+    ::clock_gettime(CLOCK_REALTIME, &unix_time);
+
+    const sntp::timestamp server_time = sntp::timestamp::now();
+    const sntp::siphash_fingerprint siphash(sntp::fingerprint::random_key());
+    const sntp::sha256_fingerprint sha256(sntp::fingerprint::random_key());
+
+    sntp::packet_pool pool(1024);
+    sntp::packet single;
+
+    // Authenticated request with key 1 (AES-CMAC) or 2 (SHA-256)
+    const sntp::fingerprint::key mac_key = sntp::fingerprint::random_key();
+    sntp::key_table keys;
+    keys.insert(1, std::make_unique<sntp::cmac_aes128>(mac_key.data()));
+    keys.insert(2, std::make_unique<sntp::sha256_mac>(mac_key.data(), mac_key.size()));
+    const auto make_signed_request = [&keys, &request](const std::uint8_t key)
+    {
+        const sntp::mac& mac = *keys.find(key);
+        std::vector<std::uint8_t> signed_request(request.size() + 4 + mac.digest_size());
+        std::memcpy(signed_request.data(), request.data(), request.size());
+        signed_request[51] = key;
+        const sntp::mac::digest digest = mac.compute(request.data(), request.size());
+        std::memcpy(signed_request.data() + 52, digest.data(), mac.digest_size());
+        return signed_request;
+    };
+    const std::vector<std::uint8_t> cmac_request = make_signed_request(1);
+    const std::vector<std::uint8_t> sha256_request = make_signed_request(2);
+    const auto authenticated_request_path =
+        [&pool, &keys](const std::vector<std::uint8_t>& signed_request)
+    {
+        return [&pool, &keys, &signed_request](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                sntp::packet_pool::handle packet = pool.allocate();
+                std::memcpy(
+                    boost::asio::buffer_cast<void*>(packet->get_receive_buffer()),
+                    signed_request.data(),
+                    signed_request.size());
+                const sntp::packet_view request(
+                    sntp::packet_pool::get_datagram(*packet), signed_request.size());
+                const bool valid =
+                    keys.verify(request) == sntp::key_table::verification::valid;
+                escape(valid && request.fill_server_values() && keys.sign(request));
+            }
+        };
+    };
+
+    // NTS request: header, unique identifier, cookie, and authenticator
+    sntp::nts::responder responder(sntp::fingerprint::random_key(), 3600);
+    std::vector<std::uint8_t> nts_request(request.begin(), request.end());
+    {
+        sntp::nts::session_keys session;
+        session.client_to_server.fill(1);
+        session.server_to_client.fill(2);
+
+        const auto append_field = [&nts_request](const std::uint16_t type, const std::size_t size)
+        {
+            const std::uint8_t header[] = {
+                std::uint8_t(type >> 8), std::uint8_t(type), 0, std::uint8_t(4 + size)};
+            nts_request.insert(nts_request.end(), std::begin(header), std::end(header));
+            nts_request.resize(nts_request.size() + size);
+            return nts_request.data() + nts_request.size() - size;
+        };
+
+        append_field(sntp::nts::field::unique_identifier, 32);
+        responder.cookies().make(
+            session,
+            sntp::nts::cookie_keys::now(),
+            append_field(sntp::nts::field::cookie, sntp::nts::cookie_keys::cookie_size));
+
+        const std::size_t authenticated = nts_request.size();
+        std::uint8_t* const body = append_field(
+            sntp::nts::field::authenticator, 4 + 16 + sntp::aes_siv::tag_size);
+        body[1] = 16;
+        body[3] = sntp::aes_siv::tag_size;
+        sntp::aes_siv(session.client_to_server.data()).seal(
+            nts_request.data(), authenticated, body + 4, 16, nullptr, 0, body + 20);
+    }
+
+    // Receive buffers of a batch, for the per-packet cost of answering a
+    // batch with packet_view or the response_kernel. The clock is read once.
+    const std::size_t batch_size = batch_operations;
+    const std::size_t batch_stride = sntp::packet::maximum_datagram_size();
+    std::vector<std::uint8_t> batch_datagrams(batch_size * batch_stride);
+    const auto load_batch = [&batch_datagrams, &request, batch_size, batch_stride]()
+    {
+        for (std::size_t index = 0; index < batch_size; ++index)
+        {
+            std::memcpy(
+                batch_datagrams.data() + index * batch_stride, request.data(), request.size());
+        }
+    };
+    const auto kernel_batch_path = [&](const sntp::response_kernel::instruction_set isa)
+    {
+        return [&, isa](const std::uint64_t count)
+        {
+            const sntp::response_kernel kernel(isa);
+            std::array<sntp::packet::rejection, batch_size> rejections;
+            std::array<sntp::response_kernel::response, batch_size> responses;
+
+            for (std::uint64_t iteration = 0; iteration < count; iteration += batch_size)
+            {
+                load_batch();
+                const sntp::timestamp current = sntp::timestamp::now();
+                kernel.check_requests(
+                    batch_datagrams.data(), batch_stride, batch_size, rejections.data());
+
+                std::size_t accepted = 0;
+                for (std::size_t index = 0; index < batch_size; ++index)
+                {
+                    if (rejections[index] == sntp::packet::rejection::none)
+                    {
+                        responses[accepted++] = {
+                            batch_datagrams.data() + index * batch_stride, current, current};
+                    }
+                }
+                kernel.fill_responses(responses.data(), accepted);
+                escape(batch_datagrams.front());
+            }
+        };
+    };
+
+    std::vector<std::pair<const char*, std::function<void(std::uint64_t)>>> benchmarks = {
+        {"timestamp_now", [](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                escape(sntp::timestamp::now());
+            }
+        }},
+        {"timestamp_from_time_duration", [&since_epoch](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                escape(sntp::timestamp(since_epoch));
+            }
+        }},
+        {"timestamp_from_timespec", [&unix_time](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                escape(sntp::timestamp(unix_time));
+            }
+        }},
+        {"timestamp_from_server", [&server_time](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                const bool looped = server_time.from_server();
+                escape(looped);
+            }
+        }},
+        // per timestamp, 64 at a time
+        {"timestamp_from_server_together", [&server_time](const std::uint64_t count)
+        {
+            std::array<sntp::timestamp, batch_operations> stamps;
+            std::array<bool, batch_operations> looped;
+            stamps.fill(server_time);
+            for (std::uint64_t iteration = 0; iteration < count; iteration += stamps.size())
+            {
+                sntp::timestamp::from_server(stamps.data(), stamps.size(), looped.data());
+                escape(looped);
+            }
+        }},
+        {"fingerprint_siphash", [&siphash](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                escape(siphash(std::uint32_t(iteration), 0x12345000));
+            }
+        }},
+        // per fingerprint, 64 at a time
+        {"fingerprint_siphash_compute", [&siphash](const std::uint64_t count)
+        {
+            std::array<std::uint32_t, batch_operations> seconds;
+            std::array<std::uint32_t, batch_operations> fractional;
+            std::array<std::uint32_t, batch_operations> strings;
+            fractional.fill(0x12345000);
+            for (std::uint64_t iteration = 0; iteration < count; iteration += seconds.size())
+            {
+                for (std::size_t index = 0; index < seconds.size(); ++index)
+                {
+                    seconds[index] = std::uint32_t(iteration + index);
+                }
+                siphash.compute(
+                    seconds.data(), fractional.data(), seconds.size(), strings.data());
+                escape(strings);
+            }
+        }},
+        {"fingerprint_sha256", [&sha256](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                escape(sha256(std::uint32_t(iteration), 0x12345000));
+            }
+        }},
+        {"packet_pool_allocate", [&pool](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                sntp::packet_pool::handle packet = pool.allocate();
+                escape(packet);
+            }
+        }},
+        // includes copying the 48 byte request into the packet
+        {"packet_fill_server_values", [&single, &request](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                load_request(single, request);
+                escape(single.fill_server_values());
+            }
+        }},
+        {"packet_fill_server_values_single_clock_read",
+         [&single, &request](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                load_request(single, request);
+                escape(single.fill_server_values(sntp::timestamp::now()));
+            }
+        }},
+        // the per-request work of the server, without I/O
+        {"request_path", [&pool, &request](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+            {
+                sntp::packet_pool::handle packet = pool.allocate();
+                load_request(*packet, request);
+                escape(packet->fill_server_values());
+            }
+        }},
+        // request_path with MAC verification and signing
+        {"request_path_cmac", authenticated_request_path(cmac_request)},
+        {"request_path_sha256", authenticated_request_path(sha256_request)},
+        {"request_path_nts", [&responder, &nts_request](const std::uint64_t count)
+            {
+                std::array<std::uint8_t, 512> datagram;
+                for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+                {
+                    std::memcpy(datagram.data(), nts_request.data(), nts_request.size());
+                    sntp::nts::responder::request state;
+                    const bool valid =
+                        responder.verify(
+                            datagram.data(),
+                            sntp::extension_fields::parse(datagram.data(), nts_request.size()),
+                            state) ==
+                        sntp::nts::responder::status::valid;
+                    escape(
+                        valid &&
+                        sntp::packet_view(datagram.data(), nts_request.size())
+                            .fill_server_values(sntp::timestamp::now()) &&
+                        responder.seal(datagram.data(), state) != 0);
+                }
+            }},
+        // per packet, in batches of 64, with one clock read per batch
+        {"batch_path_packet_view", [&](const std::uint64_t count)
+        {
+            for (std::uint64_t iteration = 0; iteration < count; iteration += batch_size)
+            {
+                load_batch();
+                const sntp::timestamp current = sntp::timestamp::now();
+                for (std::size_t index = 0; index < batch_size; ++index)
+                {
+                    const sntp::packet_view datagram(
+                        batch_datagrams.data() + index * batch_stride,
+                        sntp::packet::minimum_packet_size());
+                    escape(datagram.fill_server_values(current));
+                }
+            }
+        }}
+    };
+
+    {
+        using instruction_set = sntp::response_kernel::instruction_set;
+        const std::pair<instruction_set, const char*> kernels[] = {
+            {instruction_set::scalar, "batch_path_kernel_scalar"},
+            {instruction_set::sse2, "batch_path_kernel_sse2"},
+            {instruction_set::avx2, "batch_path_kernel_avx2"}};
+
+        for (const auto& kernel : kernels)
+        {
+            if (sntp::response_kernel::supported(kernel.first))
+            {
+                benchmarks.emplace_back(kernel.second, kernel_batch_path(kernel.first));
+            }
+        }
+    }
+
+    // Reading the time, without converting it to a timestamp
+    {
+        const auto read_clock = [](const std::shared_ptr<const sntp::clock_source>& source)
+        {
+            return [source](const std::uint64_t count)
+            {
+                for (std::uint64_t iteration = 0; iteration < count; ++iteration)
+                {
+                    escape(source->now());
+                }
+            };
+        };
+
+        benchmarks.emplace_back(
+            "clock_source_realtime", read_clock(std::make_shared<sntp::realtime_clock>()));
+        if (sntp::tsc_clock::supported())
+        {
+            benchmarks.emplace_back(
+                "clock_source_tsc", read_clock(std::make_shared<sntp::tsc_clock>()));
+        }
+    }
+
+    std::vector<result> results;
+    for (const auto& benchmark : benchmarks)
+    {
+        if (std::strstr(benchmark.first, filter) != nullptr)
+        {
+            results.push_back(
+                measure(benchmark.first, minimum_time, benchmark.second));
+        }
+    }
+
+    display_results(results);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include <atomic>
+#include <boost/test/minimal.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "clock_source.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    std::int64_t nanoseconds(const ::timespec& time)
+    {
+        return std::int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    std::int64_t realtime()
+    {
+        ::timespec current = {};
+        ::clock_gettime(CLOCK_REALTIME, &current);
+        return nanoseconds(current);
+    }
+
+    // The source is read between two reads of CLOCK_REALTIME
+    bool agrees(const sntp::clock_source& source, const std::int64_t tolerance)
+    {
+        const std::int64_t before = realtime();
+        const ::timespec current = source.now();
+        const std::int64_t after = realtime();
+
+        return 0 <= current.tv_nsec && current.tv_nsec < 1000000000 &&
+            before - tolerance <= nanoseconds(current) &&
+            nanoseconds(current) <= after + tolerance;
+    }
+
+    const std::int64_t microsecond = 1000;
+}
+
+int test_main(int, char**)
+{
+    {
+        const sntp::realtime_clock source;
+        BOOST_CHECK(std::strcmp(source.name(), "realtime") == 0);
+        BOOST_CHECK(agrees(source, 0));
+    }
+
+    // realtime when the TSC cannot be used
+    {
+        const std::unique_ptr<const sntp::clock_source> source = sntp::make_tsc_clock();
+        BOOST_CHECK(
+            std::strcmp(source->name(), sntp::tsc_clock::supported() ? "tsc" : "realtime") == 0);
+        BOOST_CHECK(agrees(*source, 500 * microsecond));
+    }
+
+    // a step of the system clock during one period is ignored, a new rate
+    // is taken after two periods agree on it
+    {
+        const std::uint64_t nominal = std::uint64_t(1) << 32;
+        const std::uint64_t slewed = nominal + nominal / 4000;      // 250 ppm
+        const std::uint64_t stepped = nominal + nominal / 100;
+        const std::uint64_t changed = nominal + nominal / 1000;     // 1000 ppm
+
+        sntp::tick_rate_filter filter;
+        BOOST_CHECK(filter.tick_length() == 0);
+        BOOST_CHECK(filter.update(nominal) == nominal);
+        BOOST_CHECK(filter.update(nominal) == nominal);
+        BOOST_CHECK(filter.update(slewed) == slewed);
+
+        BOOST_CHECK(filter.update(stepped) == slewed);
+        BOOST_CHECK(filter.update(slewed) == slewed);
+
+        BOOST_CHECK(filter.update(changed) == slewed);
+        BOOST_CHECK(filter.update(changed) == changed);
+        BOOST_CHECK(filter.tick_length() == changed);
+    }
+
+    // a bad initial calibration is replaced by the first periodic one, and
+    // a bad first periodic one by the two after it
+    {
+        const std::uint64_t nominal = std::uint64_t(1) << 32;
+        const std::uint64_t stepped = nominal * 2;
+
+        sntp::tick_rate_filter initial;
+        BOOST_CHECK(initial.update(stepped) == stepped);
+        BOOST_CHECK(initial.update(nominal) == nominal);
+
+        sntp::tick_rate_filter first_period;
+        BOOST_CHECK(first_period.update(nominal) == nominal);
+        BOOST_CHECK(first_period.update(stepped) == stepped);
+        BOOST_CHECK(first_period.update(nominal) == stepped);
+        BOOST_CHECK(first_period.update(nominal) == nominal);
+    }
+
+    if (!sntp::tsc_clock::supported())
+    {
+        return 0;
+    }
+
+    // follows CLOCK_REALTIME across background calibrations
+    {
+        const sntp::tsc_clock source(std::chrono::milliseconds(5));
+        for (unsigned round = 0; round < 10; ++round)
+        {
+            BOOST_CHECK(agrees(source, 500 * microsecond));
+            std::this_thread::sleep_for(std::chrono::milliseconds(7));
+        }
+    }
+
+    // never goes backwards between calibrations
+    {
+        const sntp::tsc_clock source(std::chrono::hours(1));
+        std::int64_t previous = nanoseconds(source.now());
+        bool monotonic = true;
+        for (unsigned read = 0; read < 100000; ++read)
+        {
+            const std::int64_t current = nanoseconds(source.now());
+            monotonic = monotonic && previous <= current;
+            previous = current;
+        }
+        BOOST_CHECK(monotonic);
+    }
+
+    // readers never see a partially published calibration
+    {
+        sntp::tsc_clock source(std::chrono::hours(1));
+        std::atomic<bool> done(false);
+        std::atomic<unsigned> disagreements(0);
+
+        std::vector<std::thread> readers;
+        for (unsigned reader = 0; reader < 2; ++reader)
+        {
+            readers.emplace_back(
+                [&source, &done, &disagreements]
+                {
+                    while (!done.load())
+                    {
+                        if (!agrees(source, 50000 * microsecond))
+                        {
+                            ++disagreements;
+                        }
+                    }
+                });
+        }
+
+        for (unsigned calibration = 0; calibration < 20000; ++calibration)
+        {
+            source.calibrate();
+        }
+
+        done = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        BOOST_CHECK(disagreements == 0);
+    }
+
+    // timestamps from the clock source
+    {
+        sntp::timestamp::set_clock_source(std::make_unique<sntp::tsc_clock>());
+
+        const sntp::timestamp current = sntp::timestamp::now();
+        BOOST_CHECK(current != sntp::timestamp());
+        BOOST_CHECK(current.from_server());
+
+        sntp::timestamp deferred = sntp::timestamp::now_deferred();
+        sntp::timestamp::generate_crypto_strings(&deferred, 1);
+        BOOST_CHECK(deferred.from_server());
+
+        // NTP seconds agree with CLOCK_REALTIME
+        std::uint8_t seconds[4];
+        std::memcpy(seconds, &current, sizeof(seconds));
+        const std::uint32_t ntp_seconds =
+            (std::uint32_t(seconds[0]) << 24) | (std::uint32_t(seconds[1]) << 16) |
+            (std::uint32_t(seconds[2]) << 8) | seconds[3];
+        const std::uint32_t expected = std::uint32_t(realtime() / 1000000000) + 2208988800U;
+        BOOST_CHECK(expected - ntp_seconds <= 1);
+
+        sntp::timestamp::set_clock_source(nullptr);
+        BOOST_CHECK(sntp::timestamp::now().from_server());
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "extension.hpp"
+#include "packet.hpp"
+
+namespace
+{
+    using bytes = std::vector<std::uint8_t>;
+
+    const std::size_t header_size = sntp::packet::minimum_packet_size();
+
+    void append_field(bytes& data, const std::uint16_t type, const std::size_t size)
+    {
+        data.push_back(std::uint8_t(type >> 8));
+        data.push_back(std::uint8_t(type));
+        data.push_back(std::uint8_t(size >> 8));
+        data.push_back(std::uint8_t(size));
+        for (std::size_t byte = 4; byte < size; ++byte)
+        {
+            data.push_back(std::uint8_t(byte));
+        }
+    }
+
+    sntp::extension_fields parse(const bytes& datagram)
+    {
+        return sntp::extension_fields::parse(datagram.data(), datagram.size());
+    }
+}
+
+int test_main(int, char**)
+{
+    // a plain request, or a request with only a MAC, has no fields
+    {
+        const bytes plain(header_size);
+        BOOST_CHECK(parse(plain).valid());
+        BOOST_CHECK(parse(plain).empty());
+        BOOST_CHECK(parse(plain).mac_size() == 0);
+
+        const bytes md5(sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(parse(md5).valid());
+        BOOST_CHECK(parse(md5).empty());
+        BOOST_CHECK(parse(md5).mac_size() == 20);
+
+        const bytes sha1(header_size + 24);
+        BOOST_CHECK(parse(sha1).valid());
+        BOOST_CHECK(parse(sha1).mac_size() == 24);
+
+        const bytes short_packet(header_size - 1);
+        BOOST_CHECK(!parse(short_packet).valid());
+        BOOST_CHECK(parse(short_packet).empty());
+    }
+
+    // fields are visited in place, in order
+    {
+        bytes datagram(header_size);
+        append_field(datagram, 0x0104, 36);
+        append_field(datagram, 0x2005, 16);
+        append_field(datagram, 0x0404, 28);
+
+        const sntp::extension_fields fields = parse(datagram);
+        BOOST_REQUIRE(fields.valid());
+        BOOST_CHECK(!fields.empty());
+        BOOST_CHECK(fields.mac_size() == 0);
+        BOOST_CHECK(std::distance(fields.begin(), fields.end()) == 3);
+
+        sntp::extension_fields::iterator field = fields.begin();
+        BOOST_CHECK((*field).type() == 0x0104);
+        BOOST_CHECK((*field).size() == 36);
+        BOOST_CHECK((*field).data() == datagram.data() + header_size);
+        BOOST_CHECK((*field).body() == datagram.data() + header_size + 4);
+        BOOST_CHECK((*field).body_size() == 32);
+        BOOST_CHECK((*field).body()[0] == 4);
+
+        ++field;
+        BOOST_CHECK((*field).type() == 0x2005);
+        BOOST_CHECK((*field).data() == datagram.data() + header_size + 36);
+
+        BOOST_CHECK((*field++).size() == 16);
+        BOOST_CHECK((*field).type() == 0x0404);
+        BOOST_CHECK(++field == fields.end());
+
+        // followed by a MAC
+        datagram.resize(datagram.size() + 20);
+        BOOST_REQUIRE(parse(datagram).valid());
+        BOOST_CHECK(parse(datagram).mac_size() == 20);
+        BOOST_CHECK(std::distance(parse(datagram).begin(), parse(datagram).end()) == 3);
+    }
+
+    // every malformed length is rejected, and leaves an empty view
+    {
+        bytes too_small(header_size);
+        append_field(too_small, 0x2005, 12);
+        append_field(too_small, 0x2005, 32);
+        BOOST_CHECK(!parse(too_small).valid());
+        BOOST_CHECK(parse(too_small).empty());
+
+        bytes unaligned(header_size);
+        append_field(unaligned, 0x2005, 30);
+        unaligned.resize(unaligned.size() + 2);
+        BOOST_CHECK(!parse(unaligned).valid());
+
+        bytes overflow(header_size);
+        append_field(overflow, 0x2005, 32);
+        overflow.resize(overflow.size() - 4);
+        BOOST_CHECK(!parse(overflow).valid());
+        BOOST_CHECK(parse(overflow).begin() == parse(overflow).end());
+
+        bytes trailing(header_size);
+        append_field(trailing, 0x2005, 32);
+        trailing.resize(trailing.size() + 8);
+        BOOST_CHECK(!parse(trailing).valid());
+
+        // a remainder that is not a MAC size must be a field
+        bytes small_last(header_size);
+        append_field(small_last, 0x2005, 32);
+        append_field(small_last, 0x2005, 16);
+        BOOST_CHECK(parse(small_last).valid());
+        BOOST_CHECK(parse(small_last).mac_size() == 0);
+        BOOST_CHECK(std::distance(parse(small_last).begin(), parse(small_last).end()) == 2);
+
+        small_last.resize(small_last.size() + 16);
+        BOOST_CHECK(!parse(small_last).valid());
+    }
+
+    // a sequence of fields has no header, and no MAC
+    {
+        bytes sequence;
+        append_field(sequence, 0x0304, 104);
+        append_field(sequence, 0x0304, 20);
+
+        const sntp::extension_fields fields(sequence.data(), sequence.size());
+        BOOST_CHECK(fields.valid());
+        BOOST_CHECK(fields.mac_size() == 0);
+        BOOST_CHECK(std::distance(fields.begin(), fields.end()) == 2);
+
+        const sntp::extension_fields empty(sequence.data(), 0);
+        BOOST_CHECK(empty.valid());
+        BOOST_CHECK(empty.empty());
+
+        BOOST_CHECK(!sntp::extension_fields(sequence.data(), sequence.size() - 4).valid());
+
+        const bytes mac(20);
+        BOOST_CHECK(!sntp::extension_fields(mac.data(), mac.size()).valid());
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <boost/test/minimal.hpp>
+#include <cryptopp/sha.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "fingerprint.hpp"
+
+namespace
+{
+    sntp::fingerprint::key make_sequential_key()
+    {
+        sntp::fingerprint::key sequential = {{0}};
+        for (std::uint8_t index = 0; index < sequential.size(); ++index)
+        {
+            sequential[index] = index;
+        }
+        return sequential;
+    }
+
+    // Load the sequential bytes 00 01 .. 07 as SipHash does
+    const std::uint64_t sequential_message = 0x0706050403020100ULL;
+}
+
+int test_main(int, char**)
+{
+    {
+        // reference vector from the SipHash paper (8 byte message)
+        const sntp::siphash_fingerprint engine(make_sequential_key());
+        BOOST_CHECK(engine.hash(sequential_message) == 0x93F5F5799A932462ULL);
+
+        std::uint32_t seconds = 0;
+        std::uint32_t fractional = 0;
+        const std::uint8_t bytes[] = {0, 1, 2, 3, 4, 5, 6, 7};
+        std::memcpy(&seconds, bytes, sizeof(seconds));
+        std::memcpy(&fractional, bytes + sizeof(seconds), sizeof(fractional));
+        BOOST_CHECK(engine(seconds, fractional) == 0x9A932462);
+    }
+    {
+        // matches the original SHA-256 construction
+        const sntp::fingerprint::key secret = make_sequential_key();
+        const sntp::sha256_fingerprint engine(secret);
+
+        const std::uint32_t seconds = 0xDEADBEEF;
+        const std::uint32_t fractional = 0xBEEFDEAD;
+
+        std::uint8_t digest[CryptoPP::SHA256::DIGESTSIZE] = {};
+        CryptoPP::SHA256 hash;
+        hash.Update(secret.data(), secret.size());
+        hash.Update(reinterpret_cast<const std::uint8_t*>(&seconds), sizeof(seconds));
+        hash.Update(
+            reinterpret_cast<const std::uint8_t*>(&fractional), sizeof(fractional));
+        hash.Final(digest);
+
+        std::uint32_t expected = 0;
+        std::memcpy(&expected, digest, sizeof(expected));
+        BOOST_CHECK(engine(seconds, fractional) == expected);
+
+        // state is reused, not consumed
+        BOOST_CHECK(engine(seconds, fractional) == expected);
+    }
+    {
+        // different keys give different results
+        const sntp::fingerprint::key first = sntp::fingerprint::random_key();
+        sntp::fingerprint::key second = first;
+        second[0] = ~second[0];
+
+        const sntp::siphash_fingerprint first_engine(first);
+        const sntp::siphash_fingerprint second_engine(second);
+        BOOST_CHECK(first_engine(1, 2) == first_engine(1, 2));
+        BOOST_CHECK(
+            first_engine.hash(sequential_message) !=
+            second_engine.hash(sequential_message));
+
+        // rekey keeps the engine, with only the key changed
+        const std::unique_ptr<const sntp::fingerprint> rekeyed = first_engine.rekey(second);
+        BOOST_CHECK(dynamic_cast<const sntp::siphash_fingerprint*>(rekeyed.get()));
+        BOOST_CHECK((*rekeyed)(1, 2) == second_engine(1, 2));
+
+        const sntp::sha256_fingerprint first_sha256(first);
+        const sntp::sha256_fingerprint second_sha256(second);
+        const std::unique_ptr<const sntp::fingerprint> rekeyed_sha256 = first_sha256.rekey(second);
+        BOOST_CHECK(dynamic_cast<const sntp::sha256_fingerprint*>(rekeyed_sha256.get()));
+        BOOST_CHECK((*rekeyed_sha256)(1, 2) == second_sha256(1, 2));
+    }
+    {
+        // fingerprints computed together match those computed one at a
+        // time, for counts that use every lane width and the remainder
+        const sntp::fingerprint::key secret = sntp::fingerprint::random_key();
+        const sntp::siphash_fingerprint siphash(secret);
+        const sntp::sha256_fingerprint sha256(secret);
+
+        for (std::uint32_t count = 0; count <= 40; ++count)
+        {
+            std::vector<std::uint32_t> seconds;
+            std::vector<std::uint32_t> fractional;
+            for (std::uint32_t index = 0; index < count; ++index)
+            {
+                seconds.push_back(0x9E3779B9 * (index + count));
+                fractional.push_back(0x7F4A7C15 ^ (index << 20));
+            }
+
+            for (const sntp::fingerprint* const engine :
+                     {static_cast<const sntp::fingerprint*>(&siphash),
+                      static_cast<const sntp::fingerprint*>(&sha256)})
+            {
+                std::vector<std::uint32_t> strings(count + 1, 0xA5A5A5A5);
+                engine->compute(seconds.data(), fractional.data(), count, strings.data());
+                for (std::uint32_t index = 0; index < count; ++index)
+                {
+                    BOOST_CHECK(strings[index] == (*engine)(seconds[index], fractional[index]));
+                }
+                BOOST_CHECK(strings[count] == 0xA5A5A5A5);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+#include "histogram.hpp"
+
+int test_main(int, char**)
+{
+    {
+        const sntp::histogram empty;
+        BOOST_CHECK(empty.count() == 0);
+        BOOST_CHECK(empty.minimum() == 0);
+        BOOST_CHECK(empty.maximum() == 0);
+        BOOST_CHECK(empty.percentile(0.5) == 0);
+    }
+
+    // small values are exact
+    {
+        sntp::histogram values;
+        for (std::uint64_t value = 1; value <= 20; ++value)
+        {
+            values.record(value);
+        }
+
+        BOOST_CHECK(values.count() == 20);
+        BOOST_CHECK(values.minimum() == 1);
+        BOOST_CHECK(values.maximum() == 20);
+        BOOST_CHECK(values.percentile(0.0) == 1);
+        BOOST_CHECK(values.percentile(0.5) == 10);
+        BOOST_CHECK(values.percentile(0.95) == 19);
+        BOOST_CHECK(values.percentile(1.0) == 20);
+    }
+
+    // larger values are within 1/16
+    {
+        sntp::histogram values;
+        for (std::uint64_t value = 1; value <= 1000000; ++value)
+        {
+            values.record(value * 1000);
+        }
+
+        const auto near = [](const std::uint64_t actual, const std::uint64_t expected)
+        {
+            return expected <= actual && actual <= expected + expected / 16;
+        };
+
+        BOOST_CHECK(near(values.percentile(0.5), 500000000));
+        BOOST_CHECK(near(values.percentile(0.99), 990000000));
+        BOOST_CHECK(near(values.percentile(0.999), 999000000));
+        BOOST_CHECK(values.percentile(1.0) == 1000000000);
+    }
+
+    // extremes, and merging
+    {
+        sntp::histogram low;
+        low.record(0);
+
+        sntp::histogram high;
+        high.record(std::numeric_limits<std::uint64_t>::max());
+
+        low.merge(high);
+        BOOST_CHECK(low.count() == 2);
+        BOOST_CHECK(low.minimum() == 0);
+        BOOST_CHECK(low.maximum() == std::numeric_limits<std::uint64_t>::max());
+        BOOST_CHECK(low.percentile(0.5) == 0);
+        BOOST_CHECK(
+            low.percentile(1.0) == std::numeric_limits<std::uint64_t>::max());
+
+        const sntp::histogram copy(low);
+        BOOST_CHECK(copy.count() == 2);
+        BOOST_CHECK(copy.minimum() == 0);
+        BOOST_CHECK(copy.maximum() == std::numeric_limits<std::uint64_t>::max());
+
+        low.clear();
+        BOOST_CHECK(low.count() == 0);
+        BOOST_CHECK(low.maximum() == 0);
+        BOOST_CHECK(copy.count() == 2);
+    }
+
+    // readers merge while a single thread records
+    {
+        sntp::histogram values;
+        std::thread writer(
+            [&values]
+            {
+                for (std::uint64_t value = 1; value <= 100000; ++value)
+                {
+                    values.record(value);
+                }
+            });
+
+        std::uint64_t last_count = 0;
+        for (unsigned read = 0; read < 100; ++read)
+        {
+            sntp::histogram merged;
+            merged.merge(values);
+            BOOST_CHECK(last_count <= merged.count());
+            BOOST_CHECK(merged.percentile(1.0) <= 100000);
+            last_count = merged.count();
+        }
+        writer.join();
+
+        BOOST_CHECK(values.count() == 100000);
+        BOOST_CHECK(values.maximum() == 100000);
+    }
+
+    return 0;
+}
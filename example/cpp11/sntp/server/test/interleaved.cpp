@@ -0,0 +1,134 @@
+#include <array>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+
+#include "batch.hpp"
+#include "interleaved.hpp"
+#include "packet_util.hpp"
+
+namespace
+{
+    using response = std::array<std::uint8_t, 68>;
+
+    sntp::timestamp make_timestamp(const std::uint32_t seconds)
+    {
+        const ::timespec unix_time = {seconds, 0};
+        return sntp::timestamp(unix_time);
+    }
+
+    response exchange(
+        boost::asio::ip::udp::socket& client,
+        boost::asio::ip::udp::socket& server,
+        sntp::batch& batch,
+        const std::array<std::uint8_t, 48>& request)
+    {
+        client.send_to(boost::asio::buffer(request), server.local_endpoint());
+
+        boost::system::error_code error;
+        BOOST_CHECK(batch.receive(server.native_handle(), error) == 1);
+        BOOST_CHECK(batch.fill_server_values() == 1);
+        BOOST_CHECK(batch.send(server.native_handle(), error) == 1);
+
+        response received = {{0}};
+        BOOST_CHECK(
+            client.receive(boost::asio::buffer(received), 0, error) ==
+            sntp::packet::minimum_packet_size());
+        return received;
+    }
+}
+
+int test_main(int, char**)
+{
+    {
+        sntp::interleaved_table table(5);
+        BOOST_CHECK(table.capacity() == 8);
+
+        const sntp::timestamp first_receive = make_timestamp(1);
+        const sntp::timestamp first_transmit = make_timestamp(2);
+        BOOST_CHECK(table.find(first_receive) == nullptr);
+        BOOST_CHECK(table.find(sntp::timestamp()) == nullptr);
+
+        table.insert(first_receive, first_transmit);
+        BOOST_CHECK(table.find(first_receive) != nullptr);
+        BOOST_CHECK(*table.find(first_receive) == first_transmit);
+        BOOST_CHECK(table.find(make_timestamp(2)) == nullptr);
+
+        // zero is never a valid key
+        table.insert(sntp::timestamp(), first_transmit);
+        BOOST_CHECK(table.find(sntp::timestamp()) == nullptr);
+    }
+    {
+        // a single entry table always replaces
+        sntp::interleaved_table table(1);
+        BOOST_CHECK(table.capacity() == 1);
+        table.insert(make_timestamp(1), make_timestamp(2));
+        table.insert(make_timestamp(3), make_timestamp(4));
+        BOOST_CHECK(table.find(make_timestamp(1)) == nullptr);
+        BOOST_CHECK(*table.find(make_timestamp(3)) == make_timestamp(4));
+    }
+    {
+        boost::asio::io_service service;
+        const boost::asio::ip::udp::endpoint loopback(
+            boost::asio::ip::address_v4::loopback(), 0);
+
+        boost::asio::ip::udp::socket server(service, loopback);
+        boost::asio::ip::udp::socket client(service, loopback);
+        server.non_blocking(true);
+        client.non_blocking(true);
+
+        BOOST_CHECK(!sntp::transmit_timestamps::enable(server.native_handle()));
+
+        sntp::interleaved_table table(64);
+        sntp::transmit_timestamps transmitted(4);
+        sntp::batch batch(4);
+        batch.set_interleaved_table(&table);
+
+        // basic mode exchange
+        std::array<std::uint8_t, 48> request = {{0}};
+        request[0] = test::sntp::valid_client;
+        request[test::sntp::transmit_fractional_offset] = 1;
+        const response first = exchange(client, server, batch, request);
+        BOOST_CHECK(first[test::sntp::originate_fractional_offset] == 1);
+
+        // kernel transmit time of the first response is recorded
+        boost::system::error_code error;
+        BOOST_CHECK(transmitted.drain(server.native_handle(), table, error) == 1);
+        BOOST_CHECK(!error);
+        BOOST_CHECK(transmitted.drain(server.native_handle(), table, error) == 0);
+        BOOST_CHECK(!error);
+
+        // interleaved request: originate is the last server receive time,
+        // and receive is a client chosen value.
+        std::copy(
+            first.begin() + test::sntp::receive_timestamp_offset,
+            first.begin() + test::sntp::receive_timestamp_offset + 8,
+            request.begin() + test::sntp::originate_timestamp_offset);
+        request[test::sntp::receive_fractional_offset] = 2;
+        request[test::sntp::transmit_fractional_offset] = 3;
+
+        const response second = exchange(client, server, batch, request);
+        BOOST_CHECK(second[test::sntp::originate_fractional_offset] == 2);
+
+        // transmit is the kernel time of the first response, which is after
+        // the transmit time in the first response, and before the receive
+        // time of the second request.
+        const std::uint64_t previous_transmit =
+            test::sntp::extract_time(second, test::sntp::transmit_timestamp_offset);
+        BOOST_CHECK(
+            test::sntp::extract_time(first, test::sntp::transmit_timestamp_offset) <=
+            previous_transmit);
+        BOOST_CHECK(
+            previous_transmit <=
+            test::sntp::extract_time(second, test::sntp::receive_timestamp_offset));
+
+        // unknown originate gets a basic response
+        request[test::sntp::originate_fractional_offset] ^= 0xFF;
+        request[test::sntp::transmit_fractional_offset] = 4;
+        const response third = exchange(client, server, batch, request);
+        BOOST_CHECK(third[test::sntp::originate_fractional_offset] == 4);
+    }
+    return 0;
+}
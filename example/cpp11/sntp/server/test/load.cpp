@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <array>
+#include <arpa/inet.h>
+#include <atomic>
+#include <boost/asio/detail/socket_ops.hpp>
+#include <boost/spirit/include/qi_eoi.hpp>
+#include <boost/spirit/include/qi_parse.hpp>
+#include <boost/spirit/include/qi_sequence.hpp>
+#include <boost/spirit/include/qi_uint.hpp>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "histogram.hpp"
+#include "packet_util.hpp"
+
+// Load generator for the sntp server. Each thread owns several sockets
+// (source ports), and either keeps a fixed number of requests in flight
+// per socket (closed loop), or sends at a fixed rate regardless of
+// responses (open loop). Requests are matched to responses with the
+// originate timestamp that the server echoes. The server drops about 1 in
+// 2^(31 - precision) requests as loops, because their transmit timestamp
+// happens to carry a valid fingerprint (one insignificant bit is the key
+// parity). These show up as lost.
+
+namespace
+{
+    const std::uint8_t client_request = 0x23; // version 4, client mode
+    const std::uint8_t mode_mask = 0x07;
+    const std::uint8_t server_mode = 0x04;
+    const std::size_t request_size = 48;
+
+    // Most requests sent per socket per loop iteration
+    const std::size_t send_burst = 32;
+
+    const std::size_t minimum_slots = 1 << 16;
+
+    struct options
+    {
+        options() :
+            address(),
+            port(0),
+            threads(1),
+            sockets(4),
+            in_flight(8),
+            rate(0),
+            open_loop(false),
+            duration(10),
+            timeout(1000)
+        {
+        }
+
+        ::in_addr address;
+        std::uint16_t port;
+        std::size_t threads;
+        std::size_t sockets;   // per thread
+        std::size_t in_flight; // per socket, closed loop only
+        std::uint64_t rate;    // requests per second, all threads
+        bool open_loop;
+        std::uint64_t duration; // seconds
+        std::uint64_t timeout;  // milliseconds
+    };
+
+    std::uint64_t monotonic_nanoseconds()
+    {
+        ::timespec current = {};
+        ::clock_gettime(CLOCK_MONOTONIC, &current);
+        return std::uint64_t(current.tv_sec) * 1000000000 + current.tv_nsec;
+    }
+
+    std::system_error last_error(const char* const what)
+    {
+        return std::system_error(errno, std::system_category(), what);
+    }
+
+    // Results of one thread, merged at the end
+    struct results
+    {
+        results() :
+            sent(0),
+            received(0),
+            lost(0),
+            invalid(0),
+            latency()
+        {
+        }
+
+        void merge(const results& other)
+        {
+            sent += other.sent;
+            received += other.received;
+            lost += other.lost;
+            invalid += other.invalid;
+            latency.merge(other.latency);
+        }
+
+        std::uint64_t sent;
+        std::uint64_t received;
+        std::uint64_t lost;     // no response within the timeout
+        std::uint64_t invalid;  // unexpected, late, or malformed responses
+        sntp::histogram latency; // nanoseconds
+    };
+
+    class load_thread
+    {
+    public:
+
+        load_thread(const options& config, const std::uint64_t rate) :
+            config_(config),
+            rate_(rate),
+            sockets_(),
+            polls_(),
+            outstanding_(),
+            in_flight_(config.sockets, 0),
+            sequence_(0),
+            oldest_(0),
+            next_socket_(0),
+            results_()
+        {
+            ::sockaddr_in server = {};
+            server.sin_family = AF_INET;
+            server.sin_addr = config.address;
+            server.sin_port = htons(config.port);
+
+            for (std::size_t index = 0; index < config.sockets; ++index)
+            {
+                const int socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+                if (socket < 0)
+                {
+                    throw last_error("socket");
+                }
+                sockets_.push_back(socket);
+
+                if (::connect(
+                        socket,
+                        reinterpret_cast<const ::sockaddr*>(&server),
+                        sizeof(server)) != 0)
+                {
+                    throw last_error("connect");
+                }
+
+                ::pollfd poll = {};
+                poll.fd = socket;
+                poll.events = POLLIN;
+                polls_.push_back(poll);
+            }
+
+            // Enough slots for every request that can be outstanding
+            // before it times out. In closed loop, a single lost request
+            // holds back the oldest slot while the others keep cycling.
+            std::size_t capacity = std::max<std::size_t>(
+                config.sockets * config.in_flight, minimum_slots);
+            if (rate_ != 0 || config.open_loop)
+            {
+                const std::uint64_t per_timeout =
+                    rate_ != 0 ? rate_ * config.timeout / 1000 + 1 : 1 << 20;
+                capacity = std::size_t(std::min<std::uint64_t>(per_timeout, 1 << 22));
+            }
+
+            std::size_t slots = 1;
+            while (slots < capacity * 2)
+            {
+                slots <<= 1;
+            }
+            outstanding_.resize(slots);
+        }
+
+        ~load_thread()
+        {
+            for (const int socket : sockets_)
+            {
+                ::close(socket);
+            }
+        }
+
+        load_thread(const load_thread&) = delete;
+        load_thread& operator=(const load_thread&) = delete;
+
+        void run(const std::atomic<bool>& stop)
+        {
+            const std::uint64_t start = monotonic_nanoseconds();
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                const std::uint64_t now = monotonic_nanoseconds();
+                expire(now);
+                send_requests(now, start);
+                wait_for_responses(now, start);
+            }
+
+            // collect late responses, then count the remainder as lost
+            const std::uint64_t drain_end =
+                monotonic_nanoseconds() + config_.timeout * 1000000;
+            while (oldest_ != sequence_ && monotonic_nanoseconds() < drain_end)
+            {
+                expire(monotonic_nanoseconds());
+                wait_for_responses(monotonic_nanoseconds(), start);
+            }
+            expire(std::numeric_limits<std::uint64_t>::max());
+        }
+
+        const results& get_results() const
+        {
+            return results_;
+        }
+
+    private:
+
+        struct request_slot
+        {
+            std::uint64_t sent_at;
+            std::uint32_t sequence;
+            std::uint16_t socket;
+            bool pending;
+        };
+
+        request_slot& slot(const std::uint32_t sequence)
+        {
+            return outstanding_[sequence & (outstanding_.size() - 1)];
+        }
+
+        bool closed_loop() const
+        {
+            return rate_ == 0 && !config_.open_loop;
+        }
+
+        void finish(request_slot& request)
+        {
+            request.pending = false;
+            --in_flight_[request.socket];
+        }
+
+        // Count requests older than the timeout as lost
+        void expire(const std::uint64_t now)
+        {
+            const std::uint64_t timeout = config_.timeout * 1000000;
+            while (oldest_ != sequence_)
+            {
+                request_slot& request = slot(oldest_);
+                if (request.pending)
+                {
+                    if (now - request.sent_at < timeout && now >= request.sent_at)
+                    {
+                        break;
+                    }
+                    finish(request);
+                    ++results_.lost;
+                }
+                ++oldest_;
+            }
+        }
+
+        bool send_request(const std::size_t socket, const std::uint64_t now)
+        {
+            // The oldest request is counted as lost when the table is full
+            if (sequence_ - oldest_ == outstanding_.size())
+            {
+                request_slot& oldest = slot(oldest_);
+                if (oldest.pending)
+                {
+                    finish(oldest);
+                    ++results_.lost;
+                }
+                ++oldest_;
+            }
+
+            // The transmit timestamp is echoed back as the originate
+            // timestamp, and carries the sequence number of the request.
+            std::uint8_t request[request_size] = {0};
+            request[0] = client_request;
+            const std::uint32_t sequence = htonl(sequence_);
+            const std::uint32_t tag = htonl(0x534E5450); // "SNTP"
+            std::memcpy(request + test::sntp::transmit_seconds_offset, &sequence, 4);
+            std::memcpy(request + test::sntp::transmit_fractional_offset, &tag, 4);
+
+            if (::send(sockets_[socket], request, sizeof(request), 0) < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+                {
+                    throw last_error("send");
+                }
+                return false;
+            }
+
+            request_slot& entry = slot(sequence_);
+            entry.sent_at = now;
+            entry.sequence = sequence_;
+            entry.socket = std::uint16_t(socket);
+            entry.pending = true;
+
+            ++in_flight_[socket];
+            ++sequence_;
+            ++results_.sent;
+            return true;
+        }
+
+        void send_requests(const std::uint64_t now, const std::uint64_t start)
+        {
+            if (closed_loop())
+            {
+                for (std::size_t socket = 0; socket < sockets_.size(); ++socket)
+                {
+                    std::size_t burst = 0;
+                    while (in_flight_[socket] < config_.in_flight &&
+                           burst++ < send_burst &&
+                           send_request(socket, now))
+                    {
+                    }
+                }
+                return;
+            }
+
+            std::uint64_t due = sockets_.size() * send_burst;
+            if (rate_ != 0)
+            {
+                const std::uint64_t scheduled =
+                    std::uint64_t((now - start) * (long double)(rate_) / 1e9L);
+                due = std::min(due, scheduled - std::min(scheduled, results_.sent));
+            }
+
+            for (; due != 0; --due)
+            {
+                const std::size_t socket = next_socket_;
+                next_socket_ = (next_socket_ + 1) % sockets_.size();
+                if (!send_request(socket, now))
+                {
+                    break;
+                }
+            }
+        }
+
+        void wait_for_responses(const std::uint64_t now, const std::uint64_t start)
+        {
+            // Wait until the next scheduled request in rate mode, or briefly
+            // otherwise so that timeouts and the stop flag are noticed.
+            ::timespec wait = {0, 1000000};
+            if (rate_ != 0)
+            {
+                const std::uint64_t next = start +
+                    std::uint64_t((results_.sent + 1) * 1e9L / (long double)(rate_));
+                wait.tv_nsec = long(std::min<std::uint64_t>(
+                    next > now ? next - now : 0, 1000000));
+            }
+            else if (!closed_loop())
+            {
+                wait.tv_nsec = 0;
+            }
+
+            const int ready = ::ppoll(polls_.data(), polls_.size(), &wait, nullptr);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
+                {
+                    return;
+                }
+                throw last_error("ppoll");
+            }
+
+            for (std::size_t socket = 0; ready != 0 && socket < sockets_.size(); ++socket)
+            {
+                if (polls_[socket].revents != 0)
+                {
+                    receive_responses(socket);
+                }
+            }
+        }
+
+        void receive_responses(const std::size_t socket)
+        {
+            std::array<std::uint8_t, 68> response = {{0}};
+            while (true)
+            {
+                const ::ssize_t bytes =
+                    ::recv(sockets_[socket], response.data(), response.size(), 0);
+                if (bytes < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        return;
+                    }
+                    if (errno == ECONNREFUSED)
+                    {
+                        continue;
+                    }
+                    throw last_error("recv");
+                }
+
+                const std::uint64_t now = monotonic_nanoseconds();
+                const std::uint32_t sequence = test::sntp::extract_ulong(
+                    response, test::sntp::originate_seconds_offset);
+                request_slot& request = slot(sequence);
+
+                if (std::size_t(bytes) < request_size ||
+                    (response[0] & mode_mask) != server_mode ||
+                    test::sntp::extract_ulong(
+                        response, test::sntp::originate_fractional_offset) !=
+                        0x534E5450 ||
+                    !request.pending ||
+                    request.sequence != sequence ||
+                    request.socket != socket)
+                {
+                    ++results_.invalid;
+                    continue;
+                }
+
+                finish(request);
+                ++results_.received;
+                results_.latency.record(now - request.sent_at);
+            }
+        }
+
+    private:
+
+        const options& config_;
+        const std::uint64_t rate_;
+        std::vector<int> sockets_;
+        std::vector<::pollfd> polls_;
+        std::vector<request_slot> outstanding_;
+        std::vector<std::size_t> in_flight_;
+        std::uint32_t sequence_;
+        std::uint32_t oldest_;
+        std::size_t next_socket_;
+        results results_;
+    };
+
+    void display_results(const options& config, const results& total, const double seconds)
+    {
+        const auto microseconds = [](const std::uint64_t nanoseconds)
+        {
+            return double(nanoseconds) / 1000.0;
+        };
+
+        std::cout << std::fixed << std::setprecision(1) <<
+            "sent:      " << total.sent << "\n"
+            "received:  " << total.received << "\n"
+            "lost:      " << total.lost << " (" << std::setprecision(3) <<
+                (total.sent ? 100.0 * total.lost / total.sent : 0.0) << "%)\n" <<
+                std::setprecision(1) <<
+            "invalid:   " << total.invalid << "\n"
+            "qps:       " << (seconds > 0 ? total.received / seconds : 0.0) << "\n"
+            "rtt (us):  min " << microseconds(total.latency.minimum()) <<
+                " p50 " << microseconds(total.latency.percentile(0.5)) <<
+                " p99 " << microseconds(total.latency.percentile(0.99)) <<
+                " p99.9 " << microseconds(total.latency.percentile(0.999)) <<
+                " max " << microseconds(total.latency.maximum()) << std::endl;
+
+        if (config.rate != 0)
+        {
+            std::cout << "offered:   " << config.rate << " qps" << std::endl;
+        }
+    }
+
+    template<typename Integer>
+    bool parse_integer(const char* const value, Integer& parsed)
+    {
+        return boost::spirit::qi::parse(
+            value,
+            value + std::strlen(value),
+            (boost::spirit::qi::uint_parser<Integer>() >> boost::spirit::qi::eoi),
+            parsed);
+    }
+
+    int display_option_error(const char* const error, int argc, const char** argv)
+    {
+        if (argc == 0)
+        {
+            std::cerr << "Bad program" << std::endl;
+        }
+        else
+        {
+            std::cerr << error << "\n\n" <<
+                argv[0] << " [ipv4 address] [port] [--threads count]"
+                " [--sockets per-thread] [--in-flight per-socket]"
+                " [--rate qps] [--open-loop] [--duration seconds]"
+                " [--timeout milliseconds]" << std::endl;
+        }
+        return EXIT_FAILURE;
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc < 3)
+    {
+        return display_option_error("Address and port required", argc, argv);
+    }
+
+    options config;
+    if (::inet_pton(AF_INET, argv[1], &config.address) != 1)
+    {
+        return display_option_error("Invalid address provided", argc, argv);
+    }
+
+    if (!parse_integer(argv[2], config.port))
+    {
+        return display_option_error("Invalid port provided", argc, argv);
+    }
+
+    for (int argument = 3; argument < argc; ++argument)
+    {
+        const char* const option = argv[argument];
+
+        if (std::strcmp(option, "--open-loop") == 0)
+        {
+            config.open_loop = true;
+            continue;
+        }
+
+        if (argument + 1 == argc)
+        {
+            return display_option_error("Option missing value", argc, argv);
+        }
+
+        const char* const value = argv[++argument];
+        bool valid = false;
+        if (std::strcmp(option, "--threads") == 0)
+        {
+            valid = parse_integer(value, config.threads) && config.threads != 0;
+        }
+        else if (std::strcmp(option, "--sockets") == 0)
+        {
+            valid = parse_integer(value, config.sockets) &&
+                config.sockets != 0 && config.sockets <= 65535;
+        }
+        else if (std::strcmp(option, "--in-flight") == 0)
+        {
+            valid = parse_integer(value, config.in_flight) && config.in_flight != 0;
+        }
+        else if (std::strcmp(option, "--rate") == 0)
+        {
+            valid = parse_integer(value, config.rate) && config.rate != 0;
+        }
+        else if (std::strcmp(option, "--duration") == 0)
+        {
+            valid = parse_integer(value, config.duration) && config.duration != 0;
+        }
+        else if (std::strcmp(option, "--timeout") == 0)
+        {
+            valid = parse_integer(value, config.timeout) && config.timeout != 0;
+        }
+        else
+        {
+            return display_option_error("Unknown option", argc, argv);
+        }
+
+        if (!valid)
+        {
+            return display_option_error("Invalid option value", argc, argv);
+        }
+    }
+
+    try
+    {
+        std::vector<std::unique_ptr<load_thread>> workers;
+        for (std::size_t thread = 0; thread < config.threads; ++thread)
+        {
+            // spread the rate evenly, the first threads take the remainder
+            const std::uint64_t rate = config.rate / config.threads +
+                (thread < config.rate % config.threads ? 1 : 0);
+            if (config.rate != 0 && rate == 0)
+            {
+                break;
+            }
+            workers.emplace_back(new load_thread(config, rate));
+        }
+
+        std::atomic<bool> stop(false);
+        std::vector<std::exception_ptr> failures(workers.size());
+        std::vector<std::thread> threads;
+
+        const std::uint64_t start = monotonic_nanoseconds();
+        for (std::size_t worker = 0; worker < workers.size(); ++worker)
+        {
+            threads.emplace_back(
+                [&workers, &failures, &stop, worker]
+                {
+                    try
+                    {
+                        workers[worker]->run(stop);
+                    }
+                    catch (...)
+                    {
+                        failures[worker] = std::current_exception();
+                    }
+                });
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(config.duration));
+        stop = true;
+        const std::uint64_t end = monotonic_nanoseconds();
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        for (const std::exception_ptr& failure : failures)
+        {
+            if (failure)
+            {
+                std::rethrow_exception(failure);
+            }
+        }
+
+        results total;
+        for (const auto& worker : workers)
+        {
+            total.merge(worker->get_results());
+        }
+
+        display_results(config, total, double(end - start) / 1e9);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "Load error: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
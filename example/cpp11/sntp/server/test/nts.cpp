@@ -0,0 +1,307 @@
+#include <array>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "authentication.hpp"
+#include "extension.hpp"
+#include "nts.hpp"
+#include "packet.hpp"
+
+namespace
+{
+    using bytes = std::vector<std::uint8_t>;
+
+    const std::size_t header_size = sntp::packet::minimum_packet_size();
+    const std::size_t cookie_field_size = 4 + sntp::nts::cookie_keys::cookie_size;
+    const std::uint32_t rotation = 3600;
+
+    const sntp::fingerprint::key master =
+        {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}};
+
+    sntp::nts::session_keys make_keys(const std::uint8_t seed)
+    {
+        sntp::nts::session_keys keys;
+        for (std::size_t byte = 0; byte < keys.client_to_server.size(); ++byte)
+        {
+            keys.client_to_server[byte] = std::uint8_t(seed + byte);
+            keys.server_to_client[byte] = std::uint8_t(seed - byte);
+        }
+        return keys;
+    }
+
+    std::uint16_t read_short(const bytes& data, const std::size_t offset)
+    {
+        return std::uint16_t((data[offset] << 8) | data[offset + 1]);
+    }
+
+    sntp::nts::responder::status verify(
+        sntp::nts::responder& responder, bytes& datagram, sntp::nts::responder::request& state)
+    {
+        const sntp::extension_fields fields =
+            sntp::extension_fields::parse(datagram.data(), datagram.size());
+        BOOST_REQUIRE(fields.valid());
+        return responder.verify(datagram.data(), fields, state);
+    }
+
+    void append_field(bytes& data, const std::uint16_t type, const bytes& body)
+    {
+        const std::size_t size = 4 + body.size();
+        data.push_back(std::uint8_t(type >> 8));
+        data.push_back(std::uint8_t(type));
+        data.push_back(std::uint8_t(size >> 8));
+        data.push_back(std::uint8_t(size));
+        data.insert(data.end(), body.begin(), body.end());
+    }
+
+    // Client side of RFC 8915 section 5.7: header, unique identifier,
+    // cookie, placeholders, and an authenticator over all of it
+    bytes make_request(
+        const bytes& cookie,
+        const sntp::nts::session_keys& keys,
+        const std::size_t placeholders,
+        const bytes& encrypted_fields = bytes())
+    {
+        bytes request(header_size);
+        request[0] = 0x23;
+        request[47] = 42;
+
+        append_field(request, sntp::nts::field::unique_identifier, bytes(32, 0xAB));
+        append_field(request, sntp::nts::field::cookie, cookie);
+        for (std::size_t count = 0; count < placeholders; ++count)
+        {
+            append_field(request, sntp::nts::field::cookie_placeholder, bytes(cookie.size()));
+        }
+
+        const bytes nonce(16, 0x5A);
+        bytes sealed(sntp::aes_siv::tag_size + encrypted_fields.size());
+        sntp::aes_siv(keys.client_to_server.data()).seal(
+            request.data(), request.size(), nonce.data(), nonce.size(),
+            encrypted_fields.data(), encrypted_fields.size(), sealed.data());
+
+        bytes body = {0, std::uint8_t(nonce.size()), 0, std::uint8_t(sealed.size())};
+        body.insert(body.end(), nonce.begin(), nonce.end());
+        body.insert(body.end(), sealed.begin(), sealed.end());
+        append_field(request, sntp::nts::field::authenticator, body);
+        return request;
+    }
+
+    // Verify a response, and return the cookies it carries
+    std::vector<bytes> open_response(
+        const bytes& response, const sntp::nts::session_keys& keys)
+    {
+        std::vector<bytes> cookies;
+
+        // echoed unique identifier
+        BOOST_CHECK(read_short(response, header_size) == sntp::nts::field::unique_identifier);
+        BOOST_CHECK(read_short(response, header_size + 2) == 36);
+        BOOST_CHECK(response[header_size + 4] == 0xAB);
+
+        const std::size_t authenticator = header_size + 36;
+        BOOST_CHECK(read_short(response, authenticator) == sntp::nts::field::authenticator);
+        BOOST_CHECK(read_short(response, authenticator + 2) == response.size() - authenticator);
+
+        const std::size_t nonce_length = read_short(response, authenticator + 4);
+        const std::size_t sealed_length = read_short(response, authenticator + 6);
+        BOOST_CHECK(nonce_length == 16);
+        const std::uint8_t* const nonce = response.data() + authenticator + 8;
+
+        bytes plaintext(sealed_length - sntp::aes_siv::tag_size);
+        if (!sntp::aes_siv(keys.server_to_client.data()).open(
+                response.data(), authenticator, nonce, nonce_length,
+                nonce + nonce_length, sealed_length, plaintext.data()))
+        {
+            BOOST_ERROR("response authenticator is not valid");
+            return cookies;
+        }
+
+        for (std::size_t offset = 0; offset < plaintext.size(); offset += cookie_field_size)
+        {
+            BOOST_CHECK(read_short(plaintext, offset) == sntp::nts::field::cookie);
+            BOOST_CHECK(read_short(plaintext, offset + 2) == cookie_field_size);
+            cookies.emplace_back(
+                plaintext.begin() + offset + 4, plaintext.begin() + offset + cookie_field_size);
+        }
+        return cookies;
+    }
+
+    bytes make_cookie(
+        sntp::nts::cookie_keys& issuer,
+        const sntp::nts::session_keys& keys,
+        const std::uint64_t seconds)
+    {
+        bytes cookie(sntp::nts::cookie_keys::cookie_size);
+        issuer.make(keys, seconds, cookie.data());
+        return cookie;
+    }
+
+    bool same_keys(const sntp::nts::session_keys& left, const sntp::nts::session_keys& right)
+    {
+        return left.client_to_server == right.client_to_server &&
+            left.server_to_client == right.server_to_client;
+    }
+}
+
+int test_main(int, char**)
+{
+    using status = sntp::nts::responder::status;
+
+    // master key file
+    {
+        std::istringstream valid("000102030405060708090a0B0c0d0e0f\n");
+        const sntp::fingerprint::key key = sntp::nts::load_master_key(valid);
+        BOOST_CHECK(key[0] == 0 && key[11] == 11 && key[15] == 15);
+    }
+    for (const char* const invalid :
+         {"", "0001", "000102030405060708090a0b0c0d0e0g", "000102030405060708090a0b0c0d0e0f 00"})
+    {
+        std::istringstream keys(invalid);
+        bool thrown = false;
+        try
+        {
+            sntp::nts::load_master_key(keys);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        BOOST_CHECK(thrown);
+    }
+
+    // cookies are shared by instances with the same master key, for the
+    // current period, the two before, and the next
+    {
+        sntp::nts::cookie_keys issuer(master, rotation);
+        sntp::nts::cookie_keys worker(master, rotation);
+        const sntp::nts::session_keys keys = make_keys(1);
+        const std::uint64_t now = 1000 * rotation;
+
+        bytes cookie = make_cookie(issuer, keys, now);
+        BOOST_CHECK(cookie != make_cookie(issuer, keys, now));
+
+        sntp::nts::session_keys opened = make_keys(2);
+        BOOST_CHECK(worker.open(cookie.data(), cookie.size(), now, opened));
+        BOOST_CHECK(same_keys(opened, keys));
+        BOOST_CHECK(worker.open(cookie.data(), cookie.size(), now + 2 * rotation, opened));
+        BOOST_CHECK(!worker.open(cookie.data(), cookie.size(), now + 3 * rotation, opened));
+        BOOST_CHECK(worker.open(cookie.data(), cookie.size(), now - rotation, opened));
+        BOOST_CHECK(!worker.open(cookie.data(), cookie.size(), now - 2 * rotation, opened));
+        BOOST_CHECK(!worker.open(cookie.data(), cookie.size() - 1, now, opened));
+
+        sntp::fingerprint::key other_master = master;
+        other_master[0] ^= 1;
+        sntp::nts::cookie_keys other(other_master, rotation);
+        BOOST_CHECK(!other.open(cookie.data(), cookie.size(), now, opened));
+
+        cookie[50] ^= 1;
+        BOOST_CHECK(!worker.open(cookie.data(), cookie.size(), now, opened));
+    }
+
+    // a valid request gets an authenticated response with new cookies, one
+    // for the cookie used and one per placeholder
+    {
+        sntp::nts::cookie_keys key_exchange(master, rotation);
+        sntp::nts::responder responder(master, rotation);
+        const sntp::nts::session_keys keys = make_keys(3);
+        const bytes cookie =
+            make_cookie(key_exchange, keys, sntp::nts::cookie_keys::now());
+
+        bytes datagram = make_request(cookie, keys, 1);
+        BOOST_CHECK(datagram.size() == header_size + 36 + 2 * cookie_field_size + 40);
+
+        sntp::nts::responder::request state;
+        BOOST_REQUIRE(verify(responder, datagram, state) == status::valid);
+        BOOST_CHECK(state.cookies == 2);
+
+        BOOST_CHECK(reinterpret_cast<sntp::packet*>(datagram.data())->fill_server_values());
+        const std::size_t size = responder.seal(datagram.data(), state);
+        BOOST_CHECK(size <= datagram.size());
+        datagram.resize(size);
+        BOOST_CHECK(datagram[31] == 42);   // originate is the request transmit
+
+        const std::vector<bytes> cookies = open_response(datagram, keys);
+        BOOST_CHECK(cookies.size() == 2);
+        for (const bytes& fresh : cookies)
+        {
+            sntp::nts::session_keys opened;
+            BOOST_CHECK(
+                key_exchange.open(fresh.data(), fresh.size(), sntp::nts::cookie_keys::now(), opened));
+            BOOST_CHECK(same_keys(opened, keys));
+        }
+
+        // placeholders inside the encrypted fields count too
+        bytes encrypted;
+        append_field(encrypted, sntp::nts::field::cookie_placeholder, bytes(cookie.size()));
+        append_field(encrypted, sntp::nts::field::cookie_placeholder, bytes(cookie.size()));
+        datagram = make_request(cookies.front(), keys, 0, encrypted);
+        BOOST_CHECK(verify(responder, datagram, state) == status::valid);
+        BOOST_CHECK(state.cookies == 3);
+
+        // never more cookies than fit in the request size
+        datagram = make_request(cookies.front(), keys, 20);
+        BOOST_CHECK(verify(responder, datagram, state) == status::valid);
+        BOOST_CHECK(state.cookies == sntp::nts::responder::maximum_cookies);
+    }
+
+    // an unknown cookie or a forged authenticator gets a "NTSN" response
+    {
+        sntp::nts::cookie_keys key_exchange(master, rotation);
+        sntp::nts::responder responder(master, rotation);
+        const sntp::nts::session_keys keys = make_keys(4);
+        bytes cookie = make_cookie(key_exchange, keys, sntp::nts::cookie_keys::now());
+
+        bytes forged = make_request(cookie, keys, 0);
+        forged[47] ^= 1;
+        sntp::nts::responder::request state;
+        BOOST_CHECK(verify(responder, forged, state) == status::nak);
+
+        cookie[20] ^= 1;
+        bytes unknown = make_request(cookie, keys, 0);
+        BOOST_CHECK(verify(responder, unknown, state) == status::nak);
+
+        sntp::packet& header = *reinterpret_cast<sntp::packet*>(unknown.data());
+        BOOST_CHECK(header.fill_kiss_of_death(sntp::kiss_code::nts_negative));
+        const std::size_t size = responder.nak(unknown.data(), state);
+        BOOST_CHECK(size == header_size + 36);
+        BOOST_CHECK(unknown[1] == 0);
+        BOOST_CHECK(unknown[12] == 'N' && unknown[15] == 'N');
+        BOOST_CHECK(read_short(unknown, header_size) == sntp::nts::field::unique_identifier);
+    }
+
+    // requests without NTS fields are left to the other checks, malformed
+    // NTS requests are dropped
+    {
+        sntp::nts::cookie_keys key_exchange(master, rotation);
+        sntp::nts::responder responder(master, rotation);
+        const sntp::nts::session_keys keys = make_keys(5);
+        const bytes cookie = make_cookie(key_exchange, keys, sntp::nts::cookie_keys::now());
+        sntp::nts::responder::request state;
+
+        bytes plain(sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(verify(responder, plain, state) == status::not_nts);
+
+        bytes unknown_field(header_size);
+        append_field(unknown_field, 0x2005, bytes(28));
+        BOOST_CHECK(
+            verify(responder, unknown_field, state) == status::not_nts);
+
+        bytes trailing = make_request(cookie, keys, 0);
+        append_field(trailing, 0x2005, bytes(28));
+        BOOST_CHECK(verify(responder, trailing, state) == status::invalid);
+
+        bytes signed_request = make_request(cookie, keys, 0);
+        signed_request.resize(signed_request.size() + 20);
+        BOOST_CHECK(verify(responder, signed_request, state) == status::invalid);
+
+        bytes no_identifier(header_size);
+        append_field(no_identifier, sntp::nts::field::cookie, cookie);
+        append_field(no_identifier, 0x2005, bytes(28));
+        BOOST_CHECK(
+            verify(responder, no_identifier, state) == status::invalid);
+    }
+
+    return 0;
+}
@@ -47,6 +47,13 @@ namespace
             reinterpret_cast<const std::uint8_t*>(&packet) + sizeof(packet));
     }
 
+    auto make_range(const sntp::timestamp& time)
+    {
+        return boost::make_iterator_range(
+            reinterpret_cast<const std::uint8_t*>(&time),
+            reinterpret_cast<const std::uint8_t*>(&time) + sizeof(time));
+    }
+
     // Get the range of bytes for the specified timestamp offset. Range must
     // be 8 bytes in length from the offset.
     boost::iterator_range<const std::uint8_t*>
@@ -191,11 +198,74 @@ int test_main(int, char**)
         verify_packet(make_default_test_packet(), packet);
 
         const sntp::packet original = packet;
+        BOOST_CHECK(packet.check_request() == sntp::packet::rejection::none);
         BOOST_CHECK(packet.fill_server_values());
         verify_packet(make_test_packet(original, packet), packet);
 
+        BOOST_CHECK(packet.check_request() == sntp::packet::rejection::looped);
         BOOST_CHECK(!packet.fill_server_values());
     }
+    {
+        // single clock read
+        sntp::packet packet = make_filled_packet(current_version, client_mode);
+        const sntp::packet original = packet;
+        const sntp::timestamp current = sntp::timestamp::now();
+
+        BOOST_CHECK(packet.fill_server_values(current));
+        verify_packet(make_test_packet(original, packet), packet);
+
+        const auto range = make_range(packet);
+        BOOST_CHECK(
+            boost::range::equal(
+                get_timestamp_range(range, test::sntp::receive_timestamp_offset),
+                make_range(current)));
+        BOOST_CHECK(
+            boost::range::equal(
+                get_timestamp_range(range, test::sntp::transmit_timestamp_offset),
+                make_range(current)));
+
+        BOOST_CHECK(!packet.fill_server_values(current));
+    }
+    {
+        // rate limited client
+        sntp::packet packet = make_filled_packet(current_version, client_mode);
+        const sntp::packet original = packet;
+        BOOST_CHECK(packet.fill_kiss_of_death(sntp::kiss_code::rate));
+
+        const auto original_range = make_range(original);
+        test_packet expected = make_default_test_packet();
+        expected[0] = 0xE4;
+        expected[2] = 0x06;
+        expected[12] = 'R';
+        expected[13] = 'A';
+        expected[14] = 'T';
+        expected[15] = 'E';
+
+        // every timestamp except the reference echoes the request
+        const auto request_transmit = get_timestamp_range(
+            original_range, test::sntp::transmit_timestamp_offset);
+        boost::range::copy(
+            request_transmit,
+            expected.begin() + test::sntp::originate_timestamp_offset);
+        boost::range::copy(
+            request_transmit,
+            expected.begin() + test::sntp::receive_timestamp_offset);
+        boost::range::copy(
+            request_transmit,
+            expected.begin() + test::sntp::transmit_timestamp_offset);
+        std::copy(
+            original_range.begin() + test::sntp::optional_section_offset,
+            original_range.end(),
+            expected.begin() + test::sntp::optional_section_offset);
+        verify_packet(expected, packet);
+
+        sntp::packet invalid = make_filled_packet(current_version, 0);
+        const sntp::packet invalid_original = invalid;
+        BOOST_CHECK(!invalid.fill_kiss_of_death(sntp::kiss_code::rate));
+        BOOST_CHECK(
+            boost::range::equal(
+                make_range(invalid_original), make_range(invalid)));
+    }
     // try every version
     {
         for (std::uint8_t test_version : make_version_range())
@@ -213,6 +283,9 @@ int test_main(int, char**)
             else
             {
                 BOOST_CHECK(!packet.fill_server_values());
+                BOOST_CHECK(
+                    packet.check_request() ==
+                    sntp::packet::rejection::bad_version);
                 BOOST_CHECK(
                     boost::range::equal(
                         make_range(original), make_range(packet)));
@@ -239,6 +312,9 @@ int test_main(int, char**)
             else
             {
                 BOOST_CHECK(!packet.fill_server_values());
+                BOOST_CHECK(
+                    packet.check_request() ==
+                    sntp::packet::rejection::bad_mode);
                 BOOST_CHECK(
                     boost::range::equal(
                         make_range(original), make_range(packet)));
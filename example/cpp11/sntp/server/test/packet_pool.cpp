@@ -0,0 +1,81 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include "packet_pool.hpp"
+
+int test_main(int, char**)
+{
+    {
+        sntp::packet_pool pool(3);
+        BOOST_CHECK(pool.capacity() == 3);
+        BOOST_CHECK(pool.available() == 3);
+        BOOST_CHECK(pool.exhausted() == 0);
+
+        std::vector<sntp::packet_pool::handle> handles;
+        std::set<const sntp::packet*> unique;
+        for (unsigned count = 0; count < 3; ++count)
+        {
+            handles.push_back(pool.allocate());
+            BOOST_CHECK(bool(handles.back()));
+            BOOST_CHECK(
+                reinterpret_cast<std::uintptr_t>(handles.back().get()) %
+                sntp::packet_pool::cache_line_size == 0);
+            unique.insert(handles.back().get());
+        }
+        BOOST_CHECK(unique.size() == 3);
+
+        // every packet has room for extension fields
+        for (const sntp::packet_pool::handle& handle : handles)
+        {
+            BOOST_CHECK(
+                boost::asio::buffer_size(sntp::packet_pool::get_receive_buffer(*handle)) ==
+                sntp::packet::maximum_datagram_size());
+            BOOST_CHECK(
+                sntp::packet_pool::get_datagram(*handle) ==
+                reinterpret_cast<std::uint8_t*>(handle.get()));
+        }
+        BOOST_CHECK(
+            std::size_t(std::abs(
+                reinterpret_cast<const std::uint8_t*>(handles[1].get()) -
+                reinterpret_cast<const std::uint8_t*>(handles[0].get()))) >=
+            sntp::packet::maximum_datagram_size());
+        BOOST_CHECK(pool.available() == 0);
+
+        // exhausted pool returns empty handles
+        {
+            const sntp::packet_pool::handle empty = pool.allocate();
+            BOOST_CHECK(!empty);
+            BOOST_CHECK(pool.exhausted() == 1);
+        }
+        BOOST_CHECK(!pool.allocate());
+        BOOST_CHECK(pool.exhausted() == 2);
+
+        // returned packets are reused, most recent first
+        const sntp::packet* const returned = handles.back().get();
+        handles.pop_back();
+        BOOST_CHECK(pool.available() == 1);
+
+        handles.push_back(pool.allocate());
+        BOOST_CHECK(handles.back().get() == returned);
+        BOOST_CHECK(pool.available() == 0);
+
+        handles.clear();
+        BOOST_CHECK(pool.available() == 3);
+        BOOST_CHECK(pool.exhausted() == 2);
+    }
+    {
+        // handles can move between owners without returning the packet
+        sntp::packet_pool pool(1);
+        sntp::packet_pool::handle first = pool.allocate();
+        sntp::packet_pool::handle second = std::move(first);
+        BOOST_CHECK(!first);
+        BOOST_CHECK(bool(second));
+        BOOST_CHECK(pool.available() == 0);
+        second.reset();
+        BOOST_CHECK(pool.available() == 1);
+    }
+    return 0;
+}
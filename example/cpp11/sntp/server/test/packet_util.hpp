@@ -1,6 +1,14 @@
 #ifndef PACKET_UTIL_HPP
 #define PACKET_UTIL_HPP
 
+#include <array>
+#include <boost/asio/detail/socket_ops.hpp>
+#include <boost/asio/detail/socket_option.hpp>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+
 namespace test
 {
     namespace sntp
@@ -22,6 +30,11 @@ namespace test
 
         const std::uint8_t optional_section_offset = 48;
 
+        const std::uint8_t valid_client = 0x23;   // version 4, client mode
+        const std::uint8_t invalid_client = 0x1B; // version 3, client mode
+
+        using receive_timestamps =
+            boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMPNS>;
 
         // Take a fractional value, and ignore the crypto string portion
         // The function is "dumb" and assumes -20 currently
@@ -44,6 +57,30 @@ namespace test
             return boost::asio::detail::socket_ops::network_to_host_long(value);
         }
 
+        // NTP timestamp as a 32.32 fixed point value, ignoring the crypto
+        // string
+        template<typename Range>
+        inline
+        std::uint64_t extract_time(const Range& range, const std::uint8_t offset)
+        {
+            return
+                (std::uint64_t(extract_ulong(range, offset)) << 32) |
+                ignore_crypto_string(extract_ulong(range, offset + 4));
+        }
+
+        // A zeroed request with the given flags, and id in the transmit
+        // timestamp to tell responses apart. Request may be larger than a
+        // header, for a MAC or extension fields.
+        template<typename Request = std::array<std::uint8_t, 48>>
+        inline
+        Request make_request(const std::uint8_t flags, const std::uint8_t id)
+        {
+            Request request = {{0}};
+            request[0] = flags;
+            request[transmit_fractional_offset] = id;
+            return request;
+        }
+
         // The range must be a sntp packet. Return true if the receive timestamp
         // is after the send timestamp.
         template<typename Range>
@@ -0,0 +1,171 @@
+#include <array>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    const std::uint8_t client_request = 0x23;  // version 4, client mode
+
+    // A request at an odd offset, as it could be in a ring or mapped
+    // buffer. Nothing in the view depends on alignment.
+    std::vector<std::uint8_t> make_buffer(const std::size_t length)
+    {
+        std::vector<std::uint8_t> buffer(length + 1);
+        buffer[1] = client_request;
+        for (std::size_t byte = 41; byte <= 48; ++byte)
+        {
+            buffer[byte] = std::uint8_t(byte);    // transmit timestamp
+        }
+        return buffer;
+    }
+}
+
+int test_main(int, char**)
+{
+    // timestamps are read and written in place
+    {
+        std::array<std::uint8_t, 9> bytes = {{0}};
+        const sntp::timestamp current = sntp::timestamp::now();
+        const sntp::timestamp_view field(bytes.data() + 1);
+
+        field.store(current);
+        BOOST_CHECK(field.load() == current);
+        BOOST_CHECK(sntp::timestamp_view::read(bytes.data() + 1) == current);
+        BOOST_CHECK(field.load().from_server());
+        BOOST_CHECK(std::memcmp(bytes.data() + 1, &current, sizeof(current)) == 0);
+    }
+
+    // a request is answered where it is, with the same result as a packet
+    {
+        std::vector<std::uint8_t> buffer = make_buffer(sntp::packet::minimum_packet_size());
+        const sntp::packet_view request(buffer.data() + 1, sntp::packet::minimum_packet_size());
+        BOOST_CHECK(request.size() == sntp::packet::minimum_packet_size());
+        BOOST_CHECK(!request.has_mac());
+        BOOST_CHECK(request.version() == 4);
+        BOOST_CHECK(request.mode() == 3);
+        BOOST_CHECK(request.check_request() == sntp::packet::rejection::none);
+
+        sntp::packet object;
+        std::memcpy(
+            sntp::packet_view(object).data(), buffer.data() + 1, sntp::packet::minimum_packet_size());
+
+        const sntp::timestamp current = sntp::timestamp::now();
+        const sntp::timestamp request_transmit = request.transmit().load();
+        BOOST_CHECK(request.fill_server_values(current));
+        BOOST_CHECK(object.fill_server_values(current));
+        BOOST_CHECK(
+            std::memcmp(
+                buffer.data() + 1, &object, sntp::packet::minimum_packet_size()) == 0);
+
+        BOOST_CHECK(request.mode() == 4);
+        BOOST_CHECK(request.leap() == 3);
+        BOOST_CHECK(request.stratum() == 1);
+        BOOST_CHECK(request.precision() == -sntp::timestamp::precision::significant_bits());
+        BOOST_CHECK(request.root_delay() == 0);
+        BOOST_CHECK(request.root_dispersion() == 0);
+        BOOST_CHECK((request.identifier() == std::array<std::uint8_t, 4>{{'L', 'O', 'C', 'L'}}));
+        BOOST_CHECK(request.reference().load() == sntp::timestamp());
+        BOOST_CHECK(request.originate().load() == request_transmit);
+        BOOST_CHECK(request.receive().load() == current);
+        BOOST_CHECK(request.transmit().load() == current);
+        BOOST_CHECK(buffer[0] == 0);
+
+        // the response looks like it came from this server
+        BOOST_CHECK(request.check_request() == sntp::packet::rejection::looped);
+        BOOST_CHECK(!request.fill_server_values());
+    }
+
+    // Kiss-o'-Death and interleaved responses
+    {
+        std::vector<std::uint8_t> buffer = make_buffer(sntp::packet::minimum_packet_size());
+        const sntp::packet_view request(buffer.data() + 1, sntp::packet::minimum_packet_size());
+        const sntp::timestamp request_transmit = request.transmit().load();
+
+        BOOST_CHECK(request.fill_kiss_of_death(sntp::kiss_code::rate));
+        BOOST_CHECK(request.stratum() == 0);
+        BOOST_CHECK(request.identifier() == sntp::kiss_code::rate);
+        BOOST_CHECK(request.receive().load() == request_transmit);
+        BOOST_CHECK(request.transmit().load() == request_transmit);
+
+        buffer = make_buffer(sntp::packet::minimum_packet_size());
+        const sntp::packet_view interleaved(
+            buffer.data() + 1, sntp::packet::minimum_packet_size());
+        const sntp::timestamp previous_receive = sntp::timestamp::now();
+        interleaved.receive().store(previous_receive);
+
+        const sntp::timestamp received = sntp::timestamp::now();
+        const sntp::timestamp previous_transmit = sntp::timestamp::now();
+        BOOST_CHECK(interleaved.fill_interleaved_server_values(received, previous_transmit));
+        BOOST_CHECK(interleaved.originate().load() == previous_receive);
+        BOOST_CHECK(interleaved.receive().load() == received);
+        BOOST_CHECK(interleaved.transmit().load() == previous_transmit);
+    }
+
+    // invalid requests are left unmodified
+    {
+        std::vector<std::uint8_t> buffer = make_buffer(sntp::packet::minimum_packet_size());
+        buffer[1] = 0x1B;   // version 3
+        const std::vector<std::uint8_t> original = buffer;
+        const sntp::packet_view request(buffer.data() + 1, sntp::packet::minimum_packet_size());
+
+        BOOST_CHECK(request.check_request() == sntp::packet::rejection::bad_version);
+        BOOST_CHECK(!request.fill_server_values());
+        BOOST_CHECK(!request.fill_kiss_of_death(sntp::kiss_code::rate));
+        BOOST_CHECK(buffer == original);
+
+        buffer[1] = 0x25;   // version 4, broadcast mode
+        BOOST_CHECK(request.check_request() == sntp::packet::rejection::bad_mode);
+    }
+
+    // the MAC follows the header
+    {
+        std::vector<std::uint8_t> buffer = make_buffer(sntp::packet::authenticated_packet_size());
+        buffer[52] = 7;
+        const sntp::packet_view request(
+            buffer.data() + 1, sntp::packet::authenticated_packet_size());
+        BOOST_CHECK(request.has_mac());
+        BOOST_CHECK(request.mac_size() == 20);
+        BOOST_CHECK(request.digest_size() == 16);
+        BOOST_CHECK(request.key_identifier() == 7);
+
+        for (std::size_t byte = 0; byte < request.digest_size(); ++byte)
+        {
+            request.digest()[byte] = std::uint8_t(100 + byte);
+        }
+        BOOST_CHECK(buffer[53] == 100 && buffer[68] == 115);
+
+        // a view of a packet object covers the MAC too
+        sntp::packet object;
+        std::memcpy(sntp::packet_view(object).data(), buffer.data() + 1, sizeof(object));
+        const sntp::packet_view whole(object);
+        BOOST_CHECK(whole.data() == reinterpret_cast<std::uint8_t*>(&object));
+        BOOST_CHECK(whole.has_mac());
+        BOOST_CHECK(whole.key_identifier() == object.key_identifier());
+        BOOST_CHECK(whole.mac_size() == 20);
+        BOOST_CHECK(
+            std::memcmp(
+                whole.digest(), object.get_digest().data(), object.get_digest().size()) == 0);
+    }
+
+    // a 24 byte MAC has a 20 byte digest, other remainders are not a MAC
+    {
+        std::vector<std::uint8_t> buffer =
+            make_buffer(sntp::packet::minimum_packet_size() + 24);
+        const sntp::packet_view request(
+            buffer.data() + 1, sntp::packet::minimum_packet_size() + 24);
+        BOOST_CHECK(request.mac_size() == 24);
+        BOOST_CHECK(request.digest_size() == 20);
+
+        const sntp::packet_view fields(
+            buffer.data() + 1, sntp::packet::minimum_packet_size() + 16);
+        BOOST_CHECK(!fields.has_mac());
+    }
+
+    return 0;
+}
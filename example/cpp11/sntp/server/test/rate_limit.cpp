@@ -0,0 +1,129 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+#include "rate_limit.hpp"
+
+namespace
+{
+    using action = sntp::rate_limiter::action;
+
+    ::sockaddr_in make_ipv4(const std::uint32_t address)
+    {
+        ::sockaddr_in source;
+        std::memset(&source, 0, sizeof(source));
+        source.sin_family = AF_INET;
+        source.sin_addr.s_addr = htonl(address);
+        return source;
+    }
+
+    ::sockaddr_in6 make_ipv6(const std::uint8_t prefix, const std::uint8_t host)
+    {
+        ::sockaddr_in6 source;
+        std::memset(&source, 0, sizeof(source));
+        source.sin6_family = AF_INET6;
+        source.sin6_addr.s6_addr[0] = 0x20;
+        source.sin6_addr.s6_addr[7] = prefix;
+        source.sin6_addr.s6_addr[15] = host;
+        return source;
+    }
+
+    template<typename Address>
+    action check(
+        sntp::rate_limiter& limiter, const Address& source, const std::uint64_t now)
+    {
+        return limiter.check(reinterpret_cast<const ::sockaddr&>(source), now);
+    }
+}
+
+int test_main(int, char**)
+{
+    {
+        BOOST_CHECK(sntp::rate_limiter(1, 1000, 1, false).capacity() == 4);
+        BOOST_CHECK(sntp::rate_limiter(10, 1000, 1, false).capacity() == 16);
+        BOOST_CHECK(sntp::rate_limiter(64, 1000, 1, false).capacity() == 64);
+    }
+
+    // a burst of 3, then one request per second
+    {
+        sntp::rate_limiter limiter(1024, 1000, 3, false);
+        const ::sockaddr_in source = make_ipv4(0x0A000001);
+        const ::sockaddr_in other = make_ipv4(0x0A000002);
+        const std::uint64_t start = 1000000;
+
+        BOOST_CHECK(check(limiter, source, start) == action::answer);
+        BOOST_CHECK(check(limiter, source, start) == action::answer);
+        BOOST_CHECK(check(limiter, source, start) == action::answer);
+        BOOST_CHECK(check(limiter, source, start) == action::drop);
+        BOOST_CHECK(check(limiter, source, start + 999) == action::drop);
+
+        // other sources are unaffected
+        BOOST_CHECK(check(limiter, other, start) == action::answer);
+
+        BOOST_CHECK(check(limiter, source, start + 1000) == action::answer);
+        BOOST_CHECK(check(limiter, source, start + 1000) == action::drop);
+
+        // idle time refills the burst, but not beyond
+        const std::uint64_t later = start + 60000;
+        BOOST_CHECK(check(limiter, source, later) == action::answer);
+        BOOST_CHECK(check(limiter, source, later) == action::answer);
+        BOOST_CHECK(check(limiter, source, later) == action::answer);
+        BOOST_CHECK(check(limiter, source, later) == action::drop);
+    }
+
+    // Kiss-o'-Death instead of dropping
+    {
+        sntp::rate_limiter limiter(16, 1000, 1, true);
+        const ::sockaddr_in source = make_ipv4(0x0A000001);
+
+        BOOST_CHECK(check(limiter, source, 5000) == action::answer);
+        BOOST_CHECK(check(limiter, source, 5500) == action::kiss_of_death);
+        BOOST_CHECK(check(limiter, source, 6000) == action::answer);
+    }
+
+    // IPv6 sources share a limit per /64
+    {
+        sntp::rate_limiter limiter(16, 1000, 1, false);
+
+        BOOST_CHECK(check(limiter, make_ipv6(1, 1), 5000) == action::answer);
+        BOOST_CHECK(check(limiter, make_ipv6(1, 2), 5000) == action::drop);
+        BOOST_CHECK(check(limiter, make_ipv6(2, 1), 5000) == action::answer);
+    }
+
+    // other address families are not limited
+    {
+        sntp::rate_limiter limiter(16, 1000, 1, false);
+        ::sockaddr_un local;
+        std::memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+
+        BOOST_CHECK(check(limiter, local, 5000) == action::answer);
+        BOOST_CHECK(check(limiter, local, 5000) == action::answer);
+    }
+
+    // memory is bounded, the least recently active source is forgotten
+    {
+        sntp::rate_limiter limiter(4, 1000, 1, false);
+        const ::sockaddr_in first = make_ipv4(1);
+
+        BOOST_CHECK(check(limiter, first, 5000) == action::answer);
+        BOOST_CHECK(check(limiter, first, 5000) == action::drop);
+        for (std::uint32_t address = 2; address <= 5; ++address)
+        {
+            BOOST_CHECK(
+                check(limiter, make_ipv4(address), 5000 + address) == action::answer);
+        }
+        BOOST_CHECK(check(limiter, first, 5010) == action::answer);
+    }
+
+    // the coarse clock moves forward
+    {
+        const std::uint64_t first = sntp::rate_limiter::now();
+        BOOST_CHECK(first != 0);
+        BOOST_CHECK(first <= sntp::rate_limiter::now());
+    }
+
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <array>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <netinet/in.h>
+
+#include "authentication.hpp"
+#include "packet.hpp"
+#include "packet_util.hpp"
+#include "packet_view.hpp"
+#include "rate_limit.hpp"
+#include "request_pipeline.hpp"
+#include "stats.hpp"
+
+namespace
+{
+    // Room for the header, an extension field, and a 24 byte MAC
+    using datagram = std::array<std::uint8_t, 96>;
+
+    ::sockaddr_in make_source(const std::uint8_t host)
+    {
+        ::sockaddr_in source;
+        std::memset(&source, 0, sizeof(source));
+        source.sin_family = AF_INET;
+        source.sin_port = htons(123);
+        source.sin_addr.s_addr = htonl(0x0A000000 | host);
+        return source;
+    }
+
+    // Records how the response was filled
+    struct fill_recorder
+    {
+        void operator()(const sntp::packet_view& request, const bool deferrable)
+        {
+            ++calls;
+            deferred = deferrable;
+            request.fill_server_values();
+        }
+
+        unsigned calls = 0;
+        bool deferred = false;
+    };
+
+    std::size_t accept(
+        datagram& request,
+        const std::size_t length,
+        const ::sockaddr_in& source,
+        const sntp::worker_context& context,
+        fill_recorder& fill)
+    {
+        const sntp::packet_view view(request.data(), length);
+        return sntp::accept_request(
+            view,
+            view.check_request(),
+            reinterpret_cast<const ::sockaddr&>(source),
+            context,
+            fill);
+    }
+}
+
+int test_main(int, char**)
+{
+    using counter = sntp::worker_stats::counter;
+    const std::size_t minimum = sntp::packet::minimum_packet_size();
+
+    // plain requests are filled deferred, and their processing recorded
+    // when the stats are timed
+    {
+        sntp::worker_stats stats(true);
+        sntp::worker_context context;
+        context.stats = &stats;
+
+        fill_recorder fill;
+        datagram request = test::sntp::make_request<datagram>(test::sntp::valid_client, 1);
+        BOOST_CHECK(accept(request, minimum, make_source(1), context, fill) == minimum);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(fill.deferred);
+        BOOST_CHECK(stats.processing().count() == 1);
+    }
+
+    // untimed stats only count, and the clock is not read
+    {
+        sntp::worker_stats stats;
+        std::uint64_t end = 0;
+        sntp::worker_context context;
+        context.stats = &stats;
+        context.end = &end;
+
+        fill_recorder fill;
+        datagram request = test::sntp::make_request<datagram>(test::sntp::valid_client, 1);
+        BOOST_CHECK(accept(request, minimum, make_source(1), context, fill) == minimum);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(end == 0);
+        BOOST_CHECK(stats.processing().count() == 0);
+    }
+
+    // a start read by the engine is reused, and the end is handed back;
+    // dropped requests leave the end unset
+    {
+        sntp::worker_stats stats(true);
+        std::uint64_t end = 0;
+        sntp::worker_context context;
+        context.stats = &stats;
+        context.start = sntp::worker_stats::now() - 5000000;
+        context.end = &end;
+
+        fill_recorder fill;
+        datagram rejected = test::sntp::make_request<datagram>(test::sntp::invalid_client, 1);
+        BOOST_CHECK(accept(rejected, minimum, make_source(1), context, fill) == 0);
+        BOOST_CHECK(end == 0);
+
+        datagram request = test::sntp::make_request<datagram>(test::sntp::valid_client, 1);
+        BOOST_CHECK(accept(request, minimum, make_source(1), context, fill) == minimum);
+        BOOST_CHECK(context.start + 5000000 <= end);
+        BOOST_CHECK(stats.processing().count() == 1);
+        BOOST_CHECK(stats.processing().maximum() >= 5000000);
+    }
+
+    // rejected requests are dropped before using rate limit credit, and
+    // sources over the limit are dropped or get an unfilled Kiss-o'-Death
+    for (const bool kiss_of_death : {false, true})
+    {
+        sntp::worker_stats stats(true);
+        sntp::rate_limiter limiter(16, 60000, 1, kiss_of_death);
+        sntp::worker_context context;
+        context.limiter = &limiter;
+        context.stats = &stats;
+
+        const ::sockaddr_in source = make_source(2);
+        fill_recorder fill;
+
+        datagram rejected = test::sntp::make_request<datagram>(test::sntp::invalid_client, 2);
+        BOOST_CHECK(accept(rejected, minimum, source, context, fill) == 0);
+        BOOST_CHECK(stats.get(counter::bad_version) == 1);
+
+        datagram looped = test::sntp::make_request<datagram>(test::sntp::valid_client, 3);
+        sntp::packet_view(looped.data(), minimum).transmit().store(sntp::timestamp::now());
+        BOOST_CHECK(accept(looped, minimum, source, context, fill) == 0);
+        BOOST_CHECK(stats.get(counter::looped) == 1);
+
+        datagram first = test::sntp::make_request<datagram>(test::sntp::valid_client, 4);
+        BOOST_CHECK(accept(first, minimum, source, context, fill) == minimum);
+        BOOST_CHECK(fill.calls == 1);
+
+        datagram limited = test::sntp::make_request<datagram>(test::sntp::valid_client, 5);
+        const std::size_t size = accept(limited, minimum, source, context, fill);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(stats.processing().count() == 1);
+        if (kiss_of_death)
+        {
+            BOOST_CHECK(size == minimum);
+            BOOST_CHECK(limited[1] == 0);
+            BOOST_CHECK(std::memcmp(limited.data() + 12, "RATE", 4) == 0);
+            BOOST_CHECK(stats.get(counter::kiss_of_death) == 1);
+        }
+        else
+        {
+            BOOST_CHECK(size == 0);
+            BOOST_CHECK(stats.get(counter::rate_limited) == 1);
+        }
+    }
+
+    // a valid MAC is filled before signing, a forged one is dropped
+    {
+        const std::array<std::uint8_t, 16> key =
+            {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}};
+        const sntp::cmac_aes128 cmac(key.data());
+        sntp::key_table keys;
+        keys.insert(1, std::make_unique<sntp::cmac_aes128>(key.data()));
+
+        sntp::worker_stats stats;
+        sntp::worker_context context;
+        context.keys = &keys;
+        context.stats = &stats;
+
+        datagram signed_request = test::sntp::make_request<datagram>(test::sntp::valid_client, 6);
+        signed_request[51] = 1;
+        const sntp::packet::digest digest = cmac(signed_request.data(), minimum);
+        std::memcpy(signed_request.data() + 52, digest.data(), digest.size());
+
+        datagram forged_request = signed_request;
+        forged_request[67] ^= 1;
+
+        fill_recorder fill;
+        const std::size_t length = sntp::packet::authenticated_packet_size();
+        BOOST_CHECK(
+            accept(signed_request, length, make_source(3), context, fill) == length);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(!fill.deferred);
+        BOOST_CHECK(stats.get(counter::authenticated) == 1);
+
+        const sntp::packet::digest expected = cmac(signed_request.data(), minimum);
+        BOOST_CHECK(
+            std::memcmp(signed_request.data() + 52, expected.data(), expected.size()) == 0);
+
+        BOOST_CHECK(accept(forged_request, length, make_source(3), context, fill) == 0);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(stats.get(counter::bad_mac) == 1);
+    }
+
+    // a SHA-256 request with a 20 byte digest (72 bytes, as sent by ntpd
+    // and chrony) gets a 72 byte signed response
+    {
+        const std::array<std::uint8_t, 16> key =
+            {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}};
+        const sntp::sha256_mac sha256(key.data(), key.size());
+        sntp::key_table keys;
+        keys.insert(2, std::make_unique<sntp::sha256_mac>(key.data(), key.size()));
+
+        sntp::worker_stats stats;
+        sntp::worker_context context;
+        context.keys = &keys;
+        context.stats = &stats;
+
+        const std::size_t length = minimum + 24;
+        datagram signed_request = test::sntp::make_request<datagram>(test::sntp::valid_client, 8);
+        signed_request[51] = 2;
+        const sntp::mac::digest digest = sha256(signed_request.data(), minimum);
+        std::memcpy(signed_request.data() + 52, digest.data(), digest.size());
+
+        datagram forged_request = signed_request;
+        forged_request[length - 1] ^= 1;
+
+        fill_recorder fill;
+        BOOST_CHECK(accept(signed_request, length, make_source(5), context, fill) == length);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(stats.get(counter::authenticated) == 1);
+
+        const sntp::mac::digest expected = sha256(signed_request.data(), minimum);
+        BOOST_CHECK(
+            std::memcmp(signed_request.data() + 52, expected.data(), expected.size()) == 0);
+
+        BOOST_CHECK(accept(forged_request, length, make_source(5), context, fill) == 0);
+        BOOST_CHECK(stats.get(counter::bad_mac) == 1);
+
+        // a MAC after an extension field is not checked, so it is dropped
+        // rather than answered unsigned
+        datagram extended = test::sntp::make_request<datagram>(test::sntp::valid_client, 9);
+        extended[minimum + 1] = 1;      // field type
+        extended[minimum + 3] = 16;     // field length
+        BOOST_CHECK(accept(extended, minimum + 16 + 24, make_source(5), context, fill) == 0);
+        BOOST_CHECK(fill.calls == 1);
+        BOOST_CHECK(stats.get(counter::bad_mac) == 2);
+    }
+
+    // malformed extension fields are dropped
+    {
+        sntp::worker_stats stats;
+        sntp::worker_context context;
+        context.stats = &stats;
+
+        // 4 bytes after the header are neither a field nor a MAC
+        datagram request = test::sntp::make_request<datagram>(test::sntp::valid_client, 7);
+        fill_recorder fill;
+        BOOST_CHECK(accept(request, 52, make_source(4), context, fill) == 0);
+        BOOST_CHECK(fill.calls == 0);
+        BOOST_CHECK(stats.get(counter::bad_extension) == 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+#include "response_kernel.hpp"
+#include "server_state.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    using instruction_set = sntp::response_kernel::instruction_set;
+
+    // Odd, so that no datagram is aligned
+    const std::size_t stride = sntp::packet::minimum_packet_size() + 5;
+
+    // Datagrams with every flags value, random contents, and some
+    // transmit timestamps from this server
+    std::vector<std::uint8_t> make_requests(const std::size_t count)
+    {
+        std::mt19937 random(count);
+        std::vector<std::uint8_t> datagrams(count * stride);
+        for (std::uint8_t& byte : datagrams)
+        {
+            byte = std::uint8_t(random());
+        }
+
+        for (std::size_t index = 0; index < count; ++index)
+        {
+            std::uint8_t* const datagram = datagrams.data() + index * stride;
+            datagram[0] = std::uint8_t(index);
+            if (index % 3 == 0)
+            {
+                sntp::timestamp_view(datagram + 40).store(sntp::timestamp::now());
+            }
+        }
+        return datagrams;
+    }
+
+    void check_kernel(const sntp::response_kernel& kernel)
+    {
+        // rejections match packet_view for every flags value, and for
+        // counts that leave a remainder for the scalar code
+        for (const std::size_t count : {0, 1, 7, 8, 15, 16, 17, 33, 256, 301})
+        {
+            std::vector<std::uint8_t> datagrams = make_requests(count);
+            std::vector<sntp::packet::rejection> results(count);
+            kernel.check_requests(datagrams.data(), stride, count, results.data());
+
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                const sntp::packet_view request(
+                    datagrams.data() + index * stride, sntp::packet::minimum_packet_size());
+                BOOST_CHECK(results[index] == request.check_request());
+            }
+        }
+
+        // responses match packet_view, and nothing past the header is
+        // written
+        {
+            const std::size_t count = 301;
+            std::vector<std::uint8_t> datagrams = make_requests(count);
+            std::vector<sntp::packet::rejection> results(count);
+            kernel.check_requests(datagrams.data(), stride, count, results.data());
+
+            std::vector<std::uint8_t> expected = datagrams;
+            std::vector<sntp::response_kernel::response> responses;
+            for (std::size_t index = 0; index < count; ++index)
+            {
+                if (results[index] == sntp::packet::rejection::none)
+                {
+                    const sntp::timestamp received = sntp::timestamp::now();
+                    const sntp::timestamp transmit = sntp::timestamp::now();
+                    responses.push_back({datagrams.data() + index * stride, received, transmit});
+
+                    const sntp::packet_view request(
+                        expected.data() + index * stride, sntp::packet::minimum_packet_size());
+                    BOOST_CHECK(request.fill_server_values(received, transmit));
+                }
+            }
+
+            BOOST_CHECK(responses.size() >= 5);
+            kernel.fill_responses(responses.data(), responses.size());
+            BOOST_CHECK(datagrams == expected);
+        }
+    }
+}
+
+int test_main(int, char**)
+{
+    BOOST_CHECK(sntp::response_kernel::supported(instruction_set::scalar));
+    BOOST_CHECK(sntp::response_kernel::supported(sntp::response_kernel::detect()));
+    BOOST_CHECK(
+        std::strcmp(sntp::response_kernel::name(instruction_set::avx2), "avx2") == 0);
+
+    for (const instruction_set isa :
+             {instruction_set::scalar, instruction_set::sse2, instruction_set::avx2})
+    {
+        if (sntp::response_kernel::supported(isa))
+        {
+            const sntp::response_kernel kernel(isa);
+            BOOST_CHECK(kernel.isa() == isa);
+            check_kernel(kernel);
+
+            // the precision is read when filling
+            BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(12));
+            check_kernel(kernel);
+            BOOST_CHECK(
+                sntp::timestamp::precision::set_significant_bits(
+                    sntp::timestamp::precision::default_significant_bits));
+
+            // every field of the published state is copied
+            sntp::server_state state;
+            state.leap = sntp::server_state::leap_indicator::none;
+            state.stratum = 2;
+            state.identifier = {{192, 0, 2, 1}};
+            state.reference = sntp::timestamp::now();
+            state.root_delay = 0x00012345;
+            state.root_dispersion = 0x00000400;
+            state.publish();
+            check_kernel(kernel);
+            sntp::server_state().publish();
+        }
+    }
+
+    return 0;
+}
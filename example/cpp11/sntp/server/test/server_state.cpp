@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+#include "response_kernel.hpp"
+#include "server_state.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    std::array<std::uint8_t, 48> make_request()
+    {
+        std::array<std::uint8_t, 48> request = {{0}};
+        request[0] = 0x23;  // version 4, client mode
+        request[47] = 1;
+        return request;
+    }
+
+    sntp::server_state make_upstream_state()
+    {
+        sntp::server_state state;
+        state.leap = sntp::server_state::leap_indicator::none;
+        state.stratum = 2;
+        state.identifier = {{192, 0, 2, 1}};
+        state.reference = sntp::timestamp::now();
+        state.root_delay = 0x00012345;
+        state.root_dispersion = 0x00000400;
+        return state;
+    }
+}
+
+int test_main(int, char**)
+{
+    // the default is the uncalibrated local clock
+    {
+        const sntp::server_state::header expected = {{
+            0xE4, 1, 6, 0xEC, 0, 0, 0, 0, 0, 0, 0, 0, 'L', 'O', 'C', 'L',
+            0, 0, 0, 0, 0, 0, 0, 0}};
+        BOOST_CHECK(sntp::server_state::response_header() == expected);
+    }
+
+    // a published state is in network byte order
+    const sntp::server_state upstream = make_upstream_state();
+    {
+        upstream.publish();
+        const sntp::server_state::header header = sntp::server_state::response_header();
+        BOOST_CHECK(header[0] == 0x24);
+        BOOST_CHECK(header[1] == 2);
+        BOOST_CHECK(header[2] == 6);
+        BOOST_CHECK(header[3] == 0xEC);
+
+        const std::uint8_t delay_and_dispersion[] = {0, 1, 0x23, 0x45, 0, 0, 4, 0};
+        BOOST_CHECK(
+            std::equal(
+                std::begin(delay_and_dispersion),
+                std::end(delay_and_dispersion),
+                header.begin() + 4));
+        BOOST_CHECK(header[12] == 192 && header[15] == 1);
+        BOOST_CHECK(sntp::timestamp_view::read(&header[16]) == upstream.reference);
+
+        // the precision is the current setting
+        BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(12));
+        BOOST_CHECK(sntp::server_state::response_header()[3] == 0xF4);
+        BOOST_CHECK(
+            sntp::timestamp::precision::set_significant_bits(
+                sntp::timestamp::precision::default_significant_bits));
+    }
+
+    // responses use the published state
+    {
+        std::array<std::uint8_t, 48> request = make_request();
+        const sntp::packet_view response(request.data(), request.size());
+        BOOST_CHECK(response.fill_server_values());
+        BOOST_CHECK(response.stratum() == 2);
+        BOOST_CHECK((response.identifier() == std::array<std::uint8_t, 4>{{192, 0, 2, 1}}));
+        BOOST_CHECK(response.reference().load() == upstream.reference);
+
+        std::array<std::uint8_t, 48> kiss = make_request();
+        const sntp::packet_view kiss_response(kiss.data(), kiss.size());
+        BOOST_CHECK(kiss_response.fill_kiss_of_death(sntp::kiss_code::rate));
+        BOOST_CHECK(kiss_response.stratum() == 0);
+        BOOST_CHECK(kiss_response.identifier() == sntp::kiss_code::rate);
+
+        std::array<std::uint8_t, 48> batched = make_request();
+        const sntp::response_kernel::response queued = {
+            batched.data(), response.receive().load(), response.transmit().load()};
+        sntp::response_kernel().fill_responses(&queued, 1);
+        BOOST_CHECK(batched == request);
+    }
+
+    // readers never see a partial publish
+    {
+        sntp::server_state other;
+        other.stratum = 3;
+        other.identifier = {{198, 51, 100, 7}};
+        other.reference = sntp::timestamp::now();
+        other.root_delay = 0xFFFFFFFF;
+        other.root_dispersion = 0xFFFFFFFF;
+
+        other.publish();
+        const sntp::server_state::header other_header = sntp::server_state::response_header();
+        upstream.publish();
+        const sntp::server_state::header upstream_header = sntp::server_state::response_header();
+
+        std::atomic<bool> done(false);
+        std::atomic<std::uint64_t> torn(0);
+        std::vector<std::thread> readers;
+        for (unsigned reader = 0; reader < 2; ++reader)
+        {
+            readers.emplace_back([&]()
+            {
+                while (!done.load())
+                {
+                    const sntp::server_state::header header =
+                        sntp::server_state::response_header();
+                    if (header != other_header && header != upstream_header)
+                    {
+                        torn.fetch_add(1);
+                    }
+                }
+            });
+        }
+
+        for (unsigned publish = 0; publish < 100000; ++publish)
+        {
+            (publish % 2 ? upstream : other).publish();
+        }
+
+        done = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        BOOST_CHECK(torn.load() == 0);
+    }
+
+    sntp::server_state().publish();
+    BOOST_CHECK(sntp::server_state::response_header()[12] == 'L');
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <boost/test/minimal.hpp>
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+#include <thread>
+
+#include "stats.hpp"
+
+int test_main(int, char**)
+{
+    using counter = sntp::worker_stats::counter;
+
+    // workers never share a cache line
+    static_assert(128 <= sizeof(sntp::worker_stats), "missing padding");
+
+    sntp::worker_stats first;
+    sntp::worker_stats second;
+
+    for (unsigned which = 0; which < unsigned(counter::count); ++which)
+    {
+        BOOST_CHECK(first.get(counter(which)) == 0);
+    }
+
+    first.increment(counter::received, 10);
+    first.increment(counter::answered, 5);
+    first.increment(counter::short_packet);
+    first.reject(sntp::packet::rejection::bad_version);
+    first.reject(sntp::packet::rejection::bad_mode);
+    first.reject(sntp::packet::rejection::looped);
+    first.reject(sntp::packet::rejection::none);
+    first.increment(counter::send_error);
+    first.increment(counter::rate_limited, 3);
+    first.increment(counter::kiss_of_death, 4);
+    first.increment(counter::bad_mac, 6);
+    first.increment(counter::bad_extension, 10);
+    first.increment(counter::authenticated, 7);
+    first.increment(counter::nts, 8);
+    first.increment(counter::nts_nak, 9);
+    first.record_residence(1000, 11000);
+    first.record_processing(1000, 1500);
+
+    // a clock step backwards
+    first.record_residence(2000, 1000);
+
+    BOOST_CHECK(first.get(counter::received) == 10);
+    BOOST_CHECK(first.get(counter::bad_version) == 1);
+    BOOST_CHECK(first.get(counter::bad_mode) == 1);
+    BOOST_CHECK(first.get(counter::looped) == 1);
+
+    // a worker thread updates its own counters
+    std::thread worker(
+        [&second]
+        {
+            for (unsigned count = 0; count < 1000; ++count)
+            {
+                second.increment(counter::received);
+                second.increment(counter::answered);
+            }
+            second.increment(counter::pool_exhausted, 2);
+            second.record_residence(0, 20000);
+        });
+    worker.join();
+
+    sntp::stats_snapshot totals;
+    totals += first;
+    totals += second;
+
+    BOOST_CHECK(totals.received == 1010);
+    BOOST_CHECK(totals.answered == 1005);
+    BOOST_CHECK(totals.short_packet == 1);
+    BOOST_CHECK(totals.bad_version == 1);
+    BOOST_CHECK(totals.bad_mode == 1);
+    BOOST_CHECK(totals.looped == 1);
+    BOOST_CHECK(totals.send_error == 1);
+    BOOST_CHECK(totals.rate_limited == 3);
+    BOOST_CHECK(totals.kiss_of_death == 4);
+    BOOST_CHECK(totals.pool_exhausted == 2);
+    BOOST_CHECK(totals.bad_mac == 6);
+    BOOST_CHECK(totals.bad_extension == 10);
+    BOOST_CHECK(totals.authenticated == 7);
+    BOOST_CHECK(totals.nts == 8);
+    BOOST_CHECK(totals.nts_nak == 9);
+    BOOST_CHECK(totals.dropped() == 24);
+    BOOST_CHECK(totals.residence.count() == 3);
+    BOOST_CHECK(totals.residence.minimum() == 0);
+    BOOST_CHECK(totals.residence.maximum() == 20000);
+    BOOST_CHECK(totals.processing.count() == 1);
+
+    BOOST_CHECK(!first.timed());
+    BOOST_CHECK(sntp::worker_stats(true).timed());
+
+    // processing is timed on a clock that is not stepped, and residence
+    // on the clock of kernel timestamps
+    {
+        const std::uint64_t start = sntp::worker_stats::now();
+        ::timespec monotonic;
+        ::clock_gettime(CLOCK_MONOTONIC, &monotonic);
+        BOOST_CHECK(start <= sntp::worker_stats::nanoseconds(monotonic));
+
+        ::timespec arrival;
+        ::clock_gettime(CLOCK_REALTIME, &arrival);
+        sntp::worker_stats timed(true);
+        timed.record_residence(arrival);
+        BOOST_CHECK(timed.residence().count() == 1);
+        BOOST_CHECK(timed.residence().maximum() < 1000000000);
+    }
+
+    const std::uint64_t now = sntp::worker_stats::realtime();
+    const ::timespec time = {std::time_t(now / 1000000000), long(now % 1000000000)};
+    BOOST_CHECK(sntp::worker_stats::nanoseconds(time) == now);
+
+    std::ostringstream summary;
+    summary << totals;
+    BOOST_CHECK(
+        summary.str() ==
+        "received 1010 answered 1005 dropped 24 (short 1 bad-version 1"
+        " bad-mode 1 looped 1 send-error 1 rate-limited 3 bad-mac 6"
+        " bad-extension 10)"
+        " kiss-of-death 4 authenticated 7 nts 8 nts-nak 9 pool-exhausted 2"
+        " residence p50 10.2 p99 20.0 p99.9 20.0us"
+        " processing p50 0.5 p99 0.5 p99.9 0.5us");
+
+    return 0;
+}
@@ -37,7 +37,7 @@ namespace
 
         sntp_packet() :
             data_(),
-            range_(data_.begin(), data_.end())
+            size_(packet_size)
         {
         }
 
@@ -54,24 +54,26 @@ namespace
         void shrink_buffer()
         {
             static_assert(packet_array().size() != 0, "buffer cannot be empty");
-            assert(!data_.empty());
-            range_ = boost::make_iterator_range(data_.begin(), data_.end() - 1);
+            assert(size_ != 0);
+            --size_;
         }
 
         auto get_buffer()
         {
-            return boost::asio::buffer(range_.begin(), range_.size());
+            return boost::asio::buffer(data_.data(), size_);
         }
 
         std::size_t get_buffer_size()
         {
-            return range_.size();
+            return size_;
         }
 
     private:
 
+        // A size instead of an iterator range, so that copies (queued
+        // packets) refer to their own data.
         packet_array data_;
-        boost::iterator_range<packet_array::iterator> range_;
+        std::size_t size_;
     };
 
     class test_client
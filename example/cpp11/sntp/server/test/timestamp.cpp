@@ -1,14 +1,55 @@
 #include <boost/range/algorithm/count.hpp>
 #include <boost/range/iterator_range.hpp>
 #include <boost/test/minimal.hpp>
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "conversion.hpp"
+#include "fingerprint.hpp"
 #include "timestamp.hpp"
 
 namespace
 {
+    // SipHash engine that counts how many of its keys are alive
+    class counted_fingerprint : public sntp::fingerprint
+    {
+    public:
+
+        counted_fingerprint(const key& secret, std::atomic<unsigned>& live) :
+            engine_(secret),
+            live_(live)
+        {
+            ++live_;
+        }
+
+        ~counted_fingerprint() override
+        {
+            --live_;
+        }
+
+        std::uint32_t operator()(
+            const std::uint32_t seconds, const std::uint32_t fractional) const override
+        {
+            return engine_(seconds, fractional);
+        }
+
+        std::unique_ptr<const sntp::fingerprint> rekey(const key& secret) const override
+        {
+            return std::unique_ptr<const sntp::fingerprint>(
+                new counted_fingerprint(secret, live_));
+        }
+
+    private:
+        sntp::siphash_fingerprint engine_;
+        std::atomic<unsigned>& live_;
+    };
+
     inline std::uint32_t get_last_bit(const std::uint32_t value)
     {
         return value & sntp::to_ulong(0x01);
@@ -191,6 +232,245 @@ int test_main(int, char**)
         BOOST_CHECK(time.from_server());
         check_timestamp(time, -101, 4292562114);
     }
+    {
+        // unix epoch is 2208988800 seconds after the NTP epoch
+        const ::timespec unix_time = {0, 0};
+        const sntp::timestamp time(unix_time);
+        BOOST_CHECK(time.from_server());
+        check_timestamp(time, 2208988800U, 0);
+    }
+    {
+        const ::timespec unix_time = {100, 500000000};
+        const sntp::timestamp time(unix_time);
+        BOOST_CHECK(time.from_server());
+        check_timestamp(time, 2208988900U, 0x80000000);
+    }
+    {
+        const ::timespec unix_time = {0, 999999999};
+        const sntp::timestamp time(unix_time);
+        BOOST_CHECK(time.from_server());
+        check_timestamp(time, 2208988800U, 4294967291U);
+    }
+    {
+        // NTP era 1 starts in 2036
+        const ::timespec unix_time = {2085978496, 1000};
+        const sntp::timestamp time(unix_time);
+        BOOST_CHECK(time.from_server());
+        check_timestamp(time, 0, 4294);
+    }
+    {
+        // the highest precision leaves 11 bits for the key parity and the
+        // crypto string
+        BOOST_CHECK(!sntp::timestamp::precision::set_significant_bits(9));
+        BOOST_CHECK(!sntp::timestamp::precision::set_significant_bits(22));
+        BOOST_CHECK(sntp::timestamp::precision::significant_bits() == 20);
+
+        const sntp::timestamp original = sntp::timestamp::now();
+        BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(21));
+        BOOST_CHECK(sntp::timestamp::precision::significant_bits() == 21);
+
+        const sntp::timestamp::precision precise;
+        BOOST_CHECK(*reinterpret_cast<const std::int8_t*>(&precise) == -21);
+
+        const ::timespec unix_time = {0, 500};
+        const sntp::timestamp time(unix_time);
+        BOOST_CHECK(time.from_server());
+
+        const auto values = get_values(time);
+        BOOST_CHECK(values.first == sntp::to_ulong(2208988800U));
+        BOOST_CHECK(
+            (values.second & sntp::to_ulong(0xFFFFF800)) == sntp::to_ulong(0x800));
+
+        // random client timestamps are mistaken for loops once in 2^10,
+        // even with both keys in use
+        sntp::timestamp::rotate_fingerprint();
+        std::mt19937 random(5);
+        unsigned looped = 0;
+        const unsigned clients = 100000;
+        for (unsigned client = 0; client < clients; ++client)
+        {
+            const std::uint32_t seconds = random();
+            const std::uint32_t fractional = random();
+            if (make_timestamp(std::make_pair(seconds, fractional)).from_server())
+            {
+                ++looped;
+            }
+        }
+        BOOST_CHECK(clients / 2048 < looped && looped < clients / 512);
+
+        BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(20));
+        BOOST_CHECK(original.from_server());
+    }
+    {
+        // the fewest significant bits make a false match unlikely (2^-21)
+        BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(10));
+        const sntp::timestamp oldest = sntp::timestamp::now();
+
+        sntp::timestamp::rotate_fingerprint();
+        const sntp::timestamp previous = sntp::timestamp::now();
+        BOOST_CHECK(oldest.from_server());
+        BOOST_CHECK(previous.from_server());
+
+        // the first insignificant bit is the key parity
+        const std::uint32_t parity = sntp::to_ulong(0x00200000);
+        BOOST_CHECK(
+            ((get_values(oldest).second ^ get_values(previous).second) & parity) != 0);
+
+        sntp::timestamp::rotate_fingerprint();
+        const sntp::timestamp current = sntp::timestamp::now();
+        BOOST_CHECK(!oldest.from_server());
+        BOOST_CHECK(previous.from_server());
+        BOOST_CHECK(current.from_server());
+
+        BOOST_CHECK(sntp::timestamp::precision::set_significant_bits(20));
+    }
+    {
+        // timestamps given their strings together match those made one at
+        // a time
+        std::vector<::timespec> unix_times;
+        std::vector<sntp::timestamp> stamps;
+        for (long index = 0; index < 100; ++index)
+        {
+            unix_times.push_back(
+                ::timespec{1400000000 + index * 7, (index * 10000019) % 1000000000});
+            stamps.push_back(sntp::timestamp::deferred(unix_times.back()));
+        }
+
+        sntp::timestamp::generate_crypto_strings(stamps.data(), stamps.size());
+        for (std::size_t index = 0; index < stamps.size(); ++index)
+        {
+            BOOST_CHECK(stamps[index] == sntp::timestamp(unix_times[index]));
+        }
+
+        // checked together, with both keys, and timestamps without strings
+        sntp::timestamp::rotate_fingerprint();
+        for (std::size_t index = 0; index < 50; ++index)
+        {
+            stamps.push_back(sntp::timestamp(unix_times[index]));
+            stamps.push_back(sntp::timestamp::deferred(unix_times[index]));
+        }
+
+        std::array<bool, 200> results;
+        results.fill(false);
+        sntp::timestamp::from_server(stamps.data(), stamps.size(), results.data());
+
+        std::size_t matches = 0;
+        for (std::size_t index = 0; index < stamps.size(); ++index)
+        {
+            BOOST_CHECK(results[index] == stamps[index].from_server());
+            matches += results[index];
+        }
+        BOOST_CHECK(150 <= matches && matches < 160);
+    }
+
+    // key sets are reused after many rotations
+    {
+        const ::timespec unix_time{1400000000, 0};
+        for (unsigned rotation = 0; rotation < 200; ++rotation)
+        {
+            const sntp::timestamp previous(unix_time);
+            sntp::timestamp::rotate_fingerprint();
+            BOOST_CHECK(previous.from_server());
+            BOOST_CHECK(sntp::timestamp(unix_time).from_server());
+        }
+    }
+
+    // replaced keys are destroyed once every registered thread has been
+    // quiescent since, or has exited
+    {
+        std::atomic<unsigned> live(0);
+        sntp::timestamp::set_fingerprint(
+            std::unique_ptr<const sntp::fingerprint>(
+                new counted_fingerprint(sntp::fingerprint::random_key(), live)));
+        sntp::timestamp::rotate_fingerprint();
+        BOOST_CHECK(live == 2);
+
+        std::atomic<unsigned> step(0);
+        const auto wait_for = [&step](const unsigned value)
+        {
+            while (step != value)
+            {
+                std::this_thread::yield();
+            }
+        };
+
+        std::thread reader(
+            [&step, &wait_for]
+            {
+                sntp::timestamp::quiescent();
+                step = 1;
+                wait_for(2);
+                sntp::timestamp::quiescent();
+                step = 3;
+                wait_for(4);
+            });
+
+        // the reader could still hold the first two keys
+        wait_for(1);
+        sntp::timestamp::rotate_fingerprint();
+        sntp::timestamp::rotate_fingerprint();
+        BOOST_CHECK(live == 4);
+
+        // the sets replaced before the reader was quiescent are destroyed
+        step = 2;
+        wait_for(3);
+        sntp::timestamp::rotate_fingerprint();
+        BOOST_CHECK(live == 3);
+
+        step = 4;
+        reader.join();
+        sntp::timestamp::rotate_fingerprint();
+        BOOST_CHECK(live == 2);
+
+        sntp::timestamp::set_fingerprint(
+            std::unique_ptr<const sntp::fingerprint>(
+                new sntp::siphash_fingerprint(sntp::fingerprint::random_key())));
+        BOOST_CHECK(live == 0);
+    }
+
+    // a registered thread that is offline, i.e. blocked waiting for
+    // requests, and never quiescent again does not keep replaced keys
+    {
+        std::atomic<unsigned> live(0);
+        sntp::timestamp::set_fingerprint(
+            std::unique_ptr<const sntp::fingerprint>(
+                new counted_fingerprint(sntp::fingerprint::random_key(), live)));
+        sntp::timestamp::rotate_fingerprint();
+        BOOST_CHECK(live == 2);
+
+        std::atomic<unsigned> step(0);
+        const auto wait_for = [&step](const unsigned value)
+        {
+            while (step != value)
+            {
+                std::this_thread::yield();
+            }
+        };
+
+        std::thread idle(
+            [&step, &wait_for]
+            {
+                sntp::timestamp::quiescent();
+                sntp::timestamp::offline();
+                step = 1;
+                wait_for(2);
+            });
+
+        wait_for(1);
+        for (unsigned rotation = 0; rotation < 100; ++rotation)
+        {
+            sntp::timestamp::rotate_fingerprint();
+            BOOST_CHECK(live == 2);
+        }
+
+        step = 2;
+        idle.join();
+
+        sntp::timestamp::set_fingerprint(
+            std::unique_ptr<const sntp::fingerprint>(
+                new sntp::siphash_fingerprint(sntp::fingerprint::random_key())));
+        BOOST_CHECK(live == 0);
+    }
 
     return 0;
 }
@@ -0,0 +1,292 @@
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/test/minimal.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "packet_view.hpp"
+#include "server_state.hpp"
+#include "timestamp.hpp"
+#include "upstream.hpp"
+
+namespace
+{
+    const std::array<std::uint8_t, 4> no_kiss = {{0, 0, 0, 0}};
+
+    sntp::timestamp at(const double seconds)
+    {
+        ::timespec unix_time;
+        unix_time.tv_sec = 1400000000 + std::time_t(seconds);
+        unix_time.tv_nsec = long((seconds - std::floor(seconds)) * 1e9);
+        return sntp::timestamp(unix_time);
+    }
+
+    bool near(const double lhs, const double rhs)
+    {
+        return std::abs(lhs - rhs) < 1e-5;
+    }
+
+    sntp::upstream::sample make_sample(const double offset, const double delay)
+    {
+        sntp::upstream::sample value = sntp::upstream::sample();
+        value.offset = offset;
+        value.delay = delay;
+        return value;
+    }
+
+    // Stand-in for an upstream server on a loopback socket. Answers every
+    // request as a synchronized stratum 1 clock, skew seconds ahead, or
+    // with a Kiss-o'-Death code.
+    class fake_upstream
+    {
+    public:
+
+        fake_upstream(
+            boost::asio::io_service& service,
+            const std::time_t skew,
+            const std::array<std::uint8_t, 4>& kiss = no_kiss) :
+            socket_(
+                service,
+                boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+            skew_(skew),
+            kiss_(kiss),
+            answered_(0),
+            datagram_(),
+            sender_()
+        {
+            receive();
+        }
+
+        boost::asio::ip::udp::endpoint endpoint() const
+        {
+            return socket_.local_endpoint();
+        }
+
+        std::size_t answered() const
+        {
+            return answered_;
+        }
+
+    private:
+
+        sntp::timestamp now() const
+        {
+            ::timespec current;
+            ::clock_gettime(CLOCK_REALTIME, &current);
+            current.tv_sec += skew_;
+            return sntp::timestamp(current);
+        }
+
+        void receive()
+        {
+            socket_.async_receive_from(
+                boost::asio::buffer(datagram_),
+                sender_,
+                [this](const boost::system::error_code& error, const std::size_t length)
+                {
+                    if (!error)
+                    {
+                        respond(length);
+                        receive();
+                    }
+                });
+        }
+
+        void respond(const std::size_t length)
+        {
+            if (length < 48)
+            {
+                return;
+            }
+
+            const sntp::packet_view response(datagram_.data(), 48);
+            response.originate().assign(response.transmit());
+            response.receive().store(now());
+
+            const bool kiss = kiss_ != no_kiss;
+            const std::array<std::uint8_t, 4> identifier = {{'G', 'P', 'S', 0}};
+            std::memset(datagram_.data(), 0, 16);
+            datagram_[0] = kiss ? 0xE4 : 0x24;
+            datagram_[1] = kiss ? 0 : 1;
+            datagram_[2] = 6;
+            datagram_[3] = std::uint8_t(-20);
+            std::memcpy(datagram_.data() + 12, (kiss ? kiss_ : identifier).data(), 4);
+
+            response.reference().store(now());
+            response.transmit().store(now());
+            socket_.send_to(boost::asio::buffer(datagram_.data(), 48), sender_);
+            ++answered_;
+        }
+
+    private:
+
+        boost::asio::ip::udp::socket socket_;
+        const std::time_t skew_;
+        const std::array<std::uint8_t, 4> kiss_;
+        std::size_t answered_;
+        std::array<std::uint8_t, 48> datagram_;
+        boost::asio::ip::udp::endpoint sender_;
+    };
+}
+
+int test_main(int, char**)
+{
+    // offset and delay of an exchange
+    {
+        // request takes 50ms, server holds it 10ms, response takes 50ms,
+        // and the server is 250ms ahead
+        const sntp::upstream::sample value = sntp::upstream::measure(
+            at(100), at(100.3), at(100.31), at(100.11));
+        BOOST_CHECK(near(value.offset, 0.25));
+        BOOST_CHECK(near(value.delay, 0.1));
+
+        const sntp::upstream::sample behind = sntp::upstream::measure(
+            at(100), at(99.8), at(99.8), at(100.4));
+        BOOST_CHECK(near(behind.offset, -0.4));
+        BOOST_CHECK(near(behind.delay, 0.4));
+    }
+
+    // clock filter keeps the last 8 samples, and prefers the lowest delay
+    {
+        sntp::upstream::clock_filter filter;
+        BOOST_CHECK(filter.empty());
+        BOOST_CHECK(filter.jitter() == 0);
+
+        filter.add(make_sample(0.5, 0.2));
+        BOOST_CHECK(!filter.empty());
+        BOOST_CHECK(filter.best().offset == 0.5);
+        BOOST_CHECK(filter.jitter() == 0);
+
+        filter.add(make_sample(0.1, 0.05));
+        filter.add(make_sample(0.3, 0.1));
+        BOOST_CHECK(filter.best().offset == 0.1);
+        BOOST_CHECK(near(filter.jitter(), std::sqrt((0.16 + 0.04) / 2)));
+
+        for (unsigned count = 0; count < sntp::upstream::clock_filter::stages; ++count)
+        {
+            filter.add(make_sample(0.2, 0.15));
+        }
+        BOOST_CHECK(filter.best().offset == 0.2);  // every earlier sample replaced
+        BOOST_CHECK(filter.jitter() == 0);
+
+        sntp::upstream::sample aged = make_sample(0, 0.01);
+        aged.dispersion = 0.001;
+        aged.time = 50;
+        filter.add(aged);
+        BOOST_CHECK(near(filter.dispersion(50), 0.001));
+        BOOST_CHECK(near(filter.dispersion(150), 0.001 + 100 * 15e-6));
+
+        filter.clear();
+        BOOST_CHECK(filter.empty());
+    }
+
+    // selection of the candidates that agree
+    {
+        using sntp::upstream::candidate;
+
+        BOOST_CHECK(sntp::upstream::select({}).empty());
+
+        const std::vector<std::size_t> single =
+            sntp::upstream::select({candidate{5, 0.1, 1}});
+        BOOST_CHECK(single == std::vector<std::size_t>({0}));
+
+        // falseticker is excluded
+        const std::vector<candidate> candidates = {
+            {0.010, 0.02, 1}, {0.012, 0.03, 2}, {4.0, 0.02, 1}, {0.008, 0.01, 1}};
+        const std::vector<std::size_t> selected = sntp::upstream::select(candidates);
+        BOOST_CHECK(selected == std::vector<std::size_t>({0, 1, 3}));
+
+        // no majority
+        BOOST_CHECK(sntp::upstream::select({{0, 0.1, 1}, {1, 0.1, 1}}).empty());
+        BOOST_CHECK(
+            sntp::upstream::select({{0, 0.1, 1}, {1, 0.1, 1}, {2, 0.1, 1}}).empty());
+
+        // lowest stratum, then lowest distance, is the system peer
+        const sntp::upstream::selection result =
+            sntp::upstream::combine(candidates, selected);
+        BOOST_CHECK(result.peer == 3);
+        BOOST_CHECK(near(
+            result.offset,
+            (0.010 / 0.02 + 0.012 / 0.03 + 0.008 / 0.01) / (1 / 0.02 + 1 / 0.03 + 1 / 0.01)));
+        BOOST_CHECK(near(result.jitter, std::sqrt((0.002 * 0.002 + 0.004 * 0.004) / 2)));
+    }
+
+    // polls stand-in upstream servers, and publishes from the ones that agree
+    {
+        boost::asio::io_service service;
+        fake_upstream first(service, 0);
+        fake_upstream second(service, 0);
+        fake_upstream falseticker(service, 10);
+        fake_upstream denied(service, 0, {{'D', 'E', 'N', 'Y'}});
+
+        sntp::upstream::client client(
+            service,
+            {first.endpoint(), second.endpoint(), falseticker.endpoint(),
+             denied.endpoint(), first.endpoint()},
+            std::chrono::milliseconds(20));
+
+        client.start();
+        BOOST_CHECK(!client.current().synchronized);
+        BOOST_CHECK(sntp::server_state::response_header()[0] == 0xE4);
+        BOOST_CHECK(sntp::server_state::response_header()[1] == 16);
+
+        service.run_for(std::chrono::milliseconds(400));
+
+        const sntp::upstream::client::status& current = client.current();
+        BOOST_CHECK(current.synchronized);
+        BOOST_CHECK(current.reachable == 3);
+        BOOST_CHECK(current.selected == 2);
+        BOOST_CHECK(std::abs(current.offset) < 0.01);
+        BOOST_CHECK(denied.answered() == 1);
+
+        const sntp::server_state::header header = sntp::server_state::response_header();
+        BOOST_CHECK(header[0] == 0x24);
+        BOOST_CHECK(header[1] == 2);
+        BOOST_CHECK(header[12] == 127 && header[13] == 0 && header[14] == 0 && header[15] == 1);
+
+        std::uint32_t dispersion = 0;
+        std::memcpy(&dispersion, header.data() + 8, sizeof(dispersion));
+        BOOST_CHECK(dispersion != 0);
+
+        sntp::timestamp reference;
+        std::memcpy(&reference, header.data() + 16, sizeof(reference));
+        BOOST_CHECK(reference != sntp::timestamp());
+
+        client.stop();
+    }
+
+    // without a majority, the server is unsynchronized
+    {
+        boost::asio::io_service service;
+        fake_upstream honest(service, 0);
+        fake_upstream falseticker(service, 10);
+
+        sntp::upstream::client client(
+            service,
+            {honest.endpoint(), falseticker.endpoint()},
+            std::chrono::milliseconds(20));
+
+        client.start();
+        service.run_for(std::chrono::milliseconds(200));
+
+        BOOST_CHECK(!client.current().synchronized);
+        BOOST_CHECK(client.current().reachable == 2);
+        BOOST_CHECK(client.current().selected == 0);
+        BOOST_CHECK(honest.answered() != 0);
+
+        const sntp::server_state::header header = sntp::server_state::response_header();
+        BOOST_CHECK(header[0] == 0xE4);
+        BOOST_CHECK(header[1] == 16);
+        BOOST_CHECK(std::memcmp(header.data() + 12, "INIT", 4) == 0);
+
+        client.stop();
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <array>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/test/minimal.hpp>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "packet.hpp"
+#include "packet_util.hpp"
+#include "uring.hpp"
+
+namespace
+{
+    using request = std::array<std::uint8_t, 48>;
+    using response = std::array<std::uint8_t, 68>;
+
+    // Run the server until the client has a response waiting
+    std::size_t receive_response(
+        sntp::uring_server& server,
+        boost::asio::ip::udp::socket& client,
+        response& received)
+    {
+        for (unsigned attempt = 0; attempt < 100; ++attempt)
+        {
+            boost::system::error_code error;
+            const std::size_t bytes =
+                client.receive(boost::asio::buffer(received), 0, error);
+            if (!error)
+            {
+                return bytes;
+            }
+
+            server.run_once();
+        }
+        return 0;
+    }
+}
+
+int test_main(int, char**)
+{
+    boost::asio::io_service service;
+    const boost::asio::ip::udp::endpoint loopback(
+        boost::asio::ip::address_v4::loopback(), 0);
+
+    boost::asio::ip::udp::socket server_socket(service, loopback);
+    boost::asio::ip::udp::socket client(service, loopback);
+    client.non_blocking(true);
+
+    // buffer count is rounded up to a power of two
+    {
+        sntp::uring_server server(server_socket.native_handle(), 3, false, false);
+        BOOST_CHECK(server.buffers() == 4);
+    }
+
+    // 6 requests: 1 invalid version, 1 short, 4 valid. Only 2 buffers are
+    // provided, so the multishot receive has to be re-armed as buffers are
+    // returned.
+    {
+        sntp::uring_server server(server_socket.native_handle(), 2, true, false);
+
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::invalid_client, 1)),
+            server_socket.local_endpoint());
+
+        const request short_request = test::sntp::make_request(test::sntp::valid_client, 2);
+        client.send_to(
+            boost::asio::buffer(short_request.data(), short_request.size() - 1),
+            server_socket.local_endpoint());
+
+        for (std::uint8_t id = 3; id != 7; ++id)
+        {
+            client.send_to(
+                boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, id)),
+                server_socket.local_endpoint());
+        }
+
+        for (const std::uint8_t expected_id : {3, 4, 5, 6})
+        {
+            response received = {{0}};
+            BOOST_CHECK(
+                receive_response(server, client, received) ==
+                sntp::packet::minimum_packet_size());
+            BOOST_CHECK((received[0] & 0x07) == 0x04);
+            BOOST_CHECK(
+                received[test::sntp::originate_fractional_offset] == expected_id);
+            BOOST_CHECK(test::sntp::receive_before_transmit(received));
+        }
+    }
+
+    // kernel timestamps are used for the receive timestamp
+    {
+        server_socket.set_option(test::sntp::receive_timestamps(true));
+        sntp::uring_server server(server_socket.native_handle(), 4, false, true);
+
+        // The kernel enables timestamping lazily, so the first datagram
+        // after the option is set might arrive without one
+        response received = {{0}};
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 8)),
+            server_socket.local_endpoint());
+        BOOST_CHECK(
+            receive_response(server, client, received) ==
+            sntp::packet::minimum_packet_size());
+
+        client.send_to(
+            boost::asio::buffer(test::sntp::make_request(test::sntp::valid_client, 7)),
+            server_socket.local_endpoint());
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        BOOST_CHECK(
+            receive_response(server, client, received) ==
+            sntp::packet::minimum_packet_size());
+        BOOST_CHECK(received[test::sntp::originate_fractional_offset] == 7);
+
+        // arrival was at least 20 milliseconds before transmit
+        const std::uint64_t arrival =
+            test::sntp::extract_time(received, test::sntp::receive_timestamp_offset);
+        const std::uint64_t transmitted =
+            test::sntp::extract_time(received, test::sntp::transmit_timestamp_offset);
+        BOOST_CHECK(arrival < transmitted);
+        BOOST_CHECK((std::uint64_t(1) << 32) / 50 <= transmitted - arrival);
+    }
+
+    // run returns once stopped, from another thread or before running
+    {
+        sntp::uring_server server(server_socket.native_handle(), 1, false, false);
+        std::thread stopper(
+            [&server]
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                server.stop();
+            });
+        server.run();
+        stopper.join();
+
+        sntp::uring_server stopped(server_socket.native_handle(), 1, false, false);
+        stopped.stop();
+        stopped.run();
+    }
+
+    return 0;
+}
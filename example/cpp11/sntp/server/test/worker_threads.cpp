@@ -0,0 +1,113 @@
+#include <atomic>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/test/minimal.hpp>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "worker_threads.hpp"
+
+int test_main(int, char**)
+{
+    // every worker runs once, stop is not needed
+    {
+        std::vector<std::atomic<unsigned>> runs(4);
+        unsigned stops = 0;
+        sntp::run_worker_threads(
+            runs.size(),
+            [&runs](const std::size_t worker)
+            {
+                ++runs[worker];
+            },
+            [&stops]
+            {
+                ++stops;
+            });
+
+        for (const std::atomic<unsigned>& count : runs)
+        {
+            BOOST_CHECK(count == 1);
+        }
+        BOOST_CHECK(stops == 0);
+    }
+
+    // a failed worker stops the others, and its failure is rethrown
+    for (std::size_t failing = 0; failing < 4; ++failing)
+    {
+        using work_guard =
+            boost::asio::executor_work_guard<boost::asio::io_service::executor_type>;
+
+        std::vector<std::unique_ptr<boost::asio::io_service>> services;
+        std::vector<work_guard> guards;
+        for (unsigned worker = 0; worker < 4; ++worker)
+        {
+            services.emplace_back(new boost::asio::io_service(1));
+            guards.emplace_back(services.back()->get_executor());
+        }
+
+        std::atomic<unsigned> stops(0);
+        bool thrown = false;
+        try
+        {
+            sntp::run_worker_threads(
+                services.size(),
+                [&services, failing](const std::size_t worker)
+                {
+                    if (worker == failing)
+                    {
+                        throw std::runtime_error("worker failed");
+                    }
+                    services[worker]->run();
+                },
+                [&services, &stops]
+                {
+                    ++stops;
+                    for (const std::unique_ptr<boost::asio::io_service>& service : services)
+                    {
+                        service->stop();
+                    }
+                });
+        }
+        catch (const std::runtime_error& error)
+        {
+            thrown = std::string(error.what()) == "worker failed";
+        }
+
+        BOOST_CHECK(thrown);
+        BOOST_CHECK(stops == 1);
+    }
+
+    // threads that cannot be started stop the workers, none of which runs
+    {
+        std::atomic<unsigned> runs(0);
+        unsigned stops = 0;
+        bool thrown = false;
+        try
+        {
+            sntp::run_worker_threads(
+                std::numeric_limits<std::size_t>::max(),
+                [&runs](std::size_t)
+                {
+                    ++runs;
+                },
+                [&stops]
+                {
+                    ++stops;
+                });
+        }
+        catch (const std::length_error&)
+        {
+            thrown = true;
+        }
+
+        BOOST_CHECK(thrown);
+        BOOST_CHECK(runs == 0);
+        BOOST_CHECK(stops == 1);
+    }
+
+    return 0;
+}
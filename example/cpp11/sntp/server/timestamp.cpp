@@ -9,82 +9,339 @@
 //
 #include "timestamp.hpp"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <cmath>
-#include <complex>
-#include <cryptopp/aes.h>
-#include <cryptopp/osrng.h>
-#include <cryptopp/sha.h>
 #include <limits>
+#include <mutex>
+#include <time.h>
+#include <utility>
+#include <vector>
 
+#include "clock_source.hpp"
 #include "conversion.hpp"
+#include "fingerprint.hpp"
 
 namespace sntp
 {
     namespace
     {
-        // Generates a random 128-bit value on construction
-        class RandomString
+        // Engines for detecting loops and replay attacks, with the current
+        // and previous keys. The engine of each key is at the parity of its
+        // generation, and a string records the parity so from_server only
+        // computes one fingerprint. Never modified once published.
+        struct fingerprint_keys
         {
-        public:
+            std::uint64_t generation;
+            std::array<std::shared_ptr<const fingerprint>, 2> engines;
+        };
+
+        std::unique_ptr<const fingerprint_keys> make_keys(
+            std::unique_ptr<const fingerprint> engine)
+        {
+            std::unique_ptr<fingerprint_keys> keys(new fingerprint_keys());
+            keys->generation = 0;
+            keys->engines[0] = std::move(engine);
+            return keys;
+        }
+
+        // Owned by the thread changing keys
+        std::unique_ptr<const fingerprint_keys> published_keys = make_keys(
+            std::unique_ptr<const fingerprint>(
+                new siphash_fingerprint(fingerprint::random_key())));
+
+        std::atomic<const fingerprint_keys*> active_keys(published_keys.get());
+
+        // Quiescent-state based reclamation of replaced key sets. Every
+        // publish starts a new epoch. A reader stores the epoch it has seen
+        // when it holds no key set, so a set replaced at an epoch is unused
+        // once every registered reader has stored that epoch or a later one.
+        // An offline reader stores the largest epoch, so it never delays a
+        // reclaim while it is blocked.
+        std::atomic<std::uint64_t> published_epoch(1);
+        constexpr std::uint64_t offline_epoch = std::numeric_limits<std::uint64_t>::max();
+
+        struct reader_registration;
+        std::mutex readers_mutex;
+        std::vector<const reader_registration*> readers;    // readers_mutex
 
-            RandomString() :
-                random_()
+        struct reader_registration
+        {
+            reader_registration() :
+                observed(0)
+            {
+                const std::lock_guard<std::mutex> lock(readers_mutex);
+                observed.store(published_epoch.load(std::memory_order_acquire));
+                readers.push_back(this);
+            }
+
+            ~reader_registration()
             {
-                CryptoPP::AutoSeededX917RNG<CryptoPP::AES> random_generator;
-                random_generator.GenerateBlock(random_.data(), random_.size());
+                const std::lock_guard<std::mutex> lock(readers_mutex);
+                readers.erase(std::find(readers.begin(), readers.end(), this));
             }
 
-            const std::array<std::uint8_t, 16>& get_random_string() const
+            reader_registration(const reader_registration&) = delete;
+            reader_registration& operator=(const reader_registration&) = delete;
+
+            // Release, so every earlier use of a key set happens before a
+            // reclaim that sees the epoch. Coming back online also needs the
+            // store ordered before the next load of active_keys, or a reclaim
+            // could still see the reader offline after it loaded a set that
+            // is being replaced; reclaim_keys has the matching fence.
+            void quiescent()
             {
-                return random_;
+                const bool was_offline =
+                    observed.load(std::memory_order_relaxed) == offline_epoch;
+                observed.store(
+                    published_epoch.load(std::memory_order_acquire), std::memory_order_release);
+                if (was_offline)
+                {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
             }
 
-        private:
+            void offline()
+            {
+                observed.store(offline_epoch, std::memory_order_release);
+            }
 
-            std::array<std::uint8_t, 16> random_;
+            std::atomic<std::uint64_t> observed;
         };
 
+        // Unregistered when the thread exits
+        thread_local std::unique_ptr<reader_registration> this_reader;
 
+        // A replaced key set, and the epoch it was replaced at
+        using retired_set = std::pair<std::uint64_t, std::unique_ptr<const fingerprint_keys>>;
 
-        // random string for detecting loops and replay attacks
-        const RandomString random_data;
+        // Owned by the thread changing keys
+        std::vector<retired_set> retired_keys;
 
-        // masks for bits of the timestamp that (in)significant due to accuracy
-        const std::uint32_t insignificant_mask =
+        void reclaim_keys()
+        {
+            // Readers coming online either see the published set, or are
+            // seen online here
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            std::uint64_t oldest = offline_epoch;
+            {
+                const std::lock_guard<std::mutex> lock(readers_mutex);
+                for (const reader_registration* const reader : readers)
+                {
+                    oldest = std::min(oldest, reader->observed.load(std::memory_order_acquire));
+                }
+            }
+
+            retired_keys.erase(
+                std::remove_if(
+                    retired_keys.begin(),
+                    retired_keys.end(),
+                    [oldest](const retired_set& retired)
+                    {
+                        return retired.first <= oldest;
+                    }),
+                retired_keys.end());
+        }
+
+        void publish_keys(std::unique_ptr<const fingerprint_keys> keys)
+        {
+            active_keys.store(keys.get(), std::memory_order_release);
+            const std::uint64_t epoch =
+                published_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+            retired_keys.emplace_back(epoch, std::move(published_keys));
+            published_keys = std::move(keys);
+
+            // The publishing thread is between timestamp operations
+            if (this_reader)
+            {
+                this_reader->quiescent();
+            }
+            reclaim_keys();
+        }
+
+        constexpr std::uint32_t make_insignificant_mask(const std::int8_t bits)
+        {
+            return std::numeric_limits<std::uint32_t>::max() >> bits;
+        }
+
+        std::int8_t configured_significant_bits =
+            timestamp::precision::default_significant_bits;
+
+        // masks for bits of the timestamp that (in)significant due to
+        // accuracy. The first insignificant bit is the key parity, and the
+        // rest are the fingerprint.
+        std::uint32_t insignificant_mask =
+            to_ulong(make_insignificant_mask(configured_significant_bits));
+        std::uint32_t significant_mask = ~insignificant_mask;
+        std::uint32_t parity_mask =
             to_ulong(
-                std::numeric_limits<std::uint32_t>::max() >>
-                timestamp::precision::significant_bits());
-        const std::uint32_t significant_mask = ~insignificant_mask;
-
-        // ratio for converting microseconds to NTP fractional
-        const double fractional_ratio = std::pow(2, 32) / std::pow(10, 6);
-
-        // total_seconds returns a long, whose type is _at least_ a 32-bit
-        // signed integer. Thus, total_seconds() could have an undefined
-        // value if total_seconds() exceeds a 32-bit signed integer. Mitigate
-        // this by bumping the epoch to the next rollover event, but do so
-        // carefully since posix_time::second also uses type long.
-        static_assert(
-            (
-                (std::uint32_t(std::numeric_limits<std::int32_t>::max()) * 2) + 1 ==
-                std::numeric_limits<std::uint32_t>::max()),
-            "unexpected int32::max value");
-        static_assert(
-            std::numeric_limits<std::int32_t>::max() <= std::numeric_limits<long>::max(),
-            "unexpected long size");
-        const boost::posix_time::ptime epoch(
-            boost::gregorian::date(1900, 1, 1),
-            boost::posix_time::seconds(std::numeric_limits<std::int32_t>::max()) +
-            boost::posix_time::seconds(std::numeric_limits<std::int32_t>::max()) +
-            boost::posix_time::seconds(2)); // +1 to equal uint32, another +1 to rollover
+                make_insignificant_mask(configured_significant_bits) ^
+                make_insignificant_mask(configured_significant_bits + 1));
+        std::uint32_t fingerprint_mask =
+            to_ulong(make_insignificant_mask(configured_significant_bits + 1));
+
+        // Null reads CLOCK_REALTIME directly, without a virtual call
+        std::unique_ptr<const clock_source> configured_clock;
+
+        ::timespec current_time()
+        {
+            if (configured_clock)
+            {
+                return configured_clock->now();
+            }
+
+            // glibc services CLOCK_REALTIME from the vDSO, no system call
+            ::timespec current = {};
+            ::clock_gettime(CLOCK_REALTIME, &current);
+            return current;
+        }
+
+        // seconds between the NTP epoch (1900) and the unix epoch (1970)
+        const std::uint32_t unix_epoch_offset = 2208988800U;
+
+        // Convert a count of 1 / Units second to NTP fractional (1 / 2^32
+        // second) with integer math. Division by a constant compiles to a
+        // multiply and shift.
+        template<std::uint64_t Units>
+        inline std::uint32_t to_fractional(const std::uint64_t count)
+        {
+            static_assert(Units <= (std::uint64_t(1) << 32), "overflow possible");
+            return std::uint32_t((count << 32) / Units);
+        }
+
+        // NTP seconds is modulus operation since 1900
+        std::uint32_t ntp_seconds(const ::timespec& unix_time)
+        {
+            return to_ulong(std::uint32_t(unix_time.tv_sec) + unix_epoch_offset);
+        }
+
+        std::uint32_t ntp_fractional(const ::timespec& unix_time)
+        {
+            return to_ulong(to_fractional<1000000000>(unix_time.tv_nsec));
+        }
+
+        // The significant bits of a fractional, and the key parity
+        std::uint32_t with_parity(const std::uint32_t fractional, const std::size_t parity)
+        {
+            return (fractional & significant_mask) | (parity ? parity_mask : 0);
+        }
+
+        // Timestamps are fingerprinted together in groups of this size
+        const std::size_t group_size = 64;
+    }
+
+    constexpr std::int8_t timestamp::precision::default_significant_bits;
+    constexpr std::int8_t timestamp::precision::minimum_significant_bits;
+    constexpr std::int8_t timestamp::precision::maximum_significant_bits;
+    constexpr unsigned timestamp::minimum_rotation_period;
+
+    std::int8_t timestamp::precision::significant_bits()
+    {
+        return configured_significant_bits;
+    }
+
+    bool timestamp::precision::set_significant_bits(const std::int8_t bits)
+    {
+        if (bits < minimum_significant_bits || maximum_significant_bits < bits)
+        {
+            return false;
+        }
+
+        configured_significant_bits = bits;
+        insignificant_mask = to_ulong(make_insignificant_mask(bits));
+        significant_mask = ~insignificant_mask;
+        parity_mask = to_ulong(make_insignificant_mask(bits) ^ make_insignificant_mask(bits + 1));
+        fingerprint_mask = to_ulong(make_insignificant_mask(bits + 1));
+        return true;
     }
 
     timestamp timestamp::now()
     {
-        return timestamp(
-            boost::posix_time::microsec_clock::universal_time() - epoch);
+        return timestamp(current_time());
+    }
+
+    timestamp timestamp::now_deferred()
+    {
+        return deferred(current_time());
+    }
+
+    timestamp timestamp::deferred(const ::timespec& unix_time)
+    {
+        timestamp stamp;
+        stamp.seconds_ = ntp_seconds(unix_time);
+        stamp.fractional_ = ntp_fractional(unix_time);
+        return stamp;
+    }
+
+    void timestamp::generate_crypto_strings(timestamp* const stamps, const std::size_t count)
+    {
+        const fingerprint_keys& keys = *active_keys.load(std::memory_order_acquire);
+        const std::size_t parity = keys.generation & 1;
+        const fingerprint& engine = *keys.engines[parity];
+
+        std::array<std::uint32_t, group_size> seconds;
+        std::array<std::uint32_t, group_size> fractional;
+        std::array<std::uint32_t, group_size> strings;
+
+        for (std::size_t start = 0; start < count; start += group_size)
+        {
+            const std::size_t grouped = std::min(group_size, count - start);
+            for (std::size_t index = 0; index < grouped; ++index)
+            {
+                timestamp& stamp = stamps[start + index];
+                stamp.fractional_ = with_parity(stamp.fractional_, parity);
+                seconds[index] = stamp.seconds_;
+                fractional[index] = stamp.fractional_;
+            }
+
+            engine.compute(seconds.data(), fractional.data(), grouped, strings.data());
+
+            for (std::size_t index = 0; index < grouped; ++index)
+            {
+                stamps[start + index].fractional_ |= strings[index] & fingerprint_mask;
+            }
+        }
+    }
+
+    void timestamp::set_clock_source(std::unique_ptr<const clock_source> source)
+    {
+        configured_clock = std::move(source);
+    }
+
+    void timestamp::set_fingerprint(std::unique_ptr<const fingerprint> engine)
+    {
+        publish_keys(make_keys(std::move(engine)));
+    }
+
+    void timestamp::quiescent()
+    {
+        if (!this_reader)
+        {
+            this_reader.reset(new reader_registration());
+        }
+        this_reader->quiescent();
+    }
+
+    void timestamp::offline()
+    {
+        if (this_reader)
+        {
+            this_reader->offline();
+        }
+    }
+
+    void timestamp::rotate_fingerprint()
+    {
+        const fingerprint_keys& current = *active_keys.load(std::memory_order_relaxed);
+        std::unique_ptr<fingerprint_keys> next(new fingerprint_keys(current));
+        ++next->generation;
+        next->engines[next->generation & 1] =
+            current.engines[current.generation & 1]->rekey(fingerprint::random_key());
+        publish_keys(std::move(next));
     }
 
     timestamp::timestamp(
@@ -108,45 +365,91 @@ namespace sntp
         }
 
         seconds_ = to_ulong(seconds_since_epoch);
-        fractional_ = to_ulong(
-            std::uint32_t(microsecond_precision * fractional_ratio));
+        fractional_ = to_ulong(to_fractional<1000000>(microsecond_precision));
 
         generate_crypto_string();
     }
 
+    timestamp::timestamp(const ::timespec& unix_time) :
+        seconds_(ntp_seconds(unix_time)),
+        fractional_(ntp_fractional(unix_time))
+    {
+        generate_crypto_string();
+    }
+
     bool timestamp::from_server() const
     {
-        timestamp crypto(*this);
-        crypto.generate_crypto_string();
-        return crypto.seconds_ == seconds_ &&
-            crypto.fractional_ == fractional_;
+        const fingerprint_keys& keys = *active_keys.load(std::memory_order_acquire);
+        const fingerprint* const engine =
+            keys.engines[(fractional_ & parity_mask) != 0].get();
+        if (!engine)
+        {
+            return false;
+        }
+
+        const std::uint32_t crypto_string =
+            (*engine)(seconds_, fractional_ & ~fingerprint_mask);
+        return (crypto_string & fingerprint_mask) == (fractional_ & fingerprint_mask);
+    }
+
+    void timestamp::from_server(
+        const timestamp* const stamps, const std::size_t count, bool* const results)
+    {
+        const fingerprint_keys& keys = *active_keys.load(std::memory_order_acquire);
+
+        std::array<std::size_t, group_size> indexes;
+        std::array<std::uint32_t, group_size> seconds;
+        std::array<std::uint32_t, group_size> fractional;
+        std::array<std::uint32_t, group_size> strings;
+
+        for (std::size_t start = 0; start < count; start += group_size)
+        {
+            const std::size_t end = std::min(count, start + group_size);
+
+            // One group per key, timestamps of a missing key are not ours
+            for (std::size_t parity = 0; parity < 2; ++parity)
+            {
+                const fingerprint* const engine = keys.engines[parity].get();
+                std::size_t grouped = 0;
+                for (std::size_t index = start; index < end; ++index)
+                {
+                    const timestamp& stamp = stamps[index];
+                    if (((stamp.fractional_ & parity_mask) != 0) == (parity != 0))
+                    {
+                        results[index] = false;
+                        if (engine)
+                        {
+                            indexes[grouped] = index;
+                            seconds[grouped] = stamp.seconds_;
+                            fractional[grouped] = stamp.fractional_ & ~fingerprint_mask;
+                            ++grouped;
+                        }
+                    }
+                }
+
+                if (grouped != 0)
+                {
+                    engine->compute(
+                        seconds.data(), fractional.data(), grouped, strings.data());
+                }
+
+                for (std::size_t index = 0; index < grouped; ++index)
+                {
+                    results[indexes[index]] =
+                        (strings[index] & fingerprint_mask) ==
+                        (stamps[indexes[index]].fractional_ & fingerprint_mask);
+                }
+            }
+        }
     }
 
     void timestamp::generate_crypto_string()
     {
-        std::uint32_t crypto_string = 0;
-        fractional_ &= significant_mask;
-        {
-            std::array<std::uint8_t, CryptoPP::SHA256::DIGESTSIZE> hash_value = {};
-
-            CryptoPP::SHA256 hash;
-            hash.Update(
-                random_data.get_random_string().data(),
-                random_data.get_random_string().size());
-            hash.Update(
-                reinterpret_cast<const std::uint8_t*>(&seconds_),
-                sizeof(seconds_));
-            hash.Update(
-                reinterpret_cast<const std::uint8_t*>(&fractional_),
-                sizeof(fractional_));
-            hash.Final(hash_value.data());
-
-            static_assert(
-                sizeof(crypto_string) <= hash_value.size(),
-                "hash is too small");
-            std::memcpy(&crypto_string, hash_value.data(), sizeof(crypto_string));
-        }
-        crypto_string &= insignificant_mask;
-        fractional_ |= crypto_string;
+        const fingerprint_keys& keys = *active_keys.load(std::memory_order_acquire);
+        const std::size_t parity = keys.generation & 1;
+
+        fractional_ = with_parity(fractional_, parity);
+        const std::uint32_t crypto_string = (*keys.engines[parity])(seconds_, fractional_);
+        fractional_ |= crypto_string & fingerprint_mask;
     }
 }
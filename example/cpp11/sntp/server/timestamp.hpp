@@ -12,28 +12,45 @@
 #define TIMESTAMP_HPP
 
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <cstddef>
 #include <cstdint>
+#include <ctime>
+#include <memory>
 #include <type_traits>
 
 namespace sntp
 {
+    class clock_source;
+    class fingerprint;
+
     // Handles timestamps in
     class timestamp
     {
     public:
 
-        // Represents server precision, currently a constant
+        // Represents server precision. Configured once at startup.
         class precision
         {
         public:
 
-            // The precision of the fractional portion, in bits.
-            static constexpr std::int8_t significant_bits()
-            {
-                return 20;
-            }
+            static constexpr std::int8_t default_significant_bits = 20;
+            static constexpr std::int8_t minimum_significant_bits = 10;
+            static constexpr std::int8_t maximum_significant_bits = 21;
+
+            // The precision of the fractional portion, in bits. The
+            // remaining bits are used for the cryptographic string, the
+            // first of them selects the current or previous key.
+            static std::int8_t significant_bits();
 
-            // Indicates microsecond precision
+            // Change the precision of all timestamps. Every bit added
+            // doubles the chance that a client timestamp appears to be
+            // from_server, and is dropped as a loop. The maximum leaves 10
+            // fingerprint bits, so about 0.1% are. Must be called before
+            // any thread uses timestamps. Returns false if bits is out of
+            // range.
+            static bool set_significant_bits(std::int8_t bits);
+
+            // Precision of the current significant_bits setting
             precision() :
                 precision_(-significant_bits())
             {
@@ -46,6 +63,57 @@ namespace sntp
         // Retrieve the current timestamp, and set cryptographic string
         static timestamp now();
 
+        // As now() and timestamp(unix_time), but without the cryptographic
+        // string, so the strings of many timestamps can be generated
+        // together with generate_crypto_strings. Must not be sent before.
+        static timestamp now_deferred();
+        static timestamp deferred(const ::timespec& unix_time);
+
+        // Set the cryptographic strings of count deferred timestamps, with
+        // the fingerprints computed together (fingerprint::compute)
+        static void generate_crypto_strings(timestamp* stamps, std::size_t count);
+
+        // Replace the engine used for cryptographic strings. Defaults to
+        // siphash with a random key. Must be called before any thread uses
+        // timestamps, and invalidates all previously generated strings.
+        static void set_fingerprint(std::unique_ptr<const fingerprint> engine);
+
+        // Replace the source of the current time, for now() and
+        // now_deferred(). Defaults to CLOCK_REALTIME, which is also
+        // restored by a null source. Must be called before any thread uses
+        // timestamps.
+        static void set_clock_source(std::unique_ptr<const clock_source> source);
+
+        // Shortest configurable rotation period in seconds. Strings older
+        // than two periods are no longer recognized by from_server.
+        static constexpr unsigned minimum_rotation_period = 60;
+
+        // Switch the engine to a new random key. Strings from the previous
+        // key are still recognized by from_server, older ones are not. The
+        // key set is published with an atomic pointer swap, so threads
+        // using timestamps never lock. A replaced key set is destroyed
+        // once every thread registered with quiescent() has called it
+        // again, or is offline(). Only one thread may rotate, and it does
+        // not need to be registered.
+        static void rotate_fingerprint();
+
+        // Report that the calling thread holds no key set, i.e. it is
+        // between timestamp operations. The first call registers the
+        // thread, so it must be made before the thread's first timestamp
+        // operation if another thread rotates the fingerprint. Call it
+        // after each batch of requests. Replaced key sets are kept until
+        // every registered thread that is not offline has called it again,
+        // so a thread that waits for requests must call offline() first,
+        // or be woken after each rotation. Never locks after the first
+        // call; the thread is unregistered when it exits.
+        static void quiescent();
+
+        // Report that the calling thread will not use timestamps until its
+        // next quiescent() call, i.e. before blocking. Replaced key sets are
+        // freed without waiting for it. Does nothing for a thread that is
+        // not registered.
+        static void offline();
+
         // Default timestamp (0 seconds, 0 fractional)
         timestamp() :
             seconds_(0),
@@ -59,10 +127,29 @@ namespace sntp
         explicit timestamp(
             const boost::posix_time::time_duration& time_since_epoch);
 
+        // Convert a unix (1970 epoch) time to NTP time, and set
+        // cryptographic string for from_server
+        explicit timestamp(const ::timespec& unix_time);
+
         // Return true if the timestamp appears to
         // have been generated by this application
         bool from_server() const;
 
+        // Set results[i] to stamps[i].from_server(), with the fingerprints
+        // computed together
+        static void from_server(const timestamp* stamps, std::size_t count, bool* results);
+
+        // Compare the network representation of two timestamps
+        friend bool operator==(const timestamp& lhs, const timestamp& rhs)
+        {
+            return lhs.seconds_ == rhs.seconds_ && lhs.fractional_ == rhs.fractional_;
+        }
+
+        friend bool operator!=(const timestamp& lhs, const timestamp& rhs)
+        {
+            return !(lhs == rhs);
+        }
+
     private:
 
         // Fills in the insignficant bits of the fractional portion
@@ -77,8 +164,8 @@ namespace sntp
 
     static_assert(sizeof(timestamp) == 8, "padding added to timestamp fields");
     static_assert(sizeof(timestamp::precision) == 1, "padding added to precision fields");
-//    static_assert(std::is_trivially_copyable<timestamp>::value, "timestamp must be pod");
-//    static_assert(std::is_trivially_copyable<timestamp::precision>::value, "timestamp precision must be pod");
+    static_assert(std::is_trivially_copyable<timestamp>::value, "timestamp must be pod");
+    static_assert(std::is_trivially_copyable<timestamp::precision>::value, "timestamp precision must be pod");
 }
 
 #endif // TIMESTAMP_HPP
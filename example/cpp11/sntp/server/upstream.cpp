@@ -0,0 +1,641 @@
+//
+// upstream.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "upstream.hpp"
+
+#include <algorithm>
+#include <boost/asio/buffer.hpp>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <ostream>
+
+#include "packet.hpp"
+#include "packet_view.hpp"
+
+namespace sntp
+{
+    namespace upstream
+    {
+        namespace
+        {
+            // No leap warning, version 4, client mode
+            const std::uint8_t client_request = 0x23;
+            const std::uint8_t server_mode = 0x04;
+
+            const std::uint8_t unsynchronized_leap = 3;
+            const std::uint8_t kiss_of_death = 0;
+            const std::uint8_t maximum_stratum = 15;
+            const std::uint8_t unsynchronized_stratum = 16;
+
+            const std::array<std::uint8_t, 4> rate_code = {{'R', 'A', 'T', 'E'}};
+            const std::array<std::uint8_t, 4> deny_code = {{'D', 'E', 'N', 'Y'}};
+            const std::array<std::uint8_t, 4> restrict_code = {{'R', 'S', 'T', 'R'}};
+            const std::array<std::uint8_t, 4> initializing = {{'I', 'N', 'I', 'T'}};
+
+            // RATE doubles the poll interval of a server, up to 2^17 seconds
+            const std::chrono::milliseconds maximum_poll = std::chrono::seconds(131072);
+
+            const std::size_t transmit_offset = 40;
+
+            // 32.32 fixed point seconds
+            std::uint64_t fixed_point(const timestamp& value)
+            {
+                std::array<std::uint8_t, sizeof(timestamp)> bytes;
+                std::memcpy(bytes.data(), &value, bytes.size());
+
+                std::uint64_t result = 0;
+                for (const std::uint8_t byte : bytes)
+                {
+                    result = (result << 8) | byte;
+                }
+                return result;
+            }
+
+            // Seconds from earlier to later, correct across an era rollover
+            // when less than 68 years apart
+            double difference(const timestamp& later, const timestamp& earlier)
+            {
+                return double(std::int64_t(fixed_point(later) - fixed_point(earlier))) /
+                    4294967296.0;
+            }
+
+            double from_short(const std::uint32_t value)
+            {
+                return value / 65536.0;
+            }
+
+            std::uint32_t to_short(const double seconds)
+            {
+                const double scaled = std::ceil(seconds * 65536.0);
+                if (scaled <= 0)
+                {
+                    return 0;
+                }
+                if (double(std::numeric_limits<std::uint32_t>::max()) <= scaled)
+                {
+                    return std::numeric_limits<std::uint32_t>::max();
+                }
+                return std::uint32_t(scaled);
+            }
+
+            double steady_seconds()
+            {
+                return std::chrono::duration<double>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            double local_precision()
+            {
+                return std::ldexp(1.0, -timestamp::precision::significant_bits());
+            }
+        }
+
+        sample measure(
+            const timestamp& originate,
+            const timestamp& receive,
+            const timestamp& transmit,
+            const timestamp& destination)
+        {
+            sample result = sample();
+            result.offset =
+                (difference(receive, originate) + difference(transmit, destination)) / 2;
+            result.delay =
+                difference(destination, originate) - difference(transmit, receive);
+            return result;
+        }
+
+        constexpr std::size_t clock_filter::stages;
+
+        clock_filter::clock_filter() :
+            samples_(),
+            count_(0),
+            next_(0)
+        {
+        }
+
+        void clock_filter::add(const sample& value)
+        {
+            samples_[next_] = value;
+            next_ = (next_ + 1) % stages;
+            count_ = std::min(count_ + 1, stages);
+        }
+
+        void clock_filter::clear()
+        {
+            count_ = 0;
+            next_ = 0;
+        }
+
+        const sample& clock_filter::best() const
+        {
+            assert(!empty());
+            return *std::min_element(
+                samples_.begin(),
+                samples_.begin() + count_,
+                [](const sample& lhs, const sample& rhs)
+                {
+                    return lhs.delay < rhs.delay;
+                });
+        }
+
+        double clock_filter::dispersion(const double now) const
+        {
+            const sample& chosen = best();
+            return chosen.dispersion + frequency_tolerance * std::max(0.0, now - chosen.time);
+        }
+
+        double clock_filter::jitter() const
+        {
+            if (count_ < 2)
+            {
+                return 0;
+            }
+
+            const double offset = best().offset;
+            double sum = 0;
+            for (std::size_t index = 0; index < count_; ++index)
+            {
+                const double error = samples_[index].offset - offset;
+                sum += error * error;
+            }
+            return std::sqrt(sum / (count_ - 1));
+        }
+
+        std::vector<std::size_t> select(const std::vector<candidate>& candidates)
+        {
+            // Every candidate has the start of its interval (-1), its offset
+            // (0), and the end of its interval (1). At equal values, starts
+            // sort first so touching intervals overlap.
+            struct edge
+            {
+                double value;
+                int type;
+            };
+
+            std::vector<edge> edges;
+            edges.reserve(candidates.size() * 3);
+            for (const candidate& current : candidates)
+            {
+                edges.push_back({current.offset - current.distance, -1});
+                edges.push_back({current.offset, 0});
+                edges.push_back({current.offset + current.distance, 1});
+            }
+
+            std::sort(
+                edges.begin(),
+                edges.end(),
+                [](const edge& lhs, const edge& rhs)
+                {
+                    return lhs.value < rhs.value ||
+                        (lhs.value == rhs.value && lhs.type < rhs.type);
+                });
+
+            // Allow an increasing number of falsetickers, until the rest
+            // agree on an interval containing none of the falseticker
+            // offsets.
+            const int count = int(candidates.size());
+            for (int allowed = 0; 2 * allowed < count; ++allowed)
+            {
+                int outside = 0;
+
+                int depth = 0;
+                double low = std::numeric_limits<double>::infinity();
+                for (const edge& current : edges)
+                {
+                    depth -= current.type;
+                    if (count - allowed <= depth)
+                    {
+                        low = current.value;
+                        break;
+                    }
+                    if (current.type == 0)
+                    {
+                        ++outside;
+                    }
+                }
+
+                depth = 0;
+                double high = -std::numeric_limits<double>::infinity();
+                for (auto current = edges.rbegin(); current != edges.rend(); ++current)
+                {
+                    depth += current->type;
+                    if (count - allowed <= depth)
+                    {
+                        high = current->value;
+                        break;
+                    }
+                    if (current->type == 0)
+                    {
+                        ++outside;
+                    }
+                }
+
+                if (outside <= allowed && low < high)
+                {
+                    std::vector<std::size_t> selected;
+                    for (std::size_t index = 0; index < candidates.size(); ++index)
+                    {
+                        const candidate& current = candidates[index];
+                        if (current.offset - current.distance <= high &&
+                            low <= current.offset + current.distance)
+                        {
+                            selected.push_back(index);
+                        }
+                    }
+                    return selected;
+                }
+            }
+
+            return {};
+        }
+
+        selection combine(
+            const std::vector<candidate>& candidates,
+            const std::vector<std::size_t>& selected)
+        {
+            assert(!selected.empty());
+
+            selection result = {selected.front(), 0, 0};
+            double weights = 0;
+            for (const std::size_t index : selected)
+            {
+                const candidate& current = candidates[index];
+                const candidate& peer = candidates[result.peer];
+                if (current.stratum < peer.stratum ||
+                    (current.stratum == peer.stratum && current.distance < peer.distance))
+                {
+                    result.peer = index;
+                }
+
+                const double weight = 1 / current.distance;
+                weights += weight;
+                result.offset += weight * current.offset;
+            }
+            result.offset /= weights;
+
+            if (1 < selected.size())
+            {
+                const double peer_offset = candidates[result.peer].offset;
+                double sum = 0;
+                for (const std::size_t index : selected)
+                {
+                    const double error = candidates[index].offset - peer_offset;
+                    sum += error * error;
+                }
+                result.jitter = std::sqrt(sum / (selected.size() - 1));
+            }
+
+            return result;
+        }
+
+        struct client::server
+        {
+            server(
+                boost::asio::io_service& service,
+                const boost::asio::ip::udp::endpoint& address,
+                const std::chrono::milliseconds interval) :
+                endpoint(address),
+                timer(service),
+                request(),
+                originate(),
+                outstanding(false),
+                reach(0),
+                denied(false),
+                poll(interval),
+                filter(),
+                leap(unsynchronized_leap),
+                stratum(unsynchronized_stratum),
+                precision(0),
+                root_delay(0),
+                root_dispersion(0),
+                updated()
+            {
+            }
+
+            const boost::asio::ip::udp::endpoint endpoint;
+            boost::asio::steady_timer timer;
+
+            // A minimum size packet, kept until it is sent
+            std::array<std::uint8_t, 48> request;
+            timestamp originate;
+            bool outstanding;
+
+            // A bit for each of the last 8 polls, set if it was answered
+            std::uint8_t reach;
+            bool denied;
+            std::chrono::milliseconds poll;
+            clock_filter filter;
+
+            // From the last valid response, in seconds
+            std::uint8_t leap;
+            std::uint8_t stratum;
+            double precision;
+            double root_delay;
+            double root_dispersion;
+            timestamp updated;
+        };
+
+        client::status::status() :
+            synchronized(false),
+            reachable(0),
+            selected(0),
+            offset(0),
+            jitter(0),
+            state()
+        {
+            state.stratum = unsynchronized_stratum;
+            state.identifier = initializing;
+        }
+
+        client::client(
+            boost::asio::io_service& service,
+            const std::vector<boost::asio::ip::udp::endpoint>& servers,
+            const std::chrono::milliseconds poll) :
+            socket_(service, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), 0)),
+            servers_(),
+            lookup_(),
+            poll_(poll),
+            spread_(std::random_device()()),
+            response_(),
+            sender_(),
+            status_()
+        {
+            static_assert(
+                sizeof(server::request) == packet::minimum_packet_size(),
+                "request is not a minimum size packet");
+            assert(0 < poll.count());
+
+            for (const boost::asio::ip::udp::endpoint& address : servers)
+            {
+                assert(address.address().is_v4());
+
+                // Each address is polled once
+                if (lookup_.find(address) == lookup_.end())
+                {
+                    servers_.emplace_back(new server(service, address, poll));
+                    lookup_.emplace(address, servers_.back().get());
+                }
+            }
+        }
+
+        client::~client()
+        {
+        }
+
+        void client::start()
+        {
+            status_ = status();
+            status_.state.publish();
+
+            std::uniform_int_distribution<std::chrono::milliseconds::rep> first(
+                0, poll_.count() - 1);
+            for (const std::unique_ptr<server>& upstream : servers_)
+            {
+                schedule(*upstream, std::chrono::milliseconds(first(spread_)));
+            }
+
+            receive();
+        }
+
+        void client::stop()
+        {
+            for (const std::unique_ptr<server>& upstream : servers_)
+            {
+                upstream->timer.cancel();
+            }
+
+            boost::system::error_code ignored;
+            socket_.cancel(ignored);
+        }
+
+        void client::schedule(server& upstream, const std::chrono::milliseconds delay)
+        {
+            upstream.timer.expires_after(delay);
+            upstream.timer.async_wait(
+                [this, &upstream](const boost::system::error_code& error)
+                {
+                    if (!error)
+                    {
+                        poll(upstream);
+                    }
+                });
+        }
+
+        void client::poll(server& upstream)
+        {
+            if (upstream.denied)
+            {
+                return;
+            }
+
+            upstream.reach <<= 1;
+            if (upstream.reach == 0 && !upstream.filter.empty())
+            {
+                upstream.filter.clear();
+                update();
+            }
+
+            // Only the transmit timestamp is set, it is echoed as the
+            // originate timestamp of the response
+            upstream.originate = timestamp::now();
+            upstream.request.fill(0);
+            upstream.request[0] = client_request;
+            timestamp_view(upstream.request.data() + transmit_offset).store(upstream.originate);
+            upstream.outstanding = true;
+
+            // A failed send is an unanswered poll
+            socket_.async_send_to(
+                boost::asio::buffer(upstream.request),
+                upstream.endpoint,
+                [](const boost::system::error_code&, std::size_t)
+                {
+                });
+
+            schedule(upstream, upstream.poll);
+        }
+
+        void client::receive()
+        {
+            socket_.async_receive_from(
+                boost::asio::buffer(response_),
+                sender_,
+                [this](const boost::system::error_code& error, const std::size_t length)
+                {
+                    if (error == boost::asio::error::operation_aborted)
+                    {
+                        return;
+                    }
+
+                    const timestamp destination = timestamp::now();
+                    if (!error)
+                    {
+                        handle_response(length, destination);
+                    }
+                    receive();
+                });
+        }
+
+        void client::handle_response(const std::size_t length, const timestamp& destination)
+        {
+            const auto found = lookup_.find(sender_);
+            if (found == lookup_.end() || length < packet::minimum_packet_size())
+            {
+                return;
+            }
+
+            server& upstream = *found->second;
+            const packet_view response(response_.data(), length);
+
+            // Anything other than a response to the latest request is
+            // bogus, a duplicate, or a replay
+            if (response.mode() != server_mode ||
+                response.version() < 3 ||
+                4 < response.version() ||
+                !upstream.outstanding ||
+                response.originate().load() != upstream.originate)
+            {
+                return;
+            }
+            upstream.outstanding = false;
+
+            if (response.stratum() == kiss_of_death)
+            {
+                const std::array<std::uint8_t, 4> code = response.identifier();
+                if (code == rate_code)
+                {
+                    upstream.poll = std::min(upstream.poll * 2, maximum_poll);
+                }
+                else if (code == deny_code || code == restrict_code)
+                {
+                    upstream.denied = true;
+                    upstream.reach = 0;
+                    upstream.filter.clear();
+                    update();
+                }
+                return;
+            }
+
+            const double root_delay = from_short(response.root_delay());
+            const double root_dispersion = from_short(response.root_dispersion());
+            if (response.leap() == unsynchronized_leap ||
+                maximum_stratum < response.stratum() ||
+                response.transmit().load() == timestamp() ||
+                maximum_distance <= root_delay / 2 + root_dispersion)
+            {
+                return;
+            }
+
+            upstream.reach |= 1;
+            upstream.leap = response.leap();
+            upstream.stratum = response.stratum();
+            upstream.precision = std::ldexp(1.0, response.precision());
+            upstream.root_delay = root_delay;
+            upstream.root_dispersion = root_dispersion;
+            upstream.updated = destination;
+
+            sample value = measure(
+                upstream.originate,
+                response.receive().load(),
+                response.transmit().load(),
+                destination);
+            value.delay = std::max(value.delay, local_precision());
+            value.dispersion = upstream.precision + local_precision() +
+                frequency_tolerance * difference(destination, upstream.originate);
+            value.time = steady_seconds();
+            upstream.filter.add(value);
+
+            update();
+        }
+
+        void client::update()
+        {
+            const double now = steady_seconds();
+
+            status next;
+            std::vector<candidate> candidates;
+            std::vector<const server*> sources;
+            for (const std::unique_ptr<server>& upstream : servers_)
+            {
+                if (upstream->reach == 0 || upstream->filter.empty())
+                {
+                    continue;
+                }
+                ++next.reachable;
+
+                // Root distance: half the round trip to the reference, plus
+                // every error accumulated on the way
+                const clock_filter& filter = upstream->filter;
+                const double distance =
+                    std::max(minimum_dispersion, upstream->root_delay + filter.best().delay) / 2 +
+                    upstream->root_dispersion +
+                    filter.dispersion(now) +
+                    filter.jitter();
+                if (distance < maximum_distance)
+                {
+                    candidates.push_back({filter.best().offset, distance, upstream->stratum});
+                    sources.push_back(upstream.get());
+                }
+            }
+
+            const std::vector<std::size_t> selected = select(candidates);
+            if (!selected.empty())
+            {
+                const selection result = combine(candidates, selected);
+                const server& peer = *sources[result.peer];
+
+                next.synchronized = std::abs(result.offset) <= step_threshold;
+                next.selected = selected.size();
+                next.offset = result.offset;
+                next.jitter = std::hypot(result.jitter, peer.filter.jitter());
+
+                next.state.leap = next.synchronized ?
+                    server_state::leap_indicator(peer.leap) :
+                    server_state::leap_indicator::unsynchronized;
+                next.state.stratum = peer.stratum + 1;
+                next.state.identifier = peer.endpoint.address().to_v4().to_bytes();
+                next.state.reference = peer.updated;
+                next.state.root_delay = to_short(peer.root_delay + peer.filter.best().delay);
+                next.state.root_dispersion = to_short(
+                    std::max(
+                        minimum_dispersion,
+                        peer.root_dispersion +
+                            peer.filter.dispersion(now) +
+                            next.jitter +
+                            std::abs(result.offset)));
+            }
+
+            status_ = next;
+            status_.state.publish();
+        }
+
+        std::ostream& operator<<(std::ostream& out, const client::status& current)
+        {
+            out <<
+                "upstream " << (current.synchronized ? "synchronized" : "unsynchronized") <<
+                " stratum " << unsigned(current.state.stratum);
+
+            if (current.selected != 0)
+            {
+                const std::array<std::uint8_t, 4>& address = current.state.identifier;
+                out <<
+                    " peer " << unsigned(address[0]) << '.' << unsigned(address[1]) <<
+                    '.' << unsigned(address[2]) << '.' << unsigned(address[3]) <<
+                    " offset " << current.offset <<
+                    " jitter " << current.jitter;
+            }
+
+            return out <<
+                " selected " << current.selected <<
+                " reachable " << current.reachable;
+        }
+    }
+}
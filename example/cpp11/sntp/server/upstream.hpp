@@ -0,0 +1,215 @@
+//
+// upstream.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include <array>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "server_state.hpp"
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    // Runs the server at stratum 2, from the clocks of upstream servers
+    // (RFC 5905 sections 8 - 11). The upstream servers are polled, each
+    // exchange is filtered, and the servers that agree are combined into the
+    // published server_state. The local clock is not adjusted; the offset
+    // to the upstream servers is added to the root dispersion instead.
+    namespace upstream
+    {
+        // Dispersion added to a clock each second (PHI)
+        constexpr double frequency_tolerance = 15e-6;
+
+        // Minimum dispersion increment (MINDISP)
+        constexpr double minimum_dispersion = 0.01;
+
+        // Upstream servers further from their reference are not selected
+        // (MAXDIST)
+        constexpr double maximum_distance = 1.5;
+
+        // Larger offsets mean the local clock is not synchronized to the
+        // upstream servers, and responses say so (STEPT)
+        constexpr double step_threshold = 0.128;
+
+        // One exchange with an upstream server, in seconds
+        struct sample
+        {
+            double offset;
+            double delay;
+            double dispersion;
+            double time;        // local steady clock, when received
+        };
+
+        // Offset and round-trip delay of an exchange. originate is the
+        // transmit timestamp of the request, receive and transmit are from
+        // the response, destination is when the response arrived.
+        sample measure(
+            const timestamp& originate,
+            const timestamp& receive,
+            const timestamp& transmit,
+            const timestamp& destination);
+
+        // The last 8 samples of an upstream server. The sample with the
+        // lowest delay has the least error from queuing, so it represents
+        // the server (RFC 5905 section 10).
+        class clock_filter
+        {
+        public:
+
+            static constexpr std::size_t stages = 8;
+
+            clock_filter();
+
+            // Replaces the oldest sample once full
+            void add(const sample& value);
+            void clear();
+
+            bool empty() const
+            {
+                return count_ == 0;
+            }
+
+            // Sample with the lowest delay. Must not be empty().
+            const sample& best() const;
+
+            // Dispersion of the best sample, aged to now. Must not be
+            // empty().
+            double dispersion(double now) const;
+
+            // RMS difference of the sample offsets to the best offset
+            double jitter() const;
+
+        private:
+
+            std::array<sample, stages> samples_;
+            std::size_t count_;
+            std::size_t next_;
+        };
+
+        // An upstream server that passed the clock filter
+        struct candidate
+        {
+            double offset;
+            double distance;        // root distance, see client
+            std::uint8_t stratum;
+        };
+
+        // Indexes of the candidates with correctness intervals (offset plus
+        // and minus distance) overlapping the interval that a majority of
+        // the candidates agree on, in order. Empty if no majority agrees
+        // (RFC 5905 section 11.2.1).
+        std::vector<std::size_t> select(const std::vector<candidate>& candidates);
+
+        struct selection
+        {
+            std::size_t peer;       // index of the system peer
+            double offset;
+            double jitter;
+        };
+
+        // The system peer of the selected candidates is the one with the
+        // lowest stratum, then the lowest distance. The offset is the
+        // average of the selected offsets, weighted by the inverse of
+        // their distances (RFC 5905 section 11.2.3). selected must not be
+        // empty.
+        selection combine(
+            const std::vector<candidate>& candidates,
+            const std::vector<std::size_t>& selected);
+
+        // Polls the upstream servers from one socket, on the thread running
+        // the io_service, and publishes the server_state after every
+        // response. Workers only read the published state, so polling many
+        // servers never blocks or slows request processing.
+        //
+        // A server must respond with a synchronized clock, echoing the
+        // transmit timestamp of the latest request. Kiss-o'-Death responses
+        // slow (RATE) or stop (DENY, RSTR) polling that server. Polling
+        // this same process fails as a loop, instead of selecting itself.
+        class client
+        {
+        public:
+
+            struct status
+            {
+                status();
+
+                bool synchronized;
+                std::size_t reachable;
+                std::size_t selected;
+                double offset;
+                double jitter;
+                server_state state;
+            };
+
+            // IPv4 servers only
+            client(
+                boost::asio::io_service& service,
+                const std::vector<boost::asio::ip::udp::endpoint>& servers,
+                std::chrono::milliseconds poll);
+
+            ~client();
+
+            client(const client&) = delete;
+            client& operator=(const client&) = delete;
+
+            // Publish an unsynchronized state, and begin polling. The first
+            // poll of each server is at a random point of the interval, so
+            // requests are spread out.
+            void start();
+
+            // Cancel polling. The published state is not changed.
+            void stop();
+
+            // Result of the last update. Only valid on the io_service
+            // thread.
+            const status& current() const
+            {
+                return status_;
+            }
+
+        private:
+
+            struct server;
+
+            void schedule(server& upstream, std::chrono::milliseconds delay);
+            void poll(server& upstream);
+            void receive();
+            void handle_response(std::size_t length, const timestamp& destination);
+            void update();
+
+        private:
+
+            boost::asio::ip::udp::socket socket_;
+            std::vector<std::unique_ptr<server>> servers_;
+            std::map<boost::asio::ip::udp::endpoint, server*> lookup_;
+            std::chrono::milliseconds poll_;
+            std::minstd_rand spread_;
+            std::array<std::uint8_t, 1024> response_;
+            boost::asio::ip::udp::endpoint sender_;
+            status status_;
+        };
+
+        std::ostream& operator<<(std::ostream& out, const client::status& current);
+    }
+}
+
+#endif // UPSTREAM_HPP
@@ -0,0 +1,641 @@
+//
+// uring.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "uring.hpp"
+
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "packet.hpp"
+#include "packet_view.hpp"
+#include "request_pipeline.hpp"
+#include "stats.hpp"
+#include "timestamp.hpp"
+
+namespace sntp
+{
+    namespace
+    {
+        // user_data of each operation, sends also carry the buffer id
+        const std::uint64_t receive_operation = std::uint64_t(1) << 32;
+        const std::uint64_t send_operation = std::uint64_t(2) << 32;
+        const std::uint64_t stop_operation = std::uint64_t(3) << 32;
+        const std::uint64_t cancel_operation = std::uint64_t(4) << 32;
+        const std::uint64_t buffer_id_mask = 0xFFFF;
+
+        const std::uint16_t buffer_group = 0;
+
+        // kernel limits for provided buffer rings, and submission queues
+        const std::size_t maximum_buffers = 32768;
+        const unsigned maximum_submissions = 4096;
+
+        // Each provided buffer holds an io_uring_recvmsg_out, the source
+        // address, control messages, and then the datagram. Space for the
+        // address is padded so that the packet is suitably aligned.
+        const std::size_t name_size = 32;
+        static_assert(sizeof(::sockaddr_in6) <= name_size, "address space too small");
+        const std::size_t buffer_alignment = 64;
+
+        boost::system::system_error last_error(const char* const what)
+        {
+            return boost::system::system_error(
+                errno, boost::asio::error::get_system_category(), what);
+        }
+
+        std::size_t round_up(const std::size_t value, const std::size_t multiple)
+        {
+            return ((value + multiple - 1) / multiple) * multiple;
+        }
+
+        std::size_t round_up_power_of_two(const std::size_t value)
+        {
+            std::size_t rounded = 1;
+            while (rounded < value)
+            {
+                rounded <<= 1;
+            }
+            return rounded;
+        }
+
+        int setup(const unsigned entries, ::io_uring_params& parameters)
+        {
+            return int(::syscall(__NR_io_uring_setup, entries, &parameters));
+        }
+
+        int enter(
+            const int ring,
+            const unsigned submit,
+            const unsigned wait_for,
+            const unsigned flags)
+        {
+            return int(::syscall(
+                __NR_io_uring_enter, ring, submit, wait_for, flags, nullptr, 0));
+        }
+
+        void* map_ring(const std::size_t size, const int ring, const off_t offset)
+        {
+            void* const memory = ::mmap(
+                nullptr,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,
+                ring,
+                offset);
+            if (memory == MAP_FAILED)
+            {
+                throw last_error("io_uring mmap");
+            }
+            return memory;
+        }
+
+        template<typename Type>
+        Type* at_offset(void* const memory, const std::uint32_t offset)
+        {
+            return reinterpret_cast<Type*>(
+                static_cast<std::uint8_t*>(memory) + offset);
+        }
+    }
+
+    uring_server::uring_server(
+        const int socket,
+        const std::size_t buffers,
+        const bool share_clock_read,
+        const bool kernel_timestamps) :
+        socket_(socket),
+        share_clock_read_(share_clock_read),
+        kernel_(),
+        ring_(-1),
+        sq_memory_(nullptr),
+        sq_memory_size_(0),
+        sq_tail_(nullptr),
+        sq_head_(nullptr),
+        sq_mask_(0),
+        sq_entries_(0),
+        sqes_(nullptr),
+        sqe_tail_(0),
+        submitted_tail_(0),
+        cq_memory_(nullptr),
+        cq_memory_size_(0),
+        cq_head_(nullptr),
+        cq_tail_(nullptr),
+        cq_mask_(0),
+        cqes_(nullptr),
+        buffer_ring_(nullptr),
+        buffer_ring_size_(0),
+        buffer_ring_tail_(0),
+        control_size_(
+            kernel_timestamps ?
+                round_up(CMSG_SPACE(sizeof(::timespec)), 16) : 0),
+        buffer_size_(
+            round_up(
+                sizeof(::io_uring_recvmsg_out) + name_size + control_size_ +
+                    packet::maximum_datagram_size(),
+                buffer_alignment)),
+        buffer_memory_(),
+        receive_header_(),
+        send_headers_(round_up_power_of_two(buffers)),
+        send_iovecs_(send_headers_.size()),
+        stop_event_(-1),
+        stop_count_(0),
+        stopped_(false),
+        cancelling_(false),
+        sending_(0),
+        receive_armed_(false),
+        keys_(nullptr),
+        limiter_(nullptr),
+        stats_(nullptr),
+        nts_(nullptr)
+    {
+        if (buffers == 0 || maximum_buffers < buffers)
+        {
+            throw std::invalid_argument("io_uring buffers must be 1 - 32768");
+        }
+
+        buffer_memory_.resize(send_headers_.size() * buffer_size_);
+
+        try
+        {
+            ::io_uring_params parameters;
+            std::memset(&parameters, 0, sizeof(parameters));
+
+            // Every buffer can have a receive and a send completion waiting
+            parameters.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+            parameters.cq_entries = unsigned(send_headers_.size() * 2 + 1);
+
+            ring_ = setup(
+                unsigned(std::min<std::size_t>(send_headers_.size(), maximum_submissions)),
+                parameters);
+            if (ring_ < 0)
+            {
+                throw last_error("io_uring_setup");
+            }
+
+            sq_entries_ = parameters.sq_entries;
+            sq_memory_size_ =
+                parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+            cq_memory_size_ =
+                parameters.cq_off.cqes + parameters.cq_entries * sizeof(::io_uring_cqe);
+
+            if (parameters.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                sq_memory_size_ = std::max(sq_memory_size_, cq_memory_size_);
+                cq_memory_size_ = 0;
+            }
+
+            sq_memory_ = map_ring(sq_memory_size_, ring_, IORING_OFF_SQ_RING);
+            cq_memory_ = cq_memory_size_ == 0 ?
+                sq_memory_ : map_ring(cq_memory_size_, ring_, IORING_OFF_CQ_RING);
+            sqes_ = static_cast<::io_uring_sqe*>(
+                map_ring(sq_entries_ * sizeof(::io_uring_sqe), ring_, IORING_OFF_SQES));
+
+            sq_head_ = at_offset<const unsigned>(sq_memory_, parameters.sq_off.head);
+            sq_tail_ = at_offset<unsigned>(sq_memory_, parameters.sq_off.tail);
+            sq_mask_ = *at_offset<const unsigned>(sq_memory_, parameters.sq_off.ring_mask);
+            sqe_tail_ = *sq_tail_;
+            submitted_tail_ = sqe_tail_;
+
+            // submission queue entries are always used in order
+            unsigned* const sq_array =
+                at_offset<unsigned>(sq_memory_, parameters.sq_off.array);
+            for (unsigned index = 0; index < sq_entries_; ++index)
+            {
+                sq_array[index] = index;
+            }
+
+            cq_head_ = at_offset<unsigned>(cq_memory_, parameters.cq_off.head);
+            cq_tail_ = at_offset<const unsigned>(cq_memory_, parameters.cq_off.tail);
+            cq_mask_ = *at_offset<const unsigned>(cq_memory_, parameters.cq_off.ring_mask);
+            cqes_ = at_offset<const ::io_uring_cqe>(cq_memory_, parameters.cq_off.cqes);
+
+            // The kernel picks a buffer from this ring for each datagram
+            buffer_ring_size_ = round_up(
+                send_headers_.size() * sizeof(::io_uring_buf), ::sysconf(_SC_PAGESIZE));
+            void* const buffer_ring = ::mmap(
+                nullptr,
+                buffer_ring_size_,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                -1,
+                0);
+            if (buffer_ring == MAP_FAILED)
+            {
+                throw last_error("io_uring buffer ring mmap");
+            }
+            buffer_ring_ = static_cast<::io_uring_buf*>(buffer_ring);
+
+            ::io_uring_buf_reg registration;
+            std::memset(&registration, 0, sizeof(registration));
+            registration.ring_addr = reinterpret_cast<std::uintptr_t>(buffer_ring_);
+            registration.ring_entries = unsigned(send_headers_.size());
+            registration.bgid = buffer_group;
+
+            if (::syscall(
+                    __NR_io_uring_register,
+                    ring_,
+                    IORING_REGISTER_PBUF_RING,
+                    &registration,
+                    1) != 0)
+            {
+                throw last_error("io_uring register buffer ring");
+            }
+
+            stop_event_ = ::eventfd(0, EFD_CLOEXEC);
+            if (stop_event_ < 0)
+            {
+                throw last_error("eventfd");
+            }
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+
+        for (std::size_t index = 0; index < send_headers_.size(); ++index)
+        {
+            provide_buffer(std::uint16_t(index));
+        }
+        publish_buffers();
+
+        // Only the space for the address and control messages is used
+        receive_header_.msg_namelen = name_size;
+        receive_header_.msg_controllen = control_size_;
+
+        queue_receive();
+        queue_stop_wait();
+    }
+
+    uring_server::~uring_server()
+    {
+        try
+        {
+            cancel_operations();
+        }
+        catch (...)
+        {
+            // the ring cannot be entered, nothing more can be waited for
+        }
+        release();
+    }
+
+    void uring_server::cancel_operations()
+    {
+        // Closing the ring cancels operations asynchronously, so the kernel
+        // could still write to the buffers after they are freed. The
+        // receive and the stop wait are cancelled instead, and every
+        // completion (including sends in flight) is reaped first.
+        cancelling_ = true;
+        if (receive_armed_)
+        {
+            queue_cancel(receive_operation);
+        }
+        if (!stopped_)
+        {
+            queue_cancel(stop_operation);
+        }
+
+        while (receive_armed_ || !stopped_ || sending_ != 0)
+        {
+            run_once();
+        }
+    }
+
+    void uring_server::release()
+    {
+        // No operation is pending, see cancel_operations
+        if (ring_ >= 0)
+        {
+            ::close(ring_);
+        }
+        if (buffer_ring_)
+        {
+            ::munmap(buffer_ring_, buffer_ring_size_);
+        }
+        if (sqes_)
+        {
+            ::munmap(sqes_, sq_entries_ * sizeof(::io_uring_sqe));
+        }
+        if (cq_memory_ && cq_memory_ != sq_memory_)
+        {
+            ::munmap(cq_memory_, cq_memory_size_);
+        }
+        if (sq_memory_)
+        {
+            ::munmap(sq_memory_, sq_memory_size_);
+        }
+        if (stop_event_ >= 0)
+        {
+            ::close(stop_event_);
+        }
+    }
+
+    void uring_server::run()
+    {
+        // The thread holds no key set while it waits for completions
+        while (!stopped_)
+        {
+            timestamp::offline();
+            submit(1);
+            timestamp::quiescent();
+            process_completions();
+        }
+    }
+
+    void uring_server::stop()
+    {
+        ::eventfd_write(stop_event_, 1);
+    }
+
+    std::size_t uring_server::run_once()
+    {
+        submit(1);
+        return process_completions();
+    }
+
+    void uring_server::submit(const unsigned wait_for)
+    {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+        while (true)
+        {
+            const int submitted = enter(
+                ring_,
+                sqe_tail_ - submitted_tail_,
+                wait_for,
+                wait_for != 0 ? IORING_ENTER_GETEVENTS : 0);
+
+            if (0 <= submitted)
+            {
+                submitted_tail_ += submitted;
+                return;
+            }
+
+            // Completion queue is full, the caller has to reap first
+            if (errno == EAGAIN || errno == EBUSY)
+            {
+                return;
+            }
+
+            if (errno != EINTR)
+            {
+                throw last_error("io_uring_enter");
+            }
+        }
+    }
+
+    ::io_uring_sqe& uring_server::get_sqe()
+    {
+        while (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)
+        {
+            submit(0);
+        }
+
+        ::io_uring_sqe& entry = sqes_[sqe_tail_ & sq_mask_];
+        std::memset(&entry, 0, sizeof(entry));
+        ++sqe_tail_;
+        return entry;
+    }
+
+    void uring_server::queue_receive()
+    {
+        ::io_uring_sqe& entry = get_sqe();
+        entry.opcode = IORING_OP_RECVMSG;
+        entry.fd = socket_;
+        entry.addr = reinterpret_cast<std::uintptr_t>(&receive_header_);
+        entry.len = 1;
+        entry.flags = IOSQE_BUFFER_SELECT;
+        entry.buf_group = buffer_group;
+        entry.ioprio = IORING_RECV_MULTISHOT;
+        entry.user_data = receive_operation;
+
+        receive_armed_ = true;
+    }
+
+    void uring_server::queue_stop_wait()
+    {
+        ::io_uring_sqe& entry = get_sqe();
+        entry.opcode = IORING_OP_READ;
+        entry.fd = stop_event_;
+        entry.addr = reinterpret_cast<std::uintptr_t>(&stop_count_);
+        entry.len = sizeof(stop_count_);
+        entry.user_data = stop_operation;
+    }
+
+    void uring_server::queue_cancel(const std::uint64_t operation)
+    {
+        ::io_uring_sqe& entry = get_sqe();
+        entry.opcode = IORING_OP_ASYNC_CANCEL;
+        entry.addr = operation;
+        entry.user_data = cancel_operation;
+    }
+
+    void uring_server::queue_send(
+        const std::uint16_t buffer_id,
+        const ::io_uring_recvmsg_out& received,
+        const std::size_t response_size)
+    {
+        std::uint8_t* const buffer = get_buffer(buffer_id);
+
+        ::iovec& payload = send_iovecs_[buffer_id];
+        payload.iov_base =
+            buffer + sizeof(::io_uring_recvmsg_out) + name_size + control_size_;
+        payload.iov_len = response_size;
+
+        ::msghdr& header = send_headers_[buffer_id];
+        header = ::msghdr();
+        header.msg_name = buffer + sizeof(::io_uring_recvmsg_out);
+        header.msg_namelen = received.namelen;
+        header.msg_iov = &payload;
+        header.msg_iovlen = 1;
+
+        ::io_uring_sqe& entry = get_sqe();
+        entry.opcode = IORING_OP_SENDMSG;
+        entry.fd = socket_;
+        entry.addr = reinterpret_cast<std::uintptr_t>(&header);
+        entry.len = 1;
+        entry.user_data = send_operation | buffer_id;
+
+        ++sending_;
+    }
+
+    void uring_server::provide_buffer(const std::uint16_t buffer_id)
+    {
+        // The ring tail shares memory with the first entry, so the fields
+        // are assigned individually.
+        ::io_uring_buf& entry =
+            buffer_ring_[buffer_ring_tail_ & (send_headers_.size() - 1)];
+        entry.addr = reinterpret_cast<std::uintptr_t>(get_buffer(buffer_id));
+        entry.len = unsigned(buffer_size_);
+        entry.bid = buffer_id;
+        ++buffer_ring_tail_;
+    }
+
+    void uring_server::publish_buffers()
+    {
+        // io_uring_buf_ring::tail overlays the reserved field of the first
+        // entry. The structure is not used directly, its flexible array
+        // member has a different offset in C++.
+        __atomic_store_n(&buffer_ring_[0].resv, buffer_ring_tail_, __ATOMIC_RELEASE);
+    }
+
+    std::size_t uring_server::process_completions()
+    {
+        const unsigned first = *cq_head_;
+        const unsigned last = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+        for (unsigned head = first; head != last; ++head)
+        {
+            const ::io_uring_cqe& completion = cqes_[head & cq_mask_];
+            if (completion.user_data == receive_operation)
+            {
+                process_receive(completion);
+            }
+            else if ((completion.user_data & ~buffer_id_mask) == send_operation)
+            {
+                // Datagram errors are specific to the destination, the
+                // buffer is reused either way.
+                --sending_;
+                provide_buffer(std::uint16_t(completion.user_data & buffer_id_mask));
+
+                if (stats_)
+                {
+                    stats_->increment(
+                        completion.res < 0 ?
+                            worker_stats::counter::send_error :
+                            worker_stats::counter::answered);
+                }
+            }
+            else if (completion.user_data == stop_operation)
+            {
+                stopped_ = true;
+            }
+        }
+
+        __atomic_store_n(cq_head_, last, __ATOMIC_RELEASE);
+        publish_buffers();
+
+        // A multishot receive stops when out of buffers (or on error).
+        // Re-arm once a buffer is available again.
+        if (!receive_armed_ && !cancelling_ && sending_ != send_headers_.size())
+        {
+            queue_receive();
+        }
+
+        return last - first;
+    }
+
+    void uring_server::process_receive(const ::io_uring_cqe& completion)
+    {
+        if (!(completion.flags & IORING_CQE_F_MORE))
+        {
+            receive_armed_ = false;
+        }
+
+        if (completion.res < 0 || !(completion.flags & IORING_CQE_F_BUFFER))
+        {
+            return;
+        }
+
+        const std::uint16_t buffer_id =
+            std::uint16_t(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        std::uint8_t* const buffer = get_buffer(buffer_id);
+        const ::io_uring_recvmsg_out& received =
+            *reinterpret_cast<const ::io_uring_recvmsg_out*>(buffer);
+
+        if (stats_)
+        {
+            stats_->increment(worker_stats::counter::received);
+        }
+
+        if (received.payloadlen < packet::minimum_packet_size() ||
+            (received.flags & MSG_TRUNC) ||
+            name_size < received.namelen)
+        {
+            if (stats_)
+            {
+                stats_->increment(worker_stats::counter::short_packet);
+            }
+            provide_buffer(buffer_id);
+            return;
+        }
+
+        ::msghdr control = ::msghdr();
+        if (control_size_ != 0 && !(received.flags & MSG_CTRUNC))
+        {
+            control.msg_control =
+                buffer + sizeof(::io_uring_recvmsg_out) + name_size;
+            control.msg_controllen = received.controllen;
+        }
+
+        // The packet is processed, and sent, in the provided buffer
+        std::uint8_t* const datagram =
+            buffer + sizeof(::io_uring_recvmsg_out) + name_size + control_size_;
+
+        const ::timespec* const receive_time = batch::find_receive_time(control);
+
+        const ::sockaddr& source = *reinterpret_cast<const ::sockaddr*>(
+            buffer + sizeof(::io_uring_recvmsg_out));
+
+        const packet_view request(datagram, received.payloadlen);
+        const packet::rejection rejection = request.check_request();
+
+        // Without a kernel timestamp, the processing start is the arrival.
+        // The processing end is the residence end.
+        const bool timed = stats_ && stats_->timed();
+        std::uint64_t processed = 0;
+        worker_context context;
+        context.keys = keys_;
+        context.limiter = limiter_;
+        context.nts = nts_;
+        context.stats = stats_;
+        context.end = &processed;
+        if (timed && !receive_time && rejection == packet::rejection::none)
+        {
+            context.start = worker_stats::now();
+        }
+
+        const std::size_t response_size = accept_request(
+            request,
+            rejection,
+            source,
+            context,
+            [this, receive_time](const packet_view& response, bool)
+            {
+                fill_response(this->kernel_, response, receive_time, this->share_clock_read_);
+            });
+
+        if (response_size != 0)
+        {
+            queue_send(buffer_id, received, response_size);
+            if (timed && receive_time)
+            {
+                stats_->record_residence(*receive_time);
+            }
+            else if (timed)
+            {
+                stats_->record_residence(
+                    context.start, processed ? processed : worker_stats::now());
+            }
+        }
+        else
+        {
+            provide_buffer(buffer_id);
+        }
+    }
+}
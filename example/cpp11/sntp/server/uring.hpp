@@ -0,0 +1,190 @@
+//
+// uring.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <boost/align/aligned_allocator.hpp>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <vector>
+
+#include "response_kernel.hpp"
+
+namespace sntp
+{
+    namespace nts
+    {
+        class responder;
+    }
+
+    class key_table;
+    class packet;
+    class rate_limiter;
+    class worker_stats;
+
+    // Serves NTP requests with io_uring. A single multishot recvmsg keeps
+    // receives flowing into a ring of kernel selected (provided) buffers,
+    // and responses are sent directly from those buffers with batched
+    // sendmsg submissions. The kernel interface is used directly, Linux
+    // 6.0 or later is required. Not thread-safe.
+    class uring_server
+    {
+    public:
+
+        // Serve requests arriving on socket, using buffers provided buffers
+        // (rounded up to a power of two). Throws system_error on failure.
+        uring_server(
+            int socket,
+            std::size_t buffers,
+            bool share_clock_read,
+            bool kernel_timestamps);
+
+        ~uring_server();
+
+        uring_server(const uring_server&) = delete;
+        uring_server& operator=(const uring_server&) = delete;
+
+        // Process completions until stop() is called. The thread is
+        // timestamp::offline() while it waits, and quiescent() before each
+        // batch. Throws system_error on failure.
+        void run();
+
+        // Make run() return. Safe to call from any thread, before or while
+        // running.
+        void stop();
+
+        // Submit queued operations, wait for and process at least one
+        // completion. Returns the number of completions processed.
+        std::size_t run_once();
+
+        // Verify requests with a MAC, and sign their responses. Requests
+        // with an invalid MAC are dropped. The keys must outlive the server.
+        void set_keys(const key_table* const keys)
+        {
+            keys_ = keys;
+        }
+
+        // Answer NTS protected requests. The responder must outlive the
+        // server.
+        void set_nts(nts::responder* const responder)
+        {
+            nts_ = responder;
+        }
+
+        // Limit the request rate of each source. Sources over the limit are
+        // dropped, or get a Kiss-o'-Death response. The limiter must outlive
+        // the server.
+        void set_rate_limiter(rate_limiter* const limiter)
+        {
+            limiter_ = limiter;
+        }
+
+        // Count received, answered, and dropped packets, and record the
+        // residence time of each response until it is filled if the stats
+        // are timed. The stats must outlive the server.
+        void set_stats(worker_stats* const stats)
+        {
+            stats_ = stats;
+        }
+
+        // Number of provided buffers
+        std::size_t buffers() const
+        {
+            return send_headers_.size();
+        }
+
+    private:
+
+        // Wait for at least wait_for completions after submitting
+        void submit(unsigned wait_for);
+
+        ::io_uring_sqe& get_sqe();
+
+        void queue_receive();
+        void queue_stop_wait();
+        void queue_cancel(std::uint64_t operation);
+        void queue_send(
+            std::uint16_t buffer_id,
+            const ::io_uring_recvmsg_out& received,
+            std::size_t response_size);
+        void provide_buffer(std::uint16_t buffer_id);
+        void publish_buffers();
+
+        std::size_t process_completions();
+        void process_receive(const ::io_uring_cqe& completion);
+
+        // Wait for every queued operation to complete, after cancelling
+        // the receive and the stop wait
+        void cancel_operations();
+        void release();
+
+        std::uint8_t* get_buffer(std::uint16_t buffer_id)
+        {
+            return buffer_memory_.data() + std::size_t(buffer_id) * buffer_size_;
+        }
+
+    private:
+
+        const int socket_;
+        const bool share_clock_read_;
+        const response_kernel kernel_;
+        int ring_;
+
+        // submission queue
+        void* sq_memory_;
+        std::size_t sq_memory_size_;
+        unsigned* sq_tail_;
+        const unsigned* sq_head_;
+        unsigned sq_mask_;
+        unsigned sq_entries_;
+        ::io_uring_sqe* sqes_;
+        unsigned sqe_tail_;
+        unsigned submitted_tail_;
+
+        // completion queue
+        void* cq_memory_;
+        std::size_t cq_memory_size_;
+        unsigned* cq_head_;
+        const unsigned* cq_tail_;
+        unsigned cq_mask_;
+        const ::io_uring_cqe* cqes_;
+
+        // provided buffers
+        ::io_uring_buf* buffer_ring_;
+        std::size_t buffer_ring_size_;
+        std::uint16_t buffer_ring_tail_;
+        std::size_t control_size_;
+        std::size_t buffer_size_;
+        std::vector<std::uint8_t, boost::alignment::aligned_allocator<std::uint8_t, 64>> buffer_memory_;
+
+        // one header per buffer for sending responses in place
+        ::msghdr receive_header_;
+        std::vector<::msghdr> send_headers_;
+        std::vector<::iovec> send_iovecs_;
+
+        // eventfd read by the ring, written by stop()
+        int stop_event_;
+        std::uint64_t stop_count_;
+        bool stopped_;
+        bool cancelling_;
+
+        std::size_t sending_;
+        bool receive_armed_;
+        const key_table* keys_;
+        rate_limiter* limiter_;
+        worker_stats* stats_;
+        nts::responder* nts_;
+    };
+}
+
+#endif // URING_HPP
@@ -0,0 +1,91 @@
+//
+// worker_threads.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "worker_threads.hpp"
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sntp
+{
+    void run_worker_threads(
+        const std::size_t count,
+        const std::function<void(std::size_t)>& work,
+        const std::function<void()>& stop)
+    {
+        std::mutex failure_mutex;
+        std::exception_ptr failure;
+
+        // Only the first failure is kept, and stops the workers
+        const auto fail = [&stop, &failure_mutex, &failure](const std::exception_ptr error)
+        {
+            {
+                const std::lock_guard<std::mutex> lock(failure_mutex);
+                if (failure)
+                {
+                    return;
+                }
+                failure = error;
+            }
+            stop();
+        };
+
+        const auto run = [&work, &fail](const std::size_t worker)
+        {
+            try
+            {
+                work(worker);
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        };
+
+        // A thread that cannot be started (e.g. EAGAIN) stops the threads
+        // already running, which are joined before the failure is
+        // rethrown. Destroying a joinable thread would terminate.
+        std::vector<std::thread> threads;
+        bool started = true;
+        try
+        {
+            if (count > 1)
+            {
+                threads.reserve(count - 1);
+            }
+            for (std::size_t worker = 1; worker < count; ++worker)
+            {
+                threads.emplace_back(run, worker);
+            }
+        }
+        catch (...)
+        {
+            started = false;
+            fail(std::current_exception());
+        }
+
+        if (started && count != 0)
+        {
+            run(0);
+        }
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+//
+// worker_threads.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2014 Lee Clagett (code at leeclagett dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying)
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef WORKER_THREADS_HPP
+#define WORKER_THREADS_HPP
+
+#include <cstddef>
+#include <functional>
+
+namespace sntp
+{
+    // Runs work(0) on the calling thread, and work(1) through
+    // work(count - 1) on new threads. The first worker to throw calls stop
+    // once, which must make every other worker return, so a failed worker
+    // never leaves the rest serving silently. Returns after every thread
+    // is joined, rethrowing the first failure.
+    void run_worker_threads(
+        std::size_t count,
+        const std::function<void(std::size_t)>& work,
+        const std::function<void()>& stop);
+}
+
+#endif // WORKER_THREADS_HPP